@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "logging.h"
 #include "util.h"
 #include "command-attrs.h"
 
@@ -28,7 +29,7 @@ command_attrs_finalize (GObject *obj)
 {
     CommandAttrs *attrs = COMMAND_ATTRS (obj);
 
-    g_debug (__func__);
+    tabrmd_debug (__func__);
     g_clear_pointer (&attrs->command_attrs, g_free);
     G_OBJECT_CLASS (command_attrs_parent_class)->finalize (obj);
 }
@@ -38,7 +39,7 @@ command_attrs_class_init (CommandAttrsClass *klass)
 {
     GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
-    g_debug ("command_attrs_class_init");
+    tabrmd_debug ("command_attrs_class_init");
     if (command_attrs_parent_class == NULL)
         command_attrs_parent_class = g_type_class_peek_parent (klass);
 
@@ -14,7 +14,11 @@
 #include "connection.h"
 #include "connection-manager.h"
 #include "command-source.h"
+#include "logging.h"
 #include "source-interface.h"
+#include "tabrmd-capture.h"
+#include "tabrmd-defaults.h"
+#include "tabrmd-probes.h"
 #include "tpm2-command.h"
 #include "tpm2-header.h"
 #include "util.h"
@@ -28,6 +32,9 @@ enum {
     PROP_COMMAND_ATTRS,
     PROP_CONNECTION_MANAGER,
     PROP_SINK,
+    PROP_MAX_IN_FLIGHT,
+    PROP_QUEUE_HIGH_WATER,
+    PROP_READER_THREADS,
     N_PROPERTIES
 };
 static GParamSpec *obj_properties [N_PROPERTIES] = { NULL, };
@@ -43,7 +50,7 @@ command_source_add_sink (Source      *self,
     CommandSource *src = COMMAND_SOURCE (self);
     GValue value = G_VALUE_INIT;
 
-    g_debug (__func__);
+    tabrmd_debug (__func__);
     g_value_init (&value, G_TYPE_OBJECT);
     g_value_set_object (&value, sink);
     g_object_set_property (G_OBJECT (src), "sink", &value);
@@ -69,7 +76,9 @@ source_data_free (gpointer data)
 {
     source_data_t *source_data = (source_data_t*)data;
     g_object_unref (source_data->cancellable);
-    g_source_unref (source_data->source);
+    if (source_data->source != NULL) {
+        g_source_unref (source_data->source);
+    }
     g_free (source_data);
 }
 /*
@@ -94,6 +103,7 @@ command_source_init (CommandSource *source)
                                g_direct_equal,
                                g_object_unref,
                                source_data_free);
+    g_mutex_init (&source->map_mutex);
 }
 
 G_DEFINE_TYPE_WITH_CODE (
@@ -112,7 +122,7 @@ command_source_set_property (GObject       *object,
 {
     CommandSource *self = COMMAND_SOURCE (object);
 
-    g_debug (__func__);
+    tabrmd_debug (__func__);
     switch (property_id) {
     case PROP_COMMAND_ATTRS:
         self->command_attrs = COMMAND_ATTRS (g_value_dup_object (value));
@@ -129,6 +139,15 @@ command_source_set_property (GObject       *object,
         self->sink = SINK (g_value_get_object (value));
         g_object_ref (self->sink);
         break;
+    case PROP_MAX_IN_FLIGHT:
+        self->max_in_flight = g_value_get_uint (value);
+        break;
+    case PROP_QUEUE_HIGH_WATER:
+        self->queue_high_water = g_value_get_uint (value);
+        break;
+    case PROP_READER_THREADS:
+        self->reader_threads = g_value_get_uint (value);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
         break;
@@ -143,7 +162,7 @@ command_source_get_property (GObject      *object,
 {
     CommandSource *self = COMMAND_SOURCE (object);
 
-    g_debug (__func__);
+    tabrmd_debug (__func__);
     switch (property_id) {
     case PROP_COMMAND_ATTRS:
         g_value_set_object (value, self->command_attrs);
@@ -154,17 +173,235 @@ command_source_get_property (GObject      *object,
     case PROP_SINK:
         g_value_set_object (value, self->sink);
         break;
+    case PROP_MAX_IN_FLIGHT:
+        g_value_set_uint (value, self->max_in_flight);
+        break;
+    case PROP_QUEUE_HIGH_WATER:
+        g_value_set_uint (value, self->queue_high_water);
+        break;
+    case PROP_READER_THREADS:
+        g_value_set_uint (value, self->reader_threads);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
         break;
     }
 }
+/*
+ * GObject constructed function. Once the 'reader-threads' property has been
+ * set we create a GMainContext / GMainLoop for each shard. The first shard
+ * uses the CommandSource main_context / main_loop.
+ */
+static void
+command_source_constructed (GObject *object)
+{
+    CommandSource *self = COMMAND_SOURCE (object);
+    guint i;
+
+    G_OBJECT_CLASS (command_source_parent_class)->constructed (object);
+    self->shards = g_new0 (command_source_shard_t, self->reader_threads);
+    self->shards [0].context = g_main_context_ref (self->main_context);
+    self->shards [0].loop = g_main_loop_ref (self->main_loop);
+    for (i = 1; i < self->reader_threads; ++i) {
+        self->shards [i].context = g_main_context_new ();
+        self->shards [i].loop = g_main_loop_new (self->shards [i].context,
+                                                 FALSE);
+    }
+}
+/*
+ * Get the GMainContext for the shard that the Connection belongs to.
+ */
+static GMainContext*
+command_source_shard_context (CommandSource *self,
+                              Connection    *connection)
+{
+    return self->shards [connection->id % self->reader_threads].context;
+}
+/*
+ * Create a GSource to monitor the istream for the G_IO_IN condition and
+ * attach it to the GMainContext of the shard that the istream belongs to.
+ * The caller must hold the map_mutex.
+ */
+static void
+command_source_attach_source (GPollableInputStream *istream,
+                              source_data_t        *data)
+{
+    data->source = g_pollable_input_stream_create_source (istream,
+                                                          data->cancellable);
+    /* we ignore the ID returned since we keep a reference to the source around */
+    g_source_attach (data->source, data->context);
+    g_source_set_callback (data->source,
+                           G_SOURCE_FUNC (command_source_on_input_ready),
+                           data,
+                           NULL);
+}
+/*
+ * Stop monitoring the istream associated with the source_data_t structure.
+ * This is safe to call from the callback of the GSource being destroyed.
+ * The caller must hold the map_mutex.
+ */
+static void
+command_source_pause_source (source_data_t *data)
+{
+    if (data->source == NULL) {
+        return;
+    }
+    g_source_destroy (data->source);
+    g_source_unref (data->source);
+    data->source = NULL;
+}
+static void
+command_source_pause_callback (gpointer key,
+                               gpointer value,
+                               gpointer user_data)
+{
+    UNUSED_PARAM(key);
+    UNUSED_PARAM(user_data);
+    command_source_pause_source ((source_data_t*)value);
+}
+/*
+ * Account for a command that has been passed down the pipeline and stop
+ * reading from clients if we've hit a limit:
+ * - If the number of commands in flight for the pipeline as a whole has
+ *   reached the high-water mark we stop monitoring all connections.
+ * - If the Connection has reached the per-connection in-flight limit we stop
+ *   monitoring just this Connection.
+ * Returns G_SOURCE_REMOVE if the GSource for 'data' has been paused,
+ * G_SOURCE_CONTINUE otherwise.
+ * The counters are incremented under the map_mutex so that a resume
+ * triggered by a response can't be handled between the increment and the
+ * pause.
+ */
+static gboolean
+command_source_account_command (CommandSource *self,
+                                Connection    *connection,
+                                source_data_t *data)
+{
+    guint in_flight, queued;
+    gboolean ret = G_SOURCE_CONTINUE;
+
+    g_mutex_lock (&self->map_mutex);
+    in_flight = connection_in_flight_inc (connection) + 1;
+    queued = (guint)g_atomic_int_add (&self->queued, 1) + 1;
+    if (queued >= self->queue_high_water) {
+        tabrmd_debug ("%s: %u commands queued, pausing all connections",
+                      __func__, queued);
+        g_hash_table_foreach (self->istream_to_source_data_map,
+                              command_source_pause_callback,
+                              NULL);
+        ret = G_SOURCE_REMOVE;
+    } else if (in_flight >= self->max_in_flight) {
+        tabrmd_debug ("%s: connection with id 0x%" PRIx64 " has %u commands in "
+                      "flight, pausing", __func__, connection->id, in_flight);
+        command_source_pause_source (data);
+        ret = G_SOURCE_REMOVE;
+    }
+    g_mutex_unlock (&self->map_mutex);
+    return ret;
+}
+/*
+ * Read a TPM command from the client. Connections created with the
+ * SOCK_SEQPACKET transport carry each command in a single datagram so it's
+ * read with a single receive. Otherwise the command is read from the stream
+ * header first.
+ * Returns -1 on error, 0 if there was no command to read yet, 1 if a
+ * command was read.
+ */
+static gint
+command_source_read_command (Connection   *connection,
+                             GInputStream *istream,
+                             uint8_t     **buf,
+                             size_t       *buf_size)
+{
+    GIOStream *iostream = connection_get_iostream (connection);
+    GSocket *socket;
+    gssize size;
+
+    if (G_IS_SOCKET_CONNECTION (iostream)) {
+        socket = g_socket_connection_get_socket (G_SOCKET_CONNECTION (iostream));
+        if (g_socket_get_socket_type (socket) == G_SOCKET_TYPE_SEQPACKET) {
+            size = read_tpm_datagram_alloc (socket, buf);
+            if (size == UTIL_READ_AGAIN) {
+                return 0;
+            }
+            if (size < 0) {
+                return -1;
+            }
+            *buf_size = (size_t)size;
+            return 1;
+        }
+    }
+    *buf = read_tpm_buffer_alloc (istream, buf_size);
+    return *buf != NULL ? 1 : -1;
+}
+/*
+ * Tell the rest of the pipeline that a connection, or a channel of a
+ * multiplexed connection, has gone away so that the ResourceManager can
+ * flush the objects and sessions that belong to it.
+ */
+static void
+command_source_connection_removed (CommandSource *self,
+                                   Connection    *connection)
+{
+    ControlMessage *msg =
+        control_message_new_with_object (CONNECTION_REMOVED,
+                                         G_OBJECT (connection));
+    sink_enqueue (self->sink, G_OBJECT (msg));
+    g_object_unref (msg);
+}
+/*
+ * Read a frame from a multiplexed connection. Commands are returned through
+ * 'buf' / 'buf_size' along with a reference to the Connection for the
+ * channel they were sent on (created on first use). Frames closing a
+ * channel are handled here: the channel is removed and the ResourceManager
+ * is told to clean up after it.
+ * Returns -1 on error, 0 if a channel was closed or there was no frame to
+ * read yet, 1 if a command was read.
+ */
+static gint
+command_source_read_mux (CommandSource *self,
+                         Connection    *connection,
+                         Connection   **channel,
+                         uint8_t      **buf,
+                         size_t        *buf_size)
+{
+    GIOStream *iostream = connection_get_iostream (connection);
+    GSocket *socket;
+    guint32 id = 0;
+    gssize size;
+
+    socket = g_socket_connection_get_socket (G_SOCKET_CONNECTION (iostream));
+    size = read_tpm_mux_alloc (socket, &id, buf);
+    if (size == UTIL_READ_AGAIN) {
+        return 0;
+    }
+    if (size < 0) {
+        return -1;
+    }
+    if (size == 0) {
+        *channel = connection_mux_remove_channel (connection, id);
+        if (*channel != NULL) {
+            command_source_connection_removed (self, *channel);
+            g_clear_object (channel);
+        }
+        return 0;
+    }
+    *channel = connection_mux_channel (connection, id, TABRMD_MUX_CHANNELS_MAX);
+    if (*channel == NULL) {
+        g_clear_pointer (buf, g_free);
+        return -1;
+    }
+    *buf_size = (size_t)size;
+    return 1;
+}
 /*
  * This function is invoked by the GMainLoop thread when a client GSocket has
  * data ready. This is what makes the CommandSource a source (of Tpm2Commands).
  * Here we take the GSocket, extract the command body from the it and
  * transform it to a Tpm2Command. Most of the details are handled by utility
  * functions further down the stack.
+ * Commands read from a multiplexed connection belong to the Connection for
+ * the channel they were sent on.
  *
  * If an error occurs while getting the command from the GSocket the connection
  * with the client will be closed and removed from the ConnectionManager.
@@ -176,13 +413,19 @@ command_source_on_input_ready (GInputStream *istream,
                                gpointer      user_data)
 {
     source_data_t *data = (source_data_t*)user_data;
-    Connection    *connection;
+    CommandSource *self;
+    Connection    *connection, *target = NULL;
     Tpm2Command   *command;
+    tabrmd_timeline_t *timeline;
     TPMA_CC        attributes = { 0 };
-    uint8_t       *buf;
+    GList         *channels, *item;
+    uint8_t       *buf = NULL;
     size_t         buf_size;
+    gboolean       ret;
+    guint8         handle_count, i;
+    gint64         time_read = g_get_monotonic_time ();
 
-    g_debug (__func__);
+    tabrmd_debug (__func__);
     connection =
         connection_manager_lookup_istream (data->self->connection_manager,
                                            istream);
@@ -190,34 +433,76 @@ command_source_on_input_ready (GInputStream *istream,
         g_error ("%s: failed to get connection associated with istream",
                  __func__);
     }
-    buf = read_tpm_buffer_alloc (istream, &buf_size);
-    if (buf == NULL) {
-        goto fail_out;
+    if (connection_is_mux (connection)) {
+        switch (command_source_read_mux (data->self,
+                                         connection,
+                                         &target,
+                                         &buf,
+                                         &buf_size)) {
+        case -1:
+            goto fail_out;
+        case 0:
+            g_object_unref (connection);
+            return G_SOURCE_CONTINUE;
+        }
+    } else {
+        switch (command_source_read_command (connection,
+                                             istream,
+                                             &buf,
+                                             &buf_size)) {
+        case -1:
+            goto fail_out;
+        case 0:
+            g_object_unref (connection);
+            return G_SOURCE_CONTINUE;
+        }
+        target = g_object_ref (connection);
     }
     attributes = command_attrs_from_cc (data->self->command_attrs,
                                         get_command_code (buf));
-    command = tpm2_command_new (connection, buf, buf_size, attributes);
-    if (command != NULL) {
-        sink_enqueue (data->self->sink, G_OBJECT (command));
-        /* the sink now owns this message */
-        g_object_unref (command);
-    } else {
+    command = tpm2_command_new (target, buf, buf_size, attributes);
+    if (command == NULL) {
         goto fail_out;
     }
+    timeline = tabrmd_timeline_new (connection_get_number (target),
+                                    tpm2_command_get_code (command),
+                                    time_read);
+    handle_count = tpm2_command_get_handle_count (command);
+    for (i = 0; i < handle_count; ++i) {
+        tabrmd_timeline_add_handle (timeline,
+                                    tpm2_command_get_handle (command, i));
+    }
+    tpm2_command_set_timeline (command, timeline);
+    tabrmd_timeline_unref (timeline);
+    tabrmd_capture_write (TABRMD_CAPTURE_COMMAND,
+                          connection_get_number (target), time_read,
+                          buf, buf_size);
+    TABRMD_PROBE_COMMAND (command_read, command);
+    /*
+     * Account for the command before it's enqueued so the response can't
+     * be counted before the command is.
+     */
+    ret = command_source_account_command (data->self, target, data);
+    sink_enqueue (data->self->sink, G_OBJECT (command));
+    /* the sink now owns this message */
+    g_object_unref (command);
+    g_object_unref (target);
     g_object_unref (connection);
-    return G_SOURCE_CONTINUE;
+    return ret;
 fail_out:
     if (buf != NULL) {
         g_free (buf);
     }
-    g_debug ("%s: removing connection from connection_manager", __func__);
+    g_clear_object (&target);
+    tabrmd_debug ("%s: removing connection from connection_manager", __func__);
     connection_manager_remove (data->self->connection_manager,
                                connection);
-    ControlMessage *msg =
-        control_message_new_with_object (CONNECTION_REMOVED,
-                                         G_OBJECT (connection));
-    sink_enqueue (data->self->sink, G_OBJECT (msg));
-    g_object_unref (msg);
+    channels = connection_mux_steal_channels (connection);
+    for (item = channels; item != NULL; item = item->next) {
+        command_source_connection_removed (data->self, CONNECTION (item->data));
+    }
+    g_list_free_full (channels, g_object_unref);
+    command_source_connection_removed (data->self, connection);
     g_object_unref (connection);
     /*
      * Remove data from hash table which includes the GCancellable associated
@@ -225,8 +510,11 @@ fail_out:
      * since we're letting this source die at the end of this function
      * (returning FALSE).
      */
-    g_debug ("%s: removing GCancellable", __func__);
-    g_hash_table_remove (data->self->istream_to_source_data_map, istream);
+    tabrmd_debug ("%s: removing GCancellable", __func__);
+    self = data->self;
+    g_mutex_lock (&self->map_mutex);
+    g_hash_table_remove (self->istream_to_source_data_map, istream);
+    g_mutex_unlock (&self->map_mutex);
     return G_SOURCE_REMOVE;
 }
 /*
@@ -244,7 +532,7 @@ command_source_on_new_connection (ConnectionManager   *connection_manager,
     source_data_t *data;
     UNUSED_PARAM(connection_manager);
 
-    g_info ("%s: adding new connection", __func__);
+    tabrmd_info ("%s: adding new connection", __func__);
     /*
      * Take reference to socket, will be freed when the source_data_t
      * structure is freed
@@ -254,24 +542,99 @@ command_source_on_new_connection (ConnectionManager   *connection_manager,
     g_object_ref (istream);
     data = g_malloc0 (sizeof (source_data_t));
     data->cancellable = g_cancellable_new ();
-    data->source = g_pollable_input_stream_create_source (istream,
-                                                          data->cancellable);
-    /* we ignore the ID returned since we keep a reference to the source around */
-    g_source_attach (data->source, self->main_context);
     data->self = self;
-    g_source_set_callback (data->source,
-                           G_SOURCE_FUNC (command_source_on_input_ready),
-                           data,
-                           NULL);
+    data->context = command_source_shard_context (self, connection);
+    g_mutex_lock (&self->map_mutex);
+    command_source_attach_source (istream, data);
     /*
      * To stop watching this socket for G_IO_IN condition use this GHashTable
      * to look up the GCancellable object. The hash table takes ownership of
      * the reference to the istream and the source_data_t pointer.
      */
     g_hash_table_insert (self->istream_to_source_data_map, istream, data);
+    g_mutex_unlock (&self->map_mutex);
 
     return 0;
 }
+/*
+ * Callback for iterating over the istream_to_source_data_map. Each paused
+ * connection that is below its in-flight limit gets a new GSource.
+ */
+static void
+command_source_resume_callback (gpointer key,
+                                gpointer value,
+                                gpointer user_data)
+{
+    GPollableInputStream *istream = G_POLLABLE_INPUT_STREAM (key);
+    source_data_t *data = (source_data_t*)value;
+    CommandSource *self = COMMAND_SOURCE (user_data);
+    Connection *connection;
+
+    if (data->source != NULL) {
+        return;
+    }
+    connection =
+        connection_manager_lookup_istream (self->connection_manager,
+                                           G_INPUT_STREAM (istream));
+    if (connection == NULL) {
+        return;
+    }
+    if (connection_in_flight_get (connection) < self->max_in_flight) {
+        tabrmd_debug ("%s: resuming connection with id 0x%" PRIx64,
+                      __func__, connection->id);
+        command_source_attach_source (istream, data);
+    }
+    g_object_unref (connection);
+}
+/*
+ * This function is invoked on the CommandSource main_context after a
+ * response has been delivered to a client that had reached a limit. It
+ * resumes monitoring for all paused connections that are below their
+ * in-flight limit, as long as the pipeline is below the high-water mark.
+ * Calling it when nothing is paused is harmless.
+ */
+gboolean
+command_source_resume (gpointer user_data)
+{
+    CommandSource *self = COMMAND_SOURCE (user_data);
+
+    tabrmd_debug ("%s", __func__);
+    if ((guint)g_atomic_int_get (&self->queued) >= self->queue_high_water) {
+        return G_SOURCE_REMOVE;
+    }
+    g_mutex_lock (&self->map_mutex);
+    if (self->istream_to_source_data_map != NULL) {
+        g_hash_table_foreach (self->istream_to_source_data_map,
+                              command_source_resume_callback,
+                              self);
+    }
+    g_mutex_unlock (&self->map_mutex);
+    return G_SOURCE_REMOVE;
+}
+/*
+ * This is a callback function invoked by the ResponseSink each time it has
+ * written a response back to a client. It is invoked from the ResponseSink
+ * thread. If either the connection or the pipeline was at its limit we ask
+ * the CommandSource GMainContext to resume monitoring paused connections.
+ */
+void
+command_source_on_response_written (ResponseSink  *response_sink,
+                                    Connection    *connection,
+                                    CommandSource *self)
+{
+    guint in_flight, queued;
+    UNUSED_PARAM(response_sink);
+
+    in_flight = connection_in_flight_dec (connection);
+    queued = (guint)g_atomic_int_add (&self->queued, -1);
+    if (in_flight >= self->max_in_flight || queued >= self->queue_high_water) {
+        g_main_context_invoke_full (self->main_context,
+                                    G_PRIORITY_DEFAULT,
+                                    command_source_resume,
+                                    g_object_ref (self),
+                                    g_object_unref);
+    }
+}
 /*
  * callback for iterating over objects in the member socket_to_source_data_map
  * GHashMap to kill off the GSource. This requires cancelling it, and then
@@ -285,10 +648,10 @@ command_source_source_cancel (gpointer key,
 {
     UNUSED_PARAM(key);
     UNUSED_PARAM(user_data);
-    g_debug ("%s", __func__);
+    tabrmd_debug ("%s", __func__);
     source_data_t *data = (source_data_t*)value;
 
-    g_debug ("%s: canceling cancellable and destroying source", __func__);
+    tabrmd_debug ("%s: canceling cancellable and destroying source", __func__);
     g_cancellable_cancel (data->cancellable);
 }
 /*
@@ -298,20 +661,30 @@ command_source_source_cancel (gpointer key,
 static void
 command_source_dispose (GObject *object) {
     CommandSource *self = COMMAND_SOURCE (object);
+    guint i;
 
     g_clear_object (&self->sink);
     g_clear_object (&self->connection_manager);
     g_clear_object (&self->command_attrs);
     /* cancel all outstanding G_IO_IN condition GSources and destroy them */
+    g_mutex_lock (&self->map_mutex);
     if (self->istream_to_source_data_map != NULL) {
         g_hash_table_foreach (self->istream_to_source_data_map,
                               command_source_source_cancel,
                               NULL);
     }
     g_clear_pointer (&self->istream_to_source_data_map, g_hash_table_unref);
+    g_mutex_unlock (&self->map_mutex);
     if (self->main_loop != NULL && g_main_loop_is_running (self->main_loop)) {
         g_main_loop_quit (self->main_loop);
     }
+    if (self->shards != NULL) {
+        for (i = 0; i < self->reader_threads; ++i) {
+            g_clear_pointer (&self->shards [i].loop, g_main_loop_unref);
+            g_clear_pointer (&self->shards [i].context, g_main_context_unref);
+        }
+        g_clear_pointer (&self->shards, g_free);
+    }
     g_clear_pointer (&self->main_loop, g_main_loop_unref);
     g_clear_pointer (&self->main_context, g_main_context_unref);
     G_OBJECT_CLASS (command_source_parent_class)->dispose (object);
@@ -324,6 +697,9 @@ command_source_dispose (GObject *object) {
 static void
 command_source_finalize (GObject  *object)
 {
+    CommandSource *self = COMMAND_SOURCE (object);
+
+    g_mutex_clear (&self->map_mutex);
     G_OBJECT_CLASS (command_source_parent_class)->finalize (object);
 }
 /*
@@ -336,22 +712,66 @@ command_source_unblock (Thread *self)
     CommandSource *source = COMMAND_SOURCE (self);
     g_main_loop_quit (source->main_loop);
 }
+/*
+ * Thread function for the reader threads beyond the first. Each runs the
+ * GMainLoop for its shard.
+ */
+static void*
+command_source_shard_thread (void *data)
+{
+    command_source_shard_t *shard = (command_source_shard_t*)data;
+
+    g_main_loop_run (shard->loop);
+    return NULL;
+}
+/*
+ * GSourceFunc invoked on a shard GMainContext to stop its GMainLoop. We
+ * quit the loop from its own context so that a quit can't be lost if the
+ * shard thread hasn't started running the loop yet.
+ */
+static gboolean
+command_source_shard_quit (gpointer user_data)
+{
+    g_main_loop_quit ((GMainLoop*)user_data);
+    return G_SOURCE_REMOVE;
+}
 /*
  * This function creates it's very own GMainLoop thread. This is used to
  * monitor client connections for incoming data (TPM2 command buffers).
+ * When configured with more than one reader thread, the threads for the
+ * other shards are started here and joined once the main loop returns.
  */
 void*
 command_source_thread (void *data)
 {
     CommandSource *source;
+    guint i, started;
+    int ret;
 
     g_assert (data != NULL);
     source = COMMAND_SOURCE (data);
     g_assert (source->main_loop != NULL);
 
+    for (started = 1; started < source->reader_threads; ++started) {
+        ret = pthread_create (&source->shards [started].thread_id,
+                              NULL,
+                              command_source_shard_thread,
+                              &source->shards [started]);
+        if (ret != 0) {
+            g_warning ("%s: failed to create reader thread %u: %s",
+                       __func__, started, strerror (ret));
+            break;
+        }
+    }
     if (!g_main_loop_is_running (source->main_loop)) {
         g_main_loop_run (source->main_loop);
     }
+    for (i = 1; i < started; ++i) {
+        g_main_context_invoke (source->shards [i].context,
+                               command_source_shard_quit,
+                               source->shards [i].loop);
+        pthread_join (source->shards [i].thread_id, NULL);
+    }
 
     return NULL;
 }
@@ -362,10 +782,11 @@ command_source_class_init (CommandSourceClass *klass)
     GObjectClass *object_class = G_OBJECT_CLASS (klass);
     ThreadClass  *thread_class = THREAD_CLASS (klass);
 
-    g_debug ("command_source_class_init");
+    tabrmd_debug ("command_source_class_init");
     if (command_source_parent_class == NULL)
         command_source_parent_class = g_type_class_peek_parent (klass);
 
+    object_class->constructed  = command_source_constructed;
     object_class->dispose      = command_source_dispose;
     object_class->finalize     = command_source_finalize;
     object_class->get_property = command_source_get_property;
@@ -391,13 +812,40 @@ command_source_class_init (CommandSourceClass *klass)
                              "Reference to a Sink object.",
                              G_TYPE_OBJECT,
                              G_PARAM_READWRITE);
+    obj_properties [PROP_MAX_IN_FLIGHT] =
+        g_param_spec_uint ("max-in-flight",
+                           "max in flight",
+                           "Maximum number of commands in flight per connection.",
+                           1,
+                           TABRMD_IN_FLIGHT_MAX,
+                           TABRMD_IN_FLIGHT_MAX_DEFAULT,
+                           G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+    obj_properties [PROP_QUEUE_HIGH_WATER] =
+        g_param_spec_uint ("queue-high-water",
+                           "queue high water",
+                           "Number of commands queued in the pipeline at which we stop reading from all connections.",
+                           1,
+                           TABRMD_QUEUE_HIGH_WATER_MAX,
+                           TABRMD_QUEUE_HIGH_WATER_DEFAULT,
+                           G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+    obj_properties [PROP_READER_THREADS] =
+        g_param_spec_uint ("reader-threads",
+                           "reader threads",
+                           "Number of threads reading commands from client connections.",
+                           1,
+                           TABRMD_READER_THREADS_MAX,
+                           TABRMD_READER_THREADS_DEFAULT,
+                           G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
     g_object_class_install_properties (object_class,
                                        N_PROPERTIES,
                                        obj_properties);
 }
 CommandSource*
 command_source_new (ConnectionManager    *connection_manager,
-                    CommandAttrs         *command_attrs)
+                    CommandAttrs         *command_attrs,
+                    guint                 max_in_flight,
+                    guint                 queue_high_water,
+                    guint                 reader_threads)
 {
     CommandSource *source;
 
@@ -407,6 +855,9 @@ command_source_new (ConnectionManager    *connection_manager,
     source = COMMAND_SOURCE (g_object_new (TYPE_COMMAND_SOURCE,
                                              "command-attrs", command_attrs,
                                              "connection-manager", connection_manager,
+                                             "max-in-flight", max_in_flight,
+                                             "queue-high-water", queue_high_water,
+                                             "reader-threads", reader_threads,
                                              NULL));
     g_signal_connect (connection_manager,
                       "new-connection",
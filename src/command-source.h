@@ -12,6 +12,7 @@
 
 #include "command-attrs.h"
 #include "connection-manager.h"
+#include "response-sink.h"
 #include "sink-interface.h"
 #include "thread.h"
 
@@ -26,6 +27,19 @@ typedef struct _CommandSourceClass {
     ThreadClass       parent;
 } CommandSourceClass;
 
+/*
+ * Each reader thread owns a GMainContext / GMainLoop pair that monitors a
+ * subset (shard) of the client connections. Connections are assigned to a
+ * shard by their id. The first shard is the CommandSource main_context /
+ * main_loop and it's run by the CommandSource thread itself. The
+ * CommandSource thread starts and joins the threads for the other shards.
+ */
+typedef struct {
+    GMainContext      *context;
+    GMainLoop         *loop;
+    pthread_t          thread_id;
+} command_source_shard_t;
+
 typedef struct _CommandSource {
     Thread             parent_instance;
     ConnectionManager *connection_manager;
@@ -33,7 +47,13 @@ typedef struct _CommandSource {
     GMainContext      *main_context;
     GMainLoop         *main_loop;
     GHashTable        *istream_to_source_data_map;
+    GMutex             map_mutex;
     Sink              *sink;
+    guint              max_in_flight;
+    guint              queue_high_water;
+    gint               queued;
+    guint              reader_threads;
+    command_source_shard_t *shards;
 } CommandSource;
 
 #define TYPE_COMMAND_SOURCE              (command_source_get_type   ())
@@ -45,16 +65,23 @@ typedef struct _CommandSource {
 
 GType           command_source_get_type          (void);
 CommandSource*  command_source_new               (ConnectionManager  *connection_manager,
-                                                  CommandAttrs       *command_attrs);
+                                                  CommandAttrs       *command_attrs,
+                                                  guint               max_in_flight,
+                                                  guint               queue_high_water,
+                                                  guint               reader_threads);
 gint            command_source_on_new_connection (ConnectionManager  *connection_manager,
                                                   Connection         *connection,
                                                   CommandSource      *command_source);
+void            command_source_on_response_written (ResponseSink     *response_sink,
+                                                  Connection         *connection,
+                                                  CommandSource      *command_source);
 /*
  * The following are private functions. They are exposed here for unit
  * testing. Do not call these from anywhere else.
  */
 gboolean        command_source_on_input_ready    (GInputStream       *socket,
                                                   gpointer            user_data);
+gboolean        command_source_resume            (gpointer            user_data);
 /*
  * Instances of this structure are used to track GSources and their
  * GCancellable objects that have been registered with the
@@ -71,11 +98,21 @@ gboolean        command_source_on_input_ready    (GInputStream       *socket,
  *   around.
  * - When the CommandSource is destroyed all of the GSources registered with
  *   the GMainContext/Loop must be canceled and freed (see dispose function).
+ * - When a connection reaches its in-flight limit, or the number of commands
+ *   queued in the pipeline reaches the high-water mark, the GSource is
+ *   destroyed and 'source' is set to NULL. The connection is 'paused' until
+ *   command_source_resume creates a new GSource for it.
+ * - 'context' is the GMainContext of the shard that the connection belongs
+ *   to. All GSources for the connection are attached to this context so
+ *   that commands from a connection are always read by the same thread.
+ * The hash table and the 'source' member are protected by the
+ * CommandSource 'map_mutex'.
  */
 typedef struct {
     CommandSource *self;
     GCancellable  *cancellable;
     GSource       *source;
+    GMainContext  *context;
 } source_data_t;
 
 
@@ -12,6 +12,9 @@
 #include <string.h>
 
 #include "connection-manager.h"
+#include "logging.h"
+#include "tabrmd-probes.h"
+#include "tabrmd-stats.h"
 #include "util.h"
 
 #define MAX_CONNECTIONS 100
@@ -45,11 +48,11 @@ connection_manager_set_property (GObject        *object,
 {
     ConnectionManager *mgr = CONNECTION_MANAGER (object);
 
-    g_debug ("%s", __func__);
+    tabrmd_debug ("%s", __func__);
     switch (property_id) {
     case PROP_MAX_CONNECTIONS:
         mgr->max_connections = g_value_get_uint (value);
-        g_debug ("  max_connections: %u", mgr->max_connections);
+        tabrmd_debug ("  max_connections: %u", mgr->max_connections);
         break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -67,7 +70,7 @@ connection_manager_get_property (GObject     *object,
 {
     ConnectionManager *mgr = CONNECTION_MANAGER (object);
 
-    g_debug (__func__);
+    tabrmd_debug (__func__);
     switch (property_id) {
     case PROP_MAX_CONNECTIONS:
         g_value_set_uint (value, mgr->max_connections);
@@ -212,6 +215,8 @@ connection_manager_insert (ConnectionManager    *manager,
     g_hash_table_insert (manager->connection_from_id_table,
                          connection_key_id (connection),
                          connection);
+    tabrmd_stats_connection (1);
+    TABRMD_PROBE1 (connection_create, connection->id);
     ret = pthread_mutex_unlock (&manager->mutex);
     if (ret != 0)
         g_error ("Error unlocking connection_manager mutex: %s",
@@ -260,9 +265,9 @@ connection_manager_lookup_id (ConnectionManager   *manager,
 {
     Connection *connection;
 
-    g_debug ("locking manager mutex");
+    tabrmd_debug ("locking manager mutex");
     pthread_mutex_lock (&manager->mutex);
-    g_debug ("g_hash_table_lookup: connection_from_id_table");
+    tabrmd_debug ("g_hash_table_lookup: connection_from_id_table");
     connection = g_hash_table_lookup (manager->connection_from_id_table,
                                       &id);
     if (connection != NULL) {
@@ -270,7 +275,7 @@ connection_manager_lookup_id (ConnectionManager   *manager,
     } else {
         g_warning ("connection_manager_lookup_id returned NULL connection");
     }
-    g_debug ("unlocking manager mutex");
+    tabrmd_debug ("unlocking manager mutex");
     pthread_mutex_unlock (&manager->mutex);
 
     return connection;
@@ -289,8 +294,9 @@ connection_manager_remove (ConnectionManager   *manager,
 {
     gboolean ret;
 
-    g_debug ("%s: removing Connection", __func__);
+    tabrmd_debug ("%s: removing Connection", __func__);
     pthread_mutex_lock (&manager->mutex);
+    TABRMD_PROBE1 (connection_remove, connection->id);
     ret = g_hash_table_remove (manager->connection_from_istream_table,
                                connection_key_istream (connection));
     if (ret != TRUE)
@@ -299,6 +305,7 @@ connection_manager_remove (ConnectionManager   *manager,
                                connection_key_id (connection));
     if (ret != TRUE)
         g_error ("%s: failed to remove Connection", __func__);
+    tabrmd_stats_connection (-1);
     pthread_mutex_unlock (&manager->mutex);
 
     return ret;
@@ -12,6 +12,7 @@
 #include <unistd.h>
 
 #include "connection.h"
+#include "logging.h"
 #include "util.h"
 
 G_DEFINE_TYPE (Connection, connection, G_TYPE_OBJECT);
@@ -24,6 +25,8 @@ enum {
     N_PROPERTIES
 };
 static GParamSpec *obj_properties [N_PROPERTIES] = { NULL, };
+/* the number given to the last connection created */
+static guint64 connection_count = 0;
 
 static void
 connection_set_property (GObject       *object,
@@ -33,20 +36,20 @@ connection_set_property (GObject       *object,
 {
     Connection *self = CONNECTION (object);
 
-    g_debug ("connection_set_property");
+    tabrmd_debug ("connection_set_property");
     switch (property_id) {
     case PROP_ID:
         self->id = g_value_get_uint64 (value);
-        g_debug ("%s: set id to 0x%" PRIx64, __func__, self->id);
+        tabrmd_debug ("%s: set id to 0x%" PRIx64, __func__, self->id);
         break;
     case PROP_IO_STREAM:
         self->iostream = G_IO_STREAM (g_value_dup_object (value));
-        g_debug ("%s: set socket", __func__);
+        tabrmd_debug ("%s: set socket", __func__);
         break;
     case PROP_TRANSIENT_HANDLE_MAP:
         self->transient_handle_map = g_value_get_object (value);
         g_object_ref (self->transient_handle_map);
-        g_debug ("%s: set transient_handle_map", __func__);
+        tabrmd_debug ("%s: set transient_handle_map", __func__);
         break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -61,7 +64,7 @@ connection_get_property (GObject     *object,
 {
     Connection *self = CONNECTION (object);
 
-    g_debug ("connection_get_property");
+    tabrmd_debug ("connection_get_property");
     switch (property_id) {
     case PROP_ID:
         g_value_set_uint64 (value, self->id);
@@ -78,14 +81,13 @@ connection_get_property (GObject     *object,
     }
 }
 
-/*
- * G_DEFINE_TYPE requires an instance init even though we don't use it.
- */
 static void
 connection_init (Connection *connection)
 {
-    UNUSED_PARAM(connection);
-    /* noop */
+    g_mutex_init (&connection->channels_mutex);
+    connection->number = __atomic_add_fetch (&connection_count,
+                                             1,
+                                             __ATOMIC_RELAXED);
 }
 
 static void
@@ -93,22 +95,39 @@ connection_dispose (GObject *obj)
 {
     Connection *connection = CONNECTION (obj);
 
+    if (connection->mux_parent != NULL) {
+        connection_mux_trans_add (connection,
+            -(gint)handle_map_size (connection->transient_handle_map));
+    }
     g_clear_object (&connection->iostream);
     g_object_unref (connection->transient_handle_map);
+    g_clear_pointer (&connection->channels, g_hash_table_unref);
+    g_clear_object (&connection->mux_parent);
 
     G_OBJECT_CLASS (connection_parent_class)->dispose (obj);
 }
 
+static void
+connection_finalize (GObject *obj)
+{
+    Connection *connection = CONNECTION (obj);
+
+    g_mutex_clear (&connection->channels_mutex);
+
+    G_OBJECT_CLASS (connection_parent_class)->finalize (obj);
+}
+
 static void
 connection_class_init (ConnectionClass *klass)
 {
     GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
-    g_debug ("connection_class_init");
+    tabrmd_debug ("connection_class_init");
     if (connection_parent_class == NULL)
         connection_parent_class = g_type_class_peek_parent (klass);
 
     object_class->dispose      = connection_dispose;
+    object_class->finalize     = connection_finalize;
     object_class->get_property = connection_get_property;
     object_class->set_property = connection_set_property;
 
@@ -165,6 +184,21 @@ connection_get_iostream (Connection *connection)
     return connection->iostream;
 }
 
+/*
+ * Return the number the connection was given when it was created. The
+ * 'id' of a connection is the secret a client proves it owns the
+ * connection with (mixed with its PID) so it must not be shown to other
+ * clients. The number identifies the connection in the flight recorder and
+ * the capture file instead: it's a count of the connections created so it
+ * gives nothing away about the 'id' and no method looks a connection up by
+ * it.
+ */
+guint64
+connection_get_number (Connection *connection)
+{
+    return connection->number;
+}
+
 gpointer
 connection_key_id (Connection *connection)
 {
@@ -182,3 +216,186 @@ connection_get_trans_map (Connection *connection)
     g_object_ref (connection->transient_handle_map);
     return connection->transient_handle_map;
 }
+/*
+ * Track the number of commands read from this connection for which no
+ * response has been written yet. The CommandSource increments the count
+ * when it passes a command down the pipeline and decrements it when the
+ * response has been written back to the client. These functions may be
+ * called from any thread. Each returns the value held *before* the update.
+ * Commands on the channels of a multiplexed connection are counted against
+ * the connection that carries them.
+ */
+guint
+connection_in_flight_inc (Connection *connection)
+{
+    connection = connection_get_owner (connection);
+    return (guint)g_atomic_int_add (&connection->in_flight, 1);
+}
+guint
+connection_in_flight_dec (Connection *connection)
+{
+    connection = connection_get_owner (connection);
+    return (guint)g_atomic_int_add (&connection->in_flight, -1);
+}
+guint
+connection_in_flight_get (Connection *connection)
+{
+    connection = connection_get_owner (connection);
+    return (guint)g_atomic_int_get (&connection->in_flight);
+}
+/*
+ * A multiplexed connection carries commands for many logical channels over
+ * a single socket. Each channel gets its own Connection object (a 'child')
+ * with its own HandleMap so that objects and sessions are virtualized per
+ * channel just like they are for separate connections. Children share the
+ * socket, the connection ID and the quotas of the connection that carries
+ * them (the 'parent'). Only the parent is tracked by the ConnectionManager.
+ * This must be set before the connection is passed to the
+ * ConnectionManager.
+ */
+void
+connection_set_mux (Connection *connection)
+{
+    connection->mux = TRUE;
+    connection->channels = g_hash_table_new_full (g_direct_hash,
+                                                  g_direct_equal,
+                                                  NULL,
+                                                  g_object_unref);
+}
+gboolean
+connection_is_mux (Connection *connection)
+{
+    return connection->mux;
+}
+/*
+ * Returns the Connection that quotas are accounted against: the parent for
+ * a channel of a multiplexed connection, the connection itself otherwise.
+ * No reference is taken.
+ */
+Connection*
+connection_get_owner (Connection *connection)
+{
+    return connection->mux_parent != NULL ? connection->mux_parent : connection;
+}
+/*
+ * Get the child Connection for the given channel of a multiplexed
+ * connection. The child is created on first use. Returns NULL if the
+ * channel doesn't exist and the connection already has 'max_channels'
+ * channels. The caller must unref the returned Connection.
+ * The child holds a reference to the parent. The reference cycle is broken
+ * by connection_mux_steal_channels when the parent is removed.
+ */
+Connection*
+connection_mux_channel (Connection *connection,
+                        guint32     channel,
+                        guint       max_channels)
+{
+    Connection *child;
+    HandleMap *handle_map;
+
+    g_mutex_lock (&connection->channels_mutex);
+    child = g_hash_table_lookup (connection->channels,
+                                 GUINT_TO_POINTER (channel));
+    if (child == NULL) {
+        if (g_hash_table_size (connection->channels) >= max_channels) {
+            g_warning ("%s: connection with id 0x%" PRIx64 " has reached "
+                       "its limit of %u channels", __func__, connection->id,
+                       max_channels);
+            g_mutex_unlock (&connection->channels_mutex);
+            return NULL;
+        }
+        handle_map = handle_map_new (TPM2_HT_TRANSIENT,
+                                     connection->transient_handle_map->max_entries);
+        child = connection_new (connection->iostream,
+                                connection->id,
+                                handle_map);
+        g_object_unref (handle_map);
+        child->mux_parent = g_object_ref (connection);
+        child->channel = channel;
+        g_hash_table_insert (connection->channels,
+                             GUINT_TO_POINTER (channel),
+                             child);
+        tabrmd_debug ("%s: created channel %" PRIu32 " for connection with id 0x%"
+                      PRIx64, __func__, channel, connection->id);
+    }
+    g_object_ref (child);
+    g_mutex_unlock (&connection->channels_mutex);
+    return child;
+}
+/*
+ * Remove a channel from a multiplexed connection. Returns the child
+ * Connection for the channel (the caller must unref it) or NULL if there's
+ * no such channel.
+ */
+Connection*
+connection_mux_remove_channel (Connection *connection,
+                               guint32     channel)
+{
+    Connection *child = NULL;
+
+    g_mutex_lock (&connection->channels_mutex);
+    child = g_hash_table_lookup (connection->channels,
+                                 GUINT_TO_POINTER (channel));
+    if (child != NULL) {
+        g_object_ref (child);
+        g_hash_table_remove (connection->channels,
+                             GUINT_TO_POINTER (channel));
+    }
+    g_mutex_unlock (&connection->channels_mutex);
+    return child;
+}
+/*
+ * Remove all channels from a multiplexed connection. The caller owns the
+ * returned list and the references to the child Connections in it.
+ */
+GList*
+connection_mux_steal_channels (Connection *connection)
+{
+    GHashTableIter iter;
+    gpointer child;
+    GList *list = NULL;
+
+    if (connection->channels == NULL) {
+        return NULL;
+    }
+    g_mutex_lock (&connection->channels_mutex);
+    g_hash_table_iter_init (&iter, connection->channels);
+    while (g_hash_table_iter_next (&iter, NULL, &child)) {
+        list = g_list_prepend (list, child);
+        g_hash_table_iter_steal (&iter);
+    }
+    g_mutex_unlock (&connection->channels_mutex);
+    return list;
+}
+/*
+ * The transient object quota of a multiplexed connection is shared by its
+ * channels. The parent keeps a count of the transient objects held by all
+ * of its channels: the ResourceManager adds 'count' when it creates or
+ * flushes a transient object for a channel, and a channel removes whatever
+ * it still holds when it's disposed. Does nothing for a connection that
+ * isn't a channel. May be called from any thread.
+ */
+void
+connection_mux_trans_add (Connection *connection,
+                          gint        count)
+{
+    if (connection->mux_parent != NULL) {
+        g_atomic_int_add (&connection->mux_parent->trans_count, count);
+    }
+}
+/*
+ * Returns TRUE if the channels of the connection that owns the provided
+ * channel hold as many transient objects as the quota allows. Always
+ * returns FALSE for a connection that isn't a channel.
+ */
+gboolean
+connection_mux_trans_full (Connection *connection)
+{
+    Connection *parent = connection->mux_parent;
+
+    if (parent == NULL) {
+        return FALSE;
+    }
+    return (guint)g_atomic_int_get (&parent->trans_count) >=
+        parent->transient_handle_map->max_entries;
+}
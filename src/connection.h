@@ -22,7 +22,17 @@ typedef struct _Connection {
     GObject             parent_instance;
     GIOStream          *iostream;
     guint64             id;
+    /* sequential, never accepted where 'id' is, see connection_get_number */
+    guint64             number;
     HandleMap          *transient_handle_map;
+    gint                in_flight;
+    /* multiplexed connections, see connection_mux_channel */
+    gboolean            mux;
+    GMutex              channels_mutex;
+    GHashTable         *channels;
+    struct _Connection *mux_parent;
+    guint32             channel;
+    gint                trans_count;
 } Connection;
 
 #define TYPE_CONNECTION              (connection_get_type ())
@@ -39,5 +49,21 @@ Connection*      connection_new          (GIOStream       *iostream,
 gpointer         connection_key_istream  (Connection      *session);
 gpointer         connection_key_id       (Connection      *session);
 GIOStream*       connection_get_iostream (Connection      *connection);
+guint64          connection_get_number   (Connection      *connection);
 HandleMap*       connection_get_trans_map(Connection      *session);
+guint            connection_in_flight_inc(Connection      *connection);
+guint            connection_in_flight_dec(Connection      *connection);
+guint            connection_in_flight_get(Connection      *connection);
+void             connection_set_mux      (Connection      *connection);
+gboolean         connection_is_mux       (Connection      *connection);
+Connection*      connection_get_owner    (Connection      *connection);
+Connection*      connection_mux_channel  (Connection      *connection,
+                                          guint32          channel,
+                                          guint            max_channels);
+Connection*      connection_mux_remove_channel (Connection *connection,
+                                          guint32          channel);
+GList*           connection_mux_steal_channels (Connection *connection);
+void             connection_mux_trans_add (Connection     *connection,
+                                          gint             count);
+gboolean         connection_mux_trans_full (Connection    *connection);
 #endif /* CONNECTION_H */
@@ -5,6 +5,7 @@
  */
 #include <inttypes.h>
 
+#include "logging.h"
 #include "util.h"
 #include "handle-map-entry.h"
 
@@ -84,7 +85,7 @@ handle_map_entry_init (HandleMapEntry *entry)
 static void
 handle_map_entry_finalize (GObject *object)
 {
-    g_debug ("%s", __func__);
+    tabrmd_debug ("%s", __func__);
     G_OBJECT_CLASS (handle_map_entry_parent_class)->finalize (object);
 }
 /*
@@ -139,8 +140,8 @@ handle_map_entry_new (TPM2_HANDLE phandle,
                                             "phandle", (guint)phandle,
                                             "vhandle", (guint)vhandle,
                                             NULL));
-    g_debug ("%s: with vhandle: 0x%" PRIx32 " and phandle: 0x%" PRIx32,
-             __func__, vhandle, phandle);
+    tabrmd_debug ("%s: with vhandle: 0x%" PRIx32 " and phandle: 0x%" PRIx32,
+                  __func__, vhandle, phandle);
     return entry;
 }
 /*
@@ -8,6 +8,7 @@
 #include <inttypes.h>
 
 #include "handle-map.h"
+#include "logging.h"
 #include "util.h"
 
 G_DEFINE_TYPE (HandleMap, handle_map, G_TYPE_OBJECT);
@@ -59,7 +60,7 @@ handle_map_set_property (GObject        *object,
         break;
     case PROP_MAX_ENTRIES:
         map->max_entries = g_value_get_uint (value);
-        g_debug ("%s: max-entries: %u", __func__, map->max_entries);
+        tabrmd_debug ("%s: max-entries: %u", __func__, map->max_entries);
         break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -78,7 +79,7 @@ handle_map_set_property (GObject        *object,
 static void
 handle_map_init (HandleMap     *map)
 {
-    g_debug ("handle_map_init");
+    tabrmd_debug ("handle_map_init");
     pthread_mutex_init (&map->mutex, NULL);
     map->vhandle_to_entry_table =
         g_hash_table_new_full (g_direct_hash,
@@ -108,7 +109,7 @@ handle_map_finalize (GObject *object)
 {
     HandleMap *self = HANDLE_MAP (object);
 
-    g_debug ("handle_map_finalize");
+    tabrmd_debug ("handle_map_finalize");
     pthread_mutex_destroy (&self->mutex);
     G_OBJECT_CLASS (handle_map_parent_class)->finalize (object);
 }
@@ -156,8 +157,8 @@ HandleMap*
 handle_map_new (TPM2_HT handle_type,
                 guint  max_entries)
 {
-    g_debug ("handle_map_new with handle_type 0x%" PRIx32
-             ", max_entries: 0x%x", handle_type, max_entries);
+    tabrmd_debug ("handle_map_new with handle_type 0x%" PRIx32
+                  ", max_entries: 0x%x", handle_type, max_entries);
     return HANDLE_MAP (g_object_new (TYPE_HANDLE_MAP,
                                      "handle-type", handle_type,
                                      "max-entries", max_entries,
@@ -211,7 +212,7 @@ handle_map_insert (HandleMap      *map,
                    TPM2_HANDLE     vhandle,
                    HandleMapEntry *entry)
 {
-    g_debug ("%s: vhandle: 0x%" PRIx32, __func__, vhandle);
+    tabrmd_debug ("%s: vhandle: 0x%" PRIx32, __func__, vhandle);
     handle_map_lock (map);
     if (handle_map_is_full (map)) {
         g_warning ("%s: max_entries of %u exceeded", __func__, map->max_entries);
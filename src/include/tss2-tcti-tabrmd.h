@@ -16,6 +16,60 @@ TSS2_RC Tss2_Tcti_Tabrmd_Init (TSS2_TCTI_CONTEXT *context,
                                size_t *size,
                                const char *conf);
 
+/*
+ * Extension API: initialize a TCTI context without blocking the caller.
+ * The connection with the daemon is established in the background. The
+ * poll handle of the context becomes readable when it's done, after which
+ * Tss2_Tcti_Tabrmd_InitFinish returns the result.
+ * See Tss2_Tcti_Tabrmd_InitAsync(3).
+ */
+TSS2_RC Tss2_Tcti_Tabrmd_InitAsync (TSS2_TCTI_CONTEXT *context,
+                                    size_t *size,
+                                    const char *conf);
+TSS2_RC Tss2_Tcti_Tabrmd_InitFinish (TSS2_TCTI_CONTEXT *context);
+
+/*
+ * Extension API: send several commands over a single connection before
+ * receiving any of the responses. Responses are received in the order the
+ * commands were sent. See Tss2_Tcti_Tabrmd_TransmitMany(3).
+ */
+#define TSS2_TCTI_TABRMD_MANY_MAX 16
+
+TSS2_RC Tss2_Tcti_Tabrmd_TransmitMany (TSS2_TCTI_CONTEXT *context,
+                                       size_t count,
+                                       const size_t *sizes,
+                                       const uint8_t *const *commands);
+TSS2_RC Tss2_Tcti_Tabrmd_ReceiveMany (TSS2_TCTI_CONTEXT *context,
+                                      size_t count,
+                                      size_t *sizes,
+                                      uint8_t **responses,
+                                      int32_t timeout,
+                                      size_t *received);
+
+/*
+ * Extension API: performance counters kept by each TCTI context since it was
+ * initialized. Latencies are measured from the transmission of a command to
+ * the completed receipt of its response and are counted in a histogram of
+ * power of two buckets: bucket 0 holds latencies under 2 microseconds,
+ * bucket n latencies in [2^n, 2^(n+1)) microseconds and the last bucket
+ * everything longer. See Tss2_Tcti_Tabrmd_GetStats(3).
+ */
+#define TSS2_TCTI_TABRMD_STATS_BUCKETS 24
+
+typedef struct {
+    uint64_t transmits;
+    uint64_t receives;
+    uint64_t bytes_transmitted;
+    uint64_t bytes_received;
+    uint64_t try_again;
+    uint64_t latency_total_us;
+    uint64_t latency_max_us;
+    uint64_t latency [TSS2_TCTI_TABRMD_STATS_BUCKETS];
+} TSS2_TCTI_TABRMD_STATS;
+
+TSS2_RC Tss2_Tcti_Tabrmd_GetStats (TSS2_TCTI_CONTEXT *context,
+                                   TSS2_TCTI_TABRMD_STATS *stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -6,9 +6,13 @@
 
 #include <gio/gunixfdlist.h>
 #include <inttypes.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #include "ipc-frontend-dbus.h"
 #include "tabrmd-defaults.h"
+#include "tabrmd-recorder.h"
+#include "tabrmd-stats.h"
 #include "tabrmd.h"
 #include "util.h"
 
@@ -29,9 +33,76 @@ enum {
     PROP_CONNECTION_MANAGER,
     PROP_MAX_TRANS,
     PROP_RANDOM,
+    PROP_CONNECTION_POOL_SIZE,
     N_PROPERTIES
 };
 static GParamSpec *obj_properties[N_PROPERTIES] = { NULL };
+/*
+ * Creating the socket pair and HandleMap for a new connection is most of
+ * the work done when a client calls CreateConnection. We keep a small pool
+ * of these resources for stream connections, built ahead of time, so that
+ * CreateConnection only needs to bind them to a new Connection with the
+ * client's ID. The pool is refilled from an idle callback on the main loop
+ * after each use. The pool is only accessed from the main loop thread.
+ */
+typedef struct {
+    GIOStream *iostream;
+    HandleMap *handle_map;
+    gint       client_fd;
+} connection_pool_entry_t;
+
+static connection_pool_entry_t*
+connection_pool_entry_new (IpcFrontendDbus *self)
+{
+    connection_pool_entry_t *entry = g_new0 (connection_pool_entry_t, 1);
+
+    entry->handle_map = handle_map_new (TPM2_HT_TRANSIENT,
+                                        self->max_transient_objects);
+    if (entry->handle_map == NULL)
+        g_error ("Failed to allocate new HandleMap");
+    entry->iostream = create_connection_iostream_type (&entry->client_fd,
+                                                       SOCK_STREAM);
+    return entry;
+}
+static void
+connection_pool_entry_free (connection_pool_entry_t *entry)
+{
+    g_clear_object (&entry->iostream);
+    g_clear_object (&entry->handle_map);
+    if (entry->client_fd >= 0) {
+        close (entry->client_fd);
+    }
+    g_free (entry);
+}
+/*
+ * Fill the connection pool up to its configured size. This is a GSourceFunc
+ * so that the pool can be refilled from the main loop.
+ */
+gboolean
+ipc_frontend_dbus_pool_refill (gpointer user_data)
+{
+    IpcFrontendDbus *self = IPC_FRONTEND_DBUS (user_data);
+
+    self->connection_pool_refill_id = 0;
+    while (g_queue_get_length (&self->connection_pool) <
+           self->connection_pool_size) {
+        g_queue_push_tail (&self->connection_pool,
+                           connection_pool_entry_new (self));
+    }
+    g_debug ("%s: connection pool has %u entries", __func__,
+             g_queue_get_length (&self->connection_pool));
+    return G_SOURCE_REMOVE;
+}
+static void
+ipc_frontend_dbus_pool_schedule_refill (IpcFrontendDbus *self)
+{
+    if (self->connection_pool_size == 0 ||
+        self->connection_pool_refill_id != 0) {
+        return;
+    }
+    self->connection_pool_refill_id =
+        g_idle_add (ipc_frontend_dbus_pool_refill, self);
+}
 
 static void
 ipc_frontend_dbus_set_property (GObject      *object,
@@ -60,6 +131,9 @@ ipc_frontend_dbus_set_property (GObject      *object,
         self->random = g_value_get_object (value);
         g_object_ref (self->random);
         break;
+    case PROP_CONNECTION_POOL_SIZE:
+        self->connection_pool_size = g_value_get_uint (value);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
         break;
@@ -89,6 +163,9 @@ ipc_frontend_dbus_get_property (GObject    *object,
     case PROP_RANDOM:
         g_value_set_object (value, self->random);
         break;
+    case PROP_CONNECTION_POOL_SIZE:
+        g_value_set_uint (value, self->connection_pool_size);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
         break;
@@ -98,6 +175,7 @@ static void
 ipc_frontend_dbus_init (IpcFrontendDbus *self)
 {
     self->dbus_name_acquired = FALSE;
+    g_queue_init (&self->connection_pool);
 }
 /*
  * Dispose method where where we free up references to other objects.
@@ -110,6 +188,13 @@ ipc_frontend_dbus_dispose (GObject *obj)
     g_clear_object (&self->connection_manager);
     g_clear_object (&self->random);
     g_clear_object (&self->skeleton);
+    if (self->connection_pool_refill_id != 0) {
+        g_source_remove (self->connection_pool_refill_id);
+        self->connection_pool_refill_id = 0;
+    }
+    while (!g_queue_is_empty (&self->connection_pool)) {
+        connection_pool_entry_free (g_queue_pop_head (&self->connection_pool));
+    }
     G_OBJECT_CLASS (ipc_frontend_dbus_parent_class)->dispose (obj);
 }
 /*
@@ -174,6 +259,14 @@ ipc_frontend_dbus_class_init (IpcFrontendDbusClass *klass)
                              "Source of random numbers.",
                              TYPE_RANDOM,
                              G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+    obj_properties [PROP_CONNECTION_POOL_SIZE] =
+        g_param_spec_uint ("connection-pool-size",
+                           "connection pool size",
+                           "number of connections to create ahead of time",
+                           0,
+                           TABRMD_CONNECTION_POOL_SIZE_MAX,
+                           TABRMD_CONNECTION_POOL_SIZE_DEFAULT,
+                           G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
     g_object_class_install_properties (object_class,
                                        N_PROPERTIES,
                                        obj_properties);
@@ -184,7 +277,8 @@ ipc_frontend_dbus_new (GBusType           bus_type,
                        gchar const       *bus_name,
                        ConnectionManager *connection_manager,
                        guint              max_trans,
-                       Random            *random)
+                       Random            *random,
+                       guint              pool_size)
 {
     GObject *object = NULL;
 
@@ -194,6 +288,7 @@ ipc_frontend_dbus_new (GBusType           bus_type,
                            "connection-manager", connection_manager,
                            "max-trans",          max_trans,
                            "random",             random,
+                           "connection-pool-size", pool_size,
                            NULL);
     return IPC_FRONTEND_DBUS (object);
 }
@@ -302,49 +397,43 @@ get_id_pid_mix_from_invocation (GDBusProxy            *proxy,
     return pid_ret;
 }
 /*
- * This is a signal handler for the handle-create-connection signal from
- * the DBus interface. This signal is triggered by a request from a client
- * to create a new connection with the daemon. This requires a few things
- * be done:
+ * This function does the work common to the CreateConnection and
+ * CreateConnectionWithTransport methods:
  * - Create a new ID (uint64) for the connection.
- * - Create a new Connection object.
- * - Build up a dbus response to the client with their connection ID and
- *   FD for the client side of the connection.
- * - Send the response message back to the client.
- * - Insert the new Connection object into the ConnectionManager.
+ * - Create a new Connection object using a socket of the requested type.
+ * The ID returned to the client is returned through the 'id' parameter and
+ * the FD for the client side of the connection through 'client_fd'.
+ * NOTE: if an error occurs then an error response is sent through the
+ * invocation to the client and NULL is returned to the caller.
  */
-static gboolean
-on_handle_create_connection (TctiTabrmd            *skeleton,
-                             GDBusMethodInvocation *invocation,
-                             gpointer               user_data)
+static Connection*
+create_connection_from_invocation (IpcFrontendDbus       *self,
+                                   GDBusMethodInvocation *invocation,
+                                   int                    socket_type,
+                                   guint64               *id,
+                                   gint                  *client_fd)
 {
-    IpcFrontendDbus *self = NULL;
     HandleMap   *handle_map = NULL;
     Connection *connection = NULL;
-    gint client_fd = 0, ret = 0;
     GIOStream *iostream;
-    GVariant *response, *response_tuple;
-    GUnixFDList *fd_list = NULL;
-    guint64 id = 0, id_pid_mix = 0;
+    connection_pool_entry_t *entry = NULL;
+    guint64 id_pid_mix = 0;
     gboolean id_ret = FALSE;
-    UNUSED_PARAM(skeleton);
 
-    self = IPC_FRONTEND_DBUS (user_data);
-    ipc_frontend_init_guard (IPC_FRONTEND (user_data));
     if (connection_manager_is_full (self->connection_manager)) {
         g_dbus_method_invocation_return_error (invocation,
                                                TABRMD_ERROR,
                                                TABRMD_ERROR_MAX_CONNECTIONS,
                                                "MAX_COMMANDS exceeded. Try again later.");
-        return TRUE;
+        return NULL;
     }
     id_ret = generate_id_pid_mix_from_invocation (self,
                                                   invocation,
-                                                  &id,
+                                                  id,
                                                   &id_pid_mix);
     /* error already returned to caller over dbus */
     if (id_ret == FALSE) {
-        return TRUE;
+        return NULL;
     }
     g_debug ("Creating connection with id: 0x%" PRIx64, id_pid_mix);
     if (connection_manager_contains_id (self->connection_manager,
@@ -355,23 +444,51 @@ on_handle_create_connection (TctiTabrmd            *skeleton,
             TABRMD_ERROR,
             TABRMD_ERROR_ID_GENERATION,
             "Failed to allocate connection ID. Try again later.");
-        return TRUE;
+        return NULL;
+    }
+    if (socket_type == SOCK_STREAM) {
+        entry = g_queue_pop_head (&self->connection_pool);
+        ipc_frontend_dbus_pool_schedule_refill (self);
+    }
+    if (entry != NULL) {
+        g_debug ("Using pre-built connection from pool");
+        handle_map = entry->handle_map;
+        iostream = entry->iostream;
+        *client_fd = entry->client_fd;
+        g_free (entry);
+    } else {
+        handle_map = handle_map_new (TPM2_HT_TRANSIENT,
+                                     self->max_transient_objects);
+        if (handle_map == NULL)
+            g_error ("Failed to allocate new HandleMap");
+        iostream = create_connection_iostream_type (client_fd, socket_type);
     }
-    handle_map = handle_map_new (TPM2_HT_TRANSIENT, self->max_transient_objects);
-    if (handle_map == NULL)
-        g_error ("Failed to allocate new HandleMap");
-    iostream = create_connection_iostream (&client_fd);
     connection = connection_new (iostream, id_pid_mix, handle_map);
     g_object_unref (handle_map);
     g_object_unref (iostream);
     if (connection == NULL)
         g_error ("Failed to allocate new connection.");
     g_debug ("Created connection with client FD: %d and id: 0x%" PRIx64,
-             client_fd, id_pid_mix);
-    /* prepare tuple variant for response message */
+             *client_fd, id_pid_mix);
+
+    return connection;
+}
+/*
+ * Insert the new Connection into the ConnectionManager and send the
+ * response message back to the client. The response holds the FD for the
+ * client side of the connection.
+ */
+static void
+return_connection_to_invocation (IpcFrontendDbus       *self,
+                                 GDBusMethodInvocation *invocation,
+                                 Connection            *connection,
+                                 GVariant              *response_tuple,
+                                 gint                   client_fd)
+{
+    GUnixFDList *fd_list = NULL;
+    gint ret = 0;
+
     fd_list = g_unix_fd_list_new_from_array (&client_fd, 1);
-    response = g_variant_new_uint64 (id);
-    response_tuple = g_variant_new_tuple (&response, 1);
     /*
      * Issue the callback to notify subscribers that a new connection has
      * been created.
@@ -386,6 +503,113 @@ on_handle_create_connection (TctiTabrmd            *skeleton,
         response_tuple,
         fd_list);
     g_object_unref (fd_list);
+}
+/*
+ * This is a signal handler for the handle-create-connection signal from
+ * the DBus interface. This signal is triggered by a request from a client
+ * to create a new connection with the daemon. This requires a few things
+ * be done:
+ * - Create a new ID (uint64) for the connection.
+ * - Create a new Connection object.
+ * - Build up a dbus response to the client with their connection ID and
+ *   FD for the client side of the connection.
+ * - Send the response message back to the client.
+ * - Insert the new Connection object into the ConnectionManager.
+ */
+static gboolean
+on_handle_create_connection (TctiTabrmd            *skeleton,
+                             GDBusMethodInvocation *invocation,
+                             gpointer               user_data)
+{
+    IpcFrontendDbus *self = NULL;
+    Connection *connection = NULL;
+    gint client_fd = 0;
+    GVariant *response, *response_tuple;
+    guint64 id = 0;
+    UNUSED_PARAM(skeleton);
+
+    self = IPC_FRONTEND_DBUS (user_data);
+    ipc_frontend_init_guard (IPC_FRONTEND (user_data));
+    connection = create_connection_from_invocation (self,
+                                                    invocation,
+                                                    SOCK_STREAM,
+                                                    &id,
+                                                    &client_fd);
+    /* error already returned to caller over dbus */
+    if (connection == NULL) {
+        return TRUE;
+    }
+    /* prepare tuple variant for response message */
+    response = g_variant_new_uint64 (id);
+    response_tuple = g_variant_new_tuple (&response, 1);
+    return_connection_to_invocation (self,
+                                     invocation,
+                                     connection,
+                                     response_tuple,
+                                     client_fd);
+    g_object_unref (connection);
+
+    return TRUE;
+}
+/*
+ * This is a signal handler for the handle-create-connection-with-transport
+ * signal from the DBus interface. It's the same as
+ * on_handle_create_connection except that the client requests the
+ * transport used for the connection. If the requested transport isn't
+ * supported we fall back to TABRMD_TRANSPORT_STREAM. The transport
+ * actually used is returned to the client along with the connection ID.
+ * TABRMD_TRANSPORT_MUX connections use a SOCK_SEQPACKET socket carrying
+ * frames for many logical channels.
+ */
+static gboolean
+on_handle_create_connection_with_transport (TctiTabrmd            *skeleton,
+                                            GDBusMethodInvocation *invocation,
+                                            guint                  transport,
+                                            gpointer               user_data)
+{
+    IpcFrontendDbus *self = NULL;
+    Connection *connection = NULL;
+    gint client_fd = 0, socket_type;
+    GVariant *response [2], *response_tuple;
+    guint64 id = 0;
+    UNUSED_PARAM(skeleton);
+
+    self = IPC_FRONTEND_DBUS (user_data);
+    ipc_frontend_init_guard (IPC_FRONTEND (user_data));
+    switch (transport) {
+    case TABRMD_TRANSPORT_SEQPACKET:
+    case TABRMD_TRANSPORT_MUX:
+        socket_type = SOCK_SEQPACKET;
+        break;
+    default:
+        g_debug ("%s: unsupported transport %u, using stream", __func__,
+                 transport);
+        transport = TABRMD_TRANSPORT_STREAM;
+        /* fall through */
+    case TABRMD_TRANSPORT_STREAM:
+        socket_type = SOCK_STREAM;
+        break;
+    }
+    connection = create_connection_from_invocation (self,
+                                                    invocation,
+                                                    socket_type,
+                                                    &id,
+                                                    &client_fd);
+    /* error already returned to caller over dbus */
+    if (connection == NULL) {
+        return TRUE;
+    }
+    if (transport == TABRMD_TRANSPORT_MUX) {
+        connection_set_mux (connection);
+    }
+    response [0] = g_variant_new_uint64 (id);
+    response [1] = g_variant_new_uint32 (transport);
+    response_tuple = g_variant_new_tuple (response, 2);
+    return_connection_to_invocation (self,
+                                     invocation,
+                                     connection,
+                                     response_tuple,
+                                     client_fd);
     g_object_unref (connection);
 
     return TRUE;
@@ -500,6 +724,55 @@ on_handle_set_locality (TctiTabrmd            *skeleton,
 
     return TRUE;
 }
+/*
+ * This is a signal handler for the handle-get-statistics signal from the
+ * Tabrmd DBus interface. It returns a snapshot of the counters and gauges
+ * maintained by the processing pipeline as a dictionary mapping the name
+ * of each statistic to its value.
+ */
+static gboolean
+on_handle_get_statistics (TctiTabrmd            *skeleton,
+                          GDBusMethodInvocation *invocation,
+                          gpointer               user_data)
+{
+    g_debug ("%s", __func__);
+    ipc_frontend_init_guard (IPC_FRONTEND (user_data));
+    tcti_tabrmd_complete_get_statistics (skeleton,
+                                         invocation,
+                                         tabrmd_stats_to_variant ());
+
+    return TRUE;
+}
+/*
+ * This is a signal handler for the handle-get-flight-recorder signal from
+ * the Tabrmd DBus interface. It returns a dump of the flight recorder in
+ * the format described in tabrmd-recorder.h.
+ */
+static gboolean
+on_handle_get_flight_recorder (TctiTabrmd            *skeleton,
+                               GDBusMethodInvocation *invocation,
+                               gpointer               user_data)
+{
+    GBytes *dump;
+
+    g_debug ("%s", __func__);
+    ipc_frontend_init_guard (IPC_FRONTEND (user_data));
+    dump = tabrmd_recorder_snapshot ();
+    if (dump == NULL) {
+        g_dbus_method_invocation_return_error (invocation,
+                                               TABRMD_ERROR,
+                                               TABRMD_ERROR_NOT_IMPLEMENTED,
+                                               "flight recorder is disabled");
+        return TRUE;
+    }
+    tcti_tabrmd_complete_get_flight_recorder (
+        skeleton,
+        invocation,
+        g_variant_new_from_bytes (G_VARIANT_TYPE_BYTESTRING, dump, TRUE));
+    g_bytes_unref (dump);
+
+    return TRUE;
+}
 /* D-Bus signal handlers */
 /*
  * This is a signal handler of type GBusAcquiredCallback. It is registered
@@ -521,8 +794,8 @@ on_bus_acquired (GDBusConnection *connection,
  * 'name' is acquired on the requested bus. It does 3 things:
  * - Obtains a new TctiTabrmd instance and stores a reference in
  *   the 'user_data' parameter (which is a reference to the gmain_data_t.
- * - Register signal handlers for the CreateConnection, Cancel and
- *   SetLocality signals.
+ * - Register signal handlers for the CreateConnection, Cancel,
+ *   SetLocality, GetStatistics and GetFlightRecorder signals.
  * - Export the TctiTabrmd interface (skeleton) on the DBus
  *   connection.
  */
@@ -545,6 +818,10 @@ on_name_acquired (GDBusConnection *connection,
                       "handle-create-connection",
                       G_CALLBACK (on_handle_create_connection),
                       user_data);
+    g_signal_connect (self->skeleton,
+                      "handle-create-connection-with-transport",
+                      G_CALLBACK (on_handle_create_connection_with_transport),
+                      user_data);
     g_signal_connect (self->skeleton,
                       "handle-cancel",
                       G_CALLBACK (on_handle_cancel),
@@ -553,6 +830,14 @@ on_name_acquired (GDBusConnection *connection,
                       "handle-set-locality",
                       G_CALLBACK (on_handle_set_locality),
                       user_data);
+    g_signal_connect (self->skeleton,
+                      "handle-get-statistics",
+                      G_CALLBACK (on_handle_get_statistics),
+                      user_data);
+    g_signal_connect (self->skeleton,
+                      "handle-get-flight-recorder",
+                      G_CALLBACK (on_handle_get_flight_recorder),
+                      user_data);
     ret = g_dbus_interface_skeleton_export (
         G_DBUS_INTERFACE_SKELETON (self->skeleton),
         connection,
@@ -638,6 +923,8 @@ ipc_frontend_dbus_connect (IpcFrontendDbus *self,
     g_return_if_fail (IS_IPC_FRONTEND_DBUS (self));
 
     frontend->init_mutex = init_mutex;
+    /* nothing can take from the pool until we own the bus name */
+    ipc_frontend_dbus_pool_refill (self);
     g_dbus_proxy_new_for_bus (self->bus_type,
                               G_DBUS_PROXY_FLAGS_DO_NOT_LOAD_PROPERTIES,
                               NULL,
@@ -37,6 +37,10 @@ typedef struct _IpcFrontendDbus
     GDBusProxy        *dbus_daemon_proxy;
     Random            *random;
     TctiTabrmd        *skeleton;
+    /* pool of pre-built connection resources, see ipc-frontend-dbus.c */
+    guint              connection_pool_size;
+    GQueue             connection_pool;
+    guint              connection_pool_refill_id;
 } IpcFrontendDbus;
 
 #define TYPE_IPC_FRONTEND_DBUS             (ipc_frontend_dbus_get_type       ())
@@ -51,10 +55,16 @@ IpcFrontendDbus* ipc_frontend_dbus_new        (GBusType           bus_type,
                                                gchar const       *bus_name,
                                                ConnectionManager *connection_manager,
                                                guint              max_trans,
-                                               Random            *random);
+                                               Random            *random,
+                                               guint              pool_size);
 void             ipc_frontend_dbus_connect    (IpcFrontendDbus   *self,
                                                GMutex            *init_mutex);
 void             ipc_frontend_dbus_disconnect (IpcFrontendDbus   *self);
+/*
+ * The following are private functions. They are exposed here for unit
+ * testing. Do not call these from anywhere else.
+ */
+gboolean         ipc_frontend_dbus_pool_refill (gpointer          user_data);
 
 G_END_DECLS
 #endif /* IPC_FRONTEND_DBUS_H */
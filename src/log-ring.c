@@ -0,0 +1,157 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#include <glib.h>
+#include <string.h>
+
+#include "log-ring.h"
+
+/*
+ * Create a ring with room for 'size' messages. 'size' must be a power of
+ * two.
+ */
+log_ring_t*
+log_ring_new (guint size)
+{
+    log_ring_t *ring;
+    guint i;
+
+    g_return_val_if_fail (size > 0 && (size & (size - 1)) == 0, NULL);
+    ring = g_new0 (log_ring_t, 1);
+    ring->entries = g_new0 (log_ring_entry_t, size);
+    ring->mask = size - 1;
+    for (i = 0; i < size; ++i) {
+        ring->entries [i].sequence = i;
+    }
+    return ring;
+}
+void
+log_ring_free (log_ring_t *ring)
+{
+    log_ring_entry_t *entry;
+
+    if (ring != NULL) {
+        /* free the messages on the heap */
+        while ((entry = log_ring_peek (ring)) != NULL) {
+            log_ring_release (ring, entry);
+        }
+        g_free (ring->entries);
+        g_free (ring);
+    }
+}
+/*
+ * Claim the next free slot and copy the message into it, or into a copy
+ * on the heap if it doesn't fit. Returns FALSE if the ring is full and
+ * the message was dropped.
+ */
+gboolean
+log_ring_push (log_ring_t *ring,
+               const gchar *domain,
+               GLogLevelFlags level,
+               const gchar *message)
+{
+    log_ring_entry_t *entry;
+    guint64 pos, seq;
+    gint64 diff;
+    gsize length;
+
+    pos = __atomic_load_n (&ring->enqueue_pos, __ATOMIC_RELAXED);
+    for (;;) {
+        entry = &ring->entries [pos & ring->mask];
+        seq = __atomic_load_n (&entry->sequence, __ATOMIC_ACQUIRE);
+        diff = (gint64)(seq - pos);
+        if (diff == 0) {
+            /* on failure 'pos' is updated to the current enqueue_pos */
+            if (__atomic_compare_exchange_n (&ring->enqueue_pos,
+                                             &pos,
+                                             pos + 1,
+                                             TRUE,
+                                             __ATOMIC_RELAXED,
+                                             __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        } else if (diff < 0) {
+            /* the consumer hasn't released this slot from the last lap */
+            __atomic_add_fetch (&ring->dropped, 1, __ATOMIC_RELAXED);
+            return FALSE;
+        } else {
+            pos = __atomic_load_n (&ring->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+    entry->level = level;
+    g_strlcpy (entry->domain, domain != NULL ? domain : "",
+               sizeof (entry->domain));
+    if (message == NULL) {
+        message = "";
+    }
+    length = strlen (message);
+    if (length < sizeof (entry->message_inline)) {
+        memcpy (entry->message_inline, message, length + 1);
+        entry->message = entry->message_inline;
+    } else {
+        entry->message = g_strndup (message, length);
+    }
+    __atomic_store_n (&entry->sequence, pos + 1, __ATOMIC_RELEASE);
+    return TRUE;
+}
+/*
+ * Return the oldest message without removing it or NULL if the ring is
+ * empty. Only the consumer may call this. The entry stays valid until it's
+ * passed to log_ring_release.
+ */
+log_ring_entry_t*
+log_ring_peek (log_ring_t *ring)
+{
+    log_ring_entry_t *entry;
+    guint64 pos;
+
+    pos = __atomic_load_n (&ring->dequeue_pos, __ATOMIC_RELAXED);
+    entry = &ring->entries [pos & ring->mask];
+    if (__atomic_load_n (&entry->sequence, __ATOMIC_ACQUIRE) != pos + 1) {
+        return NULL;
+    }
+    return entry;
+}
+/*
+ * Hand the slot of the entry returned by log_ring_peek back to producers
+ * for their next lap around the ring.
+ */
+void
+log_ring_release (log_ring_t *ring,
+                  log_ring_entry_t *entry)
+{
+    guint64 pos = __atomic_load_n (&ring->dequeue_pos, __ATOMIC_RELAXED);
+
+    if (entry->message != entry->message_inline) {
+        g_free (entry->message);
+    }
+    entry->message = NULL;
+
+    __atomic_store_n (&ring->dequeue_pos, pos + 1, __ATOMIC_RELAXED);
+    __atomic_store_n (&entry->sequence, pos + ring->mask + 1, __ATOMIC_RELEASE);
+}
+gboolean
+log_ring_is_empty (log_ring_t *ring)
+{
+    return log_ring_peek (ring) == NULL;
+}
+/* The number of messages dropped because the ring was full. */
+guint64
+log_ring_dropped (log_ring_t *ring)
+{
+    return __atomic_load_n (&ring->dropped, __ATOMIC_RELAXED);
+}
+/*
+ * The number of messages pushed and released so far. Once
+ * log_ring_released reaches a value returned by log_ring_pushed every
+ * message pushed before that call has been consumed.
+ */
+guint64
+log_ring_pushed (log_ring_t *ring)
+{
+    return __atomic_load_n (&ring->enqueue_pos, __ATOMIC_ACQUIRE);
+}
+guint64
+log_ring_released (log_ring_t *ring)
+{
+    return __atomic_load_n (&ring->dequeue_pos, __ATOMIC_ACQUIRE);
+}
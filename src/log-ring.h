@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef LOG_RING_H
+#define LOG_RING_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define LOG_RING_SIZE_DEFAULT 1024
+#define LOG_RING_DOMAIN_MAX   32
+#define LOG_RING_MESSAGE_INLINE 256
+
+/*
+ * A bounded ring of log messages. Any number of threads may push messages
+ * without taking a lock, a single consumer pops them. Each slot carries a
+ * sequence number that tells producers and the consumer whose turn it is:
+ * slot 'i' is free for the producer claiming position 'pos' when its
+ * sequence is 'pos' and holds a message for the consumer when it's
+ * 'pos + 1'. Messages pushed while the ring is full are dropped and
+ * counted. Messages shorter than LOG_RING_MESSAGE_INLINE are copied into
+ * the slot, longer ones are copied to the heap and freed when the slot is
+ * released so they're never cut short.
+ */
+typedef struct {
+    guint64         sequence;
+    GLogLevelFlags  level;
+    gchar           domain [LOG_RING_DOMAIN_MAX];
+    gchar          *message;
+    gchar           message_inline [LOG_RING_MESSAGE_INLINE];
+} log_ring_entry_t;
+
+typedef struct {
+    guint64           enqueue_pos;
+    guint64           dequeue_pos;
+    guint64           dropped;
+    guint64           mask;
+    log_ring_entry_t *entries;
+} log_ring_t;
+
+log_ring_t*        log_ring_new      (guint              size);
+void               log_ring_free     (log_ring_t        *ring);
+gboolean           log_ring_push     (log_ring_t        *ring,
+                                      const gchar       *domain,
+                                      GLogLevelFlags     level,
+                                      const gchar       *message);
+log_ring_entry_t*  log_ring_peek     (log_ring_t        *ring);
+void               log_ring_release  (log_ring_t        *ring,
+                                      log_ring_entry_t  *entry);
+gboolean           log_ring_is_empty (log_ring_t        *ring);
+guint64            log_ring_dropped  (log_ring_t        *ring);
+guint64            log_ring_pushed   (log_ring_t        *ring);
+guint64            log_ring_released (log_ring_t        *ring);
+
+G_END_DECLS
+#endif /* LOG_RING_H */
@@ -3,10 +3,54 @@
  * Copyright (c) 2017, Intel Corporation
  * All rights reserved.
  */
+#include <inttypes.h>
 #include <stdlib.h>
 #include <syslog.h>
 #include "util.h"
+#include "log-ring.h"
 #include "logging.h"
+#include "tabrmd-stats.h"
+
+/*
+ * Levels written directly by the logging thread rather than through the
+ * LogRing: the process may be about to abort. Messages already in the
+ * LogRing are written first, see async_logger_flush.
+ */
+#define LOG_LEVEL_SYNC (G_LOG_FLAG_FATAL | G_LOG_FLAG_RECURSION | \
+                        G_LOG_LEVEL_ERROR | G_LOG_LEVEL_CRITICAL)
+/*
+ * Messages are handed from the logging threads to a dedicated logger
+ * thread through a LogRing so that a burst of messages can't stall the
+ * pipeline threads on the syslog socket or stdout. The logger thread
+ * passes them on to 'sink'. Producers only take the mutex to wake the
+ * logger thread when it has gone to sleep on an empty ring. The logger
+ * thread broadcasts 'drained' each time it has emptied the ring.
+ */
+typedef struct {
+    log_ring_t *ring;
+    GLogFunc    sink;
+    guint       handler_id;
+    GThread    *thread;
+    GMutex      mutex;
+    GCond       cond;
+    GCond       drained;
+    gint        sleeping;
+    gint        stop;
+} async_logger_t;
+
+/* the longest a critical or error message waits for the ring to empty */
+#define LOG_FLUSH_TIMEOUT_USEC (G_USEC_PER_SEC / 10)
+
+static async_logger_t async_logger;
+/* called after each critical or error message is written */
+static gchar* (*critical_hook) (void);
+
+/* set_logger may replace the sink while the logger thread is running */
+static inline GLogFunc
+async_logger_sink (async_logger_t *logger)
+{
+    return __atomic_load_n (&logger->sink, __ATOMIC_ACQUIRE);
+}
 
 /**
  * This function that implements the GLogFunc prototype. It is intended
@@ -69,8 +113,225 @@ get_enabled_log_levels (void)
         return LOG_LEVEL_DEFAULT;
     }
 }
+/*
+ * Report messages dropped since the last report straight to the sink.
+ */
+static void
+async_logger_report_dropped (async_logger_t *logger,
+                             guint64 *reported)
+{
+    guint64 dropped = log_ring_dropped (logger->ring);
+    gchar *message;
+
+    if (dropped == *reported) {
+        return;
+    }
+    message = g_strdup_printf ("logger overloaded: dropped %" PRIu64
+                               " messages", dropped - *reported);
+    async_logger_sink (logger) (NULL, G_LOG_LEVEL_WARNING, message, NULL);
+    g_free (message);
+    *reported = dropped;
+}
+static gpointer
+async_logger_thread (gpointer data)
+{
+    async_logger_t *logger = (async_logger_t*)data;
+    log_ring_entry_t *entry;
+    guint64 reported = 0;
+    gboolean stop;
+
+    do {
+        while ((entry = log_ring_peek (logger->ring)) != NULL) {
+            async_logger_sink (logger) (
+                entry->domain [0] != '\0' ? entry->domain : NULL,
+                entry->level,
+                entry->message,
+                NULL);
+            log_ring_release (logger->ring, entry);
+        }
+        async_logger_report_dropped (logger, &reported);
+        /*
+         * Producers check 'sleeping' after pushing a message so either we
+         * see their message here or they see that we need waking.
+         */
+        g_mutex_lock (&logger->mutex);
+        g_cond_broadcast (&logger->drained);
+        __atomic_store_n (&logger->sleeping, TRUE, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence (__ATOMIC_SEQ_CST);
+        while (__atomic_load_n (&logger->sleeping, __ATOMIC_SEQ_CST) &&
+               !__atomic_load_n (&logger->stop, __ATOMIC_SEQ_CST) &&
+               log_ring_is_empty (logger->ring))
+        {
+            g_cond_wait (&logger->cond, &logger->mutex);
+        }
+        __atomic_store_n (&logger->sleeping, FALSE, __ATOMIC_SEQ_CST);
+        stop = __atomic_load_n (&logger->stop, __ATOMIC_SEQ_CST);
+        g_mutex_unlock (&logger->mutex);
+    } while (!stop || !log_ring_is_empty (logger->ring));
+
+    return NULL;
+}
+/*
+ * Wait for the logger thread to write out the messages in the LogRing so
+ * a critical or error message written directly doesn't overtake the
+ * warnings that led up to it. The wait is bounded so a sink that has
+ * stopped accepting messages can't hold up the caller for long. The
+ * logger thread can't wait for itself.
+ */
+static void
+async_logger_flush (async_logger_t *logger)
+{
+    guint64 target = log_ring_pushed (logger->ring);
+    gint64 end_time;
+
+    if (__atomic_load_n (&logger->thread, __ATOMIC_ACQUIRE) ==
+        g_thread_self ())
+    {
+        return;
+    }
+    end_time = g_get_monotonic_time () + LOG_FLUSH_TIMEOUT_USEC;
+    g_mutex_lock (&logger->mutex);
+    while (log_ring_released (logger->ring) < target &&
+           !__atomic_load_n (&logger->stop, __ATOMIC_SEQ_CST))
+    {
+        g_cond_signal (&logger->cond);
+        if (!g_cond_wait_until (&logger->drained, &logger->mutex, end_time)) {
+            break;
+        }
+    }
+    g_mutex_unlock (&logger->mutex);
+}
+/*
+ * The GLogFunc installed by set_logger. Once the logger thread is stopped
+ * messages are written directly.
+ */
+void
+async_log_handler (const char     *log_domain,
+                   GLogLevelFlags  log_level,
+                   const char     *message,
+                   gpointer        user_data)
+{
+    async_logger_t *logger = (async_logger_t*)user_data;
+    gchar* (*hook) (void);
+    gchar *hook_message;
+
+    if (log_level & LOG_LEVEL_SYNC ||
+        __atomic_load_n (&logger->stop, __ATOMIC_ACQUIRE))
+    {
+        if (log_level & LOG_LEVEL_SYNC) {
+            async_logger_flush (logger);
+        }
+        async_logger_sink (logger) (log_domain, log_level, message, NULL);
+        hook = __atomic_load_n (&critical_hook, __ATOMIC_ACQUIRE);
+        if (hook != NULL &&
+            log_level & (G_LOG_LEVEL_ERROR | G_LOG_LEVEL_CRITICAL))
+        {
+            /*
+             * A message logged from inside this handler would be caught as
+             * a recursion and never reach the sink, so the hook hands its
+             * message back to be written directly.
+             */
+            hook_message = hook ();
+            if (hook_message != NULL) {
+                async_logger_sink (logger) (log_domain,
+                                            G_LOG_LEVEL_WARNING,
+                                            hook_message,
+                                            NULL);
+                g_free (hook_message);
+            }
+        }
+        return;
+    }
+    if (!tabrmd_log_enabled (log_level & G_LOG_LEVEL_MASK)) {
+        return;
+    }
+    if (!log_ring_push (logger->ring, log_domain, log_level, message)) {
+        tabrmd_stats_inc (TABRMD_STATS_LOG_DROPPED);
+        return;
+    }
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+    if (__atomic_exchange_n (&logger->sleeping, FALSE, __ATOMIC_SEQ_CST)) {
+        g_mutex_lock (&logger->mutex);
+        g_cond_signal (&logger->cond);
+        g_mutex_unlock (&logger->mutex);
+    }
+}
+/*
+ * Write out everything in the LogRing and stop the logger thread. This is
+ * registered with atexit so messages logged just before the process exits
+ * aren't lost.
+ */
+void
+async_logger_stop (void)
+{
+    async_logger_t *logger = &async_logger;
+
+    if (logger->thread == NULL) {
+        return;
+    }
+    g_mutex_lock (&logger->mutex);
+    __atomic_store_n (&logger->stop, TRUE, __ATOMIC_SEQ_CST);
+    g_cond_signal (&logger->cond);
+    g_mutex_unlock (&logger->mutex);
+    g_thread_join (logger->thread);
+    __atomic_store_n (&logger->thread, NULL, __ATOMIC_RELEASE);
+}
+/*
+ * Route messages at 'levels' from the default domain through the logger
+ * thread to 'sink'. The thread is created on the first call, later calls
+ * replace the sink and levels.
+ */
+static gint
+async_logger_start (GLogLevelFlags levels,
+                    GLogFunc sink)
+{
+    async_logger_t *logger = &async_logger;
+
+    if (logger->handler_id != 0) {
+        g_log_remove_handler (NULL, logger->handler_id);
+    }
+    __atomic_store_n (&logger->sink, sink, __ATOMIC_RELEASE);
+    if (logger->thread == NULL) {
+        logger->ring = log_ring_new (LOG_RING_SIZE_DEFAULT);
+        g_mutex_init (&logger->mutex);
+        g_cond_init (&logger->cond);
+        g_cond_init (&logger->drained);
+        logger->thread = g_thread_new ("logger", async_logger_thread, logger);
+        atexit (async_logger_stop);
+    }
+    logger->handler_id = g_log_set_handler (NULL,
+                                            levels | G_LOG_FLAG_FATAL |
+                                            G_LOG_FLAG_RECURSION,
+                                            async_log_handler,
+                                            logger);
+    return 0;
+}
+/*
+ * Register a function to be called after a critical or error message has
+ * been written, before g_error aborts. The hook must not log: it returns a
+ * message to be written to the sink as a warning, or NULL.
+ */
+void
+set_critical_hook (gchar* (*hook) (void))
+{
+    __atomic_store_n (&critical_hook, hook, __ATOMIC_RELEASE);
+}
+gint tabrmd_log_levels = -1;
+/*
+ * Cache the enabled log levels for tabrmd_log_enabled. Threads racing to
+ * do this all store the same value.
+ */
+gint
+tabrmd_log_levels_init (void)
+{
+    gint levels = get_enabled_log_levels ();
+
+    g_atomic_int_set (&tabrmd_log_levels, levels);
+    return levels;
+}
 /**
- * Convenience function to set logger for GLog.
+ * Convenience function to set logger for GLog. Both loggers write from
+ * the logger thread, see async_log_handler.
  */
 gint
 set_logger (gchar *name)
@@ -79,16 +340,13 @@ set_logger (gchar *name)
 
     if (g_strcmp0 (name, "syslog") == 0) {
         enabled_log_levels = get_enabled_log_levels ();
-        g_log_set_handler (NULL,
-                           enabled_log_levels | G_LOG_FLAG_FATAL | \
-                           G_LOG_FLAG_RECURSION,
-                           syslog_log_handler,
-                           NULL);
-        return 0;
+        return async_logger_start ((GLogLevelFlags)enabled_log_levels,
+                                   syslog_log_handler);
     } else if (g_strcmp0 (name, "stdout") == 0) {
-        /* stdout is the default for g_log, nothing to do but return 0 */
+        /* stdout is the default for g_log, it does its own filtering */
         g_info ("logging to stdout");
-        return 0;
+        return async_logger_start ((GLogLevelFlags)LOG_LEVEL_ALL,
+                                   g_log_default_handler);
     }
     return -1;
 }
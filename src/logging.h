@@ -20,11 +20,72 @@
 #define LOG_LEVEL_ALL     (LOG_LEVEL_DEFAULT | G_LOG_LEVEL_MESSAGE | \
                            G_LOG_LEVEL_INFO | G_LOG_LEVEL_DEBUG)
 
+/*
+ * Debug logging is compiled out entirely when configured with
+ * --disable-debug-log. The arguments to the debug macros below are still
+ * type checked but the compiler discards them. Info messages are kept.
+ */
+#ifdef DISABLE_DEBUG_LOG
+#define TABRMD_DEBUG_LOG 0
+#else
+#define TABRMD_DEBUG_LOG 1
+#endif
+/*
+ * The levels enabled by G_MESSAGES_DEBUG, cached so that checking them is
+ * a single load. -1 until first used.
+ */
+extern gint tabrmd_log_levels;
+
+gint tabrmd_log_levels_init (void);
+
+static inline gboolean
+tabrmd_log_enabled (GLogLevelFlags level)
+{
+    gint levels = g_atomic_int_get (&tabrmd_log_levels);
+
+    if (levels < 0) {
+        levels = tabrmd_log_levels_init ();
+    }
+    return (levels & level) != 0;
+}
+/*
+ * Use these in place of g_debug / g_info / g_debug_bytes on the command
+ * processing path. When the level isn't enabled the arguments aren't
+ * evaluated and no message is formatted.
+ */
+#define tabrmd_debug(...) \
+    do { \
+        if (TABRMD_DEBUG_LOG && tabrmd_log_enabled (G_LOG_LEVEL_DEBUG)) \
+            g_debug (__VA_ARGS__); \
+    } while (0)
+#define tabrmd_info(...) \
+    do { \
+        if (tabrmd_log_enabled (G_LOG_LEVEL_INFO)) \
+            g_info (__VA_ARGS__); \
+    } while (0)
+#define tabrmd_debug_bytes(byte_array, array_size, width, indent) \
+    do { \
+        if (TABRMD_DEBUG_LOG && tabrmd_log_enabled (G_LOG_LEVEL_DEBUG)) \
+            g_debug_bytes (byte_array, array_size, width, indent); \
+    } while (0)
+#define tabrmd_debug_tpma_cc(tpma_cc) \
+    do { \
+        if (TABRMD_DEBUG_LOG && tabrmd_log_enabled (G_LOG_LEVEL_DEBUG)) \
+            g_debug_tpma_cc (tpma_cc); \
+    } while (0)
+
 void
 syslog_log_handler (const char     *log_domain,
                     GLogLevelFlags  log_level,
                     const char     *message,
                     gpointer        log_config_list);
+void
+async_log_handler (const char     *log_domain,
+                   GLogLevelFlags  log_level,
+                   const char     *message,
+                   gpointer        user_data);
+void async_logger_stop (void);
+void set_critical_hook (gchar* (*hook) (void));
 int get_enabled_log_levels (void);
 gint set_logger (gchar *name);
 #endif /* LOGGING_H */
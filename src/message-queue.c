@@ -9,34 +9,118 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "logging.h"
 #include "message-queue.h"
 #include "util.h"
 
 G_DEFINE_TYPE (MessageQueue, message_queue, G_TYPE_OBJECT);
 
+/*
+ * The queue is an intrusive MPSC list in the style of Dmitry Vyukov's
+ * non-blocking queue. Producers publish a node with a single atomic
+ * exchange on 'head' followed by a store to the previous node's 'next'
+ * pointer. The consumer owns 'tail' exclusively. The embedded 'stub' node
+ * keeps the list non-empty so neither side ever needs a lock.
+ */
+static void
+message_queue_push_node (MessageQueue     *self,
+                         MessageQueueNode *node)
+{
+    MessageQueueNode *prev;
+
+    __atomic_store_n (&node->next, NULL, __ATOMIC_RELAXED);
+    prev = __atomic_exchange_n (&self->head, node, __ATOMIC_ACQ_REL);
+    __atomic_store_n (&prev->next, node, __ATOMIC_RELEASE);
+}
+/*
+ * Remove the oldest node from the queue. This must only be called by the
+ * consumer. NULL is returned if the queue is empty or if a producer is
+ * part way through publishing a node. In the latter case the producer will
+ * wake the consumer once the node is reachable.
+ */
+static MessageQueueNode*
+message_queue_pop_node (MessageQueue *self)
+{
+    MessageQueueNode *tail = self->tail;
+    MessageQueueNode *next = __atomic_load_n (&tail->next, __ATOMIC_ACQUIRE);
+    MessageQueueNode *head;
+
+    if (tail == &self->stub) {
+        if (next == NULL) {
+            return NULL;
+        }
+        self->tail = next;
+        tail = next;
+        next = __atomic_load_n (&next->next, __ATOMIC_ACQUIRE);
+    }
+    if (next != NULL) {
+        self->tail = next;
+        return tail;
+    }
+    head = __atomic_load_n (&self->head, __ATOMIC_ACQUIRE);
+    if (tail != head) {
+        return NULL;
+    }
+    message_queue_push_node (self, &self->stub);
+    next = __atomic_load_n (&tail->next, __ATOMIC_ACQUIRE);
+    if (next != NULL) {
+        self->tail = next;
+        return tail;
+    }
+    return NULL;
+}
+/*
+ * Free a node returned by message_queue_pop_node and hand the object it
+ * carried back to the caller.
+ */
+static GObject*
+message_queue_node_take (MessageQueueNode *node)
+{
+    GObject *obj = node->object;
+
+    g_free (node);
+    return obj;
+}
 /**
- * The init function is a noop but it's required by the G_DEFINE_TYPE
- * macro.
+ * Set up the empty list: both ends point at the stub node.
  */
 static void
 message_queue_init (MessageQueue *self)
 {
-    self->queue = g_async_queue_new_full (g_object_unref);
+    self->stub.next = NULL;
+    self->stub.object = NULL;
+    self->head = &self->stub;
+    self->tail = &self->stub;
+    self->parked = 0;
+    g_mutex_init (&self->mutex);
+    g_cond_init (&self->cond);
 }
 /*
- * To finalize the MessageQueue we need only to unref the internal
- * GAsyncQueue object.
+ * To dispose of the MessageQueue we drop the reference held on each
+ * object still in the queue.
  */
 static void
 message_queue_dispose (GObject *obj)
 {
     MessageQueue *message_queue = MESSAGE_QUEUE (obj);
+    MessageQueueNode *node;
 
-    g_clear_pointer (&message_queue->queue, g_async_queue_unref);
+    while ((node = message_queue_pop_node (message_queue)) != NULL) {
+        g_object_unref (message_queue_node_take (node));
+    }
     G_OBJECT_CLASS (message_queue_parent_class)->dispose (obj);
 }
+static void
+message_queue_finalize (GObject *obj)
+{
+    MessageQueue *message_queue = MESSAGE_QUEUE (obj);
+
+    g_cond_clear (&message_queue->cond);
+    g_mutex_clear (&message_queue->mutex);
+    G_OBJECT_CLASS (message_queue_parent_class)->finalize (obj);
+}
 /**
- * Boilerplate GObject class init with custom dispose function.
+ * Boilerplate GObject class init with custom dispose / finalize functions.
  */
 static void
 message_queue_class_init (MessageQueueClass *klass)
@@ -44,6 +128,7 @@ message_queue_class_init (MessageQueueClass *klass)
     GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
     object_class->dispose = message_queue_dispose;
+    object_class->finalize = message_queue_finalize;
 }
 /**
  * Allocate a new message_queue_t object.
@@ -57,31 +142,85 @@ message_queue_new ()
     return MESSAGE_QUEUE (g_object_new (TYPE_MESSAGE_QUEUE, NULL));
 }
 /**
- * Enqueue a blob in the blob_queue_t.
- * This function is a thin wrapper around the GQueue. When we enqueue blobs
- * we push them to the head of the queue.
+ * Enqueue an object in the MessageQueue. This is safe to call from any
+ * number of threads concurrently. The lock is only taken to wake the
+ * consumer when it has parked on an empty queue.
  */
 void
 message_queue_enqueue (MessageQueue  *message_queue,
                        GObject       *object)
 {
+    MessageQueueNode *node;
+
     g_assert (message_queue != NULL);
-    g_debug ("%s", __func__);
-    g_object_ref (object);
-    g_async_queue_push (message_queue->queue, object);
+    tabrmd_debug ("%s", __func__);
+    node = g_new (MessageQueueNode, 1);
+    node->object = g_object_ref (object);
+    message_queue_push_node (message_queue, node);
+    /* pairs with the fence in message_queue_dequeue */
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+    if (__atomic_load_n (&message_queue->parked, __ATOMIC_RELAXED)) {
+        g_mutex_lock (&message_queue->mutex);
+        g_cond_signal (&message_queue->cond);
+        g_mutex_unlock (&message_queue->mutex);
+    }
 }
 /**
- * Dequeue a blob from the blob_queue_t.
- * This function is a thin wrapper around the GQueue. When we dequeue blobs
- * we pop them from the tail of the queue.
+ * Dequeue an object from the MessageQueue, blocking until one is
+ * available. Objects are returned in the order they were enqueued. Only
+ * a single thread may dequeue from a given MessageQueue.
+ * The caller owns the reference to the returned object.
  */
 GObject*
 message_queue_dequeue (MessageQueue *message_queue)
 {
-    GObject *obj;
+    MessageQueueNode *node;
+    guint i;
 
     g_assert (message_queue != NULL);
-    g_debug ("%s", __func__);
-    obj = g_async_queue_pop (message_queue->queue);
-    return obj;
+    tabrmd_debug ("%s", __func__);
+    for (i = 0; i < MESSAGE_QUEUE_SPIN_COUNT; ++i) {
+        node = message_queue_pop_node (message_queue);
+        if (node != NULL) {
+            return message_queue_node_take (node);
+        }
+    }
+    g_mutex_lock (&message_queue->mutex);
+    __atomic_store_n (&message_queue->parked, 1, __ATOMIC_RELAXED);
+    /* pairs with the fence in message_queue_enqueue */
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+    while ((node = message_queue_pop_node (message_queue)) == NULL) {
+        g_cond_wait (&message_queue->cond, &message_queue->mutex);
+    }
+    __atomic_store_n (&message_queue->parked, 0, __ATOMIC_RELAXED);
+    g_mutex_unlock (&message_queue->mutex);
+
+    return message_queue_node_take (node);
+}
+/**
+ * Dequeue up to 'max' objects from the MessageQueue into the 'objs' array.
+ * This blocks until at least one object is available and then takes every
+ * other object already in the queue without blocking again. A burst of
+ * messages is thereby drained with a single wakeup.
+ * Returns the number of objects written to 'objs'. The caller owns a
+ * reference to each of them.
+ */
+guint
+message_queue_dequeue_batch (MessageQueue *message_queue,
+                             GObject      *objs[],
+                             guint         max)
+{
+    MessageQueueNode *node;
+    guint count = 0;
+
+    g_assert (message_queue != NULL);
+    g_assert (objs != NULL && max > 0);
+    objs [count++] = message_queue_dequeue (message_queue);
+    while (count < max &&
+           (node = message_queue_pop_node (message_queue)) != NULL) {
+        objs [count++] = message_queue_node_take (node);
+    }
+    tabrmd_debug ("%s: dequeued %u objects", __func__, count);
+
+    return count;
 }
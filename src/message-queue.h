@@ -11,13 +11,37 @@
 
 G_BEGIN_DECLS
 
+/*
+ * Number of times the consumer polls an empty queue before it parks on
+ * the condition variable.
+ */
+#define MESSAGE_QUEUE_SPIN_COUNT 128
+
+typedef struct _MessageQueueNode MessageQueueNode;
+struct _MessageQueueNode {
+    MessageQueueNode *next;
+    GObject          *object;
+};
+
 typedef struct _MessageQueueClass {
     GObjectClass parent;
 } MessageQueueClass;
 
+/*
+ * The MessageQueue is a multi-producer / single-consumer queue. Any number
+ * of threads may enqueue concurrently without taking a lock. Only a single
+ * thread may dequeue. The consumer spins briefly on an empty queue before
+ * parking on 'cond'. Producers only touch 'mutex' when the consumer is
+ * parked.
+ */
 typedef struct _MessageQueue {
-    GObject       parent_instance;
-    GAsyncQueue  *queue;
+    GObject           parent_instance;
+    MessageQueueNode *head;
+    MessageQueueNode *tail;
+    MessageQueueNode  stub;
+    gint              parked;
+    GMutex            mutex;
+    GCond             cond;
 } MessageQueue;
 
 #define TYPE_MESSAGE_QUEUE           (message_queue_get_type             ())
@@ -32,6 +56,9 @@ MessageQueue*   message_queue_new          (void);
 void        message_queue_enqueue          (MessageQueue   *message_queue,
                                             GObject        *obj);
 GObject*    message_queue_dequeue          (MessageQueue   *message_queue);
+guint       message_queue_dequeue_batch    (MessageQueue   *message_queue,
+                                            GObject        *objs[],
+                                            guint           max);
 
 G_END_DECLS
 #endif /* MESSAGE_QUEUE_H */
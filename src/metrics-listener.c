@@ -0,0 +1,272 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#include <errno.h>
+#include <gio/gunixsocketaddress.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "metrics-listener.h"
+#include "tabrmd-stats.h"
+#include "util.h"
+
+G_DEFINE_TYPE (MetricsListener, metrics_listener, G_TYPE_OBJECT);
+
+enum {
+    PROP_0,
+    PROP_PATH,
+    N_PROPERTIES
+};
+static GParamSpec *obj_properties [N_PROPERTIES] = { NULL, };
+/*
+ * GObject property setter.
+ */
+static void
+metrics_listener_set_property (GObject        *object,
+                               guint           property_id,
+                               GValue const   *value,
+                               GParamSpec     *pspec)
+{
+    MetricsListener *self = METRICS_LISTENER (object);
+
+    switch (property_id) {
+    case PROP_PATH:
+        g_free (self->path);
+        self->path = g_value_dup_string (value);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+/*
+ * GObject property getter.
+ */
+static void
+metrics_listener_get_property (GObject     *object,
+                               guint        property_id,
+                               GValue      *value,
+                               GParamSpec  *pspec)
+{
+    MetricsListener *self = METRICS_LISTENER (object);
+
+    switch (property_id) {
+    case PROP_PATH:
+        g_value_set_string (value, self->path);
+        break;
+    default:
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+        break;
+    }
+}
+static void
+metrics_listener_init (MetricsListener *self)
+{
+    UNUSED_PARAM (self);
+}
+/*
+ * Stop accepting clients and remove the socket from the file system.
+ */
+static void
+metrics_listener_dispose (GObject *object)
+{
+    MetricsListener *self = METRICS_LISTENER (object);
+
+    if (self->service != NULL) {
+        g_socket_service_stop (self->service);
+        g_socket_listener_close (G_SOCKET_LISTENER (self->service));
+        g_clear_object (&self->service);
+        if (unlink (self->path) != 0) {
+            g_warning ("%s: failed to remove metrics socket %s: %s",
+                       __func__, self->path, strerror (errno));
+        }
+    }
+    G_OBJECT_CLASS (metrics_listener_parent_class)->dispose (object);
+}
+static void
+metrics_listener_finalize (GObject *object)
+{
+    MetricsListener *self = METRICS_LISTENER (object);
+
+    g_clear_pointer (&self->path, g_free);
+    G_OBJECT_CLASS (metrics_listener_parent_class)->finalize (object);
+}
+static void
+metrics_listener_class_init (MetricsListenerClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    if (metrics_listener_parent_class == NULL)
+        metrics_listener_parent_class = g_type_class_peek_parent (klass);
+    object_class->dispose = metrics_listener_dispose;
+    object_class->finalize = metrics_listener_finalize;
+    object_class->get_property = metrics_listener_get_property;
+    object_class->set_property = metrics_listener_set_property;
+
+    obj_properties [PROP_PATH] =
+        g_param_spec_string ("path",
+                             "socket path",
+                             "Path to the UNIX socket metrics are served on",
+                             NULL,
+                             G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+    g_object_class_install_properties (object_class,
+                                       N_PROPERTIES,
+                                       obj_properties);
+}
+MetricsListener*
+metrics_listener_new (const gchar *path)
+{
+    return METRICS_LISTENER (g_object_new (TYPE_METRICS_LISTENER,
+                                           "path", path,
+                                           NULL));
+}
+/*
+ * Build the response to a client request. Clients that send an HTTP
+ * request (anything starting with "GET ") get an HTTP/1.0 response so
+ * the socket can be scraped through an HTTP proxy or with
+ * 'curl --unix-socket'. Anything else gets the bare metrics.
+ */
+gchar*
+metrics_listener_response (const gchar *request,
+                           gsize        size)
+{
+    gchar *body, *response;
+
+    body = tabrmd_stats_to_prometheus ();
+    if (size < 4 || strncmp (request, "GET ", 4) != 0) {
+        return body;
+    }
+    response = g_strdup_printf ("HTTP/1.0 200 OK\r\n"
+                                "Content-Type: text/plain; version=0.0.4\r\n"
+                                "Content-Length: %zu\r\n"
+                                "Connection: close\r\n"
+                                "\r\n%s",
+                                strlen (body),
+                                body);
+    g_free (body);
+
+    return response;
+}
+/*
+ * Returns TRUE once enough of the request has been read to answer it: an
+ * HTTP request is read up to the blank line ending its headers. Anything
+ * that can't be the start of "GET " isn't HTTP and is answered right away
+ * instead of waiting for the client to send more or time out.
+ */
+static gboolean
+metrics_listener_request_complete (const gchar *request,
+                                   gsize        size)
+{
+    if (size == 0) {
+        return FALSE;
+    }
+    if (strncmp (request, "GET ", MIN (size, 4)) != 0) {
+        return TRUE;
+    }
+    return strstr (request, "\r\n\r\n") != NULL;
+}
+/*
+ * Handler for the 'run' signal from the GThreadedSocketService. This runs
+ * on a thread from the service's pool so it's free to block. We read the
+ * request until it's complete (see metrics_listener_request_complete), or
+ * until the client closes its end, stops talking, or sends too much. Then
+ * the response is written and the connection closed. A client that stops
+ * talking holds its thread for up to METRICS_LISTENER_TIMEOUT seconds so
+ * the pool has METRICS_LISTENER_WORKERS threads.
+ */
+static gboolean
+metrics_listener_on_run (GThreadedSocketService *service,
+                         GSocketConnection      *connection,
+                         GObject                *source_object,
+                         gpointer                user_data)
+{
+    GInputStream *istream;
+    GOutputStream *ostream;
+    GError *error = NULL;
+    gchar request [METRICS_LISTENER_REQUEST_MAX + 1] = { 0, };
+    gchar *response;
+    gsize size = 0;
+    gssize ret;
+    UNUSED_PARAM (service);
+    UNUSED_PARAM (source_object);
+    UNUSED_PARAM (user_data);
+
+    g_socket_set_timeout (g_socket_connection_get_socket (connection),
+                          METRICS_LISTENER_TIMEOUT);
+    istream = g_io_stream_get_input_stream (G_IO_STREAM (connection));
+    ostream = g_io_stream_get_output_stream (G_IO_STREAM (connection));
+    while (size < METRICS_LISTENER_REQUEST_MAX &&
+           !metrics_listener_request_complete (request, size))
+    {
+        ret = g_input_stream_read (istream,
+                                   &request [size],
+                                   METRICS_LISTENER_REQUEST_MAX - size,
+                                   NULL,
+                                   NULL);
+        if (ret <= 0) {
+            break;
+        }
+        size += (gsize)ret;
+    }
+    response = metrics_listener_response (request, size);
+    if (!g_output_stream_write_all (ostream,
+                                    response,
+                                    strlen (response),
+                                    NULL,
+                                    NULL,
+                                    &error))
+    {
+        g_debug ("%s: failed to write metrics: %s", __func__, error->message);
+        g_clear_error (&error);
+    }
+    g_free (response);
+    g_io_stream_close (G_IO_STREAM (connection), NULL, NULL);
+
+    return TRUE;
+}
+/*
+ * Bind the UNIX socket and start serving clients. A socket left behind at
+ * 'path' by a previous instance is removed first but any other kind of
+ * file is left alone and reported as an error.
+ */
+gboolean
+metrics_listener_start (MetricsListener *self,
+                        GError         **error)
+{
+    GSocketAddress *address;
+    struct stat st;
+    gboolean ret;
+
+    g_return_val_if_fail (IS_METRICS_LISTENER (self), FALSE);
+    g_return_val_if_fail (self->service == NULL, FALSE);
+
+    if (lstat (self->path, &st) == 0) {
+        if (!S_ISSOCK (st.st_mode)) {
+            g_set_error (error, G_IO_ERROR, G_IO_ERROR_EXISTS,
+                         "%s exists and is not a socket", self->path);
+            return FALSE;
+        }
+        unlink (self->path);
+    }
+    self->service = g_threaded_socket_service_new (METRICS_LISTENER_WORKERS);
+    address = g_unix_socket_address_new (self->path);
+    ret = g_socket_listener_add_address (G_SOCKET_LISTENER (self->service),
+                                         address,
+                                         G_SOCKET_TYPE_STREAM,
+                                         G_SOCKET_PROTOCOL_DEFAULT,
+                                         NULL,
+                                         NULL,
+                                         error);
+    g_object_unref (address);
+    if (!ret) {
+        g_clear_object (&self->service);
+        return FALSE;
+    }
+    g_signal_connect (self->service,
+                      "run",
+                      G_CALLBACK (metrics_listener_on_run),
+                      self);
+    g_socket_service_start (self->service);
+    g_info ("%s: serving metrics on %s", __func__, self->path);
+
+    return TRUE;
+}
@@ -0,0 +1,47 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef METRICS_LISTENER_H
+#define METRICS_LISTENER_H
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+/* max number of bytes read from a client looking for the end of a request */
+#define METRICS_LISTENER_REQUEST_MAX 1024
+/* seconds to wait for a client to send its request */
+#define METRICS_LISTENER_TIMEOUT 1
+/* max number of clients served at the same time */
+#define METRICS_LISTENER_WORKERS 4
+
+typedef struct _MetricsListenerClass {
+    GObjectClass      parent;
+} MetricsListenerClass;
+/*
+ * The MetricsListener serves the statistics kept by the daemon in the
+ * Prometheus text exposition format on a UNIX socket. Each client gets a
+ * single response after which the connection is closed.
+ */
+typedef struct _MetricsListener {
+    GObject           parent_instance;
+    gchar            *path;
+    GSocketService   *service;
+} MetricsListener;
+
+#define TYPE_METRICS_LISTENER              (metrics_listener_get_type   ())
+#define METRICS_LISTENER(obj)              (G_TYPE_CHECK_INSTANCE_CAST ((obj),   TYPE_METRICS_LISTENER, MetricsListener))
+#define METRICS_LISTENER_CLASS(klass)      (G_TYPE_CHECK_CLASS_CAST    ((klass), TYPE_METRICS_LISTENER, MetricsListenerClass))
+#define IS_METRICS_LISTENER(obj)           (G_TYPE_CHECK_INSTANCE_TYPE ((obj),   TYPE_METRICS_LISTENER))
+#define IS_METRICS_LISTENER_CLASS(klass)   (G_TYPE_CHECK_CLASS_TYPE    ((klass), TYPE_METRICS_LISTENER))
+#define METRICS_LISTENER_GET_CLASS(obj)    (G_TYPE_INSTANCE_GET_CLASS  ((obj),   TYPE_METRICS_LISTENER, MetricsListenerClass))
+
+GType            metrics_listener_get_type   (void);
+MetricsListener* metrics_listener_new        (const gchar      *path);
+gboolean         metrics_listener_start      (MetricsListener  *self,
+                                              GError          **error);
+gchar*           metrics_listener_response   (const gchar      *request,
+                                              gsize             size);
+
+G_END_DECLS
+#endif /* METRICS_LISTENER_H */
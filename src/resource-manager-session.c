@@ -2,12 +2,14 @@
 #include <glib.h>
 #include <inttypes.h>
 
+#include "logging.h"
 #include "tpm2.h"
 #include "resource-manager.h"
 #include "resource-manager-session.h"
 #include "session-list.h"
 #include "session-entry.h"
 #include "tabrmd.h"
+#include "tabrmd-stats.h"
 #include "tpm2-command.h"
 #include "tpm2-header.h"
 #include "tpm2-response.h"
@@ -48,6 +50,7 @@ load_session (ResourceManager *resmgr,
                    PRIx32, __func__, rc);
         goto out;
     }
+    tabrmd_stats_inc (TABRMD_STATS_CONTEXT_LOAD);
     session_entry_set_state (entry, SESSION_ENTRY_LOADED);
 out:
     g_clear_object (&cmd);
@@ -68,8 +71,8 @@ flush_session (ResourceManager *resmgr,
     TPM2_HANDLE handle = session_entry_get_handle (entry);
     TSS2_RC rc;
 
-    g_debug ("%s: flushing stale SessionEntry with handle: 0x%08" PRIx32,
-             __func__, handle);
+    tabrmd_debug ("%s: flushing stale SessionEntry with handle: 0x%08" PRIx32,
+                  __func__, handle);
     rc = tpm2_context_flush (resmgr->tpm2, handle);
     session_list_remove (resmgr->session_list, entry);
     if (rc != TSS2_RC_SUCCESS) {
@@ -117,13 +120,14 @@ save_session (ResourceManager *resmgr,
     }
     rc = tpm2_response_get_code (resp);
     if (rc != TSS2_RC_SUCCESS) {
-        g_info ("%s: failed to ContextSave SessionEntry, got RC 0x%" PRIx32,
-                __func__, rc);
+        tabrmd_info ("%s: failed to ContextSave SessionEntry, got RC 0x%" PRIx32,
+                     __func__, rc);
         goto out;
     }
     session_entry_set_context (entry,
                                &tpm2_response_get_buffer (resp)[TPM_HEADER_SIZE],
                                tpm2_response_get_size (resp) - TPM_HEADER_SIZE);
+    tabrmd_stats_inc (TABRMD_STATS_CONTEXT_SAVE);
     session_entry_set_state (entry, SESSION_ENTRY_SAVED_RM);
 out:
     g_clear_object (&cmd);
@@ -147,8 +151,8 @@ regap_session (ResourceManager *resmgr,
     g_assert_nonnull (entry);
 
     state = session_entry_get_state (entry);
-    g_debug ("%s: swapping SessionEntry in state \"%s\"", __func__,
-             session_entry_state_to_str (state));
+    tabrmd_debug ("%s: swapping SessionEntry in state \"%s\"", __func__,
+                  session_entry_state_to_str (state));
     if (state == SESSION_ENTRY_SAVED_CLIENT ||
         state == SESSION_ENTRY_SAVED_CLIENT_CLOSED ||
         state == SESSION_ENTRY_SAVED_RM)
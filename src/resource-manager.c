@@ -21,12 +21,17 @@
 #include "sink-interface.h"
 #include "source-interface.h"
 #include "tabrmd.h"
+#include "tabrmd-probes.h"
+#include "tabrmd-stats.h"
+#include "tabrmd-timeline.h"
 #include "tpm2-header.h"
 #include "tpm2-command.h"
 #include "tpm2-response.h"
 #include "util.h"
 
 #define MAX_ABANDONED 4
+/* maximum number of messages taken from the in_queue per wakeup */
+#define RESOURCE_MANAGER_BATCH_MAX 16
 
 static void resource_manager_sink_interface_init   (gpointer g_iface);
 static void resource_manager_source_interface_init (gpointer g_iface);
@@ -72,13 +77,13 @@ resource_manager_virt_to_phys (ResourceManager *resmgr,
     context = handle_map_entry_get_context (entry);
     if (handle_map_entry_get_phandle(entry)) {
         phandle = handle_map_entry_get_phandle(entry);
-        g_debug ("remembered phandle: 0x%" PRIx32, phandle);
+        tabrmd_debug ("remembered phandle: 0x%" PRIx32, phandle);
         tpm2_command_set_handle (command, phandle, handle_number);
         return TSS2_RC_SUCCESS;
     }
 
     rc = tpm2_context_load (resmgr->tpm2, context, &phandle);
-    g_debug ("loaded phandle: 0x%" PRIx32, phandle);
+    tabrmd_debug ("loaded phandle: 0x%" PRIx32, phandle);
     if (rc == TSS2_RC_SUCCESS) {
         handle_map_entry_set_phandle (entry, phandle);
         tpm2_command_set_handle (command, phandle, handle_number);
@@ -99,16 +104,16 @@ resource_manager_load_transient (ResourceManager  *resmgr,
     Connection  *connection;
     TSS2_RC       rc = TSS2_RC_SUCCESS;
 
-    g_debug ("processing TPM2_HT_TRANSIENT: 0x%" PRIx32, handle);
+    tabrmd_debug ("processing TPM2_HT_TRANSIENT: 0x%" PRIx32, handle);
     connection = tpm2_command_get_connection (command);
     map = connection_get_trans_map (connection);
     g_object_unref (connection);
-    g_debug ("handle 0x%" PRIx32 " is virtual TPM2_HT_TRANSIENT, "
-             "loading", handle);
+    tabrmd_debug ("handle 0x%" PRIx32 " is virtual TPM2_HT_TRANSIENT, "
+                  "loading", handle);
     /* we don't unref the entry since we're adding it to the entry_slist below */
     entry = handle_map_vlookup (map, handle);
     if (entry) {
-        g_debug ("mapped virtual handle 0x%" PRIx32 " to entry", handle);
+        tabrmd_debug ("mapped virtual handle 0x%" PRIx32 " to entry", handle);
     } else {
         g_warning ("No HandleMapEntry for vhandle: 0x%" PRIx32, handle);
         goto out;
@@ -141,7 +146,7 @@ regap_session_callback (gpointer data_entry,
     regap_session_data_t *data = (regap_session_data_t*)data_user;
     SessionEntry *entry  = SESSION_ENTRY (data_entry);
 
-    g_debug ("%s: SessionEntry", __func__);
+    tabrmd_debug ("%s: SessionEntry", __func__);
     if (data->ret == TRUE) {
         data->ret = regap_session (data->resmgr, entry);
     } else {
@@ -164,18 +169,19 @@ handle_rc (ResourceManager *resmgr,
     };
     gboolean ret;
 
-    g_debug ("%s: handling  RC 0x%" PRIx32, __func__, rc);
+    tabrmd_debug ("%s: handling  RC 0x%" PRIx32, __func__, rc);
     switch (rc) {
     case TPM2_RC_CONTEXT_GAP:
-        g_debug ("%s: handling TPM2_RC_CONTEXT_GAP", __func__);
+        tabrmd_debug ("%s: handling TPM2_RC_CONTEXT_GAP", __func__);
+        tabrmd_stats_inc (TABRMD_STATS_REGAP);
         session_list_foreach (resmgr->session_list,
                               regap_session_callback,
                               &data);
         ret = data.ret;
         break;
     default:
-        g_debug ("%s: Unable to recover gracefully from RC 0x%" PRIx32,
-                 __func__, rc);
+        tabrmd_debug ("%s: Unable to recover gracefully from RC 0x%" PRIx32,
+                      __func__, rc);
         ret = TRUE;
         break;
     }
@@ -206,12 +212,12 @@ resource_manager_load_session_from_handle (ResourceManager *resmgr,
     session_entry = session_list_lookup_handle (resmgr->session_list,
                                                 handle);
     if (session_entry == NULL) {
-        g_debug ("no session with handle 0x%08" PRIx32 " known to "
-                 "ResourceManager.", handle);
+        tabrmd_debug ("no session with handle 0x%08" PRIx32 " known to "
+                      "ResourceManager.", handle);
         goto out;
     }
-    g_debug ("%s: mapped session handle 0x%08" PRIx32 " to "
-             "SessionEntry", __func__, handle);
+    tabrmd_debug ("%s: mapped session handle 0x%08" PRIx32 " to "
+                  "SessionEntry", __func__, handle);
     entry_conn = session_entry_get_connection (session_entry);
     if (command_conn != entry_conn) {
         g_warning ("%s: Connection from Tpm2Command and SessionEntry do not "
@@ -243,8 +249,8 @@ resource_manager_load_session_from_handle (ResourceManager *resmgr,
         }
     }
     if (will_flush) {
-        g_debug ("%s: will_flush: removing SessionEntry from SessionList",
-                 __func__);
+        tabrmd_debug ("%s: will_flush: removing SessionEntry from SessionList",
+                      __func__);
         session_list_remove (resmgr->session_list, session_entry);
     }
 out:
@@ -284,8 +290,8 @@ resource_manager_load_auth_callback (gpointer auth_offset_ptr,
                                                    will_flush);
         break;
     default:
-        g_debug ("not loading object with handle: 0x%08" PRIx32 " from "
-                 "command auth area: not a session", handle);
+        tabrmd_debug ("not loading object with handle: 0x%08" PRIx32 " from "
+                      "command auth area: not a session", handle);
         break;
     }
     g_clear_object (&connection);
@@ -306,7 +312,7 @@ resource_manager_load_handles (ResourceManager *resmgr,
     size_t        i, handle_count = TPM2_COMMAND_MAX_HANDLES;
     gboolean      handle_ret;
 
-    g_debug ("%s", __func__);
+    tabrmd_debug ("%s", __func__);
     if (!resmgr || !command) {
         g_warning ("%s: received NULL parameter.", __func__);
         return RM_RC (TSS2_BASE_RC_GENERAL_FAILURE);
@@ -315,12 +321,12 @@ resource_manager_load_handles (ResourceManager *resmgr,
     if (handle_ret == FALSE) {
         g_error ("Unable to get handles from command");
     }
-    g_debug ("%s: for %zu handles in command handle area",
-             __func__, handle_count);
+    tabrmd_debug ("%s: for %zu handles in command handle area",
+                  __func__, handle_count);
     for (i = 0; i < handle_count; ++i) {
         switch (handles [i] >> TPM2_HR_SHIFT) {
         case TPM2_HT_TRANSIENT:
-            g_debug ("processing TPM2_HT_TRANSIENT: 0x%" PRIx32, handles [i]);
+            tabrmd_debug ("processing TPM2_HT_TRANSIENT: 0x%" PRIx32, handles [i]);
             rc = resource_manager_load_transient (resmgr,
                                                   command,
                                                   loaded_transients,
@@ -329,8 +335,8 @@ resource_manager_load_handles (ResourceManager *resmgr,
             break;
         case TPM2_HT_HMAC_SESSION:
         case TPM2_HT_POLICY_SESSION:
-            g_debug ("processing TPM2_HT_HMAC_SESSION or "
-                     "TPM2_HT_POLICY_SESSION: 0x%" PRIx32, handles [i]);
+            tabrmd_debug ("processing TPM2_HT_HMAC_SESSION or "
+                          "TPM2_HT_POLICY_SESSION: 0x%" PRIx32, handles [i]);
             connection = tpm2_command_get_connection (command);
             rc = resource_manager_load_session_from_handle (resmgr,
                                                             connection,
@@ -341,7 +347,7 @@ resource_manager_load_handles (ResourceManager *resmgr,
             break;
         }
     }
-    g_debug ("%s: end", __func__);
+    tabrmd_debug ("%s: end", __func__);
     g_clear_object (&connection);
 
     return rc;
@@ -362,19 +368,19 @@ resource_manager_flushsave_context (gpointer data_entry,
     TPM2_HANDLE      phandle;
     TSS2_RC         rc = TSS2_RC_SUCCESS;
 
-    g_debug ("%s: for entry", __func__);
+    tabrmd_debug ("%s: for entry", __func__);
     if (resmgr == NULL || entry == NULL)
         g_error ("%s: passed NULL parameter", __func__);
     phandle = handle_map_entry_get_phandle (entry);
-    g_debug ("%s: phandle: 0x%" PRIx32, __func__, phandle);
+    tabrmd_debug ("%s: phandle: 0x%" PRIx32, __func__, phandle);
     switch (phandle >> TPM2_HR_SHIFT) {
     case TPM2_HT_TRANSIENT:
         if (!handle_map_entry_get_phandle (entry)) {
-            g_debug ("phandle for vhandle 0x%" PRIx32 " was already flushed.",
-                handle_map_entry_get_vhandle (entry));
+            tabrmd_debug ("phandle for vhandle 0x%" PRIx32 " was already flushed.",
+                     handle_map_entry_get_vhandle (entry));
             break;
         }
-        g_debug ("%s: handle is transient, saving context", __func__);
+        tabrmd_debug ("%s: handle is transient, saving context", __func__);
         context = handle_map_entry_get_context (entry);
         rc = tpm2_context_saveflush (resmgr->tpm2,
                                               phandle,
@@ -404,9 +410,9 @@ save_session_callback (gpointer data_entry,
     Tpm2Response *resp = NULL;
     TSS2_RC rc;
 
-    g_debug ("%s: SessionEntry", __func__);
+    tabrmd_debug ("%s: SessionEntry", __func__);
     if (session_entry_get_state (entry) != SESSION_ENTRY_LOADED) {
-        g_debug ("%s: cannot save SessionEntry, not loaded", __func__);
+        tabrmd_debug ("%s: cannot save SessionEntry, not loaded", __func__);
         return;
     }
     resp = save_session (resmgr, entry);
@@ -434,23 +440,23 @@ static void
 dump_command (Tpm2Command *command)
 {
     g_assert (command != NULL);
-    g_debug ("Tpm2Command");
-    g_debug_bytes (tpm2_command_get_buffer (command),
-                   tpm2_command_get_size (command),
-                   16,
-                   4);
-    g_debug_tpma_cc (tpm2_command_get_attributes (command));
+    tabrmd_debug ("Tpm2Command");
+    tabrmd_debug_bytes (tpm2_command_get_buffer (command),
+                        tpm2_command_get_size (command),
+                        16,
+                        4);
+    tabrmd_debug_tpma_cc (tpm2_command_get_attributes (command));
 }
 static void
 dump_response (Tpm2Response *response)
 {
     g_assert (response != NULL);
-    g_debug ("Tpm2Response");
-    g_debug_bytes (tpm2_response_get_buffer (response),
-                   tpm2_response_get_size (response),
-                   16,
-                   4);
-    g_debug_tpma_cc (tpm2_response_get_attributes (response));
+    tabrmd_debug ("Tpm2Response");
+    tabrmd_debug_bytes (tpm2_response_get_buffer (response),
+                        tpm2_response_get_size (response),
+                        16,
+                        4);
+    tabrmd_debug_tpma_cc (tpm2_response_get_attributes (response));
 }
 /*
  * This function performs the special processing required when a client
@@ -472,7 +478,7 @@ resource_manager_save_context_session (ResourceManager *resmgr,
     TPM2_HANDLE handle = 0;
 
     handle = tpm2_command_get_handle (command, 0);
-    g_debug ("save_context for session handle: 0x%" PRIx32, handle);
+    tabrmd_debug ("save_context for session handle: 0x%" PRIx32, handle);
     entry = session_list_lookup_handle (resmgr->session_list, handle);
     if (entry == NULL) {
         g_warning ("Client attempting to save unknown session.");
@@ -487,10 +493,10 @@ resource_manager_save_context_session (ResourceManager *resmgr,
     }
     session_entry_set_state (entry, SESSION_ENTRY_SAVED_CLIENT);
     response = tpm2_response_new_context_save (conn_cmd, entry);
-    g_debug ("%s: Tpm2Response from TPM2_ContextSave", __func__);
-    g_debug_bytes (tpm2_response_get_buffer (response),
-                   tpm2_response_get_size (response),
-                   16, 4);
+    tabrmd_debug ("%s: Tpm2Response from TPM2_ContextSave", __func__);
+    tabrmd_debug_bytes (tpm2_response_get_buffer (response),
+                        tpm2_response_get_size (response),
+                        16, 4);
 out:
     g_clear_object (&conn_cmd);
     g_clear_object (&conn_entry);
@@ -527,14 +533,14 @@ resource_manager_save_context (ResourceManager *resmgr,
 {
     TPM2_HANDLE handle = tpm2_command_get_handle (command, 0);
 
-    g_debug ("%s", __func__);
+    tabrmd_debug ("%s", __func__);
     switch (handle >> TPM2_HR_SHIFT) {
     case TPM2_HT_HMAC_SESSION:
     case TPM2_HT_POLICY_SESSION:
         return resource_manager_save_context_session (resmgr, command);
     default:
-        g_debug ("save_context: not virtualizing TPM2_CC_ContextSave for "
-                 "handles: 0x%08" PRIx32, handle);
+        tabrmd_debug ("save_context: not virtualizing TPM2_CC_ContextSave for "
+                      "handles: 0x%08" PRIx32, handle);
         break;
     }
 
@@ -564,12 +570,12 @@ resource_manager_load_context_session (ResourceManager *resmgr,
     SessionEntry *entry = NULL;
     Tpm2Response *response = NULL;
 
-    g_debug ("%s", __func__);
+    tabrmd_debug ("%s", __func__);
     entry = session_list_lookup_context_client (resmgr->session_list,
                                                 &tpm2_command_get_buffer (command) [TPM_HEADER_SIZE],
                                                 tpm2_command_get_size (command) - TPM_HEADER_SIZE);
     if (entry == NULL) {
-        g_debug ("%s: Tpm2Command contains unknown TPMS_CONTEXT.", __func__);
+        tabrmd_debug ("%s: Tpm2Command contains unknown TPMS_CONTEXT.", __func__);
         goto out;
     }
     conn_cmd = tpm2_command_get_connection (command);
@@ -580,11 +586,11 @@ resource_manager_load_context_session (ResourceManager *resmgr,
         }
     }
     session_entry_set_state (entry, SESSION_ENTRY_SAVED_RM);
-    g_debug ("%s: SessionEntry context savedHandle: 0x%08" PRIx32, __func__,
-             session_entry_get_handle (entry));
+    tabrmd_debug ("%s: SessionEntry context savedHandle: 0x%08" PRIx32, __func__,
+                  session_entry_get_handle (entry));
     response = tpm2_response_new_context_load (conn_cmd, entry);
 out:
-    g_debug ("%s: returning Tpm2Response", __func__);
+    tabrmd_debug ("%s: returning Tpm2Response", __func__);
     g_clear_object (&conn_cmd);
     g_clear_object (&conn_entry);
     g_clear_object (&entry);
@@ -619,8 +625,8 @@ resource_manager_load_context (ResourceManager *resmgr,
     case TPM2_HT_POLICY_SESSION:
         return resource_manager_load_context_session (resmgr, command);
     default:
-        g_debug ("%s: not virtualizing TPM2_ContextLoad for "
-                 "handles: 0x%08" PRIx32, __func__, tpms_context.savedHandle);
+        tabrmd_debug ("%s: not virtualizing TPM2_ContextLoad for "
+                      "handles: 0x%08" PRIx32, __func__, tpms_context.savedHandle);
         break;
     }
 
@@ -668,16 +674,18 @@ resource_manager_flush_context (ResourceManager *resmgr,
         g_object_unref (connection);
         goto out;
     }
-    g_debug ("resource_manager_flush_context handle: 0x%" PRIx32, handle);
+    tabrmd_debug ("resource_manager_flush_context handle: 0x%" PRIx32, handle);
     handle_type = handle >> TPM2_HR_SHIFT;
     switch (handle_type) {
     case TPM2_HT_TRANSIENT:
-        g_debug ("handle is TPM2_HT_TRANSIENT, virtualizing");
+        tabrmd_debug ("handle is TPM2_HT_TRANSIENT, virtualizing");
         connection = tpm2_command_get_connection (command);
         map = connection_get_trans_map (connection);
         entry = handle_map_vlookup (map, handle);
         if (entry != NULL) {
-            handle_map_remove (map, handle);
+            if (handle_map_remove (map, handle)) {
+                connection_mux_trans_add (connection, -1);
+            }
             g_object_unref (entry);
             rc = TSS2_RC_SUCCESS;
         } else {
@@ -695,8 +703,8 @@ resource_manager_flush_context (ResourceManager *resmgr,
         break;
     case TPM2_HT_HMAC_SESSION:
     case TPM2_HT_POLICY_SESSION:
-        g_debug ("%s: handle 0x%08" PRIx32 "is a session, removing from "
-                 "SessionList", __func__, handle);
+        tabrmd_debug ("%s: handle 0x%08" PRIx32 "is a session, removing from "
+                      "SessionList", __func__, handle);
         session_list_remove_handle (resmgr->session_list, handle);
         break;
     }
@@ -724,9 +732,10 @@ resource_manager_quota_check (ResourceManager *resmgr,
     case TPM2_CC_LoadExternal:
         connection = tpm2_command_get_connection (command);
         handle_map = connection_get_trans_map (connection);
-        if (handle_map_is_full (handle_map)) {
-            g_info ("%s: Connection has exceeded transient object limit",
-                    __func__);
+        if (handle_map_is_full (handle_map) ||
+            connection_mux_trans_full (connection)) {
+            tabrmd_info ("%s: Connection has exceeded transient object limit",
+                         __func__);
             rc = TSS2_RESMGR_RC_OBJECT_MEMORY;
         }
         break;
@@ -734,7 +743,7 @@ resource_manager_quota_check (ResourceManager *resmgr,
     case TPM2_CC_StartAuthSession:
         connection = tpm2_command_get_connection (command);
         if (session_list_is_full (resmgr->session_list, connection)) {
-            g_info ("%s: Connectionhas exceeded session limit", __func__);
+            tabrmd_info ("%s: Connectionhas exceeded session limit", __func__);
             rc = TSS2_RESMGR_RC_SESSION_MEMORY;
         }
         break;
@@ -760,14 +769,16 @@ remove_entry_from_handle_map (gpointer data_entry,
     TPM2_HT           handle_type = 0;
 
     handle_type = handle >> TPM2_HR_SHIFT;
-    g_debug ("remove_entry_from_handle_map");
+    tabrmd_debug ("remove_entry_from_handle_map");
     switch (handle_type) {
     case TPM2_HT_TRANSIENT:
-        g_debug ("%s: entry is transient, removing from map", __func__);
-        handle_map_remove (map, handle);
+        tabrmd_debug ("%s: entry is transient, removing from map", __func__);
+        if (handle_map_remove (map, handle)) {
+            connection_mux_trans_add (connection, -1);
+        }
         break;
     default:
-        g_debug ("%s: entry not transient, leaving entry alone", __func__);
+        tabrmd_debug ("%s: entry not transient, leaving entry alone", __func__);
         break;
     }
 }
@@ -784,8 +795,8 @@ post_process_loaded_transients (ResourceManager  *resmgr,
 {
     /* if flushed bit is clear we need to flush & save contexts */
     if (!(command_attrs & TPMA_CC_FLUSHED)) {
-        g_debug ("flushsave_context for %" PRIu32 " entries",
-                 g_slist_length (*transient_slist));
+        tabrmd_debug ("flushsave_context for %" PRIu32 " entries",
+                      g_slist_length (*transient_slist));
         g_slist_foreach (*transient_slist,
                         resource_manager_flushsave_context,
                         resmgr);
@@ -794,7 +805,7 @@ post_process_loaded_transients (ResourceManager  *resmgr,
          * if flushed bit is set the transient object entry has been flushed
          * and so we just remove it
          */
-        g_debug ("TPMA_CC flushed bit set");
+        tabrmd_debug ("TPMA_CC flushed bit set");
         g_slist_foreach (*transient_slist,
                          remove_entry_from_handle_map,
                          connection);
@@ -839,8 +850,8 @@ vhandle_iterator_callback (gpointer entry,
     if (vhandle < state->start_handle) {
         return;
     }
-    g_debug ("vhandle_iterator_callback with max_count: %zu and count: %"
-             PRIu32, state->max_count, cap_data->data.handles.count);
+    tabrmd_debug ("vhandle_iterator_callback with max_count: %zu and count: %"
+                  PRIu32, state->max_count, cap_data->data.handles.count);
     /* if we've collected max_count handles set 'more_data' and return */
     if (!(cap_data->data.handles.count < state->max_count)) {
         state->more_data = TRUE;
@@ -897,11 +908,11 @@ get_cap_handles (HandleMap            *map,
     vhandle_list = g_list_sort (vhandle_list, handle_compare);
     g_list_foreach (vhandle_list, vhandle_iterator_callback, &state);
 
-    g_debug ("iterating over %" PRIu32 " vhandles from g_list_foreach",
-             cap_data->data.handles.count);
+    tabrmd_debug ("iterating over %" PRIu32 " vhandles from g_list_foreach",
+                  cap_data->data.handles.count);
     size_t i;
     for (i = 0; i < cap_data->data.handles.count; ++i) {
-        g_debug ("  vhandle: 0x%" PRIx32, cap_data->data.handles.handle [i]);
+        tabrmd_debug ("  vhandle: 0x%" PRIx32, cap_data->data.handles.handle [i]);
     }
 
     return state.more_data;
@@ -992,20 +1003,20 @@ get_cap_post_process (Tpm2Response *resp)
         g_warning ("%s: Failed to unmarshal TPMS_CAPABILITY_DATA", __func__);
         return rc;
     }
-    g_debug ("%s: capability 0x%" PRIx32, __func__, cap_data.capability);
+    tabrmd_debug ("%s: capability 0x%" PRIx32, __func__, cap_data.capability);
     switch (cap_data.capability) {
     case TPM2_CAP_TPM_PROPERTIES:
         for (i = 0; i < cap_data.data.tpmProperties.count; ++i) {
-            g_debug ("%s: property 0x%" PRIx32 ", value 0x%" PRIx32,
-                     __func__,
-                     cap_data.data.tpmProperties.tpmProperty [i].property,
-                     cap_data.data.tpmProperties.tpmProperty [i].value);
+            tabrmd_debug ("%s: property 0x%" PRIx32 ", value 0x%" PRIx32,
+                          __func__,
+                          cap_data.data.tpmProperties.tpmProperty [i].property,
+                          cap_data.data.tpmProperties.tpmProperty [i].value);
             switch (cap_data.data.tpmProperties.tpmProperty [i].property) {
             case TPM2_PT_CONTEXT_GAP_MAX:
-                g_debug ("%s: changing TPM2_PT_CONTEXT_GAP_MAX, from 0x%"
-                         PRIx32 " to UINT32_MAX: 0x%" PRIx32, __func__,
-                         cap_data.data.tpmProperties.tpmProperty [i].value,
-                         UINT32_MAX);
+                tabrmd_debug ("%s: changing TPM2_PT_CONTEXT_GAP_MAX, from 0x%"
+                              PRIx32 " to UINT32_MAX: 0x%" PRIx32, __func__,
+                              cap_data.data.tpmProperties.tpmProperty [i].value,
+                              UINT32_MAX);
                 cap_data.data.tpmProperties.tpmProperty [i].value = UINT32_MAX;
                 break;
             default:
@@ -1051,15 +1062,15 @@ get_cap_gen_response (ResourceManager *resmgr,
     uint8_t *resp_buf;
     Tpm2Response *response = NULL;
 
-    g_debug ("processing TPM2_CC_GetCapability with cap: 0x%" PRIx32
-             " prop: 0x%" PRIx32 " prop_count: 0x%" PRIx32,
-             cap, prop, prop_count);
+    tabrmd_debug ("processing TPM2_CC_GetCapability with cap: 0x%" PRIx32
+                  " prop: 0x%" PRIx32 " prop_count: 0x%" PRIx32,
+                  cap, prop, prop_count);
     switch (cap) {
     case TPM2_CAP_HANDLES:
         handle_type = prop >> TPM2_HR_SHIFT;
         switch (handle_type) {
         case TPM2_HT_TRANSIENT:
-            g_debug ("%s: TPM2_CAP_HANDLES && TPM2_HT_TRANSIENT", __func__);
+            tabrmd_debug ("%s: TPM2_CAP_HANDLES && TPM2_HT_TRANSIENT", __func__);
             connection = tpm2_command_get_connection (command);
             map = connection_get_trans_map (connection);
             more_data = get_cap_handles (map,  prop, prop_count, &cap_data);
@@ -1071,13 +1082,13 @@ get_cap_gen_response (ResourceManager *resmgr,
                                           tpm2_command_get_attributes (command));
             break;
         default:
-            g_debug ("%s: TPM2_CAP_HANDLES not virtualized for handle type: "
-                     "0x%" PRIx32, __func__, handle_type);
+            tabrmd_debug ("%s: TPM2_CAP_HANDLES not virtualized for handle type: "
+                          "0x%" PRIx32, __func__, handle_type);
             break;
         }
         break;
     default:
-        g_debug ("%s: cap 0x%" PRIx32 " not handled", __func__, cap);
+        tabrmd_debug ("%s: cap 0x%" PRIx32 " not handled", __func__, cap);
         break;
     }
 
@@ -1109,20 +1120,20 @@ command_special_processing (ResourceManager *resmgr,
 
     switch (tpm2_command_get_code (command)) {
     case TPM2_CC_FlushContext:
-        g_debug ("processing TPM2_CC_FlushContext");
+        tabrmd_debug ("processing TPM2_CC_FlushContext");
         response = resource_manager_flush_context (resmgr, command);
         break;
     case TPM2_CC_ContextSave:
-        g_debug ("processing TPM2_CC_ContextSave");
+        tabrmd_debug ("processing TPM2_CC_ContextSave");
         response = resource_manager_save_context (resmgr, command);
         break;
     case TPM2_CC_ContextLoad:
-        g_debug ("%s: processing TPM2_CC_ContextLoad", __func__);
+        tabrmd_debug ("%s: processing TPM2_CC_ContextLoad", __func__);
         response = resource_manager_load_context (resmgr, command);
         break;
     case TPM2_CC_GetCapability:
         if (!tpm2_command_has_auths(command)) {
-            g_debug ("processing TPM2_CC_GetCapability");
+            tabrmd_debug ("processing TPM2_CC_GetCapability");
             response = get_cap_gen_response (resmgr, command);
         }
         break;
@@ -1149,17 +1160,16 @@ create_context_mapping_transient (ResourceManager  *resmgr,
     Connection     *connection;
     UNUSED_PARAM(resmgr);
 
-    g_debug ("create_context_mapping_transient");
+    tabrmd_debug ("create_context_mapping_transient");
     phandle = tpm2_response_get_handle (response);
-    g_debug ("  physical handle: 0x%08" PRIx32, phandle);
+    tabrmd_debug ("  physical handle: 0x%08" PRIx32, phandle);
     connection = tpm2_response_get_connection (response);
     handle_map = connection_get_trans_map (connection);
-    g_object_unref (connection);
     vhandle = handle_map_next_vhandle (handle_map);
     if (vhandle == 0) {
         g_error ("vhandle rolled over!");
     }
-    g_debug ("  vhandle:0x%08" PRIx32, vhandle);
+    tabrmd_debug ("  vhandle:0x%08" PRIx32, vhandle);
     handle_entry = handle_map_entry_new (phandle, vhandle);
     if (handle_entry == NULL) {
         g_warning ("failed to create new HandleMapEntry for handle 0x%"
@@ -1167,8 +1177,12 @@ create_context_mapping_transient (ResourceManager  *resmgr,
     }
     *loaded_transient_slist = g_slist_prepend (*loaded_transient_slist,
                                                handle_entry);
-    handle_map_insert (handle_map, vhandle, handle_entry);
+    if (handle_entry != NULL &&
+        handle_map_insert (handle_map, vhandle, handle_entry)) {
+        connection_mux_trans_add (connection, 1);
+    }
     g_object_unref (handle_map);
+    g_object_unref (connection);
     tpm2_response_set_handle (response, vhandle);
 }
 /*
@@ -1211,14 +1225,14 @@ create_context_mapping_session (ResourceManager *resmgr,
     entry = session_list_lookup_handle (resmgr->session_list, handle);
     conn_resp = tpm2_response_get_connection (response);
     if (entry != NULL) {
-        g_debug ("%s: got SessionEntry that's in the SessionList", __func__);
+        tabrmd_debug ("%s: got SessionEntry that's in the SessionList", __func__);
         conn_entry = session_entry_get_connection (entry);
         if (conn_resp != conn_entry) {
             g_warning ("%s: connections do not match!", __func__);
         }
     } else {
-        g_debug ("%s: handle is a session, creating entry for SessionList "
-                 "and SessionList", __func__);
+        tabrmd_debug ("%s: handle is a session, creating entry for SessionList "
+                      "and SessionList", __func__);
         entry = session_entry_new (conn_resp, handle);
         session_entry_set_state (entry, SESSION_ENTRY_LOADED);
         session_list_insert (resmgr->session_list, entry);
@@ -1252,9 +1266,9 @@ resource_manager_create_context_mapping (ResourceManager  *resmgr,
 {
     TPM2_HANDLE       handle;
 
-    g_debug ("%s", __func__);
+    tabrmd_debug ("%s", __func__);
     if (!tpm2_response_has_handle (response)) {
-        g_debug ("response has no handles");
+        tabrmd_debug ("response has no handles");
         return;
     }
     handle = tpm2_response_get_handle (response);
@@ -1267,7 +1281,7 @@ resource_manager_create_context_mapping (ResourceManager  *resmgr,
         create_context_mapping_session (resmgr, response, handle);
         break;
     default:
-        g_debug ("  not creating context for handle: 0x%08" PRIx32, handle);
+        tabrmd_debug ("  not creating context for handle: 0x%08" PRIx32, handle);
         break;
     }
 }
@@ -1286,7 +1300,8 @@ send_command_handle_rc (ResourceManager *resmgr,
     resp = tpm2_send_command (resmgr->tpm2, cmd, &rc);
     rc = tpm2_response_get_code (resp);
     if (rc == TPM2_RC_CONTEXT_GAP) {
-        g_debug ("%s: handling TPM2_RC_CONTEXT_GAP", __func__);
+        tabrmd_debug ("%s: handling TPM2_RC_CONTEXT_GAP", __func__);
+        tabrmd_stats_inc (TABRMD_STATS_REGAP);
         session_list_foreach (resmgr->session_list,
                               regap_session_callback,
                               &data);
@@ -1321,14 +1336,19 @@ resource_manager_process_tpm2_command (ResourceManager   *resmgr,
     TSS2_RC         rc = TSS2_RC_SUCCESS;
     GSList         *transient_slist = NULL;
     TPMA_CC         command_attrs;
+    tabrmd_timeline_t *timeline;
+    gint64          start;
 
+    tpm2_command_stamp (command, TABRMD_STAGE_DEQUEUE);
     command_attrs = tpm2_command_get_attributes (command);
-    g_debug ("%s", __func__);
+    tabrmd_debug ("%s", __func__);
     dump_command (command);
     connection = tpm2_command_get_connection (command);
+    tabrmd_stats_command (tpm2_command_get_code (command));
     /* If executing the command would exceed a per connection quota */
     rc = resource_manager_quota_check (resmgr, command);
     if (rc != TSS2_RC_SUCCESS) {
+        tabrmd_stats_inc (TABRMD_STATS_QUOTA_REJECT);
         response = tpm2_response_new_rc (connection, rc);
         goto send_response;
     }
@@ -1339,13 +1359,16 @@ resource_manager_process_tpm2_command (ResourceManager   *resmgr,
     }
     /* Load objects associated with the handles in the command handle area. */
     if (tpm2_command_get_handle_count (command) > 0) {
+        start = g_get_monotonic_time ();
         resource_manager_load_handles (resmgr,
                                        command,
                                        &transient_slist);
+        tabrmd_stats_observe (TABRMD_STATS_HIST_LOAD_HANDLES,
+                              g_get_monotonic_time () - start);
     }
     /* Load objets associated with the authorizations in the command. */
     if (tpm2_command_has_auths (command)) {
-        g_info ("%s, Processing auths for command", __func__);
+        tabrmd_info ("%s, Processing auths for command", __func__);
         auth_callback_data_t auth_callback_data = {
             .resmgr = resmgr,
             .command = command,
@@ -1354,6 +1377,7 @@ resource_manager_process_tpm2_command (ResourceManager   *resmgr,
                                    resource_manager_load_auth_callback,
                                    &auth_callback_data);
     }
+    tpm2_command_stamp (command, TABRMD_STAGE_LOADED);
     /* Send command and create response object. */
     response = send_command_handle_rc (resmgr, command);
     dump_response (response);
@@ -1362,13 +1386,24 @@ resource_manager_process_tpm2_command (ResourceManager   *resmgr,
                                              response,
                                              &transient_slist);
 send_response:
+    tabrmd_stats_response (tpm2_response_get_code (response));
+    timeline = tpm2_command_get_timeline (command);
+    if (timeline != NULL) {
+        tabrmd_timeline_set_response_code (timeline,
+                                           tpm2_response_get_code (response));
+    }
+    tpm2_response_set_timeline (response, timeline);
     sink_enqueue (resmgr->sink, G_OBJECT (response));
     g_object_unref (response);
     /* save contexts that were previously loaded */
+    start = g_get_monotonic_time ();
     session_list_foreach (resmgr->session_list,
                           save_session_callback,
                           resmgr);
     post_process_loaded_transients (resmgr, &transient_slist, connection, command_attrs);
+    tabrmd_stats_observe (TABRMD_STATS_HIST_SAVE_CONTEXTS,
+                          g_get_monotonic_time () - start);
+    tpm2_command_stamp (command, TABRMD_STAGE_SAVED);
     g_object_unref (connection);
     return;
 }
@@ -1382,15 +1417,15 @@ resource_manager_process_control (ResourceManager *resmgr,
     ControlCode code = control_message_get_code (msg);
     Connection *conn;
 
-    g_debug ("%s", __func__);
+    tabrmd_debug ("%s", __func__);
     switch (code) {
     case CHECK_CANCEL:
         sink_enqueue (resmgr->sink, G_OBJECT (msg));
         return FALSE;
     case CONNECTION_REMOVED:
         conn = CONNECTION (control_message_get_object (msg));
-        g_debug ("%s: received CONNECTION_REMOVED message for connection",
-                 __func__);
+        tabrmd_debug ("%s: received CONNECTION_REMOVED message for connection",
+                      __func__);
         resource_manager_remove_connection (resmgr, conn);
         sink_enqueue (resmgr->sink, G_OBJECT (msg));
         return TRUE;
@@ -1403,35 +1438,45 @@ resource_manager_process_control (ResourceManager *resmgr,
 /**
  * This function acts as a thread. It simply:
  * - Blocks on the in_queue. Then wakes up and
- * - Dequeues a message from the in_queue.
- * - Processes the message (depending on TYPE)
+ * - Dequeues every message waiting in the in_queue (up to
+ *   RESOURCE_MANAGER_BATCH_MAX).
+ * - Processes each message in order (depending on TYPE)
  * - Does it all over again.
+ * Messages dequeued after a CHECK_CANCEL are dropped.
  */
 gpointer
 resource_manager_thread (gpointer data)
 {
     ResourceManager *resmgr = RESOURCE_MANAGER (data);
-    GObject         *obj = NULL;
+    GObject         *objs [RESOURCE_MANAGER_BATCH_MAX] = { NULL, };
+    guint            count, i;
     gboolean done = FALSE;
 
-    g_debug ("resource_manager_thread start");
+    tabrmd_debug ("resource_manager_thread start");
     while (!done) {
-        obj = message_queue_dequeue (resmgr->in_queue);
-        g_debug ("%s: message_queue_dequeue got obj", __func__);
-        if (obj == NULL) {
-            g_debug ("%s: dequeued a null object", __func__);
-            break;
-        }
-        if (IS_TPM2_COMMAND (obj)) {
-            resource_manager_process_tpm2_command (resmgr, TPM2_COMMAND (obj));
-        } else if (IS_CONTROL_MESSAGE (obj)) {
-            gboolean ret =
-                resource_manager_process_control (resmgr, CONTROL_MESSAGE (obj));
-            if (ret == FALSE) {
-                done = TRUE;
+        count = message_queue_dequeue_batch (resmgr->in_queue,
+                                             objs,
+                                             RESOURCE_MANAGER_BATCH_MAX);
+        tabrmd_debug ("%s: message_queue_dequeue_batch got %u objs",
+                      __func__, count);
+        tabrmd_stats_queue (-(gint)count);
+        for (i = 0; i < count; ++i) {
+            if (done) {
+                tabrmd_debug ("%s: dropping message after cancel", __func__);
+            } else if (IS_TPM2_COMMAND (objs [i])) {
+                TABRMD_PROBE_COMMAND (command_dequeue, TPM2_COMMAND (objs [i]));
+                resource_manager_process_tpm2_command (resmgr,
+                                                       TPM2_COMMAND (objs [i]));
+            } else if (IS_CONTROL_MESSAGE (objs [i])) {
+                gboolean ret =
+                    resource_manager_process_control (resmgr,
+                                                      CONTROL_MESSAGE (objs [i]));
+                if (ret == FALSE) {
+                    done = TRUE;
+                }
             }
+            g_object_unref (objs [i]);
         }
-        g_object_unref (obj);
     }
 
     return NULL;
@@ -1445,7 +1490,8 @@ resource_manager_unblock (Thread *self)
     if (resmgr == NULL)
         g_error ("resource_manager_cancel passed NULL ResourceManager");
     msg = control_message_new (CHECK_CANCEL);
-    g_debug ("%s: enqueuing ControlMessage", __func__);
+    tabrmd_debug ("%s: enqueuing ControlMessage", __func__);
+    tabrmd_stats_queue (1);
     message_queue_enqueue (resmgr->in_queue, G_OBJECT (msg));
     g_object_unref (msg);
 }
@@ -1459,7 +1505,12 @@ resource_manager_enqueue (Sink        *sink,
 {
     ResourceManager *resmgr = RESOURCE_MANAGER (sink);
 
-    g_debug ("%s", __func__);
+    tabrmd_debug ("%s", __func__);
+    /* constant false when probes are disabled so the type check goes too */
+    if (TABRMD_PROBE_ENABLED && IS_TPM2_COMMAND (obj)) {
+        TABRMD_PROBE_COMMAND (command_enqueue, TPM2_COMMAND (obj));
+    }
+    tabrmd_stats_queue (1);
     message_queue_enqueue (resmgr->in_queue, obj);
 }
 /**
@@ -1474,7 +1525,7 @@ resource_manager_add_sink (Source *self,
     ResourceManager *resmgr = RESOURCE_MANAGER (self);
     GValue value = G_VALUE_INIT;
 
-    g_debug ("%s", __func__);
+    tabrmd_debug ("%s", __func__);
     g_value_init (&value, G_TYPE_OBJECT);
     g_value_set_object (&value, sink);
     g_object_set_property (G_OBJECT (resmgr), "sink", &value);
@@ -1491,7 +1542,7 @@ resource_manager_set_property (GObject        *object,
 {
     ResourceManager *resmgr = RESOURCE_MANAGER (object);
 
-    g_debug ("%s", __func__);
+    tabrmd_debug ("%s", __func__);
     switch (property_id) {
     case PROP_QUEUE_IN:
         resmgr->in_queue = g_value_get_object (value);
@@ -1531,7 +1582,7 @@ resource_manager_get_property (GObject     *object,
 {
     ResourceManager *resmgr = RESOURCE_MANAGER (object);
 
-    g_debug ("%s", __func__);
+    tabrmd_debug ("%s", __func__);
     switch (property_id) {
     case PROP_QUEUE_IN:
         g_value_set_object (value, resmgr->in_queue);
@@ -1559,7 +1610,7 @@ resource_manager_dispose (GObject *obj)
     ResourceManager *resmgr = RESOURCE_MANAGER (obj);
     Thread *thread = THREAD (obj);
 
-    g_debug ("%s", __func__);
+    tabrmd_debug ("%s", __func__);
     if (resmgr == NULL)
         g_error ("%s: passed NULL parameter", __func__);
     if (thread->thread_id != 0)
@@ -1689,17 +1740,17 @@ connection_close_session_callback (gpointer data,
     TPM2_HANDLE handle;
     TSS2_RC rc;
 
-    g_debug ("%s", __func__);
+    tabrmd_debug ("%s", __func__);
     if (session_entry->connection != connection) {
-        g_debug ("%s: connection mismatch", __func__);
+        tabrmd_debug ("%s: connection mismatch", __func__);
         return;
     }
     handle = session_entry_get_handle (session_entry);
-    g_debug ("%s: SessionEntry is in state %s", __func__,
-             session_entry_state_to_str (session_state));
+    tabrmd_debug ("%s: SessionEntry is in state %s", __func__,
+                  session_entry_state_to_str (session_state));
     switch (session_state) {
     case SESSION_ENTRY_SAVED_CLIENT:
-        g_debug ("%s: abandoning.", __func__);
+        tabrmd_debug ("%s: abandoning.", __func__);
         session_list_abandon_handle (resource_manager->session_list,
                                      connection,
                                      handle);
@@ -1708,7 +1759,7 @@ connection_close_session_callback (gpointer data,
                                       resource_manager);
         break;
     case SESSION_ENTRY_SAVED_RM:
-        g_debug ("%s: flushing.", __func__);
+        tabrmd_debug ("%s: flushing.", __func__);
         rc = tpm2_context_flush (resource_manager->tpm2,
                                           handle);
         if (rc != TSS2_RC_SUCCESS) {
@@ -1739,11 +1790,11 @@ resource_manager_remove_connection (ResourceManager *resource_manager,
         .resource_manager = resource_manager,
     };
 
-    g_info ("%s: flushing session contexts", __func__);
+    tabrmd_info ("%s: flushing session contexts", __func__);
     session_list_foreach (resource_manager->session_list,
                           connection_close_session_callback,
                           &connection_close_data);
-    g_debug ("%s: done", __func__);
+    tabrmd_debug ("%s: done", __func__);
 }
 /**
  * Create new ResourceManager object.
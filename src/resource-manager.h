@@ -58,5 +58,9 @@ void                  resource_manager_enqueue           (Sink            *sink,
 void                  resource_manager_remove_connection (ResourceManager *resource_manager,
                                                           Connection      *connection);
 TSS2_RC               get_cap_post_process (Tpm2Response *resp);
+gboolean              get_cap_handles (HandleMap            *map,
+                                       TPM2_HANDLE           prop,
+                                       UINT32                count,
+                                       TPMS_CAPABILITY_DATA *cap_data);
 G_END_DECLS
 #endif /* RESOURCE_MANAGER_H */
@@ -7,15 +7,23 @@
 #include <glib.h>
 #include <inttypes.h>
 #include <pthread.h>
+#include <string.h>
 
 #include "connection.h"
+#include "logging.h"
 #include "sink-interface.h"
 #include "response-sink.h"
 #include "control-message.h"
+#include "tabrmd.h"
+#include "tabrmd-capture.h"
+#include "tabrmd-defaults.h"
+#include "tabrmd-probes.h"
 #include "tpm2-response.h"
 #include "util.h"
 
 #define RESPONSE_SINK_TIMEOUT 1e6
+/* maximum number of messages taken from the in_queue per wakeup */
+#define RESPONSE_SINK_BATCH_MAX 16
 
 static void response_sink_sink_interface_init   (gpointer g_iface);
 
@@ -30,11 +38,26 @@ G_DEFINE_TYPE_WITH_CODE (
 enum {
     PROP_0,
     PROP_IN_QUEUE,
+    PROP_DIRECT,
     N_PROPERTIES
 };
 static GParamSpec *obj_properties [N_PROPERTIES] = { NULL, };
+enum {
+    SIGNAL_0,
+    SIGNAL_RESPONSE_WRITTEN,
+    N_SIGNALS,
+};
+static guint signals [N_SIGNALS] = { 0, };
+static void response_sink_deliver_response (ResponseSink *sink,
+                                            Tpm2Response *response);
 /**
  * enqueue function to implement Sink interface.
+ * When the ResponseSink is in 'direct' mode responses are written to the
+ * client from the calling thread instead of being handed off to the
+ * ResponseSink thread, which isn't started. A client that doesn't make
+ * room for its response within TABRMD_DIRECT_RESPONSE_TIMEOUT_USEC is
+ * disconnected so it can't hold up the calling thread. Control messages
+ * are dropped: there's no thread to cancel.
  */
 void
 response_sink_enqueue (Sink            *self,
@@ -42,11 +65,17 @@ response_sink_enqueue (Sink            *self,
 {
     ResponseSink *sink = RESPONSE_SINK (self);
 
-    g_debug ("response_sink_enqueue:");
+    tabrmd_debug ("response_sink_enqueue:");
     if (sink == NULL)
         g_error ("  passed NULL sink");
     if (obj == NULL)
         g_error ("  passed NULL object");
+    if (sink->direct) {
+        if (IS_TPM2_RESPONSE (obj)) {
+            response_sink_deliver_response (sink, TPM2_RESPONSE (obj));
+        }
+        return;
+    }
     message_queue_enqueue (sink->in_queue, obj);
 }
 /**
@@ -60,12 +89,15 @@ response_sink_set_property (GObject        *object,
 {
     ResponseSink *self = RESPONSE_SINK (object);
 
-    g_debug ("response_sink_set_property");
+    tabrmd_debug ("response_sink_set_property");
     switch (property_id) {
     case PROP_IN_QUEUE:
-        g_debug ("  setting PROP_IN_QUEUE");
+        tabrmd_debug ("  setting PROP_IN_QUEUE");
         self->in_queue = g_value_get_object (value);
         break;
+    case PROP_DIRECT:
+        self->direct = g_value_get_boolean (value);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
         break;
@@ -86,6 +118,9 @@ response_sink_get_property (GObject     *object,
     case PROP_IN_QUEUE:
         g_value_set_object (value, self->in_queue);
         break;
+    case PROP_DIRECT:
+        g_value_set_boolean (value, self->direct);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
         break;
@@ -152,9 +187,33 @@ response_sink_class_init (ResponseSinkClass *klass)
                              "Input MessageQueue.",
                              G_TYPE_OBJECT,
                              G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+    obj_properties [PROP_DIRECT] =
+        g_param_spec_boolean ("direct",
+                              "Direct",
+                              "Write responses from the thread that enqueues them.",
+                              FALSE,
+                              G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
     g_object_class_install_properties (object_class,
                                        N_PROPERTIES,
                                        obj_properties);
+    /*
+     * The 'response-written' signal is emitted from the ResponseSink thread
+     * (or the thread calling enqueue in 'direct' mode) each time a response
+     * has been handed back to the client. It is emitted
+     * whether or not the write succeeded: either way the command is no
+     * longer in flight.
+     */
+    signals [SIGNAL_RESPONSE_WRITTEN] =
+        g_signal_new ("response-written",
+                      G_TYPE_FROM_CLASS (object_class),
+                      G_SIGNAL_RUN_LAST | G_SIGNAL_NO_RECURSE | G_SIGNAL_NO_HOOKS,
+                      0,
+                      NULL,
+                      NULL,
+                      NULL,
+                      G_TYPE_NONE,
+                      1,
+                      TYPE_CONNECTION);
 }
 /**
  * Boilerplate code to register functions with the SinkInterface.
@@ -166,33 +225,140 @@ response_sink_sink_interface_init (gpointer g_iface)
     sink_interface->enqueue = response_sink_enqueue;
 }
 /**
+ * Create a new ResponseSink. When 'direct' is TRUE responses are written
+ * by the thread that enqueues them (the ResourceManager) and the
+ * ResponseSink thread must not be started.
  */
 ResponseSink*
-response_sink_new ()
+response_sink_new (gboolean direct)
 {
     MessageQueue *in_queue = message_queue_new ();
     return RESPONSE_SINK (g_object_new (TYPE_RESPONSE_SINK,
                                            "in-queue", in_queue,
+                                           "direct", direct,
                                            NULL));
 }
 
+/*
+ * Write 'size' bytes of 'buf' to the client. A negative 'timeout' blocks
+ * until everything is written. Otherwise the write gives up after
+ * 'timeout' microseconds and the connection is shut down: the client has
+ * stopped reading its responses and the rest of this one can't be
+ * delivered. Shutting the socket down in both directions makes the
+ * CommandSource see EOF and remove the connection.
+ */
+static ssize_t
+response_sink_write (GIOStream    *iostream,
+                     const guint8 *buf,
+                     size_t        size,
+                     gint64        timeout)
+{
+    GSocket *socket;
+    ssize_t written;
+
+    if (timeout < 0 || !G_IS_SOCKET_CONNECTION (iostream)) {
+        return write_all (g_io_stream_get_output_stream (iostream), buf, size);
+    }
+    socket = g_socket_connection_get_socket (G_SOCKET_CONNECTION (iostream));
+    written = write_all_timeout (socket, buf, size, timeout);
+    if (written < 0 && errno == ETIMEDOUT) {
+        g_warning ("%s: client not reading responses, closing connection",
+                   __func__);
+        g_socket_shutdown (socket, TRUE, TRUE, NULL);
+    }
+    return written;
+}
+/*
+ * Write a response to a channel of a multiplexed connection. The channel id
+ * and the response must be sent as a single datagram, they're gathered
+ * from two vectors by the one send. 'timeout' is as for
+ * response_sink_write. Returns the number of bytes of the response written.
+ */
+static ssize_t
+response_sink_process_response_mux (Connection *connection,
+                                    GIOStream  *iostream,
+                                    guint8     *buffer,
+                                    guint32     size,
+                                    gint64      timeout)
+{
+    guint32 channel = GUINT32_TO_BE (connection->channel);
+    GOutputVector vectors [2] = {
+        { .buffer = &channel, .size = TABRMD_MUX_HEADER_SIZE, },
+        { .buffer = buffer, .size = size, },
+    };
+    GSocket *socket;
+    ssize_t written;
+
+    socket = g_socket_connection_get_socket (G_SOCKET_CONNECTION (iostream));
+    written = write_datagram_timeout (socket, vectors, 2, timeout);
+    if (written < 0 && errno == ETIMEDOUT) {
+        g_warning ("%s: client not reading responses, closing connection",
+                   __func__);
+        g_socket_shutdown (socket, TRUE, TRUE, NULL);
+    }
+    if (written < (ssize_t)TABRMD_MUX_HEADER_SIZE) {
+        return written;
+    }
+
+    return written - TABRMD_MUX_HEADER_SIZE;
+}
+/*
+ * Write a response to its client. 'timeout' is passed to
+ * response_sink_write.
+ */
 ssize_t
-response_sink_process_response (Tpm2Response *response)
+response_sink_process_response (Tpm2Response *response,
+                                gint64        timeout)
 {
     ssize_t      written = 0;
     guint32      size    = tpm2_response_get_size (response);
     guint8      *buffer  = tpm2_response_get_buffer (response);
     Connection  *connection = tpm2_response_get_connection (response);
     GIOStream   *iostream = connection_get_iostream (connection);
-    GOutputStream *ostream = g_io_stream_get_output_stream (iostream);
 
-    g_debug ("%s: writing 0x%x bytes", __func__, size);
-    g_debug_bytes (buffer, size, 16, 4);
-    written = write_all (ostream, buffer, size);
+    tabrmd_debug ("%s: writing 0x%x bytes", __func__, size);
+    tabrmd_debug_bytes (buffer, size, 16, 4);
+    if (connection_get_owner (connection) != connection) {
+        written = response_sink_process_response_mux (
+            connection, iostream, buffer, size, timeout);
+    } else {
+        written = response_sink_write (iostream, buffer, size, timeout);
+    }
+    if (tabrmd_capture_enabled ()) {
+        tabrmd_capture_write (TABRMD_CAPTURE_RESPONSE,
+                              connection_get_number (connection),
+                              g_get_monotonic_time (), buffer, size);
+    }
+    TABRMD_PROBE4 (response_write,
+                   connection->id,
+                   response->attributes & TPMA_CC_COMMANDINDEX_MASK,
+                   size,
+                   written);
     g_object_unref (connection);
 
     return written;
 }
+/*
+ * Write the response to the client and notify anyone interested that the
+ * Connection has one less command in flight.
+ */
+static void
+response_sink_deliver_response (ResponseSink *sink,
+                                Tpm2Response *response)
+{
+    Connection *connection;
+
+    response_sink_process_response (response,
+                                    sink->direct ?
+                                    TABRMD_DIRECT_RESPONSE_TIMEOUT_USEC : -1);
+    tpm2_response_stamp (response, TABRMD_STAGE_WRITTEN);
+    connection = tpm2_response_get_connection (response);
+    g_signal_emit (sink,
+                   signals [SIGNAL_RESPONSE_WRITTEN],
+                   0,
+                   connection);
+    g_object_unref (connection);
+}
 
 gboolean
 response_sink_process_control (ResponseSink *sink,
@@ -201,15 +367,15 @@ response_sink_process_control (ResponseSink *sink,
     ControlCode code = control_message_get_code (msg);
 
     UNUSED_PARAM (sink);
-    g_debug ("%s", __func__);
+    tabrmd_debug ("%s", __func__);
     switch (code) {
     case CHECK_CANCEL:
-        g_debug ("%s: Received CHECK_CANCEL control code, terminating.",
-                 __func__);
+        tabrmd_debug ("%s: Received CHECK_CANCEL control code, terminating.",
+                      __func__);
         return FALSE;
     case CONNECTION_REMOVED:
-        g_debug ("%s: Received CONNECTION_REMOVED message, nothing to do.",
-                 __func__);
+        tabrmd_debug ("%s: Received CONNECTION_REMOVED message, nothing to do.",
+                      __func__);
         return TRUE;
     default:
         g_warning ("%s: Unknown control code: %d ... ignoring",
@@ -218,26 +384,41 @@ response_sink_process_control (ResponseSink *sink,
     }
 }
 
+/*
+ * The ResponseSink thread drains every message waiting in its input queue
+ * (up to RESPONSE_SINK_BATCH_MAX) on each wakeup. Responses are written
+ * in the order they were enqueued. Messages dequeued after a CHECK_CANCEL
+ * are dropped.
+ */
 void*
 response_sink_thread (void *data)
 {
     ResponseSink *sink = RESPONSE_SINK (data);
-    GObject *obj;
+    GObject *objs [RESPONSE_SINK_BATCH_MAX] = { NULL, };
+    guint count, i;
     gboolean done = FALSE;
 
     while (!done) {
-        g_debug ("%s: blocking on input queue", __func__);
-        obj = message_queue_dequeue (sink->in_queue);
-        if (IS_TPM2_RESPONSE (obj)) {
-            response_sink_process_response (TPM2_RESPONSE (obj));
-        } else if (IS_CONTROL_MESSAGE (obj)) {
-            gboolean ret =
-                response_sink_process_control (sink, CONTROL_MESSAGE (obj));
-            if (ret == FALSE) {
-                done = TRUE;
+        tabrmd_debug ("%s: blocking on input queue", __func__);
+        count = message_queue_dequeue_batch (sink->in_queue,
+                                             objs,
+                                             RESPONSE_SINK_BATCH_MAX);
+        for (i = 0; i < count; ++i) {
+            if (done) {
+                tabrmd_debug ("%s: dropping message after cancel", __func__);
+            } else if (IS_TPM2_RESPONSE (objs [i])) {
+                response_sink_deliver_response (sink,
+                                                TPM2_RESPONSE (objs [i]));
+            } else if (IS_CONTROL_MESSAGE (objs [i])) {
+                gboolean ret =
+                    response_sink_process_control (sink,
+                                                   CONTROL_MESSAGE (objs [i]));
+                if (ret == FALSE) {
+                    done = TRUE;
+                }
             }
+            g_object_unref (objs [i]);
         }
-        g_object_unref (obj);
     }
 
     return NULL;
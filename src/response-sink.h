@@ -27,6 +27,7 @@ typedef struct _ResponseSinkClass {
 typedef struct _ResponseSink {
     Thread             parent_instance;
     MessageQueue      *in_queue;
+    gboolean           direct;
 } ResponseSink;
 
 #define TYPE_RESPONSE_SINK              (response_sink_get_type ())
@@ -37,7 +38,7 @@ typedef struct _ResponseSink {
 #define RESPONSE_SINK_GET_CLASS(obj)    (G_TYPE_INSTANCE_GET_CLASS  ((obj),   TYPE_RESPONSE_SINK, ResponseSinkClass))
 
 GType               response_sink_get_type    (void);
-ResponseSink*       response_sink_new         (void);
+ResponseSink*       response_sink_new         (gboolean direct);
 
 G_END_DECLS
 #endif /* RESPONSE_SINK_H */
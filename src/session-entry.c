@@ -9,6 +9,8 @@
 
 #include <tss2/tss2_mu.h>
 
+#include "logging.h"
+#include "tabrmd-stats.h"
 #include "tpm2-header.h"
 #include "util.h"
 #include "session-entry.h"
@@ -99,10 +101,31 @@ session_entry_dispose (GObject *object)
 {
     SessionEntry *entry = SESSION_ENTRY (object);
 
-    g_debug ("%s", __func__);
+    tabrmd_debug ("%s", __func__);
     g_clear_object (&entry->connection);
     G_OBJECT_CLASS (session_entry_parent_class)->dispose (object);
 }
+/*
+ * The 'state' property is set during construction so it's only once that's
+ * done that we know which state to count the new SessionEntry in.
+ */
+static void
+session_entry_constructed (GObject *object)
+{
+    SessionEntry *entry = SESSION_ENTRY (object);
+
+    tabrmd_stats_session_state (-1, entry->state);
+    if (G_OBJECT_CLASS (session_entry_parent_class)->constructed != NULL)
+        G_OBJECT_CLASS (session_entry_parent_class)->constructed (object);
+}
+static void
+session_entry_finalize (GObject *object)
+{
+    SessionEntry *entry = SESSION_ENTRY (object);
+
+    tabrmd_stats_session_state (entry->state, -1);
+    G_OBJECT_CLASS (session_entry_parent_class)->finalize (object);
+}
 /*
  * Class initialization function. Register function pointers and properties.
  */
@@ -113,7 +136,9 @@ session_entry_class_init (SessionEntryClass *klass)
 
     if (session_entry_parent_class == NULL)
         session_entry_parent_class = g_type_class_peek_parent (klass);
+    object_class->constructed = session_entry_constructed;
     object_class->dispose = session_entry_dispose;
+    object_class->finalize = session_entry_finalize;
     object_class->get_property = session_entry_get_property;
     object_class->set_property = session_entry_set_property;
 
@@ -153,7 +178,7 @@ SessionEntry*
 session_entry_new (Connection *connection,
                    TPM2_HANDLE  handle)
 {
-    g_debug ("%s", __func__);
+    tabrmd_debug ("%s", __func__);
     return SESSION_ENTRY (g_object_new (TYPE_SESSION_ENTRY,
                                         "connection", connection,
                                         "handle", handle,
@@ -219,6 +244,7 @@ session_entry_set_state (SessionEntry *entry,
     if (state == SESSION_ENTRY_SAVED_CLIENT_CLOSED) {
         g_clear_object (&entry->connection);
     }
+    tabrmd_stats_session_state (entry->state, state);
     entry->state = state;
 }
 /*
@@ -334,6 +360,8 @@ void
 session_entry_abandon (SessionEntry *entry)
 {
     g_clear_object (&entry->connection);
+    tabrmd_stats_session_state (entry->state,
+                                SESSION_ENTRY_SAVED_CLIENT_CLOSED);
     entry->state = SESSION_ENTRY_SAVED_CLIENT_CLOSED;
 }
 /*
@@ -7,8 +7,10 @@
 #include <string.h>
 #include <inttypes.h>
 
+#include "logging.h"
 #include "util.h"
 #include "session-list.h"
+#include "tabrmd-stats.h"
 
 G_DEFINE_TYPE (SessionList, session_list, G_TYPE_OBJECT);
 
@@ -73,7 +75,7 @@ session_list_set_property (GObject        *object,
 static void
 session_list_init (SessionList     *list)
 {
-    g_debug ("session_list_init");
+    tabrmd_debug ("session_list_init");
     list->abandoned_queue = g_queue_new ();
     list->session_entry_list = NULL;
 }
@@ -87,8 +89,8 @@ session_list_dispose (GObject *object)
 {
     SessionList *self = SESSION_LIST (object);
 
-    g_debug ("%s: SessionList with %" PRIu32 " entries", __func__,
-             g_list_length (self->session_entry_list));
+    tabrmd_debug ("%s: SessionList with %" PRIu32 " entries", __func__,
+                  g_list_length (self->session_entry_list));
     g_queue_free (self->abandoned_queue);
     self->abandoned_queue = NULL;
     g_list_free_full (self->session_entry_list, g_object_unref);
@@ -103,8 +105,8 @@ session_list_finalize (GObject *object)
 {
     SessionList *self = SESSION_LIST (object);
 
-    g_debug ("%s: SessionList with %" PRIu32 " entries", __func__,
-             g_list_length (self->session_entry_list));
+    tabrmd_debug ("%s: SessionList with %" PRIu32 " entries", __func__,
+                  g_list_length (self->session_entry_list));
     g_list_free_full (self->session_entry_list, g_object_unref);
     G_OBJECT_CLASS (session_list_parent_class)->finalize (object);
 }
@@ -152,7 +154,7 @@ SessionList*
 session_list_new (guint  max_per_conn,
                   guint  max_abandoned)
 {
-    g_debug ("session_list_new with max-per-connection: 0x%x", max_per_conn);
+    tabrmd_debug ("session_list_new with max-per-connection: 0x%x", max_per_conn);
     return SESSION_LIST (g_object_new (TYPE_SESSION_LIST,
                                        "max-abandoned", max_abandoned,
                                        "max-per-connection", max_per_conn,
@@ -235,7 +237,7 @@ void
 session_list_remove (SessionList   *list,
                      SessionEntry  *entry)
 {
-    g_debug ("%s", __func__);
+    tabrmd_debug ("%s", __func__);
     list->session_entry_list = g_list_remove (list->session_entry_list, entry);
     g_object_unref (entry);
 }
@@ -327,7 +329,9 @@ typedef struct {
 } connection_count_data_t;
 /*
  * Callback function used to count the number of SessionEntry objects in the
- * list associated with a given connection.
+ * list associated with a given connection. The channels of a multiplexed
+ * connection share its quota so entries are matched on the connection that
+ * owns them.
  */
 static void
 session_list_connection_counter (gpointer data,
@@ -337,7 +341,9 @@ session_list_connection_counter (gpointer data,
     Connection *conn = session_entry_get_connection (entry);
     connection_count_data_t *count_data = (connection_count_data_t*)user_data;
 
-    if (count_data->connection == conn) {
+    if (conn != NULL &&
+        connection_get_owner (count_data->connection) ==
+        connection_get_owner (conn)) {
         ++count_data->count;
     }
     g_clear_object (&conn);
@@ -371,7 +377,7 @@ session_list_is_full (SessionList *session_list,
     session_count = session_list_connection_count (session_list,
                                                    connection);
     if (session_count >= session_list->max_per_connection) {
-        g_info ("%s: Connection has exceeded session limit", __func__);
+        tabrmd_info ("%s: Connection has exceeded session limit", __func__);
         ret = TRUE;
     } else {
         ret= FALSE;
@@ -402,8 +408,8 @@ session_list_abandon_handle (SessionList *list,
 
     entry = session_list_lookup_handle (list, handle);
     if (entry == NULL) {
-        g_debug ("%s: Handle 0x%08" PRIx32 " doesn't exist in SessionList",
-                 __func__, handle);
+        tabrmd_debug ("%s: Handle 0x%08" PRIx32 " doesn't exist in SessionList",
+                      __func__, handle);
         return FALSE;
     }
     if (session_entry_compare_on_connection (entry, connection)) {
@@ -413,6 +419,7 @@ session_list_abandon_handle (SessionList *list,
         return FALSE;
     }
     session_entry_abandon (entry);
+    tabrmd_stats_inc (TABRMD_STATS_SESSION_ABANDONED);
     g_queue_push_head (list->abandoned_queue, entry);
     g_clear_object (&entry);
 
@@ -438,8 +445,8 @@ session_list_claim (SessionList *list,
     link = g_queue_find (list->abandoned_queue, entry);
     if (link != NULL) {
         g_assert (link->data == entry);
-        g_debug ("%s: GQueue of abandoned sessions does not contain "
-                 "SessionEntry", __func__);
+        tabrmd_debug ("%s: GQueue of abandoned sessions does not contain "
+                      "SessionEntry", __func__);
         session_entry_set_state (entry, SESSION_ENTRY_LOADED);
         session_entry_set_connection (entry, connection);
         g_queue_remove (list->abandoned_queue, link->data);
@@ -448,7 +455,7 @@ session_list_claim (SessionList *list,
     link = g_list_find (list->session_entry_list, entry);
     if (link != NULL) {
         g_assert (link->data == entry);
-        g_debug ("%s: SessionEntry found in SessionList", __func__);
+        tabrmd_debug ("%s: SessionEntry found in SessionList", __func__);
         session_entry_set_state (entry, SESSION_ENTRY_LOADED);
         session_entry_set_connection (entry, connection);
     } else {
@@ -469,13 +476,13 @@ session_list_prune_abandoned (SessionList *list,
     gboolean ret = FALSE;
 
     if (g_queue_get_length (list->abandoned_queue) <= list->max_abandoned) {
-        g_debug ("%s: abandoned_queue has not exceeded 'max_abandoned', "
-                 "nothing to do.", __func__);
+        tabrmd_debug ("%s: abandoned_queue has not exceeded 'max_abandoned', "
+                      "nothing to do.", __func__);
         return TRUE;
     }
     entry = g_queue_pop_tail (list->abandoned_queue);
     if (entry == NULL) {
-        g_debug ("%s: Abandoned queue is empty.", __func__);
+        tabrmd_debug ("%s: Abandoned queue is empty.", __func__);
         return TRUE;
     }
     g_object_ref (entry);
@@ -4,6 +4,7 @@
  * All rights reserved.
  */
 
+#include "logging.h"
 #include "util.h"
 #include "sink-interface.h"
 
@@ -26,7 +27,7 @@ sink_enqueue (Sink       *self,
 {
     SinkInterface *iface;
 
-    g_debug ("sink_enqueue");
+    tabrmd_debug ("sink_enqueue");
     g_return_if_fail (IS_SINK (self));
     iface = SINK_GET_INTERFACE (self);
     g_return_if_fail (iface->enqueue != NULL);
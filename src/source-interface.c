@@ -4,6 +4,7 @@
  * All rights reserved.
  */
 
+#include "logging.h"
 #include "util.h"
 #include "source-interface.h"
 
@@ -26,7 +27,7 @@ source_add_sink (Source       *self,
 {
     SourceInterface *iface;
 
-    g_debug ("source_add_sink");
+    tabrmd_debug ("source_add_sink");
     g_return_if_fail (IS_SOURCE (self));
     iface = SOURCE_GET_INTERFACE (self);
     g_return_if_fail (iface->add_sink != NULL);
@@ -0,0 +1,292 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "tabrmd-capture.h"
+
+G_STATIC_ASSERT (sizeof (tabrmd_capture_header_t) == 16);
+G_STATIC_ASSERT (sizeof (tabrmd_capture_record_t) == 24);
+
+/* the writer thread is woken early once this much is waiting */
+#define CAPTURE_BUFFER_SIZE (256 * 1024)
+/* records that would take the backlog past this are dropped */
+#define CAPTURE_PENDING_MAX (16 * CAPTURE_BUFFER_SIZE)
+
+/*
+ * Records are added by the threads reading commands and the thread
+ * writing responses. They only take 'mutex' to copy the record onto
+ * 'pending'. A dedicated writer thread swaps 'pending' for 'spare' at
+ * least every TABRMD_CAPTURE_FLUSH_USEC and writes it out without the
+ * mutex held so a slow disk can't stall the pipeline. If the writer falls
+ * behind by more than CAPTURE_PENDING_MAX records are dropped and counted.
+ */
+typedef struct {
+    GMutex      mutex;
+    GCond       cond;
+    GThread    *thread;
+    FILE       *file;
+    GByteArray *pending;
+    GByteArray *spare;
+    gint64      start;
+    guint64     dropped;
+    gint        enabled;
+    gboolean    stop;
+} tabrmd_capture_t;
+
+static tabrmd_capture_t capture;
+
+/*
+ * Write 'batch' to the file. Only the writer thread touches the file
+ * until it's joined.
+ */
+static gboolean
+tabrmd_capture_flush (tabrmd_capture_t *cap,
+                      GByteArray *batch)
+{
+    if (batch->len == 0) {
+        return TRUE;
+    }
+    if (fwrite (batch->data, 1, batch->len, cap->file) != batch->len ||
+        fflush (cap->file) != 0)
+    {
+        return FALSE;
+    }
+    return TRUE;
+}
+static gpointer
+tabrmd_capture_thread (gpointer data)
+{
+    tabrmd_capture_t *cap = (tabrmd_capture_t*)data;
+    GByteArray *batch;
+    gboolean stop, ok;
+    gint64 deadline;
+
+    g_mutex_lock (&cap->mutex);
+    do {
+        deadline = g_get_monotonic_time () + TABRMD_CAPTURE_FLUSH_USEC;
+        while (!cap->stop && cap->pending->len < CAPTURE_BUFFER_SIZE) {
+            if (!g_cond_wait_until (&cap->cond, &cap->mutex, deadline)) {
+                break;
+            }
+        }
+        batch = cap->pending;
+        cap->pending = cap->spare;
+        cap->spare = NULL;
+        stop = cap->stop;
+        g_mutex_unlock (&cap->mutex);
+
+        ok = tabrmd_capture_flush (cap, batch);
+        if (!ok) {
+            g_warning ("failed to write capture file, capture stopped: %s",
+                       strerror (errno));
+        }
+        g_byte_array_set_size (batch, 0);
+
+        g_mutex_lock (&cap->mutex);
+        cap->spare = batch;
+        if (!ok) {
+            __atomic_store_n (&cap->enabled, FALSE, __ATOMIC_RELEASE);
+        }
+    } while (ok && !stop);
+    g_mutex_unlock (&cap->mutex);
+
+    return NULL;
+}
+/*
+ * Create the capture file at 'path', replacing any existing file, and
+ * start capturing. The file is only readable by the daemon's user since
+ * commands may carry secrets.
+ */
+gboolean
+tabrmd_capture_open (const gchar *path,
+                     GError **error)
+{
+    tabrmd_capture_header_t header = {
+        .magic       = GUINT32_TO_LE (TABRMD_CAPTURE_MAGIC),
+        .version     = GUINT16_TO_LE (TABRMD_CAPTURE_VERSION),
+        .record_size = GUINT16_TO_LE (sizeof (tabrmd_capture_record_t)),
+        .start_time  = GINT64_TO_LE (g_get_real_time ()),
+    };
+    FILE *file;
+    gint fd;
+
+    g_return_val_if_fail (capture.thread == NULL, FALSE);
+    fd = open (path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW,
+               0600);
+    if (fd < 0) {
+        goto err_out;
+    }
+    file = fdopen (fd, "wb");
+    if (file == NULL) {
+        close (fd);
+        goto err_out;
+    }
+    if (fwrite (&header, sizeof (header), 1, file) != 1) {
+        fclose (file);
+        goto err_out;
+    }
+    capture.file = file;
+    capture.pending = g_byte_array_sized_new (CAPTURE_BUFFER_SIZE);
+    capture.spare = g_byte_array_sized_new (CAPTURE_BUFFER_SIZE);
+    capture.start = g_get_monotonic_time ();
+    capture.dropped = 0;
+    capture.stop = FALSE;
+    capture.thread = g_thread_new ("capture", tabrmd_capture_thread, &capture);
+    __atomic_store_n (&capture.enabled, TRUE, __ATOMIC_RELEASE);
+    return TRUE;
+
+err_out:
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                 "failed to create capture file %s: %s", path,
+                 strerror (errno));
+    return FALSE;
+}
+/*
+ * Stop capturing and wait for the writer thread to write out everything
+ * still pending.
+ */
+void
+tabrmd_capture_close (void)
+{
+    if (capture.thread == NULL) {
+        return;
+    }
+    g_mutex_lock (&capture.mutex);
+    __atomic_store_n (&capture.enabled, FALSE, __ATOMIC_RELEASE);
+    capture.stop = TRUE;
+    g_cond_signal (&capture.cond);
+    g_mutex_unlock (&capture.mutex);
+    g_thread_join (capture.thread);
+    capture.thread = NULL;
+
+    if (fclose (capture.file) != 0) {
+        g_warning ("failed to close capture file: %s", strerror (errno));
+    }
+    capture.file = NULL;
+    if (capture.dropped > 0) {
+        g_warning ("capture file is missing %" G_GUINT64_FORMAT " records "
+                   "dropped while the writer was behind", capture.dropped);
+    }
+    g_clear_pointer (&capture.pending, g_byte_array_unref);
+    g_clear_pointer (&capture.spare, g_byte_array_unref);
+}
+gboolean
+tabrmd_capture_enabled (void)
+{
+    return __atomic_load_n (&capture.enabled, __ATOMIC_ACQUIRE);
+}
+/*
+ * Queue a command or response for the capture file. 'time' is the
+ * g_get_monotonic_time () at which it was read or written. Capturing stops
+ * on the first write error.
+ */
+void
+tabrmd_capture_write (TabrmdCaptureType type,
+                      guint64 connection_id,
+                      gint64 time,
+                      const guint8 *buffer,
+                      gsize size)
+{
+    tabrmd_capture_record_t record;
+    guint len;
+
+    if (!tabrmd_capture_enabled ()) {
+        return;
+    }
+    record.connection_id = GUINT64_TO_LE (connection_id);
+    record.time = GUINT64_TO_LE ((guint64)MAX (time - capture.start, 0));
+    record.size = GUINT32_TO_LE ((guint32)size);
+    record.type = GUINT32_TO_LE ((guint32)type);
+
+    g_mutex_lock (&capture.mutex);
+    if (!tabrmd_capture_enabled ()) {
+        goto out;
+    }
+    len = capture.pending->len;
+    if (len + sizeof (record) + size > CAPTURE_PENDING_MAX) {
+        ++capture.dropped;
+        goto out;
+    }
+    g_byte_array_append (capture.pending, (guint8*)&record, sizeof (record));
+    g_byte_array_append (capture.pending, buffer, size);
+    if (len < CAPTURE_BUFFER_SIZE &&
+        capture.pending->len >= CAPTURE_BUFFER_SIZE)
+    {
+        g_cond_signal (&capture.cond);
+    }
+out:
+    g_mutex_unlock (&capture.mutex);
+}
+/*
+ * Read and check the header of a capture file.
+ */
+gboolean
+tabrmd_capture_read_header (FILE *file,
+                            tabrmd_capture_header_t *header,
+                            GError **error)
+{
+    if (fread (header, sizeof (*header), 1, file) != 1) {
+        g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                     "failed to read capture header");
+        return FALSE;
+    }
+    header->magic = GUINT32_FROM_LE (header->magic);
+    header->version = GUINT16_FROM_LE (header->version);
+    header->record_size = GUINT16_FROM_LE (header->record_size);
+    header->start_time = GINT64_FROM_LE (header->start_time);
+    if (header->magic != TABRMD_CAPTURE_MAGIC ||
+        header->version != TABRMD_CAPTURE_VERSION ||
+        header->record_size != sizeof (tabrmd_capture_record_t))
+    {
+        g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                     "not a version %d capture file",
+                     TABRMD_CAPTURE_VERSION);
+        return FALSE;
+    }
+    return TRUE;
+}
+/*
+ * Read the next record and the buffer following it. The caller must free
+ * '*buffer'. Returns 1 for a record, 0 at the end of the file and -1 on
+ * error.
+ */
+gint
+tabrmd_capture_read_record (FILE *file,
+                            tabrmd_capture_record_t *record,
+                            guint8 **buffer,
+                            GError **error)
+{
+    size_t count;
+
+    count = fread (record, 1, sizeof (*record), file);
+    if (count == 0 && feof (file)) {
+        return 0;
+    }
+    if (count != sizeof (*record)) {
+        g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                     "truncated capture record");
+        return -1;
+    }
+    record->connection_id = GUINT64_FROM_LE (record->connection_id);
+    record->time = GUINT64_FROM_LE (record->time);
+    record->size = GUINT32_FROM_LE (record->size);
+    record->type = GUINT32_FROM_LE (record->type);
+    if (record->size > TABRMD_CAPTURE_SIZE_MAX) {
+        g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                     "capture record size %" G_GUINT32_FORMAT " too large",
+                     record->size);
+        return -1;
+    }
+    *buffer = g_malloc (record->size);
+    if (fread (*buffer, 1, record->size, file) != record->size) {
+        g_clear_pointer (buffer, g_free);
+        g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                     "truncated capture record");
+        return -1;
+    }
+    return 1;
+}
@@ -0,0 +1,61 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef TABRMD_CAPTURE_H
+#define TABRMD_CAPTURE_H
+
+#include <stdio.h>
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define TABRMD_CAPTURE_MAGIC       0x31504354 /* "TCP1" */
+#define TABRMD_CAPTURE_VERSION     1
+/* records larger than this can only come from a corrupt file */
+#define TABRMD_CAPTURE_SIZE_MAX    65536
+/* buffered writes are flushed at least this often */
+#define TABRMD_CAPTURE_FLUSH_USEC  G_USEC_PER_SEC
+
+/*
+ * A capture file is a header followed by one record per command read from
+ * a client and per response written to one, in the order they happened.
+ * Each record is followed by 'size' bytes of the TPM command or response.
+ * All integers are little endian.
+ */
+typedef struct {
+    guint32 magic;
+    guint16 version;
+    guint16 record_size;
+    gint64  start_time;     /* g_get_real_time () when capture started */
+} tabrmd_capture_header_t;
+
+typedef enum {
+    TABRMD_CAPTURE_COMMAND = 1,
+    TABRMD_CAPTURE_RESPONSE = 2,
+} TabrmdCaptureType;
+
+typedef struct {
+    guint64 connection_id;  /* connection_get_number () */
+    guint64 time;           /* microseconds since capture started */
+    guint32 size;
+    guint32 type;
+} tabrmd_capture_record_t;
+
+gboolean  tabrmd_capture_open         (const gchar             *path,
+                                       GError                 **error);
+void      tabrmd_capture_close        (void);
+gboolean  tabrmd_capture_enabled      (void);
+void      tabrmd_capture_write        (TabrmdCaptureType        type,
+                                       guint64                  connection_id,
+                                       gint64                   time,
+                                       const guint8            *buffer,
+                                       gsize                    size);
+gboolean  tabrmd_capture_read_header  (FILE                    *file,
+                                       tabrmd_capture_header_t *header,
+                                       GError                 **error);
+gint      tabrmd_capture_read_record  (FILE                    *file,
+                                       tabrmd_capture_record_t *record,
+                                       guint8                 **buffer,
+                                       GError                 **error);
+
+G_END_DECLS
+#endif /* TABRMD_CAPTURE_H */
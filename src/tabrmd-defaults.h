@@ -7,13 +7,30 @@
 
 #define TABRMD_CONNECTIONS_MAX_DEFAULT 27
 #define TABRMD_CONNECTION_MAX 100
+#define TABRMD_CONNECTION_POOL_SIZE_DEFAULT 2
+#define TABRMD_CONNECTION_POOL_SIZE_MAX 16
+#define TABRMD_SLOW_COMMAND_MS_DEFAULT 0
+#define TABRMD_SLOW_COMMAND_MS_MAX 3600000
+/* longest a direct response write may hold up the ResourceManager */
+#define TABRMD_DIRECT_RESPONSE_TIMEOUT_USEC 100000
 #define TABRMD_DBUS_NAME_DEFAULT "com.intel.tss2.Tabrmd"
 #define TABRMD_DBUS_TYPE_DEFAULT G_BUS_TYPE_SYSTEM
 #define TABRMD_DBUS_PATH "/com/intel/tss2/Tabrmd/Tcti"
+#define TABRMD_DBUS_INTERFACE "com.intel.tss2.TctiTabrmd"
 #define TABRMD_DBUS_METHOD_CREATE_CONNECTION "CreateConnection"
 #define TABRMD_DBUS_METHOD_CANCEL "Cancel"
+#define TABRMD_DBUS_METHOD_SET_LOCALITY "SetLocality"
 #define TABRMD_ERROR tabrmd_error_quark ()
 #define TABRMD_ENTROPY_SRC_DEFAULT "/dev/urandom"
+#define TABRMD_FLIGHT_RECORDER_EVENTS_DEFAULT 4096
+#define TABRMD_FLIGHT_RECORDER_EVENTS_MAX 1048576
+#define TABRMD_IN_FLIGHT_MAX_DEFAULT 4
+#define TABRMD_IN_FLIGHT_MAX 64
+#define TABRMD_MUX_CHANNELS_MAX 256
+#define TABRMD_QUEUE_HIGH_WATER_DEFAULT 256
+#define TABRMD_QUEUE_HIGH_WATER_MAX 4096
+#define TABRMD_READER_THREADS_DEFAULT 1
+#define TABRMD_READER_THREADS_MAX 16
 #define TABRMD_SESSIONS_MAX_DEFAULT 4
 #define TABRMD_SESSIONS_MAX 64
 #define TABRMD_TCTI_CONF_DEFAULT "device:/dev/tpm0"
@@ -13,12 +13,16 @@
 #include "logging.h"
 #include "ipc-frontend.h"
 #include "ipc-frontend-dbus.h"
+#include "metrics-listener.h"
 #include "random.h"
 #include "resource-manager.h"
 #include "response-sink.h"
 #include "source-interface.h"
+#include "tabrmd-capture.h"
 #include "tabrmd-init.h"
 #include "tabrmd-options.h"
+#include "tabrmd-recorder.h"
+#include "tabrmd-timeline.h"
 #include "tabrmd.h"
 #include "util.h"
 
@@ -46,6 +50,21 @@ signal_handler (gpointer user_data)
 
     return G_SOURCE_CONTINUE;
 }
+/*
+ * Invoked in response to SIGUSR1: dump the flight recorder.
+ */
+static gboolean
+dump_signal_handler (gpointer user_data)
+{
+    gchar *message;
+
+    UNUSED_PARAM (user_data);
+    message = tabrmd_recorder_dump ("SIGUSR1");
+    g_warning ("%s", message);
+    g_free (message);
+
+    return G_SOURCE_CONTINUE;
+}
 
 /*
  * This function is a callback invoked by the IpcFrontend object
@@ -85,7 +104,9 @@ gmain_data_cleanup (gmain_data_t *data)
         thread = THREAD (data->resource_manager);
         thread_cleanup (&thread);
     }
-    if (data->response_sink != NULL) {
+    if (data->response_sink != NULL && data->options.direct_response) {
+        g_clear_object (&data->response_sink);
+    } else if (data->response_sink != NULL) {
         thread = THREAD (data->response_sink);
         thread_cleanup (&thread);
     }
@@ -93,6 +114,9 @@ gmain_data_cleanup (gmain_data_t *data)
         ipc_frontend_disconnect (data->ipc_frontend);
         g_clear_object (&data->ipc_frontend);
     }
+    if (data->metrics_listener != NULL) {
+        g_clear_object (&data->metrics_listener);
+    }
     if (data->random != NULL) {
         g_clear_object (&data->random);
     }
@@ -102,6 +126,9 @@ gmain_data_cleanup (gmain_data_t *data)
     if (data->tpm2) {
         g_clear_object (&data->tpm2);
     }
+    set_critical_hook (NULL);
+    tabrmd_recorder_cleanup ();
+    tabrmd_capture_close ();
 
     tabrmd_options_free(&data->options);
 }
@@ -113,7 +140,8 @@ gmain_data_cleanup (gmain_data_t *data)
  * on the 'init_mutex' until this thread completes but they won't be
  * timing etc. This function does X things:
  * - Locks the init_mutex.
- * - Registers a handler for UNIX signals for SIGINT and SIGTERM.
+ * - Registers a handler for UNIX signals for SIGINT and SIGTERM, and one
+ *   for SIGUSR1 that dumps the flight recorder.
  * - Seeds the RNG state from an entropy source.
  * - Creates the ConnectionManager.
  * - Creates the TCTI instance used by the Tab.
@@ -134,12 +162,14 @@ init_thread_func (gpointer user_data)
     SessionList *session_list;
     Tcti *tcti = NULL;
     TSS2_TCTI_CONTEXT *tcti_ctx = NULL;
+    GError *error = NULL;
 
     g_info ("init_thread_func start");
     g_mutex_lock (&data->init_mutex);
     /* Setup program signals */
     if (g_unix_signal_add(SIGINT, signal_handler, data->loop) <= 0 ||
-        g_unix_signal_add(SIGTERM, signal_handler, data->loop) <= 0)
+        g_unix_signal_add(SIGTERM, signal_handler, data->loop) <= 0 ||
+        g_unix_signal_add(SIGUSR1, dump_signal_handler, NULL) <= 0)
     {
         g_critical ("failed to setup signal handlers");
         ret = EX_OSERR;
@@ -155,6 +185,24 @@ init_thread_func (gpointer user_data)
         goto err_out;
     }
 
+    tabrmd_timeline_set_slow_threshold (
+        (gint64)data->options.slow_command_ms * 1000);
+    if (!tabrmd_recorder_init (data->options.flight_recorder_events,
+                               data->options.flight_recorder_file))
+    {
+        g_critical ("failed to create flight recorder");
+        ret = EX_OSERR;
+        goto err_out;
+    }
+    set_critical_hook (tabrmd_recorder_on_critical);
+    if (data->options.capture_file != NULL &&
+        !tabrmd_capture_open (data->options.capture_file, &error))
+    {
+        g_critical ("%s", error->message);
+        g_clear_error (&error);
+        ret = EX_CANTCREAT;
+        goto err_out;
+    }
     connection_manager = connection_manager_new(data->options.max_connections);
     /* setup IpcFrontend */
     data->ipc_frontend =
@@ -162,7 +210,8 @@ init_thread_func (gpointer user_data)
                                              data->options.dbus_name,
                                              connection_manager,
                                              data->options.max_transients,
-                                             data->random));
+                                             data->random,
+                                             data->options.connection_pool_size));
     g_signal_connect (data->ipc_frontend,
                       "disconnected",
                       (GCallback) on_ipc_frontend_disconnect,
@@ -202,14 +251,22 @@ init_thread_func (gpointer user_data)
     }
 
     data->command_source =
-        command_source_new (connection_manager, command_attrs);
+        command_source_new (connection_manager,
+                            command_attrs,
+                            data->options.max_in_flight,
+                            data->options.queue_high_water,
+                            data->options.reader_threads);
     g_object_unref (connection_manager);
     session_list = session_list_new (data->options.max_sessions,
                                      SESSION_LIST_MAX_ABANDONED_DEFAULT);
     data->resource_manager = resource_manager_new (data->tpm2,
                                                    session_list);
     g_clear_object (&session_list);
-    data->response_sink = response_sink_new ();
+    data->response_sink = response_sink_new (data->options.direct_response);
+    g_signal_connect (data->response_sink,
+                      "response-written",
+                      (GCallback) command_source_on_response_written,
+                      data->command_source);
     g_object_unref (command_attrs);
     g_clear_object (&data->tpm2);
     /*
@@ -236,12 +293,24 @@ init_thread_func (gpointer user_data)
         ret = EX_OSERR;
         goto err_out;
     }
-    ret = thread_start (THREAD (data->response_sink));
+    /* in direct mode responses are written by the ResourceManager thread */
+    ret = data->options.direct_response ? 0 :
+        thread_start (THREAD (data->response_sink));
     if (ret != 0) {
         g_critical ("failed to start response_source");
         ret = EX_OSERR;
         goto err_out;
     }
+    if (data->options.metrics_socket != NULL) {
+        data->metrics_listener =
+            metrics_listener_new (data->options.metrics_socket);
+        if (!metrics_listener_start (data->metrics_listener, &error)) {
+            g_critical ("failed to start MetricsListener: %s", error->message);
+            g_clear_error (&error);
+            ret = EX_OSERR;
+            goto err_out;
+        }
+    }
 
     g_mutex_unlock (&data->init_mutex);
     g_info ("init_thread_func done");
@@ -6,6 +6,7 @@
 #include "tpm2.h"
 #include "command-source.h"
 #include "ipc-frontend.h"
+#include "metrics-listener.h"
 #include "random.h"
 #include "resource-manager.h"
 #include "response-sink.h"
@@ -27,6 +28,7 @@ typedef struct gmain_data {
     GMutex                  init_mutex;
     IpcFrontend            *ipc_frontend;
     gboolean                ipc_disconnected;
+    MetricsListener        *metrics_listener;
 } gmain_data_t;
 
 gpointer
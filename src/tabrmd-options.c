@@ -6,6 +6,7 @@
 #include <tss2/tss2_tpm2_types.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/un.h>
 
 #include "logging.h"
 #include "tabrmd-options.h"
@@ -56,6 +57,9 @@ tabrmd_options_free(tabrmd_options_t *opts)
     g_clear_pointer(&opts->dbus_name, g_free);
     g_clear_pointer(&opts->prng_seed_file, g_free);
     g_clear_pointer(&opts->tcti_conf, g_free);
+    g_clear_pointer(&opts->metrics_socket, g_free);
+    g_clear_pointer(&opts->flight_recorder_file, g_free);
+    g_clear_pointer(&opts->capture_file, g_free);
 }
 
 /**
@@ -115,6 +119,96 @@ parse_opts (gint argc,
             .description     = "TCTI configuration string. See tpm2-abrmd (8) for search rules.",
             .arg_description = "tcti-conf",
         },
+        {
+            .long_name       = "max-in-flight",
+            .short_name      = '\0',
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_INT,
+            .arg_data        = &options->max_in_flight,
+            .description     = "Maximum number of commands in flight per connection.",
+            .arg_description = NULL,
+        },
+        {
+            .long_name       = "queue-high-water",
+            .short_name      = '\0',
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_INT,
+            .arg_data        = &options->queue_high_water,
+            .description     = "Number of queued commands at which the daemon stops reading from all clients.",
+            .arg_description = NULL,
+        },
+        {
+            .long_name       = "reader-threads",
+            .short_name      = '\0',
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_INT,
+            .arg_data        = &options->reader_threads,
+            .description     = "Number of threads reading commands from clients.",
+            .arg_description = NULL,
+        },
+        {
+            .long_name       = "direct-response",
+            .short_name      = '\0',
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_NONE,
+            .arg_data        = &options->direct_response,
+            .description     = "Write responses to clients from the thread that talks to the TPM.",
+            .arg_description = NULL,
+        },
+        {
+            .long_name       = "connection-pool-size",
+            .short_name      = '\0',
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_INT,
+            .arg_data        = &options->connection_pool_size,
+            .description     = "Number of client connections to create ahead of time.",
+            .arg_description = NULL,
+        },
+        {
+            .long_name       = "metrics-socket",
+            .short_name      = '\0',
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_STRING,
+            .arg_data        = &options->metrics_socket,
+            .description     = "Serve Prometheus metrics on a UNIX socket at this path.",
+            .arg_description = "path",
+        },
+        {
+            .long_name       = "slow-command-ms",
+            .short_name      = '\0',
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_INT,
+            .arg_data        = &options->slow_command_ms,
+            .description     = "Log commands taking at least this many milliseconds with a per stage breakdown.",
+            .arg_description = NULL,
+        },
+        {
+            .long_name       = "flight-recorder-events",
+            .short_name      = '\0',
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_INT,
+            .arg_data        = &options->flight_recorder_events,
+            .description     = "Number of recent commands kept by the flight recorder, 0 disables it.",
+            .arg_description = NULL,
+        },
+        {
+            .long_name       = "flight-recorder-file",
+            .short_name      = '\0',
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_STRING,
+            .arg_data        = &options->flight_recorder_file,
+            .description     = "Dump the flight recorder to this path on SIGUSR1 or a critical error.",
+            .arg_description = "path",
+        },
+        {
+            .long_name       = "capture-file",
+            .short_name      = '\0',
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_STRING,
+            .arg_data        = &options->capture_file,
+            .description     = "Record every command and response to this path for tabrmd-replay.",
+            .arg_description = "path",
+        },
         { NULL, '\0', 0, 0, NULL, NULL, NULL },
     };
 
@@ -169,6 +263,64 @@ parse_opts (gint argc,
                     TABRMD_TRANSIENT_MAX);
         goto error;
     }
+    if (options->max_in_flight < 1 ||
+        options->max_in_flight > TABRMD_IN_FLIGHT_MAX)
+    {
+        g_critical ("max-in-flight must be between 1 and %d",
+                    TABRMD_IN_FLIGHT_MAX);
+        goto error;
+    }
+    if (options->queue_high_water < 1 ||
+        options->queue_high_water > TABRMD_QUEUE_HIGH_WATER_MAX)
+    {
+        g_critical ("queue-high-water must be between 1 and %d",
+                    TABRMD_QUEUE_HIGH_WATER_MAX);
+        goto error;
+    }
+    if (options->reader_threads < 1 ||
+        options->reader_threads > TABRMD_READER_THREADS_MAX)
+    {
+        g_critical ("reader-threads must be between 1 and %d",
+                    TABRMD_READER_THREADS_MAX);
+        goto error;
+    }
+    if (options->connection_pool_size > TABRMD_CONNECTION_POOL_SIZE_MAX) {
+        g_critical ("connection-pool-size must be between 0 and %d",
+                    TABRMD_CONNECTION_POOL_SIZE_MAX);
+        goto error;
+    }
+    if (options->metrics_socket != NULL &&
+        (!g_path_is_absolute (options->metrics_socket) ||
+         strlen (options->metrics_socket) >=
+            sizeof (((struct sockaddr_un*)NULL)->sun_path)))
+    {
+        g_critical ("metrics-socket must be an absolute path shorter than "
+                    "%zu characters",
+                    sizeof (((struct sockaddr_un*)NULL)->sun_path));
+        goto error;
+    }
+    if (options->slow_command_ms > TABRMD_SLOW_COMMAND_MS_MAX) {
+        g_critical ("slow-command-ms must be between 0 and %d",
+                    TABRMD_SLOW_COMMAND_MS_MAX);
+        goto error;
+    }
+    if (options->flight_recorder_events > TABRMD_FLIGHT_RECORDER_EVENTS_MAX) {
+        g_critical ("flight-recorder-events must be between 0 and %d",
+                    TABRMD_FLIGHT_RECORDER_EVENTS_MAX);
+        goto error;
+    }
+    if (options->flight_recorder_file != NULL &&
+        !g_path_is_absolute (options->flight_recorder_file))
+    {
+        g_critical ("flight-recorder-file must be an absolute path");
+        goto error;
+    }
+    if (options->capture_file != NULL &&
+        !g_path_is_absolute (options->capture_file))
+    {
+        g_critical ("capture-file must be an absolute path");
+        goto error;
+    }
     g_debug ("tcti_conf after: \"%s\"", options->tcti_conf);
     return TRUE;
 
@@ -19,6 +19,16 @@
     .prng_seed_file = NULL, \
     .allow_root = FALSE, \
     .tcti_conf = NULL, \
+    .max_in_flight = TABRMD_IN_FLIGHT_MAX_DEFAULT, \
+    .queue_high_water = TABRMD_QUEUE_HIGH_WATER_DEFAULT, \
+    .reader_threads = TABRMD_READER_THREADS_DEFAULT, \
+    .direct_response = FALSE, \
+    .connection_pool_size = TABRMD_CONNECTION_POOL_SIZE_DEFAULT, \
+    .metrics_socket = NULL, \
+    .slow_command_ms = TABRMD_SLOW_COMMAND_MS_DEFAULT, \
+    .flight_recorder_events = TABRMD_FLIGHT_RECORDER_EVENTS_DEFAULT, \
+    .flight_recorder_file = NULL, \
+    .capture_file = NULL, \
 }
 
 typedef struct tabrmd_options {
@@ -31,6 +41,16 @@ typedef struct tabrmd_options {
     gchar          *prng_seed_file;
     gboolean        allow_root;
     gchar          *tcti_conf;
+    guint           max_in_flight;
+    guint           queue_high_water;
+    guint           reader_threads;
+    gboolean        direct_response;
+    guint           connection_pool_size;
+    gchar          *metrics_socket;
+    guint           slow_command_ms;
+    guint           flight_recorder_events;
+    gchar          *flight_recorder_file;
+    gchar          *capture_file;
 } tabrmd_options_t;
 
 gboolean
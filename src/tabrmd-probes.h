@@ -0,0 +1,42 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef TABRMD_PROBES_H
+#define TABRMD_PROBES_H
+/*
+ * Static tracepoints (USDT) for following commands through the processing
+ * pipeline with perf, bpftrace or systemtap. All probes belong to the
+ * 'tabrmd' provider. They're only compiled in when the build is configured
+ * with --enable-usdt. Otherwise the macros expand to nothing and their
+ * arguments are never evaluated.
+ */
+#ifdef ENABLE_USDT
+#include <sys/sdt.h>
+
+#define TABRMD_PROBE_ENABLED 1
+#define TABRMD_PROBE1(name, a) \
+    DTRACE_PROBE1 (tabrmd, name, a)
+#define TABRMD_PROBE3(name, a, b, c) \
+    DTRACE_PROBE3 (tabrmd, name, a, b, c)
+#define TABRMD_PROBE4(name, a, b, c, d) \
+    DTRACE_PROBE4 (tabrmd, name, a, b, c, d)
+#else
+#define TABRMD_PROBE_ENABLED 0
+#define TABRMD_PROBE1(name, a) do {} while (0)
+#define TABRMD_PROBE3(name, a, b, c) do {} while (0)
+#define TABRMD_PROBE4(name, a, b, c, d) do {} while (0)
+#endif
+
+/* Connection ID for a Connection that may be NULL, 0 is never assigned. */
+#define TABRMD_PROBE_CONN_ID(connection) \
+    ((connection) != NULL ? (connection)->id : (guint64)0)
+/*
+ * Fire probe 'name' with the connection ID, command code and size from a
+ * Tpm2Command. These are read straight from the object to avoid taking a
+ * reference on the Connection.
+ */
+#define TABRMD_PROBE_COMMAND(name, command) \
+    TABRMD_PROBE3 (name, \
+                   TABRMD_PROBE_CONN_ID ((command)->connection), \
+                   tpm2_command_get_code (command), \
+                   (command)->buffer_size)
+
+#endif /* TABRMD_PROBES_H */
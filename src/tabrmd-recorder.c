@@ -0,0 +1,295 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "tabrmd-recorder.h"
+
+G_STATIC_ASSERT (sizeof (tabrmd_recorder_header_t) == 32);
+G_STATIC_ASSERT (sizeof (tabrmd_recorder_event_t) == 80);
+
+/* everything in an event after the sequence number */
+#define EVENT_BODY_OFFSET G_STRUCT_OFFSET (tabrmd_recorder_event_t, time)
+#define EVENT_BODY_SIZE   (sizeof (tabrmd_recorder_event_t) - EVENT_BODY_OFFSET)
+
+/*
+ * The ring is mapped rather than allocated so it sits on its own pages in
+ * the same layout as a dump: it can be found by its magic in a core file.
+ * Dumps triggered by critical messages are limited to one a second.
+ */
+typedef struct {
+    tabrmd_recorder_header_t *ring;
+    gsize                     size;
+    gchar                    *dump_path;
+    gint64                    last_critical_dump;
+} tabrmd_recorder_t;
+
+static tabrmd_recorder_t recorder;
+
+static inline tabrmd_recorder_event_t*
+recorder_events (tabrmd_recorder_header_t *ring)
+{
+    return (tabrmd_recorder_event_t*)(ring + 1);
+}
+/*
+ * Map a ring with room for 'capacity' events, replacing any previous
+ * ring. A capacity of 0 disables recording. Dumps triggered by SIGUSR1 or
+ * a critical message are written to 'dump_path', they're disabled if it's
+ * NULL.
+ */
+gboolean
+tabrmd_recorder_init (guint capacity,
+                      const gchar *dump_path)
+{
+    tabrmd_recorder_header_t *ring;
+    gsize size;
+
+    tabrmd_recorder_cleanup ();
+    recorder.dump_path = g_strdup (dump_path);
+    if (capacity == 0) {
+        return TRUE;
+    }
+    size = sizeof (tabrmd_recorder_header_t) +
+        (gsize)capacity * sizeof (tabrmd_recorder_event_t);
+    ring = mmap (NULL, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        g_warning ("%s: failed to map %zu bytes: %s", __func__, size,
+                   strerror (errno));
+        return FALSE;
+    }
+    ring->magic = TABRMD_RECORDER_MAGIC;
+    ring->version = TABRMD_RECORDER_VERSION;
+    ring->event_size = sizeof (tabrmd_recorder_event_t);
+    ring->capacity = capacity;
+    ring->event_count = capacity;
+    ring->next = 1;
+    recorder.size = size;
+    __atomic_store_n (&recorder.ring, ring, __ATOMIC_RELEASE);
+    return TRUE;
+}
+/*
+ * Unmap the ring. The pipeline threads must have been stopped.
+ */
+void
+tabrmd_recorder_cleanup (void)
+{
+    tabrmd_recorder_header_t *ring;
+
+    ring = __atomic_exchange_n (&recorder.ring, NULL, __ATOMIC_ACQ_REL);
+    if (ring != NULL) {
+        munmap (ring, recorder.size);
+    }
+    g_clear_pointer (&recorder.dump_path, g_free);
+    memset (&recorder, 0, sizeof (recorder));
+}
+gboolean
+tabrmd_recorder_enabled (void)
+{
+    return __atomic_load_n (&recorder.ring, __ATOMIC_ACQUIRE) != NULL;
+}
+/*
+ * Copy 'event' into the next slot of the ring. Each slot is a seqlock: its
+ * sequence number is cleared while the event is being copied in so that
+ * tabrmd_recorder_snapshot can skip it.
+ */
+void
+tabrmd_recorder_record (tabrmd_recorder_event_t *event)
+{
+    tabrmd_recorder_header_t *ring;
+    tabrmd_recorder_event_t *slot;
+    guint64 sequence;
+
+    ring = __atomic_load_n (&recorder.ring, __ATOMIC_ACQUIRE);
+    if (ring == NULL) {
+        return;
+    }
+    sequence = __atomic_fetch_add (&ring->next, 1, __ATOMIC_RELAXED);
+    slot = &recorder_events (ring) [sequence % ring->capacity];
+    __atomic_store_n (&slot->sequence, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+    memcpy ((guint8*)slot + EVENT_BODY_OFFSET,
+            (guint8*)event + EVENT_BODY_OFFSET,
+            EVENT_BODY_SIZE);
+    __atomic_store_n (&slot->sequence, sequence, __ATOMIC_RELEASE);
+}
+/*
+ * Return a dump of the ring: the header followed by the events it holds,
+ * oldest first. Events being recorded while the snapshot is taken are left
+ * out. Returns NULL if recording is disabled.
+ */
+GBytes*
+tabrmd_recorder_snapshot (void)
+{
+    tabrmd_recorder_header_t *ring, *header;
+    tabrmd_recorder_event_t *slot, *events;
+    guint64 first, next, sequence;
+    guint32 count = 0;
+
+    ring = __atomic_load_n (&recorder.ring, __ATOMIC_ACQUIRE);
+    if (ring == NULL) {
+        return NULL;
+    }
+    next = __atomic_load_n (&ring->next, __ATOMIC_ACQUIRE);
+    first = next > ring->capacity ? next - ring->capacity : 1;
+    header = g_malloc0 (sizeof (*header) + (next - first) * sizeof (*events));
+    events = recorder_events (header);
+    for (sequence = first; sequence < next; ++sequence) {
+        slot = &recorder_events (ring) [sequence % ring->capacity];
+        if (__atomic_load_n (&slot->sequence, __ATOMIC_ACQUIRE) != sequence) {
+            continue;
+        }
+        memcpy ((guint8*)&events [count] + EVENT_BODY_OFFSET,
+                (guint8*)slot + EVENT_BODY_OFFSET,
+                EVENT_BODY_SIZE);
+        __atomic_thread_fence (__ATOMIC_ACQUIRE);
+        if (__atomic_load_n (&slot->sequence, __ATOMIC_RELAXED) != sequence) {
+            continue;
+        }
+        events [count++].sequence = sequence;
+    }
+    header->magic = TABRMD_RECORDER_MAGIC;
+    header->version = TABRMD_RECORDER_VERSION;
+    header->event_size = sizeof (tabrmd_recorder_event_t);
+    header->capacity = ring->capacity;
+    header->event_count = count;
+    header->next = next;
+    header->time = g_get_real_time ();
+    return g_bytes_new_take (header,
+                             sizeof (*header) + count * sizeof (*events));
+}
+/*
+ * Write 'bytes' to a temporary file next to 'path' then rename it so that
+ * readers never see a partial dump.
+ */
+static gboolean
+recorder_write_bytes (const gchar *path,
+                      GBytes *bytes,
+                      GError **error)
+{
+    const guint8 *data;
+    gsize size;
+    gssize written;
+    gchar *tmp_path;
+    gint fd, saved_errno;
+
+    tmp_path = g_strconcat (path, ".tmp", NULL);
+    fd = open (tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW,
+               0600);
+    if (fd < 0) {
+        goto err_out;
+    }
+    data = g_bytes_get_data (bytes, &size);
+    while (size > 0) {
+        written = write (fd, data, size);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written < 0) {
+            goto err_close;
+        }
+        data += written;
+        size -= written;
+    }
+    if (close (fd) != 0) {
+        fd = -1;
+        goto err_close;
+    }
+    if (rename (tmp_path, path) != 0) {
+        fd = -1;
+        goto err_close;
+    }
+    g_free (tmp_path);
+    return TRUE;
+
+err_close:
+    saved_errno = errno;
+    if (fd >= 0) {
+        close (fd);
+    }
+    unlink (tmp_path);
+    errno = saved_errno;
+err_out:
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                 "failed to write %s: %s", tmp_path, strerror (errno));
+    g_free (tmp_path);
+    return FALSE;
+}
+/*
+ * Write a snapshot of the ring to 'path'.
+ */
+gboolean
+tabrmd_recorder_write (const gchar *path,
+                       GError **error)
+{
+    GBytes *bytes;
+    gboolean ret;
+
+    bytes = tabrmd_recorder_snapshot ();
+    if (bytes == NULL) {
+        g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+                     "flight recorder is disabled");
+        return FALSE;
+    }
+    ret = recorder_write_bytes (path, bytes, error);
+    g_bytes_unref (bytes);
+    return ret;
+}
+/*
+ * Write a snapshot of the ring to the dump file. 'reason' says what
+ * triggered the dump. This doesn't log: it's called from inside the log
+ * handler. Returns a message describing the outcome for the caller to log,
+ * free it with g_free.
+ */
+gchar*
+tabrmd_recorder_dump (const gchar *reason)
+{
+    GError *error = NULL;
+    gchar *message;
+
+    if (recorder.dump_path == NULL) {
+        return g_strdup_printf ("flight recorder dump on %s: no dump file "
+                                "configured", reason);
+    }
+    if (!tabrmd_recorder_write (recorder.dump_path, &error)) {
+        message = g_strdup_printf ("flight recorder dump on %s: %s", reason,
+                                   error->message);
+        g_clear_error (&error);
+        return message;
+    }
+    return g_strdup_printf ("flight recorder dumped to %s on %s",
+                            recorder.dump_path, reason);
+}
+/*
+ * Called by the logger for each critical or error message. A burst of
+ * critical messages only triggers a single dump. Returns the outcome of
+ * the dump for the logger to write out or NULL if there was no dump.
+ */
+gchar*
+tabrmd_recorder_on_critical (void)
+{
+    gint64 now, last;
+
+    if (recorder.dump_path == NULL || !tabrmd_recorder_enabled ()) {
+        return NULL;
+    }
+    now = g_get_monotonic_time ();
+    last = __atomic_load_n (&recorder.last_critical_dump, __ATOMIC_RELAXED);
+    if (last != 0 && now - last < G_USEC_PER_SEC) {
+        return NULL;
+    }
+    if (!__atomic_compare_exchange_n (&recorder.last_critical_dump,
+                                      &last,
+                                      now,
+                                      FALSE,
+                                      __ATOMIC_RELAXED,
+                                      __ATOMIC_RELAXED))
+    {
+        return NULL;
+    }
+    return tabrmd_recorder_dump ("critical message");
+}
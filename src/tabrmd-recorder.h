@@ -0,0 +1,67 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef TABRMD_RECORDER_H
+#define TABRMD_RECORDER_H
+
+#include <glib.h>
+
+#include "tabrmd-stats.h"
+
+G_BEGIN_DECLS
+
+#define TABRMD_RECORDER_MAGIC          0x31524654 /* "TFR1" */
+#define TABRMD_RECORDER_VERSION        1
+#define TABRMD_RECORDER_HANDLES_MAX    3
+
+/*
+ * The flight recorder keeps the last N commands processed by the daemon in
+ * a fixed size ring. Recording an event is a copy into the next slot, no
+ * lock is taken and nothing is formatted, so it's always on.
+ *
+ * The ring and a dump of it share one binary layout: a header followed by
+ * 'event_count' events. A dump holds only valid events, oldest first, so
+ * it can be mapped and read as an array. Integers are in host byte order,
+ * readers can tell from the magic.
+ */
+typedef struct {
+    guint32 magic;
+    guint16 version;
+    guint16 event_size;
+    guint32 capacity;     /* slots in the ring */
+    guint32 event_count;  /* events following the header */
+    guint64 next;         /* sequence number of the next event */
+    gint64  time;         /* g_get_real_time () of the dump */
+} tabrmd_recorder_header_t;
+
+/*
+ * One command. 'sequence' is 0 for an empty slot. Stage times are in
+ * microseconds as returned by tabrmd_timeline_stage_usec, -1 for stages
+ * the command skipped. The handles are the ones in the command's handle
+ * area as sent by the client. 'connection_id' is the connection's number
+ * from connection_get_number, never the ID clients use with the D-Bus API:
+ * dumps are handed to any client that asks.
+ */
+typedef struct {
+    guint64 sequence;
+    gint64  time;         /* g_get_real_time () when the command was read */
+    guint64 connection_id;
+    guint32 command_code;
+    guint32 response_code;
+    gint32  total_usec;
+    gint32  stage_usec [TABRMD_STAGE_MAX];
+    guint32 handle_count;
+    guint32 handles [TABRMD_RECORDER_HANDLES_MAX];
+} tabrmd_recorder_event_t;
+
+gboolean  tabrmd_recorder_init        (guint               capacity,
+                                       const gchar        *dump_path);
+void      tabrmd_recorder_cleanup     (void);
+gboolean  tabrmd_recorder_enabled     (void);
+void      tabrmd_recorder_record      (tabrmd_recorder_event_t *event);
+GBytes*   tabrmd_recorder_snapshot    (void);
+gboolean  tabrmd_recorder_write       (const gchar        *path,
+                                       GError            **error);
+gchar*    tabrmd_recorder_dump        (const gchar        *reason);
+gchar*    tabrmd_recorder_on_critical (void);
+
+G_END_DECLS
+#endif /* TABRMD_RECORDER_H */
@@ -0,0 +1,522 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#include <inttypes.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "tabrmd-stats.h"
+
+#define STATS_INC(field) __atomic_add_fetch (&(field), 1, __ATOMIC_RELAXED)
+#define STATS_GET(field) __atomic_load_n (&(field), __ATOMIC_RELAXED)
+/*
+ * Format one TPM response codes carry the number of the handle, parameter
+ * or session that caused the error. We strip these bits so that the same
+ * error reported against different parameters is counted once.
+ */
+#define RC_FMT1      0x080U
+#define RC_N_MASK    0xf00U
+#define RC_P         0x040U
+#define RC_LAYER_SHIFT 16
+
+static tabrmd_stats_t tabrmd_stats;
+
+/*
+ * Each statistic has a name used in the GetStatistics dictionary and a
+ * name and help string used for the Prometheus text exposition format.
+ */
+typedef struct {
+    const char *name;
+    const char *metric;
+    const char *help;
+} stats_name_t;
+
+static const stats_name_t counter_names [TABRMD_STATS_COUNTER_MAX] = {
+    [TABRMD_STATS_CONTEXT_LOAD] = {
+        "context.loads", "tabrmd_context_loads_total",
+        "Contexts loaded into the TPM by the resource manager." },
+    [TABRMD_STATS_CONTEXT_SAVE] = {
+        "context.saves", "tabrmd_context_saves_total",
+        "Contexts saved from the TPM by the resource manager." },
+    [TABRMD_STATS_CONTEXT_FLUSH] = {
+        "context.flushes", "tabrmd_context_flushes_total",
+        "Contexts flushed from the TPM by the resource manager." },
+    [TABRMD_STATS_REGAP] = {
+        "context.regaps", "tabrmd_context_regaps_total",
+        "TPM2_RC_CONTEXT_GAP responses handled by re-gapping sessions." },
+    [TABRMD_STATS_QUOTA_REJECT] = {
+        "quota.rejections", "tabrmd_quota_rejections_total",
+        "Commands rejected for exceeding a per connection quota." },
+    [TABRMD_STATS_CONNECTION_TOTAL] = {
+        "connections.total", "tabrmd_connections_created_total",
+        "Client connections created." },
+    [TABRMD_STATS_SESSION_ABANDONED] = {
+        "sessions.abandoned", "tabrmd_sessions_abandoned_total",
+        "Sessions abandoned by closed connections." },
+    [TABRMD_STATS_LOG_DROPPED] = {
+        "log.dropped", "tabrmd_log_dropped_total",
+        "Log messages dropped because the logger thread fell behind." },
+};
+static const char* const session_names [TABRMD_STATS_SESSION_STATES] = {
+    [SESSION_ENTRY_LOADED]              = "loaded",
+    [SESSION_ENTRY_SAVED_RM]            = "saved-rm",
+    [SESSION_ENTRY_SAVED_CLIENT]        = "saved-client",
+    [SESSION_ENTRY_SAVED_CLIENT_CLOSED] = "saved-client-closed",
+};
+static const stats_name_t hist_names [TABRMD_STATS_HIST_MAX] = {
+    [TABRMD_STATS_HIST_LOAD_HANDLES] = {
+        NULL, "tabrmd_load_handles_duration_seconds",
+        "Time spent loading the contexts for the handles in a command." },
+    [TABRMD_STATS_HIST_SAVE_CONTEXTS] = {
+        NULL, "tabrmd_save_contexts_duration_seconds",
+        "Time spent saving and flushing contexts after a command." },
+    [TABRMD_STATS_HIST_COMMAND] = {
+        NULL, "tabrmd_command_duration_seconds",
+        "Time from reading a command to writing its response." },
+};
+/*
+ * Stages are named for the work done in the time leading up to them.
+ * TABRMD_STAGE_READ starts the timeline so there's nothing to measure.
+ */
+static const char* const stage_names [TABRMD_STAGE_MAX] = {
+    [TABRMD_STAGE_READ]         = NULL,
+    [TABRMD_STAGE_DEQUEUE]      = "queue",
+    [TABRMD_STAGE_LOADED]       = "load",
+    [TABRMD_STAGE_TPM_SENT]     = "dispatch",
+    [TABRMD_STAGE_TPM_RECEIVED] = "tpm",
+    [TABRMD_STAGE_SAVED]        = "save",
+    [TABRMD_STAGE_WRITTEN]      = "write",
+};
+/*
+ * Count a command received by the ResourceManager.
+ */
+void
+tabrmd_stats_command (TPM2_CC command_code)
+{
+    if (command_code >= TABRMD_STATS_CC_FIRST &&
+        command_code - TABRMD_STATS_CC_FIRST < TABRMD_STATS_CC_COUNT)
+    {
+        STATS_INC (tabrmd_stats.commands [command_code - TABRMD_STATS_CC_FIRST]);
+    } else {
+        STATS_INC (tabrmd_stats.commands_other);
+    }
+}
+TSS2_RC
+tabrmd_stats_normalize_rc (TSS2_RC response_code)
+{
+    if (response_code >> RC_LAYER_SHIFT == 0 && response_code & RC_FMT1) {
+        return response_code & ~(RC_N_MASK | RC_P);
+    }
+    return response_code;
+}
+/*
+ * Count a response sent back to a client. The slot for a response code is
+ * claimed with a CAS on the key (RC + 1 so that 0 means empty) and is never
+ * released. Collisions are resolved by linear probing.
+ */
+void
+tabrmd_stats_response (TSS2_RC response_code)
+{
+    guint64 key = (guint64)tabrmd_stats_normalize_rc (response_code) + 1;
+    guint64 expected;
+    size_t i, slot;
+
+    slot = (size_t)(key * 0x9e3779b97f4a7c15ULL >> 58);
+    for (i = 0; i < TABRMD_STATS_RC_SLOTS; ++i) {
+        tabrmd_stats_rc_t *entry =
+            &tabrmd_stats.responses [(slot + i) % TABRMD_STATS_RC_SLOTS];
+        expected = __atomic_load_n (&entry->key, __ATOMIC_ACQUIRE);
+        if (expected == 0) {
+            __atomic_compare_exchange_n (&entry->key,
+                                         &expected,
+                                         key,
+                                         FALSE,
+                                         __ATOMIC_ACQ_REL,
+                                         __ATOMIC_ACQUIRE);
+            /* on failure 'expected' holds the key that won the race */
+            if (expected == 0) {
+                expected = key;
+            }
+        }
+        if (expected == key) {
+            STATS_INC (entry->count);
+            return;
+        }
+    }
+    STATS_INC (tabrmd_stats.responses_other);
+}
+void
+tabrmd_stats_inc (TabrmdStatsCounter counter)
+{
+    g_return_if_fail (counter < TABRMD_STATS_COUNTER_MAX);
+    STATS_INC (tabrmd_stats.counters [counter]);
+}
+/*
+ * Track the number of messages waiting in the ResourceManager input queue
+ * and the high water mark.
+ */
+void
+tabrmd_stats_queue (gint delta)
+{
+    guint64 depth, max;
+
+    depth = __atomic_add_fetch (&tabrmd_stats.queue_depth,
+                                (guint64)(gint64)delta,
+                                __ATOMIC_RELAXED);
+    if (delta <= 0) {
+        return;
+    }
+    max = __atomic_load_n (&tabrmd_stats.queue_depth_max, __ATOMIC_RELAXED);
+    while (depth > max &&
+           !__atomic_compare_exchange_n (&tabrmd_stats.queue_depth_max,
+                                         &max,
+                                         depth,
+                                         TRUE,
+                                         __ATOMIC_RELAXED,
+                                         __ATOMIC_RELAXED));
+}
+void
+tabrmd_stats_connection (gint delta)
+{
+    __atomic_add_fetch (&tabrmd_stats.connections,
+                        (guint64)(gint64)delta,
+                        __ATOMIC_RELAXED);
+    if (delta > 0) {
+        STATS_INC (tabrmd_stats.counters [TABRMD_STATS_CONNECTION_TOTAL]);
+    }
+}
+/*
+ * Move a session from one state to another. A negative 'old_state' is used
+ * for a new session, a negative 'new_state' for one that's gone away.
+ */
+void
+tabrmd_stats_session_state (gint old_state,
+                            gint new_state)
+{
+    if (old_state == new_state) {
+        return;
+    }
+    if (old_state >= 0 && old_state < TABRMD_STATS_SESSION_STATES) {
+        __atomic_sub_fetch (&tabrmd_stats.sessions [old_state],
+                            1,
+                            __ATOMIC_RELAXED);
+    }
+    if (new_state >= 0 && new_state < TABRMD_STATS_SESSION_STATES) {
+        STATS_INC (tabrmd_stats.sessions [new_state]);
+    }
+}
+/*
+ * Map a duration in microseconds to its histogram bucket: the smallest 'i'
+ * such that usec <= 2^i, clamped to the last bucket.
+ */
+guint
+tabrmd_stats_hist_bucket (gint64 usec)
+{
+    guint bucket;
+
+    if (usec <= 1) {
+        return 0;
+    }
+    bucket = 64 - (guint)__builtin_clzll ((guint64)usec - 1);
+    return MIN (bucket, TABRMD_STATS_HIST_BUCKETS - 1);
+}
+static void
+stats_hist_observe (tabrmd_stats_hist_t *hist,
+                    gint64 usec)
+{
+    if (usec < 0) {
+        usec = 0;
+    }
+    STATS_INC (hist->buckets [tabrmd_stats_hist_bucket (usec)]);
+    __atomic_add_fetch (&hist->sum, (guint64)usec, __ATOMIC_RELAXED);
+    STATS_INC (hist->count);
+}
+void
+tabrmd_stats_observe (TabrmdStatsHistogram hist,
+                      gint64 usec)
+{
+    g_return_if_fail (hist < TABRMD_STATS_HIST_MAX);
+    stats_hist_observe (&tabrmd_stats.hists [hist], usec);
+}
+void
+tabrmd_stats_observe_stage (TabrmdStage stage,
+                            gint64 usec)
+{
+    g_return_if_fail (stage > TABRMD_STAGE_READ && stage < TABRMD_STAGE_MAX);
+    stats_hist_observe (&tabrmd_stats.stages [stage], usec);
+}
+const char*
+tabrmd_stats_stage_name (TabrmdStage stage)
+{
+    g_return_val_if_fail (stage < TABRMD_STAGE_MAX, NULL);
+    return stage_names [stage];
+}
+/*
+ * Record the time the TPM took to execute a command.
+ */
+void
+tabrmd_stats_observe_tpm (TPM2_CC command_code,
+                          gint64 usec)
+{
+    if (command_code >= TABRMD_STATS_CC_FIRST &&
+        command_code - TABRMD_STATS_CC_FIRST < TABRMD_STATS_CC_COUNT)
+    {
+        stats_hist_observe (
+            &tabrmd_stats.tpm [command_code - TABRMD_STATS_CC_FIRST], usec);
+    } else {
+        stats_hist_observe (&tabrmd_stats.tpm_other, usec);
+    }
+}
+static void
+stats_hist_snapshot (tabrmd_stats_hist_t *dest,
+                     tabrmd_stats_hist_t *src)
+{
+    size_t i;
+
+    for (i = 0; i < TABRMD_STATS_HIST_BUCKETS; ++i) {
+        dest->buckets [i] = STATS_GET (src->buckets [i]);
+    }
+    dest->sum = STATS_GET (src->sum);
+    dest->count = STATS_GET (src->count);
+}
+/*
+ * Copy the current value of each statistic into the caller provided
+ * structure.
+ */
+void
+tabrmd_stats_snapshot (tabrmd_stats_t *stats)
+{
+    size_t i;
+
+    g_return_if_fail (stats != NULL);
+    for (i = 0; i < TABRMD_STATS_CC_COUNT; ++i) {
+        stats->commands [i] = STATS_GET (tabrmd_stats.commands [i]);
+    }
+    stats->commands_other = STATS_GET (tabrmd_stats.commands_other);
+    for (i = 0; i < TABRMD_STATS_RC_SLOTS; ++i) {
+        stats->responses [i].key = STATS_GET (tabrmd_stats.responses [i].key);
+        stats->responses [i].count =
+            STATS_GET (tabrmd_stats.responses [i].count);
+    }
+    stats->responses_other = STATS_GET (tabrmd_stats.responses_other);
+    for (i = 0; i < TABRMD_STATS_COUNTER_MAX; ++i) {
+        stats->counters [i] = STATS_GET (tabrmd_stats.counters [i]);
+    }
+    stats->queue_depth = STATS_GET (tabrmd_stats.queue_depth);
+    stats->queue_depth_max = STATS_GET (tabrmd_stats.queue_depth_max);
+    stats->connections = STATS_GET (tabrmd_stats.connections);
+    for (i = 0; i < TABRMD_STATS_SESSION_STATES; ++i) {
+        stats->sessions [i] = STATS_GET (tabrmd_stats.sessions [i]);
+    }
+    for (i = 0; i < TABRMD_STATS_CC_COUNT; ++i) {
+        stats_hist_snapshot (&stats->tpm [i], &tabrmd_stats.tpm [i]);
+    }
+    stats_hist_snapshot (&stats->tpm_other, &tabrmd_stats.tpm_other);
+    for (i = 0; i < TABRMD_STATS_HIST_MAX; ++i) {
+        stats_hist_snapshot (&stats->hists [i], &tabrmd_stats.hists [i]);
+    }
+    for (i = 0; i < TABRMD_STAGE_MAX; ++i) {
+        stats_hist_snapshot (&stats->stages [i], &tabrmd_stats.stages [i]);
+    }
+}
+/*
+ * Build the a{st} dictionary returned by the GetStatistics D-Bus method.
+ * Per command and per response code entries are only included once they
+ * have been seen.
+ */
+GVariant*
+tabrmd_stats_to_variant (void)
+{
+    GVariantBuilder builder;
+    tabrmd_stats_t *stats = g_new0 (tabrmd_stats_t, 1);
+    gchar key [sizeof ("sessions.saved-client-closed")];
+    size_t i;
+
+    tabrmd_stats_snapshot (stats);
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{st}"));
+    for (i = 0; i < TABRMD_STATS_CC_COUNT; ++i) {
+        if (stats->commands [i] == 0) {
+            continue;
+        }
+        g_snprintf (key, sizeof (key), "commands.0x%08" PRIx32,
+                    (uint32_t)(TABRMD_STATS_CC_FIRST + i));
+        g_variant_builder_add (&builder, "{st}", key, stats->commands [i]);
+    }
+    g_variant_builder_add (&builder, "{st}", "commands.other",
+                           stats->commands_other);
+    for (i = 0; i < TABRMD_STATS_RC_SLOTS; ++i) {
+        if (stats->responses [i].key == 0) {
+            continue;
+        }
+        g_snprintf (key, sizeof (key), "responses.0x%08" PRIx32,
+                    (uint32_t)(stats->responses [i].key - 1));
+        g_variant_builder_add (&builder, "{st}", key,
+                               stats->responses [i].count);
+    }
+    g_variant_builder_add (&builder, "{st}", "responses.other",
+                           stats->responses_other);
+    for (i = 0; i < TABRMD_STATS_COUNTER_MAX; ++i) {
+        g_variant_builder_add (&builder, "{st}", counter_names [i].name,
+                               stats->counters [i]);
+    }
+    g_variant_builder_add (&builder, "{st}", "queue.depth",
+                           stats->queue_depth);
+    g_variant_builder_add (&builder, "{st}", "queue.depth-max",
+                           stats->queue_depth_max);
+    g_variant_builder_add (&builder, "{st}", "connections",
+                           stats->connections);
+    for (i = 0; i < TABRMD_STATS_SESSION_STATES; ++i) {
+        g_snprintf (key, sizeof (key), "sessions.%s", session_names [i]);
+        g_variant_builder_add (&builder, "{st}", key, stats->sessions [i]);
+    }
+    g_free (stats);
+
+    return g_variant_builder_end (&builder);
+}
+static void
+prometheus_header (GString *out,
+                   const char *metric,
+                   const char *type,
+                   const char *help)
+{
+    g_string_append_printf (out, "# HELP %s %s\n# TYPE %s %s\n",
+                            metric, help, metric, type);
+}
+/*
+ * Append the samples for one histogram. Prometheus buckets are cumulative
+ * and bounds are in seconds. 'label' is either NULL or a label pair added
+ * to every sample.
+ */
+static void
+prometheus_hist (GString *out,
+                 const char *metric,
+                 const char *label,
+                 tabrmd_stats_hist_t *hist)
+{
+    const char *sep = label != NULL ? "," : "";
+    guint64 total = 0;
+    size_t i;
+
+    if (label == NULL) {
+        label = "";
+    }
+    for (i = 0; i < TABRMD_STATS_HIST_BUCKETS - 1; ++i) {
+        total += hist->buckets [i];
+        g_string_append_printf (out, "%s_bucket{%s%sle=\"%.6f\"} %" PRIu64
+                                "\n", metric, label, sep,
+                                (double)(1ULL << i) / 1e6, total);
+    }
+    total += hist->buckets [i];
+    g_string_append_printf (out, "%s_bucket{%s%sle=\"+Inf\"} %" PRIu64 "\n",
+                            metric, label, sep, total);
+    if (*label != '\0') {
+        g_string_append_printf (out, "%s_sum{%s} %.6f\n%s_count{%s} %" PRIu64
+                                "\n", metric, label, (double)hist->sum / 1e6,
+                                metric, label, hist->count);
+    } else {
+        g_string_append_printf (out, "%s_sum %.6f\n%s_count %" PRIu64 "\n",
+                                metric, (double)hist->sum / 1e6,
+                                metric, hist->count);
+    }
+}
+/*
+ * Render every statistic in the Prometheus text exposition format. The
+ * caller must free the returned string.
+ */
+gchar*
+tabrmd_stats_to_prometheus (void)
+{
+    tabrmd_stats_t *stats = g_new0 (tabrmd_stats_t, 1);
+    GString *out = g_string_sized_new (4096);
+    gchar label [sizeof ("code=\"0x00000000\"")];
+    size_t i;
+
+    tabrmd_stats_snapshot (stats);
+    prometheus_header (out, "tabrmd_commands_total", "counter",
+                       "Commands received from clients by command code.");
+    for (i = 0; i < TABRMD_STATS_CC_COUNT; ++i) {
+        if (stats->commands [i] != 0) {
+            g_string_append_printf (out, "tabrmd_commands_total{code=\"0x%08"
+                                    PRIx32 "\"} %" PRIu64 "\n",
+                                    (uint32_t)(TABRMD_STATS_CC_FIRST + i),
+                                    stats->commands [i]);
+        }
+    }
+    g_string_append_printf (out, "tabrmd_commands_total{code=\"other\"} %"
+                            PRIu64 "\n", stats->commands_other);
+    prometheus_header (out, "tabrmd_responses_total", "counter",
+                       "Responses sent to clients by response code.");
+    for (i = 0; i < TABRMD_STATS_RC_SLOTS; ++i) {
+        if (stats->responses [i].key != 0) {
+            g_string_append_printf (out, "tabrmd_responses_total{code=\"0x%08"
+                                    PRIx32 "\"} %" PRIu64 "\n",
+                                    (uint32_t)(stats->responses [i].key - 1),
+                                    stats->responses [i].count);
+        }
+    }
+    g_string_append_printf (out, "tabrmd_responses_total{code=\"other\"} %"
+                            PRIu64 "\n", stats->responses_other);
+    for (i = 0; i < TABRMD_STATS_COUNTER_MAX; ++i) {
+        prometheus_header (out, counter_names [i].metric, "counter",
+                           counter_names [i].help);
+        g_string_append_printf (out, "%s %" PRIu64 "\n",
+                                counter_names [i].metric,
+                                stats->counters [i]);
+    }
+    prometheus_header (out, "tabrmd_queue_depth", "gauge",
+                       "Messages waiting for the resource manager.");
+    g_string_append_printf (out, "tabrmd_queue_depth %" PRIu64 "\n",
+                            stats->queue_depth);
+    prometheus_header (out, "tabrmd_queue_depth_max", "gauge",
+                       "Most messages ever waiting for the resource manager.");
+    g_string_append_printf (out, "tabrmd_queue_depth_max %" PRIu64 "\n",
+                            stats->queue_depth_max);
+    prometheus_header (out, "tabrmd_connections", "gauge",
+                       "Open client connections.");
+    g_string_append_printf (out, "tabrmd_connections %" PRIu64 "\n",
+                            stats->connections);
+    prometheus_header (out, "tabrmd_sessions", "gauge",
+                       "Sessions tracked by the resource manager by state.");
+    for (i = 0; i < TABRMD_STATS_SESSION_STATES; ++i) {
+        g_string_append_printf (out, "tabrmd_sessions{state=\"%s\"} %"
+                                PRIu64 "\n", session_names [i],
+                                stats->sessions [i]);
+    }
+    prometheus_header (out, "tabrmd_tpm_duration_seconds", "histogram",
+                       "Time the TPM took to execute commands by command "
+                       "code.");
+    for (i = 0; i < TABRMD_STATS_CC_COUNT; ++i) {
+        if (stats->tpm [i].count == 0) {
+            continue;
+        }
+        g_snprintf (label, sizeof (label), "code=\"0x%08" PRIx32 "\"",
+                    (uint32_t)(TABRMD_STATS_CC_FIRST + i));
+        prometheus_hist (out, "tabrmd_tpm_duration_seconds", label,
+                         &stats->tpm [i]);
+    }
+    prometheus_hist (out, "tabrmd_tpm_duration_seconds", "code=\"other\"",
+                     &stats->tpm_other);
+    for (i = 0; i < TABRMD_STATS_HIST_MAX; ++i) {
+        prometheus_header (out, hist_names [i].metric, "histogram",
+                           hist_names [i].help);
+        prometheus_hist (out, hist_names [i].metric, NULL, &stats->hists [i]);
+    }
+    prometheus_header (out, "tabrmd_stage_duration_seconds", "histogram",
+                       "Time commands spent in each stage of the pipeline.");
+    for (i = TABRMD_STAGE_READ + 1; i < TABRMD_STAGE_MAX; ++i) {
+        g_snprintf (label, sizeof (label), "stage=\"%s\"", stage_names [i]);
+        prometheus_hist (out, "tabrmd_stage_duration_seconds", label,
+                         &stats->stages [i]);
+    }
+    g_free (stats);
+
+    return g_string_free (out, FALSE);
+}
+/*
+ * Clear all statistics. This is only safe when no other thread is
+ * updating them.
+ */
+void
+tabrmd_stats_reset (void)
+{
+    memset (&tabrmd_stats, 0, sizeof (tabrmd_stats));
+}
@@ -0,0 +1,127 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef TABRMD_STATS_H
+#define TABRMD_STATS_H
+
+#include <glib.h>
+#include <tss2/tss2_tpm2_types.h>
+
+#include "session-entry-state-enum.h"
+
+G_BEGIN_DECLS
+
+/*
+ * Commands are counted in a table indexed by command code. TPM2_CC values
+ * are dense from TPM2_CC_FIRST so this covers every command in the spec
+ * with room to spare. Anything outside the table (vendor commands, junk
+ * from a misbehaving client) is counted in a single 'other' bucket.
+ */
+#define TABRMD_STATS_CC_FIRST  TPM2_CC_FIRST
+#define TABRMD_STATS_CC_COUNT  0x80
+/*
+ * Response codes are counted in a small open addressed hash table. Format
+ * one response codes from the TPM are normalized by removing the handle /
+ * parameter / session number so that they collapse to a single entry.
+ * Response codes that don't fit in the table are counted in 'other'.
+ */
+#define TABRMD_STATS_RC_SLOTS  64
+#define TABRMD_STATS_SESSION_STATES (SESSION_ENTRY_SAVED_CLIENT_CLOSED + 1)
+
+/*
+ * Monotonic counters maintained by the pipeline threads.
+ */
+typedef enum {
+    TABRMD_STATS_CONTEXT_LOAD,
+    TABRMD_STATS_CONTEXT_SAVE,
+    TABRMD_STATS_CONTEXT_FLUSH,
+    TABRMD_STATS_REGAP,
+    TABRMD_STATS_QUOTA_REJECT,
+    TABRMD_STATS_CONNECTION_TOTAL,
+    TABRMD_STATS_SESSION_ABANDONED,
+    TABRMD_STATS_LOG_DROPPED,
+    TABRMD_STATS_COUNTER_MAX,
+} TabrmdStatsCounter;
+
+/*
+ * Latency histograms. Bucket 'i' counts observations of up to 2^i
+ * microseconds, the last bucket everything larger.
+ */
+#define TABRMD_STATS_HIST_BUCKETS 24
+
+typedef enum {
+    TABRMD_STATS_HIST_LOAD_HANDLES,
+    TABRMD_STATS_HIST_SAVE_CONTEXTS,
+    TABRMD_STATS_HIST_COMMAND,
+    TABRMD_STATS_HIST_MAX,
+} TabrmdStatsHistogram;
+
+/*
+ * Points in the pipeline at which a command is timestamped, see
+ * tabrmd-timeline.h. Each stage after TABRMD_STAGE_READ has a histogram
+ * of the time a command took to reach it.
+ */
+typedef enum {
+    TABRMD_STAGE_READ,
+    TABRMD_STAGE_DEQUEUE,
+    TABRMD_STAGE_LOADED,
+    TABRMD_STAGE_TPM_SENT,
+    TABRMD_STAGE_TPM_RECEIVED,
+    TABRMD_STAGE_SAVED,
+    TABRMD_STAGE_WRITTEN,
+    TABRMD_STAGE_MAX,
+} TabrmdStage;
+
+typedef struct {
+    guint64 buckets [TABRMD_STATS_HIST_BUCKETS];
+    guint64 sum;
+    guint64 count;
+} tabrmd_stats_hist_t;
+
+typedef struct {
+    guint64 key;
+    guint64 count;
+} tabrmd_stats_rc_t;
+/*
+ * Process wide statistics. Every field is only ever accessed through the
+ * __atomic builtins so that the threads updating them never take a lock.
+ * The values are independent: a snapshot isn't guaranteed to be
+ * consistent across fields.
+ */
+typedef struct {
+    guint64           commands [TABRMD_STATS_CC_COUNT];
+    guint64           commands_other;
+    tabrmd_stats_rc_t responses [TABRMD_STATS_RC_SLOTS];
+    guint64           responses_other;
+    guint64           counters [TABRMD_STATS_COUNTER_MAX];
+    guint64           queue_depth;
+    guint64           queue_depth_max;
+    guint64           connections;
+    guint64           sessions [TABRMD_STATS_SESSION_STATES];
+    tabrmd_stats_hist_t tpm [TABRMD_STATS_CC_COUNT];
+    tabrmd_stats_hist_t tpm_other;
+    tabrmd_stats_hist_t hists [TABRMD_STATS_HIST_MAX];
+    tabrmd_stats_hist_t stages [TABRMD_STAGE_MAX];
+} tabrmd_stats_t;
+
+void      tabrmd_stats_command        (TPM2_CC             command_code);
+void      tabrmd_stats_response       (TSS2_RC             response_code);
+void      tabrmd_stats_inc            (TabrmdStatsCounter  counter);
+void      tabrmd_stats_queue          (gint                delta);
+void      tabrmd_stats_connection     (gint                delta);
+void      tabrmd_stats_session_state  (gint                old_state,
+                                       gint                new_state);
+void      tabrmd_stats_observe        (TabrmdStatsHistogram hist,
+                                       gint64              usec);
+void      tabrmd_stats_observe_tpm    (TPM2_CC             command_code,
+                                       gint64              usec);
+void      tabrmd_stats_observe_stage  (TabrmdStage         stage,
+                                       gint64              usec);
+const char* tabrmd_stats_stage_name   (TabrmdStage         stage);
+guint     tabrmd_stats_hist_bucket    (gint64              usec);
+TSS2_RC   tabrmd_stats_normalize_rc   (TSS2_RC             response_code);
+void      tabrmd_stats_snapshot       (tabrmd_stats_t     *stats);
+GVariant* tabrmd_stats_to_variant     (void);
+gchar*    tabrmd_stats_to_prometheus  (void);
+void      tabrmd_stats_reset          (void);
+
+G_END_DECLS
+#endif /* TABRMD_STATS_H */
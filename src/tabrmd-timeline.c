@@ -0,0 +1,219 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#include <inttypes.h>
+
+#include <glib.h>
+
+#include "tabrmd-timeline.h"
+
+/*
+ * The stage each stage is measured from. Saving contexts happens in
+ * parallel with writing the response so both are measured from the
+ * response being received from the TPM. When the stage a command is
+ * measured from was skipped we fall back to the one before it.
+ */
+static const TabrmdStage stage_from [TABRMD_STAGE_MAX] = {
+    [TABRMD_STAGE_READ]         = TABRMD_STAGE_READ,
+    [TABRMD_STAGE_DEQUEUE]      = TABRMD_STAGE_READ,
+    [TABRMD_STAGE_LOADED]       = TABRMD_STAGE_DEQUEUE,
+    [TABRMD_STAGE_TPM_SENT]     = TABRMD_STAGE_LOADED,
+    [TABRMD_STAGE_TPM_RECEIVED] = TABRMD_STAGE_TPM_SENT,
+    [TABRMD_STAGE_SAVED]        = TABRMD_STAGE_TPM_RECEIVED,
+    [TABRMD_STAGE_WRITTEN]      = TABRMD_STAGE_TPM_RECEIVED,
+};
+/* commands taking at least this many microseconds are logged, 0 disables */
+static gint64 slow_threshold = 0;
+
+tabrmd_timeline_t*
+tabrmd_timeline_new (guint64 connection_id,
+                     TPM2_CC command_code,
+                     gint64 time_read)
+{
+    tabrmd_timeline_t *timeline = g_new0 (tabrmd_timeline_t, 1);
+
+    timeline->ref_count = 1;
+    timeline->connection_id = connection_id;
+    timeline->command_code = command_code;
+    timeline->stamps [TABRMD_STAGE_READ] = time_read;
+    return timeline;
+}
+tabrmd_timeline_t*
+tabrmd_timeline_ref (tabrmd_timeline_t *timeline)
+{
+    g_return_val_if_fail (timeline != NULL, NULL);
+    g_atomic_int_inc (&timeline->ref_count);
+    return timeline;
+}
+void
+tabrmd_timeline_set_slow_threshold (gint64 usec)
+{
+    __atomic_store_n (&slow_threshold, usec, __ATOMIC_RELAXED);
+}
+/*
+ * Copy the command and the time it spent in each stage into the flight
+ * recorder.
+ */
+static void
+tabrmd_timeline_record (tabrmd_timeline_t *timeline,
+                        gint64 total_usec)
+{
+    tabrmd_recorder_event_t event = { 0 };
+    guint stage, i;
+
+    if (!tabrmd_recorder_enabled ()) {
+        return;
+    }
+    event.time = g_get_real_time () -
+        (g_get_monotonic_time () - timeline->stamps [TABRMD_STAGE_READ]);
+    event.connection_id = timeline->connection_id;
+    event.command_code = timeline->command_code;
+    event.response_code = timeline->response_code;
+    event.total_usec = (gint32)MIN (total_usec, G_MAXINT32);
+    event.stage_usec [TABRMD_STAGE_READ] = -1;
+    for (stage = TABRMD_STAGE_READ + 1; stage < TABRMD_STAGE_MAX; ++stage) {
+        event.stage_usec [stage] =
+            (gint32)MIN (tabrmd_timeline_stage_usec (timeline, stage),
+                         G_MAXINT32);
+    }
+    event.handle_count = timeline->handle_count;
+    for (i = 0; i < timeline->handle_count; ++i) {
+        event.handles [i] = timeline->handles [i];
+    }
+    tabrmd_recorder_record (&event);
+}
+/*
+ * Record the time spent in each stage and log the command if it was
+ * slow. This is called by whichever thread drops the last reference so
+ * all stamps are visible.
+ */
+static void
+tabrmd_timeline_finish (tabrmd_timeline_t *timeline)
+{
+    gint64 usec, threshold;
+    gchar *breakdown;
+    guint stage;
+
+    for (stage = TABRMD_STAGE_READ + 1; stage < TABRMD_STAGE_MAX; ++stage) {
+        usec = tabrmd_timeline_stage_usec (timeline, stage);
+        if (usec >= 0) {
+            tabrmd_stats_observe_stage (stage, usec);
+        }
+    }
+    usec = tabrmd_timeline_total_usec (timeline);
+    tabrmd_timeline_record (timeline, usec);
+    if (usec < 0) {
+        return;
+    }
+    tabrmd_stats_observe (TABRMD_STATS_HIST_COMMAND, usec);
+    threshold = __atomic_load_n (&slow_threshold, __ATOMIC_RELAXED);
+    if (threshold > 0 && usec >= threshold) {
+        breakdown = tabrmd_timeline_to_string (timeline);
+        g_warning ("slow command: %s", breakdown);
+        g_free (breakdown);
+    }
+}
+void
+tabrmd_timeline_unref (tabrmd_timeline_t *timeline)
+{
+    g_return_if_fail (timeline != NULL);
+    if (g_atomic_int_dec_and_test (&timeline->ref_count)) {
+        tabrmd_timeline_finish (timeline);
+        g_free (timeline);
+    }
+}
+void
+tabrmd_timeline_stamp (tabrmd_timeline_t *timeline,
+                       TabrmdStage stage)
+{
+    g_return_if_fail (timeline != NULL);
+    g_return_if_fail (stage < TABRMD_STAGE_MAX);
+    timeline->stamps [stage] = g_get_monotonic_time ();
+}
+/*
+ * Remember a handle from the command's handle area for the flight
+ * recorder. Handles beyond TABRMD_RECORDER_HANDLES_MAX are ignored.
+ */
+void
+tabrmd_timeline_add_handle (tabrmd_timeline_t *timeline,
+                            TPM2_HANDLE handle)
+{
+    g_return_if_fail (timeline != NULL);
+    if (timeline->handle_count < TABRMD_RECORDER_HANDLES_MAX) {
+        timeline->handles [timeline->handle_count++] = handle;
+    }
+}
+void
+tabrmd_timeline_set_response_code (tabrmd_timeline_t *timeline,
+                                   TSS2_RC response_code)
+{
+    g_return_if_fail (timeline != NULL);
+    timeline->response_code = response_code;
+}
+/*
+ * Return the number of microseconds the command spent getting to 'stage'
+ * or -1 if it never got there.
+ */
+gint64
+tabrmd_timeline_stage_usec (tabrmd_timeline_t *timeline,
+                            TabrmdStage stage)
+{
+    TabrmdStage from;
+
+    g_return_val_if_fail (timeline != NULL, -1);
+    g_return_val_if_fail (stage < TABRMD_STAGE_MAX, -1);
+    if (stage == TABRMD_STAGE_READ || timeline->stamps [stage] == 0) {
+        return -1;
+    }
+    for (from = stage_from [stage];
+         from != TABRMD_STAGE_READ && timeline->stamps [from] == 0;
+         from = stage_from [from]);
+    if (timeline->stamps [from] == 0) {
+        return -1;
+    }
+    return timeline->stamps [stage] - timeline->stamps [from];
+}
+/*
+ * Return the number of microseconds from reading the command to writing
+ * the response or -1 if either didn't happen.
+ */
+gint64
+tabrmd_timeline_total_usec (tabrmd_timeline_t *timeline)
+{
+    g_return_val_if_fail (timeline != NULL, -1);
+    if (timeline->stamps [TABRMD_STAGE_READ] == 0 ||
+        timeline->stamps [TABRMD_STAGE_WRITTEN] == 0)
+    {
+        return -1;
+    }
+    return timeline->stamps [TABRMD_STAGE_WRITTEN] -
+        timeline->stamps [TABRMD_STAGE_READ];
+}
+/*
+ * Describe the command and the time it spent in each stage for the slow
+ * command log. The caller must free the returned string.
+ */
+gchar*
+tabrmd_timeline_to_string (tabrmd_timeline_t *timeline)
+{
+    GString *out;
+    const char *sep = ": ";
+    gint64 usec;
+    guint stage;
+
+    g_return_val_if_fail (timeline != NULL, NULL);
+    out = g_string_new (NULL);
+    g_string_append_printf (out, "connection %" PRIu64 " command 0x%08"
+                            PRIx32 " took %" PRId64 "us",
+                            timeline->connection_id,
+                            timeline->command_code,
+                            tabrmd_timeline_total_usec (timeline));
+    for (stage = TABRMD_STAGE_READ + 1; stage < TABRMD_STAGE_MAX; ++stage) {
+        usec = tabrmd_timeline_stage_usec (timeline, stage);
+        if (usec < 0) {
+            continue;
+        }
+        g_string_append_printf (out, "%s%s %" PRId64 "us", sep,
+                                tabrmd_stats_stage_name (stage), usec);
+        sep = ", ";
+    }
+    return g_string_free (out, FALSE);
+}
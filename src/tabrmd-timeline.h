@@ -0,0 +1,50 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef TABRMD_TIMELINE_H
+#define TABRMD_TIMELINE_H
+
+#include <glib.h>
+#include <tss2/tss2_tpm2_types.h>
+
+#include "tabrmd-recorder.h"
+#include "tabrmd-stats.h"
+
+G_BEGIN_DECLS
+
+/*
+ * The monotonic time (g_get_monotonic_time) at which a command reached
+ * each stage of the pipeline, 0 for stages it skipped. A timeline is
+ * shared by a Tpm2Command and the Tpm2Response to it: the ResourceManager
+ * saves contexts for the command while the ResponseSink is writing the
+ * response. When the last reference is dropped the time spent in each
+ * stage is recorded in the statistics and the flight recorder, and the
+ * command is logged if it took longer than the slow command threshold.
+ */
+typedef struct {
+    gint     ref_count;
+    guint64  connection_id;  /* connection_get_number () */
+    TPM2_CC  command_code;
+    TSS2_RC  response_code;
+    guint32  handle_count;
+    TPM2_HANDLE handles [TABRMD_RECORDER_HANDLES_MAX];
+    gint64   stamps [TABRMD_STAGE_MAX];
+} tabrmd_timeline_t;
+
+tabrmd_timeline_t* tabrmd_timeline_new     (guint64            connection_id,
+                                            TPM2_CC            command_code,
+                                            gint64             time_read);
+tabrmd_timeline_t* tabrmd_timeline_ref     (tabrmd_timeline_t *timeline);
+void       tabrmd_timeline_unref           (tabrmd_timeline_t *timeline);
+void       tabrmd_timeline_stamp           (tabrmd_timeline_t *timeline,
+                                            TabrmdStage        stage);
+void       tabrmd_timeline_add_handle      (tabrmd_timeline_t *timeline,
+                                            TPM2_HANDLE        handle);
+void       tabrmd_timeline_set_response_code (tabrmd_timeline_t *timeline,
+                                              TSS2_RC          response_code);
+gint64     tabrmd_timeline_stage_usec      (tabrmd_timeline_t *timeline,
+                                            TabrmdStage        stage);
+gint64     tabrmd_timeline_total_usec      (tabrmd_timeline_t *timeline);
+gchar*     tabrmd_timeline_to_string       (tabrmd_timeline_t *timeline);
+void       tabrmd_timeline_set_slow_threshold (gint64          usec);
+
+G_END_DECLS
+#endif /* TABRMD_TIMELINE_H */
@@ -25,6 +25,33 @@
 #define TSS2_RESMGR_RC_OBJECT_MEMORY   (TSS2_RC)(TSS2_RESMGR_RC_LAYER | TPM2_RC_OBJECT_MEMORY)
 #define TSS2_RESMGR_RC_SESSION_MEMORY  (TSS2_RC)(TSS2_RESMGR_RC_LAYER | TPM2_RC_SESSION_MEMORY)
 
+/*
+ * Transports that a client may request for the connection used to send
+ * commands and receive responses. With TABRMD_TRANSPORT_STREAM the
+ * connection is a SOCK_STREAM socket and TPM buffers must be framed by
+ * the size field in their header. With TABRMD_TRANSPORT_SEQPACKET the
+ * connection is a SOCK_SEQPACKET socket and each TPM command / response
+ * is sent as exactly one datagram. With TABRMD_TRANSPORT_MUX the
+ * connection is a SOCK_SEQPACKET socket shared by many logical channels:
+ * each datagram starts with a TABRMD_MUX_HEADER_SIZE byte channel id (big
+ * endian) followed by the TPM command / response. A datagram holding only
+ * the channel id closes the channel.
+ *
+ * There is deliberately no shared memory transport. The resource manager
+ * rewrites the handles in a command in place, so consuming commands from
+ * a region the client can still write would let it change a command after
+ * it has been validated. Copying each buffer into and out of the region
+ * avoids that but still needs a doorbell on a socket per command, so it
+ * costs the same syscalls as TABRMD_TRANSPORT_SEQPACKET.
+ */
+typedef enum {
+    TABRMD_TRANSPORT_STREAM    = 0,
+    TABRMD_TRANSPORT_SEQPACKET = 1,
+    TABRMD_TRANSPORT_MUX       = 2,
+} TabrmdTransport;
+
+#define TABRMD_MUX_HEADER_SIZE sizeof (guint32)
+
 GQuark  tabrmd_error_quark (void);
 
 TSS2_RC tss2_tcti_tabrmd_dump_trans_state (TSS2_TCTI_CONTEXT *tcti_context);
@@ -0,0 +1,143 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (c) 2017 - 2018, Intel Corporation
+ * All rights reserved.
+ */
+#ifndef TSS2TCTI_TABRMD_LITE_PRIV_H
+#define TSS2TCTI_TABRMD_LITE_PRIV_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <tss2/tss2_tcti.h>
+#include <tss2/tss2_tpm2_types.h>
+
+#include "tcti-tabrmd-replay.h"
+#include "tcti-tabrmd-stats.h"
+#include "tpm2-header.h"
+
+/* these must be kept in sync with tcti-tabrmd-priv.h */
+#define TSS2_TCTI_TABRMD_MAGIC 0x1c8e03ff00db0f92
+#define TSS2_TCTI_TABRMD_VERSION 2
+
+#define TABRMD_LITE_BUS_NAME_MAX 255
+#define TABRMD_LITE_SYSTEM_BUS_DEFAULT \
+    "unix:path=/var/run/dbus/system_bus_socket"
+/* the largest D-Bus message we'll accept from the bus */
+#define TABRMD_LITE_MSG_MAX 65536
+/* the most file descriptors we'll accept with a D-Bus message */
+#define TABRMD_LITE_FDS_MAX 4
+
+/* D-Bus message types */
+#define TABRMD_LITE_MSG_METHOD_CALL   1
+#define TABRMD_LITE_MSG_METHOD_RETURN 2
+#define TABRMD_LITE_MSG_ERROR         3
+#define TABRMD_LITE_MSG_SIGNAL        4
+
+/*
+ * Same state machine as the GLib TCTI, see tcti-tabrmd-priv.h.
+ */
+typedef enum {
+    TABRMD_LITE_STATE_FINAL,
+    TABRMD_LITE_STATE_RECEIVE,
+    TABRMD_LITE_STATE_TRANSMIT,
+    TABRMD_LITE_STATE_INIT,
+} tcti_tabrmd_lite_state_t;
+
+typedef enum {
+    TABRMD_LITE_BUS_SYSTEM,
+    TABRMD_LITE_BUS_SESSION,
+} tcti_tabrmd_lite_bus_t;
+
+typedef struct {
+    const char *bus_name;
+    tcti_tabrmd_lite_bus_t bus_type;
+    bool reconnect;
+} tcti_tabrmd_lite_conf_t;
+
+/* these must be kept in sync with tcti-tabrmd-priv.h */
+#define TABRMD_RECONNECT_ATTEMPTS 5
+#define TABRMD_RECONNECT_DELAY_US 10000
+/*
+ * State kept by contexts initialized with "reconnect=true", see the GLib
+ * TCTI. The bus type and name are always kept in the context.
+ */
+typedef struct {
+    bool                           locality_set;
+    uint8_t                        locality;
+    unsigned int                   attempt;
+    uint64_t                       next_time;
+    size_t                         replay_size;
+    uint8_t                        replay [TPM2_MAX_COMMAND_SIZE];
+} tcti_tabrmd_lite_reconnect_t;
+
+/*
+ * State of a pending Tss2_Tcti_Tabrmd_InitAsync, see the GLib TCTI.
+ */
+typedef struct {
+    pthread_t                      thread;
+    int                            fds [2];
+    TSS2_RC                        rc;
+    int                            done;
+} tcti_tabrmd_lite_init_t;
+
+typedef struct {
+    TSS2_TCTI_CONTEXT_COMMON_V1    common;
+    uint64_t                       id;
+    int                            fd;
+    tcti_tabrmd_lite_state_t       state;
+    uint32_t                       response_size;
+    size_t                         index;
+    uint8_t                        header_buf [TPM_HEADER_SIZE];
+    size_t                         outstanding;
+    tcti_tabrmd_lite_bus_t         bus_type;
+    char                           bus_name [TABRMD_LITE_BUS_NAME_MAX + 1];
+    tcti_tabrmd_lite_init_t       *init;
+    tcti_tabrmd_stats_t            stats;
+    tcti_tabrmd_lite_reconnect_t  *reconnect;
+} TSS2_TCTI_TABRMD_LITE_CONTEXT;
+
+/*
+ * A D-Bus message parsed by tcti_tabrmd_lite_msg_parse. The strings and
+ * the body point into the buffer holding the message.
+ */
+typedef struct {
+    uint8_t                        type;
+    bool                           big_endian;
+    uint32_t                       serial;
+    uint32_t                       reply_serial;
+    uint32_t                       unix_fds;
+    const char                    *error_name;
+    const char                    *signature;
+    const uint8_t                 *body;
+    size_t                         body_size;
+} tcti_tabrmd_lite_msg_t;
+
+size_t tcti_tabrmd_lite_method_call (uint8_t *buf,
+                                     size_t buf_size,
+                                     uint32_t serial,
+                                     const char *destination,
+                                     const char *path,
+                                     const char *interface,
+                                     const char *member,
+                                     const char *signature,
+                                     const uint8_t *body,
+                                     size_t body_size);
+int tcti_tabrmd_lite_msg_parse (const uint8_t *buf,
+                                size_t size,
+                                tcti_tabrmd_lite_msg_t *msg);
+uint32_t tcti_tabrmd_lite_get_u32 (const uint8_t *buf,
+                                   bool big_endian);
+uint64_t tcti_tabrmd_lite_get_u64 (const uint8_t *buf,
+                                   bool big_endian);
+int tcti_tabrmd_lite_bus_address (const char *address,
+                                  struct sockaddr_un *addr,
+                                  socklen_t *addr_len);
+TSS2_RC tcti_tabrmd_lite_conf_parse (char *conf,
+                                     tcti_tabrmd_lite_conf_t *lite_conf);
+
+#endif /* TSS2TCTI_TABRMD_LITE_PRIV_H */
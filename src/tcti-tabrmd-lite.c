@@ -0,0 +1,1664 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (c) 2017 - 2018, Intel Corporation
+ * All rights reserved.
+ */
+/*
+ * This is an implementation of the tabrmd TCTI that doesn't depend on GLib.
+ * It's built in place of tcti-tabrmd.c when the library is configured with
+ * --enable-tcti-lite. The connection with the daemon is created with a
+ * minimal D-Bus client that speaks just enough of the protocol to
+ * authenticate with the bus, call a method on the daemon and receive the
+ * reply along with the file descriptors passed with it. All other I/O uses
+ * the raw file descriptor for the connection.
+ * Only the "stream" transport is supported. Other transports requested in
+ * the conf string fall back to "stream" as they do when the daemon doesn't
+ * support them.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <tss2/tss2_tcti.h>
+
+#include "tabrmd-defaults.h"
+#include "tcti-tabrmd-lite-priv.h"
+#include "tss2-tcti-tabrmd.h"
+
+#define LITE_CTX(context) ((TSS2_TCTI_TABRMD_LITE_CONTEXT*)context)
+#define LITE_ALIGN(value, align) (((value) + (align) - 1) & ~((size_t)(align) - 1))
+#define LITE_EINTR_RETRY(exp)                           \
+  ({                                                    \
+    long int __result = 0;                              \
+    do {                                                \
+      __result = (long int)(exp);                       \
+    } while ((__result == -1) && (errno == EINTR));     \
+    __result;                                           \
+  })
+
+#define DBUS_NAME "org.freedesktop.DBus"
+#define DBUS_PATH "/org/freedesktop/DBus"
+
+/* D-Bus header field codes */
+#define FIELD_PATH         1
+#define FIELD_INTERFACE    2
+#define FIELD_MEMBER       3
+#define FIELD_ERROR_NAME   4
+#define FIELD_REPLY_SERIAL 5
+#define FIELD_DESTINATION  6
+#define FIELD_SENDER       7
+#define FIELD_SIGNATURE    8
+#define FIELD_UNIX_FDS     9
+
+/* the fixed part of the D-Bus message header */
+#define HEADER_FIXED_SIZE 16
+
+/*
+ * There's no logging framework without GLib. Failures that the GLib TCTI
+ * reports through g_warning / g_critical are written to stderr.
+ */
+static void
+lite_warn (const char *format, ...)
+{
+    va_list args;
+
+    va_start (args, format);
+    fputs ("tcti-tabrmd: ", stderr);
+    vfprintf (stderr, format, args);
+    fputc ('\n', stderr);
+    va_end (args);
+}
+
+/*
+ * Helpers to marshal a D-Bus message into a buffer. We always send
+ * little-endian messages. Writes past the end of the buffer set 'overflow'
+ * and are otherwise ignored.
+ */
+typedef struct {
+    uint8_t *buf;
+    size_t size;
+    size_t len;
+    bool overflow;
+} lite_buf_t;
+
+static void
+lite_buf_put (lite_buf_t *buf,
+              const void *data,
+              size_t size)
+{
+    if (buf->len + size > buf->size) {
+        buf->overflow = true;
+        return;
+    }
+    memcpy (&buf->buf [buf->len], data, size);
+    buf->len += size;
+}
+static void
+lite_buf_put_u8 (lite_buf_t *buf,
+                 uint8_t value)
+{
+    lite_buf_put (buf, &value, sizeof (value));
+}
+static void
+lite_buf_align (lite_buf_t *buf,
+                size_t align)
+{
+    while (!buf->overflow && buf->len % align != 0) {
+        lite_buf_put_u8 (buf, 0);
+    }
+}
+static void
+lite_buf_put_u32 (lite_buf_t *buf,
+                  uint32_t value)
+{
+    uint8_t le [] = {
+        value & 0xff,
+        (value >> 8) & 0xff,
+        (value >> 16) & 0xff,
+        (value >> 24) & 0xff,
+    };
+
+    lite_buf_align (buf, 4);
+    lite_buf_put (buf, le, sizeof (le));
+}
+static void
+lite_buf_put_string (lite_buf_t *buf,
+                     const char *str)
+{
+    lite_buf_put_u32 (buf, (uint32_t)strlen (str));
+    lite_buf_put (buf, str, strlen (str) + 1);
+}
+static void
+lite_buf_put_signature (lite_buf_t *buf,
+                        const char *sig)
+{
+    lite_buf_put_u8 (buf, (uint8_t)strlen (sig));
+    lite_buf_put (buf, sig, strlen (sig) + 1);
+}
+static void
+lite_buf_put_field (lite_buf_t *buf,
+                    uint8_t code,
+                    const char *type,
+                    const char *value)
+{
+    lite_buf_align (buf, 8);
+    lite_buf_put_u8 (buf, code);
+    lite_buf_put_signature (buf, type);
+    if (type [0] == 'g') {
+        lite_buf_put_signature (buf, value);
+    } else {
+        lite_buf_put_string (buf, value);
+    }
+}
+/*
+ * Marshal a METHOD_CALL message into 'buf'. The body must already be
+ * marshalled (little-endian, starting at an 8 byte boundary) and match the
+ * signature. Returns the size of the message or 0 if it doesn't fit.
+ */
+size_t
+tcti_tabrmd_lite_method_call (uint8_t *buf,
+                              size_t buf_size,
+                              uint32_t serial,
+                              const char *destination,
+                              const char *path,
+                              const char *interface,
+                              const char *member,
+                              const char *signature,
+                              const uint8_t *body,
+                              size_t body_size)
+{
+    lite_buf_t msg = { .buf = buf, .size = buf_size, };
+    size_t fields_len_offset, fields_start, fields_len;
+
+    lite_buf_put_u8 (&msg, 'l');
+    lite_buf_put_u8 (&msg, TABRMD_LITE_MSG_METHOD_CALL);
+    lite_buf_put_u8 (&msg, 0);
+    lite_buf_put_u8 (&msg, 1);
+    lite_buf_put_u32 (&msg, (uint32_t)body_size);
+    lite_buf_put_u32 (&msg, serial);
+    fields_len_offset = msg.len;
+    lite_buf_put_u32 (&msg, 0);
+    fields_start = msg.len;
+    lite_buf_put_field (&msg, FIELD_PATH, "o", path);
+    if (destination != NULL) {
+        lite_buf_put_field (&msg, FIELD_DESTINATION, "s", destination);
+    }
+    lite_buf_put_field (&msg, FIELD_INTERFACE, "s", interface);
+    lite_buf_put_field (&msg, FIELD_MEMBER, "s", member);
+    if (signature != NULL && signature [0] != '\0') {
+        lite_buf_put_field (&msg, FIELD_SIGNATURE, "g", signature);
+    }
+    if (msg.overflow) {
+        return 0;
+    }
+    fields_len = msg.len - fields_start;
+    msg.len = fields_len_offset;
+    lite_buf_put_u32 (&msg, (uint32_t)fields_len);
+    msg.len = fields_start + fields_len;
+    lite_buf_align (&msg, 8);
+    if (body_size > 0) {
+        lite_buf_put (&msg, body, body_size);
+    }
+    return msg.overflow ? 0 : msg.len;
+}
+
+uint32_t
+tcti_tabrmd_lite_get_u32 (const uint8_t *buf,
+                          bool big_endian)
+{
+    if (big_endian) {
+        return (uint32_t)buf [0] << 24 | (uint32_t)buf [1] << 16 |
+               (uint32_t)buf [2] << 8 | (uint32_t)buf [3];
+    }
+    return (uint32_t)buf [3] << 24 | (uint32_t)buf [2] << 16 |
+           (uint32_t)buf [1] << 8 | (uint32_t)buf [0];
+}
+uint64_t
+tcti_tabrmd_lite_get_u64 (const uint8_t *buf,
+                          bool big_endian)
+{
+    uint64_t first = tcti_tabrmd_lite_get_u32 (buf, big_endian);
+    uint64_t second = tcti_tabrmd_lite_get_u32 (&buf [4], big_endian);
+
+    return big_endian ? first << 32 | second : second << 32 | first;
+}
+/*
+ * Get the size of the message from its fixed header. Returns 0 if the
+ * header is malformed or the message is larger than TABRMD_LITE_MSG_MAX.
+ */
+static size_t
+lite_msg_size (const uint8_t *header)
+{
+    bool big_endian = header [0] == 'B';
+    size_t body_size, fields_size, size;
+
+    if (header [0] != 'l' && header [0] != 'B') {
+        return 0;
+    }
+    body_size = tcti_tabrmd_lite_get_u32 (&header [4], big_endian);
+    fields_size = tcti_tabrmd_lite_get_u32 (&header [12], big_endian);
+    if (body_size > TABRMD_LITE_MSG_MAX || fields_size > TABRMD_LITE_MSG_MAX) {
+        return 0;
+    }
+    size = LITE_ALIGN (HEADER_FIXED_SIZE + fields_size, 8) + body_size;
+    return size > TABRMD_LITE_MSG_MAX ? 0 : size;
+}
+/*
+ * Parse the complete D-Bus message in 'buf'. Only the header fields that
+ * we need are extracted. Returns 0 on success, -1 if the message is
+ * malformed.
+ */
+int
+tcti_tabrmd_lite_msg_parse (const uint8_t *buf,
+                            size_t size,
+                            tcti_tabrmd_lite_msg_t *msg)
+{
+    size_t pos, header_end, str_len;
+    const char *str;
+    uint32_t value;
+    uint8_t code;
+
+    memset (msg, 0, sizeof (*msg));
+    if (size < HEADER_FIXED_SIZE || lite_msg_size (buf) != size) {
+        return -1;
+    }
+    msg->big_endian = buf [0] == 'B';
+    msg->type = buf [1];
+    msg->body_size = tcti_tabrmd_lite_get_u32 (&buf [4], msg->big_endian);
+    msg->serial = tcti_tabrmd_lite_get_u32 (&buf [8], msg->big_endian);
+    header_end = HEADER_FIXED_SIZE +
+        tcti_tabrmd_lite_get_u32 (&buf [12], msg->big_endian);
+    msg->body = &buf [size - msg->body_size];
+    for (pos = HEADER_FIXED_SIZE; LITE_ALIGN (pos, 8) < header_end;) {
+        pos = LITE_ALIGN (pos, 8);
+        /* field code, signature length, one type code and its terminator */
+        if (pos + 4 > header_end || buf [pos + 1] != 1 || buf [pos + 3] != 0) {
+            return -1;
+        }
+        code = buf [pos];
+        switch (buf [pos + 2]) {
+        case 'o':
+        case 's':
+            pos = LITE_ALIGN (pos + 4, 4);
+            if (pos + 4 > header_end) {
+                return -1;
+            }
+            str_len = tcti_tabrmd_lite_get_u32 (&buf [pos], msg->big_endian);
+            pos += 4;
+            if (str_len >= header_end - pos || buf [pos + str_len] != '\0') {
+                return -1;
+            }
+            str = (const char*)&buf [pos];
+            pos += str_len + 1;
+            break;
+        case 'g':
+            pos += 4;
+            if (pos >= header_end) {
+                return -1;
+            }
+            str_len = buf [pos++];
+            if (str_len >= header_end - pos || buf [pos + str_len] != '\0') {
+                return -1;
+            }
+            str = (const char*)&buf [pos];
+            pos += str_len + 1;
+            break;
+        case 'u':
+            pos = LITE_ALIGN (pos + 4, 4);
+            if (pos + 4 > header_end) {
+                return -1;
+            }
+            value = tcti_tabrmd_lite_get_u32 (&buf [pos], msg->big_endian);
+            pos += 4;
+            str = NULL;
+            break;
+        default:
+            return -1;
+        }
+        switch (code) {
+        case FIELD_ERROR_NAME:
+            msg->error_name = str;
+            break;
+        case FIELD_REPLY_SERIAL:
+            msg->reply_serial = value;
+            break;
+        case FIELD_SIGNATURE:
+            msg->signature = str;
+            break;
+        case FIELD_UNIX_FDS:
+            msg->unix_fds = value;
+            break;
+        default:
+            break;
+        }
+    }
+    return 0;
+}
+
+static int
+lite_hex_value (char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+/*
+ * Copy the D-Bus address value 'value' of length 'len' into 'dest',
+ * decoding %-escaped bytes. Returns the decoded length or -1 on error.
+ */
+static ssize_t
+lite_address_unescape (char *dest,
+                       size_t dest_size,
+                       const char *value,
+                       size_t len)
+{
+    size_t i, out = 0;
+    int high, low;
+
+    for (i = 0; i < len; ++i) {
+        if (out >= dest_size) {
+            return -1;
+        }
+        if (value [i] != '%') {
+            dest [out++] = value [i];
+            continue;
+        }
+        if (i + 2 >= len) {
+            return -1;
+        }
+        high = lite_hex_value (value [i + 1]);
+        low = lite_hex_value (value [i + 2]);
+        if (high == -1 || low == -1) {
+            return -1;
+        }
+        dest [out++] = (char)(high << 4 | low);
+        i += 2;
+    }
+    return (ssize_t)out;
+}
+/*
+ * Get the socket address from a D-Bus server address string. Addresses are
+ * separated by ';' and the first "unix" address with a "path" or "abstract"
+ * key is used. Returns 0 on success, -1 if there's no usable address.
+ */
+int
+tcti_tabrmd_lite_bus_address (const char *address,
+                              struct sockaddr_un *addr,
+                              socklen_t *addr_len)
+{
+    const char *entry, *entry_end, *key, *key_end, *value, *value_end;
+    size_t path_max = sizeof (addr->sun_path) - 1;
+    ssize_t len;
+
+    for (entry = address; *entry != '\0'; entry = entry_end + 1) {
+        entry_end = strchrnul (entry, ';');
+        if (strncmp (entry, "unix:", strlen ("unix:")) != 0) {
+            if (*entry_end == '\0') {
+                break;
+            }
+            continue;
+        }
+        for (key = entry + strlen ("unix:"); key < entry_end; key = value_end + 1) {
+            value_end = memchr (key, ',', entry_end - key);
+            if (value_end == NULL) {
+                value_end = entry_end;
+            }
+            key_end = memchr (key, '=', value_end - key);
+            if (key_end == NULL) {
+                continue;
+            }
+            value = key_end + 1;
+            memset (addr, 0, sizeof (*addr));
+            addr->sun_family = AF_UNIX;
+            if (key_end - key == strlen ("path") &&
+                strncmp (key, "path", strlen ("path")) == 0) {
+                len = lite_address_unescape (addr->sun_path,
+                                             path_max,
+                                             value,
+                                             value_end - value);
+                if (len <= 0) {
+                    return -1;
+                }
+                *addr_len = offsetof (struct sockaddr_un, sun_path) + len + 1;
+                return 0;
+            }
+            if (key_end - key == strlen ("abstract") &&
+                strncmp (key, "abstract", strlen ("abstract")) == 0) {
+                len = lite_address_unescape (&addr->sun_path [1],
+                                             path_max,
+                                             value,
+                                             value_end - value);
+                if (len <= 0) {
+                    return -1;
+                }
+                *addr_len = offsetof (struct sockaddr_un, sun_path) + len + 1;
+                return 0;
+            }
+        }
+        if (*entry_end == '\0') {
+            break;
+        }
+    }
+    return -1;
+}
+
+static int
+lite_write_all (int fd,
+                const void *buf,
+                size_t size)
+{
+    const uint8_t *data = (const uint8_t*)buf;
+    ssize_t ret;
+    size_t done = 0;
+
+    while (done < size) {
+        ret = LITE_EINTR_RETRY (send (fd, &data [done], size - done,
+                                      MSG_NOSIGNAL));
+        if (ret <= 0) {
+            return -1;
+        }
+        done += (size_t)ret;
+    }
+    return 0;
+}
+/*
+ * Read one "\r\n" terminated line of the authentication protocol. The line
+ * is read a byte at a time so that nothing following it is consumed.
+ */
+static int
+lite_auth_read_line (int fd,
+                     char *line,
+                     size_t size)
+{
+    size_t len = 0;
+    ssize_t ret;
+
+    while (len < size - 1) {
+        ret = LITE_EINTR_RETRY (read (fd, &line [len], 1));
+        if (ret != 1) {
+            return -1;
+        }
+        if (line [len] == '\n' && len > 0 && line [len - 1] == '\r') {
+            line [len - 1] = '\0';
+            return 0;
+        }
+        ++len;
+    }
+    return -1;
+}
+/*
+ * Authenticate with the bus using the EXTERNAL mechanism (our uid, checked
+ * by the bus through the socket credentials) and ask for file descriptor
+ * passing.
+ */
+static int
+lite_auth (int fd)
+{
+    char uid_str [32], line [512];
+    size_t i;
+    int len;
+
+    len = snprintf (uid_str, sizeof (uid_str), "%u", (unsigned)getuid ());
+    if (lite_write_all (fd, "", 1) != 0 ||
+        lite_write_all (fd, "AUTH EXTERNAL ", strlen ("AUTH EXTERNAL ")) != 0) {
+        return -1;
+    }
+    for (i = 0; i < (size_t)len; ++i) {
+        snprintf (line, sizeof (line), "%02x", uid_str [i]);
+        if (lite_write_all (fd, line, 2) != 0) {
+            return -1;
+        }
+    }
+    if (lite_write_all (fd, "\r\n", 2) != 0 ||
+        lite_auth_read_line (fd, line, sizeof (line)) != 0 ||
+        strncmp (line, "OK ", strlen ("OK ")) != 0) {
+        lite_warn ("bus rejected authentication");
+        return -1;
+    }
+    if (lite_write_all (fd, "NEGOTIATE_UNIX_FD\r\n",
+                        strlen ("NEGOTIATE_UNIX_FD\r\n")) != 0 ||
+        lite_auth_read_line (fd, line, sizeof (line)) != 0 ||
+        strcmp (line, "AGREE_UNIX_FD") != 0) {
+        lite_warn ("bus doesn't support file descriptor passing");
+        return -1;
+    }
+    return lite_write_all (fd, "BEGIN\r\n", strlen ("BEGIN\r\n"));
+}
+
+static void
+lite_close_fds (int *fds,
+                size_t *num_fds)
+{
+    size_t i;
+
+    for (i = 0; i < *num_fds; ++i) {
+        close (fds [i]);
+    }
+    *num_fds = 0;
+}
+/*
+ * Read exactly 'size' bytes from the bus. File descriptors received along
+ * the way are appended to 'fds'. Any past TABRMD_LITE_FDS_MAX are closed.
+ */
+static int
+lite_recv_all (int fd,
+               uint8_t *buf,
+               size_t size,
+               int *fds,
+               size_t *num_fds)
+{
+    union {
+        struct cmsghdr align;
+        char buf [CMSG_SPACE (sizeof (int) * TABRMD_LITE_FDS_MAX)];
+    } control;
+    struct iovec iov;
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    size_t done = 0, i, count;
+    ssize_t ret;
+    int received;
+
+    while (done < size) {
+        iov.iov_base = &buf [done];
+        iov.iov_len = size - done;
+        memset (&msg, 0, sizeof (msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof (control.buf);
+        ret = LITE_EINTR_RETRY (recvmsg (fd, &msg, MSG_CMSG_CLOEXEC));
+        if (ret <= 0) {
+            return -1;
+        }
+        for (cmsg = CMSG_FIRSTHDR (&msg);
+             cmsg != NULL;
+             cmsg = CMSG_NXTHDR (&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET ||
+                cmsg->cmsg_type != SCM_RIGHTS) {
+                continue;
+            }
+            count = (cmsg->cmsg_len - CMSG_LEN (0)) / sizeof (int);
+            for (i = 0; i < count; ++i) {
+                memcpy (&received,
+                        CMSG_DATA (cmsg) + i * sizeof (int),
+                        sizeof (int));
+                if (*num_fds < TABRMD_LITE_FDS_MAX) {
+                    fds [(*num_fds)++] = received;
+                } else {
+                    close (received);
+                }
+            }
+        }
+        done += (size_t)ret;
+    }
+    return 0;
+}
+/*
+ * Send a method call on the bus connection 'bus_fd' and wait for the reply.
+ * Signals and replies to other calls are discarded. On success the caller
+ * must free '*reply_buf', which holds the reply that 'reply' points into,
+ * and close the 'fds' received with it.
+ */
+static TSS2_RC
+lite_call (int bus_fd,
+           uint32_t serial,
+           const char *destination,
+           const char *path,
+           const char *interface,
+           const char *member,
+           const char *signature,
+           const uint8_t *body,
+           size_t body_size,
+           uint8_t **reply_buf,
+           tcti_tabrmd_lite_msg_t *reply,
+           int *fds,
+           size_t *num_fds)
+{
+    uint8_t buf [1024], header [HEADER_FIXED_SIZE];
+    size_t size;
+
+    size = tcti_tabrmd_lite_method_call (buf,
+                                         sizeof (buf),
+                                         serial,
+                                         destination,
+                                         path,
+                                         interface,
+                                         member,
+                                         signature,
+                                         body,
+                                         body_size);
+    if (size == 0 || lite_write_all (bus_fd, buf, size) != 0) {
+        lite_warn ("failed to send %s method call", member);
+        return TSS2_TCTI_RC_NO_CONNECTION;
+    }
+    *num_fds = 0;
+    for (;;) {
+        if (lite_recv_all (bus_fd, header, sizeof (header), fds, num_fds) != 0) {
+            goto err_out;
+        }
+        size = lite_msg_size (header);
+        if (size == 0) {
+            goto err_out;
+        }
+        *reply_buf = malloc (size);
+        if (*reply_buf == NULL) {
+            goto err_out;
+        }
+        memcpy (*reply_buf, header, sizeof (header));
+        if (lite_recv_all (bus_fd,
+                           &(*reply_buf) [sizeof (header)],
+                           size - sizeof (header),
+                           fds,
+                           num_fds) != 0 ||
+            tcti_tabrmd_lite_msg_parse (*reply_buf, size, reply) != 0) {
+            free (*reply_buf);
+            goto err_out;
+        }
+        if ((reply->type == TABRMD_LITE_MSG_METHOD_RETURN ||
+             reply->type == TABRMD_LITE_MSG_ERROR) &&
+            reply->reply_serial == serial) {
+            break;
+        }
+        free (*reply_buf);
+        lite_close_fds (fds, num_fds);
+    }
+    if (reply->type == TABRMD_LITE_MSG_ERROR) {
+        lite_warn ("%s method call failed: %s", member,
+                   reply->error_name != NULL ? reply->error_name : "unknown");
+    }
+    return TSS2_RC_SUCCESS;
+err_out:
+    lite_warn ("failed to receive reply to %s method call", member);
+    lite_close_fds (fds, num_fds);
+    return TSS2_TCTI_RC_NO_CONNECTION;
+}
+/*
+ * Connect to the bus, authenticate and send the Hello message that every
+ * client must send before anything else. Returns the connected socket or
+ * -1 on error.
+ */
+static int
+lite_bus_open (tcti_tabrmd_lite_bus_t bus_type)
+{
+    struct sockaddr_un addr;
+    socklen_t addr_len;
+    tcti_tabrmd_lite_msg_t reply;
+    uint8_t *reply_buf = NULL;
+    int fds [TABRMD_LITE_FDS_MAX];
+    size_t num_fds = 0;
+    char session_address [sizeof (addr.sun_path) + 16];
+    const char *address, *runtime_dir;
+    int fd;
+
+    if (bus_type == TABRMD_LITE_BUS_SYSTEM) {
+        address = getenv ("DBUS_SYSTEM_BUS_ADDRESS");
+        if (address == NULL) {
+            address = TABRMD_LITE_SYSTEM_BUS_DEFAULT;
+        }
+    } else {
+        address = getenv ("DBUS_SESSION_BUS_ADDRESS");
+        runtime_dir = getenv ("XDG_RUNTIME_DIR");
+        if (address == NULL && runtime_dir != NULL) {
+            snprintf (session_address, sizeof (session_address),
+                      "unix:path=%s/bus", runtime_dir);
+            address = session_address;
+        }
+    }
+    if (address == NULL ||
+        tcti_tabrmd_lite_bus_address (address, &addr, &addr_len) != 0) {
+        lite_warn ("no usable address for the %s bus",
+                   bus_type == TABRMD_LITE_BUS_SYSTEM ? "system" : "session");
+        return -1;
+    }
+    fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        lite_warn ("failed to create socket: %s", strerror (errno));
+        return -1;
+    }
+    if (LITE_EINTR_RETRY (connect (fd, (struct sockaddr*)&addr, addr_len)) != 0) {
+        lite_warn ("failed to connect to bus: %s", strerror (errno));
+        goto err_out;
+    }
+    if (lite_auth (fd) != 0) {
+        goto err_out;
+    }
+    if (lite_call (fd, 1, DBUS_NAME, DBUS_PATH, DBUS_NAME, "Hello",
+                   NULL, NULL, 0, &reply_buf, &reply, fds, &num_fds) !=
+        TSS2_RC_SUCCESS) {
+        goto err_out;
+    }
+    lite_close_fds (fds, &num_fds);
+    if (reply.type != TABRMD_LITE_MSG_METHOD_RETURN) {
+        free (reply_buf);
+        goto err_out;
+    }
+    free (reply_buf);
+    return fd;
+err_out:
+    close (fd);
+    return -1;
+}
+
+typedef struct {
+    const char *name;
+    TSS2_RC rc;
+} lite_error_entry_t;
+
+/* the errors registered by the daemon in tabrmd-error.c */
+static const lite_error_entry_t lite_error_map [] = {
+    {
+        .name = "com.intel.tss2.Tabrmd.Error.General",
+        .rc = TSS2_RESMGR_RC_LAYER | TSS2_BASE_RC_GENERAL_FAILURE,
+    },
+    {
+        .name = "com.intel.tss2.Tabrmd.Error.Internal",
+        .rc = TSS2_RESMGR_RC_LAYER |
+              (1 << TSS2_LEVEL_IMPLEMENTATION_SPECIFIC_SHIFT),
+    },
+    {
+        .name = "com.intel.tss2.Tabrmd.Error.Init",
+        .rc = TSS2_RESMGR_RC_LAYER |
+              (2 << TSS2_LEVEL_IMPLEMENTATION_SPECIFIC_SHIFT),
+    },
+    {
+        .name = "com.intel.tss2.Tabrmd.Error.NotImplemented",
+        .rc = TSS2_RESMGR_RC_LAYER | TSS2_BASE_RC_NOT_IMPLEMENTED,
+    },
+    {
+        .name = "com.intel.tss2.Tabrmd.Error.NotPermitted",
+        .rc = TSS2_RESMGR_RC_LAYER | TSS2_BASE_RC_NOT_PERMITTED,
+    },
+};
+#define LITE_ERROR_MAP_LENGTH (sizeof (lite_error_map) / sizeof (lite_error_entry_t))
+
+static TSS2_RC
+lite_error_to_rc (const char *error_name)
+{
+    size_t i;
+
+    for (i = 0; error_name != NULL && i < LITE_ERROR_MAP_LENGTH; ++i) {
+        if (strcmp (error_name, lite_error_map [i].name) == 0) {
+            return lite_error_map [i].rc;
+        }
+    }
+    return TSS2_TCTI_RC_GENERAL_FAILURE;
+}
+/*
+ * Call one of the daemon methods that take the connection id (and for
+ * SetLocality the locality) and return a TSS2_RC.
+ */
+static TSS2_RC
+lite_call_rc_method (TSS2_TCTI_TABRMD_LITE_CONTEXT *ctx,
+                     const char *member,
+                     const char *signature,
+                     const uint8_t *body,
+                     size_t body_size)
+{
+    tcti_tabrmd_lite_msg_t reply;
+    uint8_t *reply_buf = NULL;
+    int fds [TABRMD_LITE_FDS_MAX];
+    size_t num_fds = 0;
+    TSS2_RC rc;
+    int bus_fd;
+
+    bus_fd = lite_bus_open (ctx->bus_type);
+    if (bus_fd == -1) {
+        return TSS2_TCTI_RC_NO_CONNECTION;
+    }
+    rc = lite_call (bus_fd, 2, ctx->bus_name, TABRMD_DBUS_PATH,
+                    TABRMD_DBUS_INTERFACE, member, signature, body,
+                    body_size, &reply_buf, &reply, fds, &num_fds);
+    close (bus_fd);
+    if (rc != TSS2_RC_SUCCESS) {
+        return rc;
+    }
+    lite_close_fds (fds, &num_fds);
+    if (reply.type == TABRMD_LITE_MSG_ERROR) {
+        rc = lite_error_to_rc (reply.error_name);
+    } else if (reply.signature == NULL || strcmp (reply.signature, "u") != 0 ||
+               reply.body_size < sizeof (uint32_t)) {
+        rc = TSS2_TCTI_RC_GENERAL_FAILURE;
+    } else {
+        rc = tcti_tabrmd_lite_get_u32 (reply.body, reply.big_endian);
+    }
+    free (reply_buf);
+    return rc;
+}
+/*
+ * Marshal a connection id as the first (8 byte aligned) body argument.
+ */
+static void
+lite_put_id (uint8_t *body,
+             uint64_t id)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof (id); ++i) {
+        body [i] = (id >> (8 * i)) & 0xff;
+    }
+}
+/*
+ * Call CreateConnection on the daemon and keep the file descriptor and
+ * connection id from the reply.
+ */
+static TSS2_RC
+lite_connect (TSS2_TCTI_TABRMD_LITE_CONTEXT *ctx)
+{
+    tcti_tabrmd_lite_msg_t reply;
+    uint8_t *reply_buf = NULL;
+    int fds [TABRMD_LITE_FDS_MAX];
+    size_t num_fds = 0;
+    TSS2_RC rc;
+    int bus_fd;
+
+    bus_fd = lite_bus_open (ctx->bus_type);
+    if (bus_fd == -1) {
+        return TSS2_TCTI_RC_NO_CONNECTION;
+    }
+    rc = lite_call (bus_fd, 2, ctx->bus_name, TABRMD_DBUS_PATH,
+                    TABRMD_DBUS_INTERFACE, TABRMD_DBUS_METHOD_CREATE_CONNECTION,
+                    NULL, NULL, 0, &reply_buf, &reply, fds, &num_fds);
+    close (bus_fd);
+    if (rc != TSS2_RC_SUCCESS) {
+        return rc;
+    }
+    if (reply.type == TABRMD_LITE_MSG_ERROR) {
+        rc = TSS2_TCTI_RC_NO_CONNECTION;
+        goto out;
+    }
+    if (reply.signature == NULL || strcmp (reply.signature, "t") != 0 ||
+        reply.body_size < sizeof (uint64_t) || reply.unix_fds != 1 ||
+        num_fds != 1) {
+        lite_warn ("CreateConnection returned a malformed reply");
+        rc = TSS2_TCTI_RC_GENERAL_FAILURE;
+        goto out;
+    }
+    ctx->id = tcti_tabrmd_lite_get_u64 (reply.body, reply.big_endian);
+    ctx->fd = fds [0];
+    num_fds = 0;
+out:
+    lite_close_fds (fds, &num_fds);
+    free (reply_buf);
+    return rc;
+}
+
+static TSS2_RC
+lite_check_context (TSS2_TCTI_CONTEXT *context)
+{
+    if (TSS2_TCTI_MAGIC (context) != TSS2_TCTI_TABRMD_MAGIC ||
+        TSS2_TCTI_VERSION (context) != TSS2_TCTI_TABRMD_VERSION) {
+        return TSS2_TCTI_RC_BAD_CONTEXT;
+    }
+    return TSS2_RC_SUCCESS;
+}
+
+/*
+ * Map the errno from a failed write to the daemon to a TCTI RC. A broken
+ * pipe or a reset connection means the daemon has gone away.
+ */
+static TSS2_RC
+lite_write_error_rc (void)
+{
+    if (errno == EPIPE || errno == ECONNRESET) {
+        return TSS2_TCTI_RC_NO_CONNECTION;
+    }
+    return TSS2_TCTI_RC_IO_ERROR;
+}
+/*
+ * Replace the connection with the daemon after it has been lost, see
+ * tcti_tabrmd_reconnect in the GLib TCTI, including the use of 'timeout'.
+ * Each attempt opens a new connection with the bus so there's no stale
+ * state to refresh.
+ */
+static TSS2_RC
+lite_reconnect (TSS2_TCTI_TABRMD_LITE_CONTEXT *ctx,
+                int32_t timeout)
+{
+    tcti_tabrmd_lite_reconnect_t *reconnect = ctx->reconnect;
+    uint8_t body [sizeof (uint64_t) + sizeof (uint8_t)];
+    uint64_t now, end_time = 0;
+    int fd = ctx->fd;
+    TSS2_RC rc = TSS2_TCTI_RC_NO_CONNECTION;
+
+    if (timeout != TSS2_TCTI_TIMEOUT_BLOCK) {
+        end_time = tcti_tabrmd_stats_now () + (uint64_t)timeout * 1000;
+    }
+    for (;
+         reconnect->attempt < TABRMD_RECONNECT_ATTEMPTS;
+         ++reconnect->attempt) {
+        now = tcti_tabrmd_stats_now ();
+        if (reconnect->attempt > 0) {
+            if (end_time != 0 && reconnect->next_time > end_time) {
+                if (end_time > now) {
+                    usleep ((useconds_t)(end_time - now));
+                }
+                return TSS2_TCTI_RC_TRY_AGAIN;
+            }
+            if (reconnect->next_time > now) {
+                usleep ((useconds_t)(reconnect->next_time - now));
+            }
+            now = tcti_tabrmd_stats_now ();
+        }
+        reconnect->next_time = now +
+            ((uint64_t)TABRMD_RECONNECT_DELAY_US << reconnect->attempt);
+        rc = lite_connect (ctx);
+        if (rc == TSS2_RC_SUCCESS) {
+            break;
+        }
+    }
+    reconnect->attempt = 0;
+    if (rc != TSS2_RC_SUCCESS) {
+        lite_warn ("failed to reconnect to daemon after %u attempts",
+                   TABRMD_RECONNECT_ATTEMPTS);
+        return rc;
+    }
+    if (fd != -1) {
+        close (fd);
+    }
+    ctx->index = 0;
+    if (!reconnect->locality_set) {
+        return TSS2_RC_SUCCESS;
+    }
+    lite_put_id (body, ctx->id);
+    body [sizeof (uint64_t)] = reconnect->locality;
+    return lite_call_rc_method (ctx,
+                                TABRMD_DBUS_METHOD_SET_LOCALITY,
+                                "ty",
+                                body,
+                                sizeof (body));
+}
+/*
+ * Handle the loss of the connection with the daemon, see tcti_tabrmd_replay
+ * in the GLib TCTI.
+ */
+static TSS2_RC
+lite_replay (TSS2_TCTI_TABRMD_LITE_CONTEXT *ctx,
+             TSS2_RC rc,
+             int32_t timeout)
+{
+    TSS2_RC reconnect_rc;
+
+    if (ctx->reconnect == NULL || rc != TSS2_TCTI_RC_NO_CONNECTION) {
+        return rc;
+    }
+    reconnect_rc = lite_reconnect (ctx, timeout);
+    if (reconnect_rc != TSS2_RC_SUCCESS) {
+        return reconnect_rc;
+    }
+    ctx->state = TABRMD_LITE_STATE_TRANSMIT;
+    ctx->outstanding = 0;
+    if (ctx->reconnect->replay_size == 0) {
+        return rc;
+    }
+    if (lite_write_all (ctx->fd,
+                        ctx->reconnect->replay,
+                        ctx->reconnect->replay_size) != 0) {
+        return lite_write_error_rc ();
+    }
+    ctx->state = TABRMD_LITE_STATE_RECEIVE;
+    ctx->outstanding = 1;
+    return TSS2_RC_SUCCESS;
+}
+
+static TSS2_RC
+tss2_tcti_tabrmd_lite_transmit (TSS2_TCTI_CONTEXT *context,
+                                size_t size,
+                                const uint8_t *command)
+{
+    tcti_tabrmd_lite_reconnect_t *reconnect;
+    TSS2_RC rc;
+
+    if (context == NULL || command == NULL) {
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+    }
+    if (size == 0) {
+        return TSS2_TCTI_RC_BAD_VALUE;
+    }
+    if (lite_check_context (context) != TSS2_RC_SUCCESS) {
+        return TSS2_TCTI_RC_BAD_CONTEXT;
+    }
+    if (LITE_CTX (context)->state != TABRMD_LITE_STATE_TRANSMIT) {
+        return TSS2_TCTI_RC_BAD_SEQUENCE;
+    }
+    reconnect = LITE_CTX (context)->reconnect;
+    if (reconnect != NULL) {
+        if (size <= sizeof (reconnect->replay) &&
+            tcti_tabrmd_replay_safe (command, size)) {
+            memcpy (reconnect->replay, command, size);
+            reconnect->replay_size = size;
+        } else {
+            reconnect->replay_size = 0;
+        }
+    }
+    if (lite_write_all (LITE_CTX (context)->fd, command, size) != 0) {
+        rc = lite_write_error_rc ();
+        return lite_replay (LITE_CTX (context), rc, TSS2_TCTI_TIMEOUT_BLOCK);
+    }
+    LITE_CTX (context)->state = TABRMD_LITE_STATE_RECEIVE;
+    LITE_CTX (context)->outstanding = 1;
+    tcti_tabrmd_stats_transmit (&LITE_CTX (context)->stats, 1, size);
+    return TSS2_RC_SUCCESS;
+}
+/*
+ * Read as much of the requested data as possible into 'buf' at the context
+ * 'index', waiting up to 'timeout' for it to become available. A short
+ * read returns TSS2_TCTI_RC_TRY_AGAIN, the same as tcti_tabrmd_read.
+ */
+static TSS2_RC
+lite_read (TSS2_TCTI_TABRMD_LITE_CONTEXT *ctx,
+           uint8_t *buf,
+           size_t size,
+           int32_t timeout)
+{
+    struct pollfd pollfd = { .fd = ctx->fd, .events = POLLIN | POLLPRI, };
+    ssize_t num_read;
+    int ret;
+
+    if (timeout != TSS2_TCTI_TIMEOUT_BLOCK) {
+        ret = LITE_EINTR_RETRY (poll (&pollfd, 1, timeout));
+        if (ret == 0) {
+            return TSS2_TCTI_RC_TRY_AGAIN;
+        } else if (ret == -1) {
+            return TSS2_TCTI_RC_GENERAL_FAILURE;
+        }
+    }
+    num_read = LITE_EINTR_RETRY (read (ctx->fd, &buf [ctx->index], size));
+    switch (num_read) {
+    case 0:
+        return TSS2_TCTI_RC_NO_CONNECTION;
+    case -1:
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return TSS2_TCTI_RC_TRY_AGAIN;
+        }
+        if (errno == ECONNRESET) {
+            return TSS2_TCTI_RC_NO_CONNECTION;
+        }
+        return errno == EIO ? TSS2_TCTI_RC_IO_ERROR :
+                              TSS2_TCTI_RC_GENERAL_FAILURE;
+    default:
+        ctx->index += (size_t)num_read;
+        return (size_t)num_read == size ? TSS2_RC_SUCCESS :
+                                          TSS2_TCTI_RC_TRY_AGAIN;
+    }
+}
+/*
+ * The same algorithm as tcti_tabrmd_receive_stream in the GLib TCTI.
+ */
+static TSS2_RC
+lite_receive_stream (TSS2_TCTI_TABRMD_LITE_CONTEXT *ctx,
+                     size_t *size,
+                     uint8_t *response,
+                     int32_t timeout)
+{
+    TSS2_RC rc = TSS2_RC_SUCCESS;
+    bool header_in_response = false;
+
+    if (ctx->index < TPM_HEADER_SIZE) {
+        if (ctx->index == 0 && response != NULL) {
+            rc = lite_read (ctx, response, TPM_HEADER_SIZE, timeout);
+            memcpy (ctx->header_buf, response, ctx->index);
+            header_in_response = true;
+        } else {
+            rc = lite_read (ctx,
+                            ctx->header_buf,
+                            TPM_HEADER_SIZE - ctx->index,
+                            timeout);
+        }
+        if (rc != TSS2_RC_SUCCESS) {
+            return rc;
+        }
+        ctx->response_size = tcti_tabrmd_lite_get_u32 (&ctx->header_buf [2],
+                                                       true);
+        if (ctx->response_size < TPM_HEADER_SIZE) {
+            ctx->state = TABRMD_LITE_STATE_TRANSMIT;
+            return TSS2_TCTI_RC_MALFORMED_RESPONSE;
+        }
+    }
+    if (response == NULL) {
+        *size = ctx->response_size;
+        return TSS2_RC_SUCCESS;
+    } else if (ctx->index == TPM_HEADER_SIZE && !header_in_response) {
+        memcpy (response, ctx->header_buf, TPM_HEADER_SIZE);
+    }
+    if (*size < ctx->response_size) {
+        return TSS2_TCTI_RC_INSUFFICIENT_BUFFER;
+    }
+    if (ctx->response_size != ctx->index) {
+        rc = lite_read (ctx, response, ctx->response_size - ctx->index, timeout);
+    }
+    if (rc == TSS2_RC_SUCCESS) {
+        *size = ctx->index;
+        ctx->index = 0;
+        ctx->state = TABRMD_LITE_STATE_TRANSMIT;
+    }
+    return rc;
+}
+
+static TSS2_RC
+tss2_tcti_tabrmd_lite_receive (TSS2_TCTI_CONTEXT *context,
+                               size_t *size,
+                               uint8_t *response,
+                               int32_t timeout)
+{
+    TSS2_TCTI_TABRMD_LITE_CONTEXT *ctx = LITE_CTX (context);
+    TSS2_RC rc;
+
+    if (context == NULL || size == NULL) {
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+    }
+    if (response == NULL && *size != 0) {
+        return TSS2_TCTI_RC_BAD_VALUE;
+    }
+    if (lite_check_context (context) != TSS2_RC_SUCCESS) {
+        return TSS2_TCTI_RC_BAD_CONTEXT;
+    }
+    if (ctx->state != TABRMD_LITE_STATE_RECEIVE) {
+        return TSS2_TCTI_RC_BAD_SEQUENCE;
+    }
+    if (timeout < TSS2_TCTI_TIMEOUT_BLOCK) {
+        return TSS2_TCTI_RC_BAD_VALUE;
+    }
+    if (response != NULL && *size < TPM_HEADER_SIZE) {
+        return TSS2_TCTI_RC_INSUFFICIENT_BUFFER;
+    }
+    rc = lite_receive_stream (ctx, size, response, timeout);
+    if (rc == TSS2_TCTI_RC_NO_CONNECTION) {
+        rc = lite_replay (ctx, rc, timeout);
+        if (rc == TSS2_RC_SUCCESS) {
+            rc = lite_receive_stream (ctx, size, response, timeout);
+        }
+    }
+    if (rc != TSS2_RC_SUCCESS || response != NULL) {
+        tcti_tabrmd_stats_receive (&ctx->stats, rc, *size);
+    }
+    if (ctx->state == TABRMD_LITE_STATE_TRANSMIT) {
+        if (rc == TSS2_RC_SUCCESS && ctx->outstanding > 1) {
+            ctx->state = TABRMD_LITE_STATE_RECEIVE;
+            --ctx->outstanding;
+        } else {
+            ctx->outstanding = 0;
+        }
+    }
+    return rc;
+}
+
+static void
+lite_init_free (tcti_tabrmd_lite_init_t *init)
+{
+    if (init->fds [0] != -1) {
+        close (init->fds [0]);
+    }
+    if (init->fds [1] != -1) {
+        close (init->fds [1]);
+    }
+    free (init);
+}
+/*
+ * Wait for the thread created by Tss2_Tcti_Tabrmd_InitAsync and return
+ * the result of the connection attempt.
+ */
+static TSS2_RC
+lite_init_join (TSS2_TCTI_TABRMD_LITE_CONTEXT *ctx)
+{
+    TSS2_RC rc;
+
+    if (ctx->init == NULL) {
+        return TSS2_RC_SUCCESS;
+    }
+    pthread_join (ctx->init->thread, NULL);
+    rc = ctx->init->rc;
+    lite_init_free (ctx->init);
+    ctx->init = NULL;
+    return rc;
+}
+
+static void
+lite_reconnect_free (TSS2_TCTI_TABRMD_LITE_CONTEXT *ctx)
+{
+    free (ctx->reconnect);
+    ctx->reconnect = NULL;
+}
+
+static void
+tss2_tcti_tabrmd_lite_finalize (TSS2_TCTI_CONTEXT *context)
+{
+    if (context == NULL) {
+        return;
+    }
+    lite_init_join (LITE_CTX (context));
+    LITE_CTX (context)->state = TABRMD_LITE_STATE_FINAL;
+    if (LITE_CTX (context)->fd != -1) {
+        close (LITE_CTX (context)->fd);
+        LITE_CTX (context)->fd = -1;
+    }
+    lite_reconnect_free (LITE_CTX (context));
+}
+
+static TSS2_RC
+tss2_tcti_tabrmd_lite_cancel (TSS2_TCTI_CONTEXT *context)
+{
+    uint8_t body [sizeof (uint64_t)];
+
+    if (context == NULL) {
+        return TSS2_TCTI_RC_BAD_CONTEXT;
+    }
+    if (LITE_CTX (context)->state != TABRMD_LITE_STATE_RECEIVE) {
+        return TSS2_TCTI_RC_BAD_SEQUENCE;
+    }
+    lite_put_id (body, LITE_CTX (context)->id);
+    return lite_call_rc_method (LITE_CTX (context),
+                                TABRMD_DBUS_METHOD_CANCEL,
+                                "t",
+                                body,
+                                sizeof (body));
+}
+
+static TSS2_RC
+tss2_tcti_tabrmd_lite_get_poll_handles (TSS2_TCTI_CONTEXT *context,
+                                        TSS2_TCTI_POLL_HANDLE *handles,
+                                        size_t *num_handles)
+{
+    if (context == NULL) {
+        return TSS2_TCTI_RC_BAD_CONTEXT;
+    }
+    if (num_handles == NULL) {
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+    }
+    if (handles != NULL && *num_handles < 1) {
+        return TSS2_TCTI_RC_INSUFFICIENT_BUFFER;
+    }
+    *num_handles = 1;
+    if (handles == NULL) {
+        return TSS2_RC_SUCCESS;
+    }
+    if (LITE_CTX (context)->state == TABRMD_LITE_STATE_INIT) {
+        handles [0].fd = LITE_CTX (context)->init->fds [0];
+    } else {
+        handles [0].fd = LITE_CTX (context)->fd;
+    }
+    return TSS2_RC_SUCCESS;
+}
+
+static TSS2_RC
+tss2_tcti_tabrmd_lite_set_locality (TSS2_TCTI_CONTEXT *context,
+                                    uint8_t locality)
+{
+    uint8_t body [sizeof (uint64_t) + sizeof (uint8_t)];
+    TSS2_RC rc;
+
+    if (context == NULL) {
+        return TSS2_TCTI_RC_BAD_CONTEXT;
+    }
+    if (LITE_CTX (context)->state != TABRMD_LITE_STATE_TRANSMIT) {
+        return TSS2_TCTI_RC_BAD_SEQUENCE;
+    }
+    lite_put_id (body, LITE_CTX (context)->id);
+    body [sizeof (uint64_t)] = locality;
+    rc = lite_call_rc_method (LITE_CTX (context),
+                              TABRMD_DBUS_METHOD_SET_LOCALITY,
+                              "ty",
+                              body,
+                              sizeof (body));
+    if (rc == TSS2_RC_SUCCESS && LITE_CTX (context)->reconnect != NULL) {
+        LITE_CTX (context)->reconnect->locality_set = true;
+        LITE_CTX (context)->reconnect->locality = locality;
+    }
+    return rc;
+}
+
+TSS2_RC
+Tss2_Tcti_Tabrmd_TransmitMany (TSS2_TCTI_CONTEXT    *context,
+                               size_t                count,
+                               const size_t         *sizes,
+                               const uint8_t *const *commands)
+{
+    size_t i, bytes = 0;
+    TSS2_RC rc;
+
+    if (context == NULL || sizes == NULL || commands == NULL) {
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+    }
+    if (count == 0 || count > TSS2_TCTI_TABRMD_MANY_MAX) {
+        return TSS2_TCTI_RC_BAD_VALUE;
+    }
+    if (lite_check_context (context) != TSS2_RC_SUCCESS) {
+        return TSS2_TCTI_RC_BAD_CONTEXT;
+    }
+    if (LITE_CTX (context)->state != TABRMD_LITE_STATE_TRANSMIT) {
+        return TSS2_TCTI_RC_BAD_SEQUENCE;
+    }
+    for (i = 0; i < count; ++i) {
+        if (commands [i] == NULL) {
+            return TSS2_TCTI_RC_BAD_REFERENCE;
+        }
+        if (sizes [i] == 0) {
+            return TSS2_TCTI_RC_BAD_VALUE;
+        }
+    }
+    /* only single commands are replayed after reconnecting */
+    if (LITE_CTX (context)->reconnect != NULL) {
+        LITE_CTX (context)->reconnect->replay_size = 0;
+    }
+    for (i = 0; i < count; ++i) {
+        if (lite_write_all (LITE_CTX (context)->fd, commands [i], sizes [i]) != 0) {
+            rc = lite_write_error_rc ();
+            /* the commands already written can't be taken back */
+            if (i > 0) {
+                LITE_CTX (context)->state = TABRMD_LITE_STATE_RECEIVE;
+                LITE_CTX (context)->outstanding = i;
+                tcti_tabrmd_stats_transmit (&LITE_CTX (context)->stats,
+                                            i,
+                                            bytes);
+            }
+            return rc;
+        }
+        bytes += sizes [i];
+    }
+    LITE_CTX (context)->state = TABRMD_LITE_STATE_RECEIVE;
+    LITE_CTX (context)->outstanding = count;
+    tcti_tabrmd_stats_transmit (&LITE_CTX (context)->stats, count, bytes);
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC
+Tss2_Tcti_Tabrmd_ReceiveMany (TSS2_TCTI_CONTEXT *context,
+                              size_t count,
+                              size_t *sizes,
+                              uint8_t **responses,
+                              int32_t timeout,
+                              size_t *received)
+{
+    TSS2_RC rc = TSS2_RC_SUCCESS;
+
+    if (context == NULL || sizes == NULL || responses == NULL ||
+        received == NULL) {
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+    }
+    *received = 0;
+    if (lite_check_context (context) != TSS2_RC_SUCCESS) {
+        return TSS2_TCTI_RC_BAD_CONTEXT;
+    }
+    if (count == 0 || count > LITE_CTX (context)->outstanding) {
+        return TSS2_TCTI_RC_BAD_VALUE;
+    }
+    while (*received < count) {
+        rc = tss2_tcti_tabrmd_lite_receive (context,
+                                            &sizes [*received],
+                                            responses [*received],
+                                            timeout);
+        if (rc != TSS2_RC_SUCCESS) {
+            break;
+        }
+        ++*received;
+    }
+    return rc;
+}
+
+TSS2_RC
+Tss2_Tcti_Tabrmd_GetStats (TSS2_TCTI_CONTEXT *context,
+                           TSS2_TCTI_TABRMD_STATS *stats)
+{
+    if (context == NULL || stats == NULL) {
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+    }
+    if (lite_check_context (context) != TSS2_RC_SUCCESS) {
+        return TSS2_TCTI_RC_BAD_CONTEXT;
+    }
+    *stats = LITE_CTX (context)->stats.stats;
+    return TSS2_RC_SUCCESS;
+}
+
+static void
+init_tcti_data (TSS2_TCTI_CONTEXT *context)
+{
+    memset (context, 0, sizeof (TSS2_TCTI_TABRMD_LITE_CONTEXT));
+
+    TSS2_TCTI_MAGIC (context)            = TSS2_TCTI_TABRMD_MAGIC;
+    TSS2_TCTI_VERSION (context)          = TSS2_TCTI_TABRMD_VERSION;
+    TSS2_TCTI_TRANSMIT (context)         = tss2_tcti_tabrmd_lite_transmit;
+    TSS2_TCTI_RECEIVE (context)          = tss2_tcti_tabrmd_lite_receive;
+    TSS2_TCTI_FINALIZE (context)         = tss2_tcti_tabrmd_lite_finalize;
+    TSS2_TCTI_CANCEL (context)           = tss2_tcti_tabrmd_lite_cancel;
+    TSS2_TCTI_GET_POLL_HANDLES (context) = tss2_tcti_tabrmd_lite_get_poll_handles;
+    TSS2_TCTI_SET_LOCALITY (context)     = tss2_tcti_tabrmd_lite_set_locality;
+    LITE_CTX (context)->state = TABRMD_LITE_STATE_TRANSMIT;
+    LITE_CTX (context)->fd = -1;
+}
+/*
+ * Parse the conf string in place. Accepts the same keys and values as the
+ * GLib TCTI. The strings in 'lite_conf' point into 'conf'.
+ */
+TSS2_RC
+tcti_tabrmd_lite_conf_parse (char *conf,
+                             tcti_tabrmd_lite_conf_t *lite_conf)
+{
+    static const char *transports [] = { "stream", "seqpacket", "mux" };
+    char *pair, *value, *saveptr = NULL;
+    size_t i;
+
+    for (pair = strtok_r (conf, ",", &saveptr);
+         pair != NULL;
+         pair = strtok_r (NULL, ",", &saveptr)) {
+        value = strchr (pair, '=');
+        if (value == NULL || value == pair || value [1] == '\0') {
+            return TSS2_TCTI_RC_BAD_VALUE;
+        }
+        *value++ = '\0';
+        if (strcmp (pair, "bus_name") == 0) {
+            if (strlen (value) > TABRMD_LITE_BUS_NAME_MAX) {
+                return TSS2_TCTI_RC_BAD_VALUE;
+            }
+            lite_conf->bus_name = value;
+        } else if (strcmp (pair, "bus_type") == 0) {
+            if (strcmp (value, "system") == 0) {
+                lite_conf->bus_type = TABRMD_LITE_BUS_SYSTEM;
+            } else if (strcmp (value, "session") == 0) {
+                lite_conf->bus_type = TABRMD_LITE_BUS_SESSION;
+            } else {
+                return TSS2_TCTI_RC_BAD_VALUE;
+            }
+        } else if (strcmp (pair, "transport") == 0) {
+            for (i = 0; i < sizeof (transports) / sizeof (transports [0]); ++i) {
+                if (strcmp (value, transports [i]) == 0) {
+                    break;
+                }
+            }
+            if (i == sizeof (transports) / sizeof (transports [0])) {
+                return TSS2_TCTI_RC_BAD_VALUE;
+            }
+        } else if (strcmp (pair, "reconnect") == 0) {
+            if (strcmp (value, "true") == 0) {
+                lite_conf->reconnect = true;
+            } else if (strcmp (value, "false") == 0) {
+                lite_conf->reconnect = false;
+            } else {
+                return TSS2_TCTI_RC_BAD_VALUE;
+            }
+        } else {
+            return TSS2_TCTI_RC_BAD_VALUE;
+        }
+    }
+    return TSS2_RC_SUCCESS;
+}
+/* see CONF_STRING_MAX in tcti-tabrmd.c */
+#define CONF_STRING_MAX 316
+/*
+ * Validate the parameters common to Tss2_Tcti_Tabrmd_Init and
+ * Tss2_Tcti_Tabrmd_InitAsync, parse the conf string and initialize the
+ * context. Returns TSS2_RC_SUCCESS with '*done' set if the caller only
+ * queried the context size.
+ */
+static TSS2_RC
+lite_init_common (TSS2_TCTI_CONTEXT *context,
+                  size_t *size,
+                  const char *conf,
+                  bool *done)
+{
+    tcti_tabrmd_lite_conf_t lite_conf = {
+        .bus_name = TABRMD_DBUS_NAME_DEFAULT,
+        .bus_type = TABRMD_LITE_BUS_SYSTEM,
+    };
+    char conf_copy [CONF_STRING_MAX + 1];
+    TSS2_RC rc;
+
+    *done = false;
+    if (context == NULL && size != NULL) {
+        *size = sizeof (TSS2_TCTI_TABRMD_LITE_CONTEXT);
+        *done = true;
+        return TSS2_RC_SUCCESS;
+    }
+    if (size == NULL) {
+        return TSS2_TCTI_RC_BAD_VALUE;
+    }
+    if (conf != NULL) {
+        if (strlen (conf) > CONF_STRING_MAX) {
+            return TSS2_TCTI_RC_BAD_VALUE;
+        }
+        strcpy (conf_copy, conf);
+        rc = tcti_tabrmd_lite_conf_parse (conf_copy, &lite_conf);
+        if (rc != TSS2_RC_SUCCESS) {
+            return rc;
+        }
+    }
+    init_tcti_data (context);
+    LITE_CTX (context)->bus_type = lite_conf.bus_type;
+    strcpy (LITE_CTX (context)->bus_name, lite_conf.bus_name);
+    if (lite_conf.reconnect) {
+        LITE_CTX (context)->reconnect =
+            calloc (1, sizeof (tcti_tabrmd_lite_reconnect_t));
+        if (LITE_CTX (context)->reconnect == NULL) {
+            return TSS2_TCTI_RC_MEMORY;
+        }
+    }
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC
+Tss2_Tcti_Tabrmd_Init (TSS2_TCTI_CONTEXT *context,
+                       size_t            *size,
+                       const char        *conf)
+{
+    TSS2_RC rc;
+    bool done;
+
+    rc = lite_init_common (context, size, conf, &done);
+    if (rc != TSS2_RC_SUCCESS || done) {
+        return rc;
+    }
+    rc = lite_connect (LITE_CTX (context));
+    if (rc != TSS2_RC_SUCCESS) {
+        lite_reconnect_free (LITE_CTX (context));
+    }
+    return rc;
+}
+
+static void*
+lite_init_thread (void *data)
+{
+    TSS2_TCTI_TABRMD_LITE_CONTEXT *ctx = LITE_CTX (data);
+    const uint8_t done = 1;
+
+    ctx->init->rc = lite_connect (ctx);
+    __atomic_store_n (&ctx->init->done, 1, __ATOMIC_RELEASE);
+    if (LITE_EINTR_RETRY (write (ctx->init->fds [1], &done, 1)) != 1) {
+        lite_warn ("failed to signal completion: %s", strerror (errno));
+    }
+    return NULL;
+}
+
+TSS2_RC
+Tss2_Tcti_Tabrmd_InitAsync (TSS2_TCTI_CONTEXT *context,
+                            size_t            *size,
+                            const char        *conf)
+{
+    tcti_tabrmd_lite_init_t *init;
+    TSS2_RC rc;
+    bool done;
+
+    rc = lite_init_common (context, size, conf, &done);
+    if (rc != TSS2_RC_SUCCESS || done) {
+        return rc;
+    }
+    init = calloc (1, sizeof (*init));
+    if (init == NULL) {
+        lite_reconnect_free (LITE_CTX (context));
+        return TSS2_TCTI_RC_MEMORY;
+    }
+    if (pipe2 (init->fds, O_CLOEXEC) != 0) {
+        lite_warn ("failed to create poll handle: %s", strerror (errno));
+        lite_reconnect_free (LITE_CTX (context));
+        free (init);
+        return TSS2_TCTI_RC_GENERAL_FAILURE;
+    }
+    LITE_CTX (context)->init = init;
+    LITE_CTX (context)->state = TABRMD_LITE_STATE_INIT;
+    if (pthread_create (&init->thread, NULL, lite_init_thread, context) != 0) {
+        lite_warn ("failed to create thread");
+        LITE_CTX (context)->init = NULL;
+        LITE_CTX (context)->state = TABRMD_LITE_STATE_FINAL;
+        lite_reconnect_free (LITE_CTX (context));
+        lite_init_free (init);
+        return TSS2_TCTI_RC_GENERAL_FAILURE;
+    }
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC
+Tss2_Tcti_Tabrmd_InitFinish (TSS2_TCTI_CONTEXT *context)
+{
+    TSS2_TCTI_TABRMD_LITE_CONTEXT *ctx = LITE_CTX (context);
+    TSS2_RC rc;
+
+    if (context == NULL) {
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+    }
+    if (lite_check_context (context) != TSS2_RC_SUCCESS) {
+        return TSS2_TCTI_RC_BAD_CONTEXT;
+    }
+    if (ctx->state != TABRMD_LITE_STATE_INIT) {
+        return TSS2_TCTI_RC_BAD_SEQUENCE;
+    }
+    if (!__atomic_load_n (&ctx->init->done, __ATOMIC_ACQUIRE)) {
+        return TSS2_TCTI_RC_TRY_AGAIN;
+    }
+    rc = lite_init_join (ctx);
+    if (rc == TSS2_RC_SUCCESS) {
+        ctx->state = TABRMD_LITE_STATE_TRANSMIT;
+    } else {
+        ctx->state = TABRMD_LITE_STATE_FINAL;
+        lite_reconnect_free (ctx);
+    }
+    return rc;
+}
+
+/* public info structure */
+static const TSS2_TCTI_INFO tss2_tcti_info = {
+    .version = TSS2_TCTI_TABRMD_VERSION,
+    .name = "tcti-abrmd",
+    .description = "TCTI module for communication with tabrmd.",
+    .config_help = "This conf string is a series of key / value pairs " \
+        "where keys and values are separated by the '=' character and " \
+        "each pair is separated by the ',' character. Valid keys are " \
+        "\"bus_name\", \"bus_type\", \"transport\" and \"reconnect\".",
+    .init = Tss2_Tcti_Tabrmd_Init,
+};
+
+const TSS2_TCTI_INFO*
+Tss2_Tcti_Info (void)
+{
+    return &tss2_tcti_info;
+}
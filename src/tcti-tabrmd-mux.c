@@ -0,0 +1,400 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#include <errno.h>
+#include <gio/gio.h>
+#include <glib.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <tss2/tss2_tpm2_types.h>
+
+#include "logging.h"
+#include "tabrmd.h"
+#include "tcti-tabrmd-priv.h"
+#include "tpm2-header.h"
+#include "util.h"
+
+/*
+ * Multiplexed connections are cached per bus type / bus name pair so that
+ * all TCTI contexts in the process using the "mux" transport share a single
+ * connection with the daemon. A connection is created by the first context
+ * to ask for it and closed when the last context using it is finalized.
+ * Like the proxy cache, the connections are forgotten (not freed) in the
+ * child after a fork and the mutex is held across the fork.
+ */
+static GMutex mux_cache_mutex;
+static GHashTable *mux_cache = NULL;
+static pthread_once_t mux_cache_once = PTHREAD_ONCE_INIT;
+
+static void
+tcti_tabrmd_mux_cache_prepare (void)
+{
+    g_mutex_lock (&mux_cache_mutex);
+}
+static void
+tcti_tabrmd_mux_cache_parent (void)
+{
+    g_mutex_unlock (&mux_cache_mutex);
+}
+static void
+tcti_tabrmd_mux_cache_child (void)
+{
+    mux_cache = NULL;
+    g_mutex_unlock (&mux_cache_mutex);
+}
+static void
+tcti_tabrmd_mux_cache_atfork (void)
+{
+    pthread_atfork (tcti_tabrmd_mux_cache_prepare,
+                    tcti_tabrmd_mux_cache_parent,
+                    tcti_tabrmd_mux_cache_child);
+}
+/*
+ * Forget all cached connections without releasing them.
+ */
+void
+tcti_tabrmd_mux_cache_reset (void)
+{
+    g_mutex_lock (&mux_cache_mutex);
+    if (mux_cache != NULL) {
+        g_hash_table_steal_all (mux_cache);
+        g_clear_pointer (&mux_cache, g_hash_table_unref);
+    }
+    g_mutex_unlock (&mux_cache_mutex);
+}
+
+static void
+tcti_tabrmd_mux_queue_free (gpointer data)
+{
+    GQueue *queue = (GQueue*)data;
+    GBytes *bytes;
+
+    while ((bytes = g_queue_pop_head (queue)) != NULL) {
+        g_bytes_unref (bytes);
+    }
+    g_queue_free (queue);
+}
+
+static tcti_tabrmd_mux_t*
+tcti_tabrmd_mux_new (GSocketConnection *sock_connect,
+                     guint64            id,
+                     gchar             *key)
+{
+    tcti_tabrmd_mux_t *mux = g_malloc0 (sizeof (tcti_tabrmd_mux_t));
+
+    g_mutex_init (&mux->mutex);
+    g_cond_init (&mux->cond);
+    mux->sock_connect = g_object_ref (sock_connect);
+    mux->id = id;
+    mux->responses = g_hash_table_new_full (g_direct_hash,
+                                            g_direct_equal,
+                                            NULL,
+                                            tcti_tabrmd_mux_queue_free);
+    mux->key = key;
+    return mux;
+}
+
+static void
+tcti_tabrmd_mux_free (tcti_tabrmd_mux_t *mux)
+{
+    g_clear_object (&mux->sock_connect);
+    g_hash_table_unref (mux->responses);
+    g_cond_clear (&mux->cond);
+    g_mutex_clear (&mux->mutex);
+    g_free (mux->key);
+    g_free (mux);
+}
+/*
+ * Attach the context to the multiplexed connection as a new channel.
+ */
+static void
+tcti_tabrmd_mux_attach (TSS2_TCTI_TABRMD_CONTEXT *ctx,
+                        tcti_tabrmd_mux_t        *mux)
+{
+    g_mutex_lock (&mux->mutex);
+    ++mux->refcount;
+    ctx->channel = mux->next_channel++;
+    g_hash_table_insert (mux->responses,
+                         GUINT_TO_POINTER (ctx->channel),
+                         g_queue_new ());
+    g_mutex_unlock (&mux->mutex);
+
+    ctx->mux = mux;
+    ctx->sock_connect = g_object_ref (mux->sock_connect);
+    ctx->id = mux->id;
+    ctx->transport = TABRMD_TRANSPORT_MUX;
+    tabrmd_debug ("%s: attached to connection with id 0x%" PRIx64 " as channel %"
+                  PRIu32, __func__, ctx->id, ctx->channel);
+}
+/*
+ * Connect the context to the daemon over the multiplexed connection for
+ * the given bus, creating the connection if this is the first context to
+ * use it. If the daemon doesn't support multiplexed connections the
+ * context is left with the connection the daemon created for it using
+ * the transport it fell back to.
+ */
+TSS2_RC
+tcti_tabrmd_mux_connect (TSS2_TCTI_CONTEXT *context,
+                         GBusType           bus_type,
+                         const char        *bus_name)
+{
+    TSS2_TCTI_TABRMD_CONTEXT *ctx = (TSS2_TCTI_TABRMD_CONTEXT*)context;
+    tcti_tabrmd_mux_t *mux;
+    TSS2_RC rc = TSS2_RC_SUCCESS;
+    gchar *key;
+
+    pthread_once (&mux_cache_once, tcti_tabrmd_mux_cache_atfork);
+    key = g_strdup_printf ("%d:%s", bus_type, bus_name);
+    g_mutex_lock (&mux_cache_mutex);
+    if (mux_cache == NULL) {
+        mux_cache = g_hash_table_new (g_str_hash, g_str_equal);
+    }
+    mux = g_hash_table_lookup (mux_cache, key);
+    if (mux == NULL) {
+        rc = tcti_tabrmd_connect (context, TABRMD_TRANSPORT_MUX);
+        if (rc != TSS2_RC_SUCCESS || ctx->transport != TABRMD_TRANSPORT_MUX) {
+            goto out;
+        }
+        mux = tcti_tabrmd_mux_new (ctx->sock_connect, ctx->id, key);
+        g_hash_table_insert (mux_cache, mux->key, mux);
+        key = NULL;
+        g_clear_object (&ctx->sock_connect);
+    }
+    tcti_tabrmd_mux_attach (ctx, mux);
+out:
+    g_mutex_unlock (&mux_cache_mutex);
+    g_free (key);
+    return rc;
+}
+/*
+ * Close the context's channel and release its reference to the
+ * multiplexed connection. The connection is closed when the last channel
+ * is released.
+ */
+void
+tcti_tabrmd_mux_detach (TSS2_TCTI_TABRMD_CONTEXT *ctx)
+{
+    tcti_tabrmd_mux_t *mux = ctx->mux;
+    guint32 channel = GUINT32_TO_BE (ctx->channel);
+    GSocket *socket;
+    gboolean last;
+
+    if (mux == NULL) {
+        return;
+    }
+    /* a frame holding just the channel id closes the channel */
+    socket = g_socket_connection_get_socket (mux->sock_connect);
+    if (g_socket_send (socket,
+                       (gchar*)&channel,
+                       sizeof (channel),
+                       NULL,
+                       NULL) != sizeof (channel)) {
+        tabrmd_debug ("%s: failed to close channel %" PRIu32, __func__,
+                      ctx->channel);
+    }
+    g_mutex_lock (&mux_cache_mutex);
+    g_mutex_lock (&mux->mutex);
+    g_hash_table_remove (mux->responses, GUINT_TO_POINTER (ctx->channel));
+    last = --mux->refcount == 0;
+    g_mutex_unlock (&mux->mutex);
+    if (last && mux_cache != NULL &&
+        g_hash_table_lookup (mux_cache, mux->key) == mux) {
+        g_hash_table_remove (mux_cache, mux->key);
+    }
+    g_mutex_unlock (&mux_cache_mutex);
+    if (last) {
+        tcti_tabrmd_mux_free (mux);
+    }
+    g_clear_pointer (&ctx->mux_response, g_bytes_unref);
+    ctx->mux = NULL;
+}
+/*
+ * Send a command on the context's channel. The channel id and the command
+ * are sent as a single datagram.
+ */
+TSS2_RC
+tcti_tabrmd_mux_send (TSS2_TCTI_TABRMD_CONTEXT *ctx,
+                      const uint8_t            *command,
+                      size_t                    size)
+{
+    guint32 channel = GUINT32_TO_BE (ctx->channel);
+    GOutputVector vectors [2] = {
+        { .buffer = &channel, .size = sizeof (channel), },
+        { .buffer = command, .size = size, },
+    };
+    GError *error = NULL;
+    gssize ret;
+
+    if (size > TPM2_MAX_COMMAND_SIZE) {
+        return TSS2_TCTI_RC_BAD_VALUE;
+    }
+    tabrmd_debug_bytes (command, size, 16, 4);
+    ret = g_socket_send_message (
+        g_socket_connection_get_socket (ctx->mux->sock_connect),
+        NULL,
+        vectors,
+        2,
+        NULL,
+        0,
+        0,
+        NULL,
+        &error);
+    if (ret < 0) {
+        g_warning ("%s: send on socket produced error: %s", __func__,
+                   error->message);
+        g_error_free (error);
+        return TSS2_TCTI_RC_IO_ERROR;
+    }
+    if ((size_t)ret != sizeof (channel) + size) {
+        tabrmd_debug ("%s: short write", __func__);
+        return TSS2_TCTI_RC_GENERAL_FAILURE;
+    }
+    return TSS2_RC_SUCCESS;
+}
+/*
+ * Read one frame from the multiplexed connection. The frame is returned
+ * through 'response' along with the channel it belongs to. 'end_time' is
+ * the monotonic time at which to give up, or -1 to block.
+ * The channel id is received onto the stack and the response straight
+ * into the buffer handed to the GBytes. That buffer has to be allocated
+ * before the size of the response is known: it's shrunk to fit
+ * afterwards, which the allocator does in place.
+ */
+static TSS2_RC
+tcti_tabrmd_mux_read (tcti_tabrmd_mux_t *mux,
+                      gint64             end_time,
+                      guint32           *channel,
+                      GBytes           **response)
+{
+    GSocket *socket = g_socket_connection_get_socket (mux->sock_connect);
+    GInputVector vectors [2];
+    GError *error = NULL;
+    gssize num_read;
+    gint64 remaining;
+    gint flags = 0;
+    guint32 header;
+    uint8_t *buf;
+    gsize size;
+    int ret;
+
+    if (end_time != -1) {
+        remaining = (end_time - g_get_monotonic_time ()) /
+            G_TIME_SPAN_MILLISECOND;
+        ret = tcti_tabrmd_poll (g_socket_get_fd (socket),
+                                (int32_t)MAX (remaining, 0));
+        if (ret == -1) {
+            return TSS2_TCTI_RC_TRY_AGAIN;
+        } else if (ret != 0) {
+            return TSS2_TCTI_RC_IO_ERROR;
+        }
+    }
+    buf = g_malloc (TPM2_MAX_RESPONSE_SIZE);
+    vectors [0].buffer = &header;
+    vectors [0].size = TABRMD_MUX_HEADER_SIZE;
+    vectors [1].buffer = buf;
+    vectors [1].size = TPM2_MAX_RESPONSE_SIZE;
+    num_read = g_socket_receive_message (socket,
+                                         NULL,
+                                         vectors,
+                                         2,
+                                         NULL,
+                                         NULL,
+                                         &flags,
+                                         NULL,
+                                         &error);
+    if (num_read < 0) {
+        g_warning ("%s: receive on socket produced error: %s", __func__,
+                   error->message);
+        g_error_free (error);
+        g_free (buf);
+        return TSS2_TCTI_RC_IO_ERROR;
+    }
+    if (num_read == 0) {
+        tabrmd_debug ("%s: receive produced EOF", __func__);
+        g_free (buf);
+        return TSS2_TCTI_RC_NO_CONNECTION;
+    }
+    if (flags & MSG_TRUNC ||
+        (size_t)num_read < TABRMD_MUX_HEADER_SIZE + TPM_HEADER_SIZE) {
+        g_warning ("%s: malformed frame of size %zd", __func__, num_read);
+        g_free (buf);
+        return TSS2_TCTI_RC_MALFORMED_RESPONSE;
+    }
+    *channel = GUINT32_FROM_BE (header);
+    size = (gsize)num_read - TABRMD_MUX_HEADER_SIZE;
+    *response = g_bytes_new_take (g_realloc (buf, size), size);
+    return TSS2_RC_SUCCESS;
+}
+/*
+ * Wait for the next response on a channel of the multiplexed connection.
+ * If no response is queued for the channel and no other context is
+ * reading, this context becomes the reader: it reads frames and queues them
+ * for their channels until one arrives for its own channel. Otherwise it
+ * waits for the reader to queue a response for it. Errors reading from the
+ * connection other than a timeout are fatal for all channels.
+ */
+TSS2_RC
+tcti_tabrmd_mux_wait (tcti_tabrmd_mux_t *mux,
+                      guint32            channel,
+                      int32_t            timeout,
+                      GBytes           **response)
+{
+    gint64 end_time = -1;
+    GQueue *queue;
+    GBytes *bytes = NULL;
+    guint32 frame_channel = 0;
+    TSS2_RC rc;
+
+    if (timeout != TSS2_TCTI_TIMEOUT_BLOCK) {
+        end_time = g_get_monotonic_time () +
+            (gint64)timeout * G_TIME_SPAN_MILLISECOND;
+    }
+    g_mutex_lock (&mux->mutex);
+    for (;;) {
+        queue = g_hash_table_lookup (mux->responses,
+                                     GUINT_TO_POINTER (channel));
+        if (queue != NULL && !g_queue_is_empty (queue)) {
+            *response = g_queue_pop_head (queue);
+            rc = TSS2_RC_SUCCESS;
+            break;
+        }
+        if (mux->broken) {
+            rc = TSS2_TCTI_RC_NO_CONNECTION;
+            break;
+        }
+        if (mux->reading) {
+            if (end_time == -1) {
+                g_cond_wait (&mux->cond, &mux->mutex);
+            } else if (!g_cond_wait_until (&mux->cond, &mux->mutex, end_time)) {
+                rc = TSS2_TCTI_RC_TRY_AGAIN;
+                break;
+            }
+            continue;
+        }
+        mux->reading = TRUE;
+        g_mutex_unlock (&mux->mutex);
+        rc = tcti_tabrmd_mux_read (mux, end_time, &frame_channel, &bytes);
+        g_mutex_lock (&mux->mutex);
+        mux->reading = FALSE;
+        g_cond_broadcast (&mux->cond);
+        if (rc == TSS2_TCTI_RC_TRY_AGAIN) {
+            break;
+        } else if (rc != TSS2_RC_SUCCESS) {
+            mux->broken = TRUE;
+            break;
+        }
+        queue = g_hash_table_lookup (mux->responses,
+                                     GUINT_TO_POINTER (frame_channel));
+        if (queue != NULL) {
+            g_queue_push_tail (queue, bytes);
+        } else {
+            tabrmd_debug ("%s: dropping response for closed channel %" PRIu32,
+                          __func__, frame_channel);
+            g_bytes_unref (bytes);
+        }
+        bytes = NULL;
+    }
+    g_mutex_unlock (&mux->mutex);
+    return rc;
+}
@@ -10,8 +10,11 @@
 #include <pthread.h>
 #include <tss2/tss2_tcti.h>
 
+#include "tabrmd.h"
 #include "tabrmd-defaults.h"
 #include "tabrmd-generated.h"
+#include "tcti-tabrmd-replay.h"
+#include "tcti-tabrmd-stats.h"
 #include "tpm2-header.h"
 #include "util.h"
 
@@ -46,7 +49,16 @@
 /*
  * The elements in this enumeration represent the possible states that the
  * tabrmd TCTI can be in. The state machine is as follows:
- * An instantiated TCTI context begins in the TRANSMIT state:
+ * An instantiated TCTI context begins in the TRANSMIT state. A context
+ * instantiated with Tss2_Tcti_Tabrmd_InitAsync begins in the INIT state:
+ *   INIT:
+ *     getPollHandles: returns a handle that becomes readable when the
+ *                  connection with the daemon has been established
+ *     InitFinish:  success transitions the state machine to TRANSMIT
+ *                  failure transitions the state machine to FINAL
+ *                  TRY_AGAIN leaves the state unchanged
+ *     finalize:    transitions state machine to FINAL state
+ *     all other function calls produce TSS2_TCTI_RC_BAD_SEQUENCE
  *   TRANSMIT:
  *     transmit:    success transitions the state machine to RECEIVE
  *                  failure leaves the state unchanged
@@ -56,7 +68,9 @@
  *     setLocality: success or failure leaves state unchanged
  *   RECEIVE:
  *     transmit:    produces TSS2_TCTI_RC_BAD_SEQUENCE
- *     receive:     success transitions the state machine to TRANSMIT
+ *     receive:     success transitions the state machine to TRANSMIT unless
+ *                    more responses are outstanding after a call to
+ *                    Tss2_Tcti_Tabrmd_TransmitMany
  *                  failure with the following RCs leave the state unchanged:
  *                    TRY_AGAIN, INSUFFICIENT_BUFFER, BAD_CONTEXT,
  *                    BAD_REFERENCE, BAD_VALUE, BAD_SEQUENCE
@@ -73,8 +87,90 @@ typedef enum {
     TABRMD_STATE_FINAL,
     TABRMD_STATE_RECEIVE,
     TABRMD_STATE_TRANSMIT,
+    TABRMD_STATE_INIT,
 } tcti_tabrmd_state_t;
 
+#define TABRMD_CONF_INIT_DEFAULT { \
+    .bus_name = TABRMD_DBUS_NAME_DEFAULT, \
+    .bus_type = TABRMD_DBUS_TYPE_DEFAULT, \
+    .transport = TABRMD_TRANSPORT_STREAM, \
+}
+
+typedef struct {
+    const char *bus_name;
+    GBusType bus_type;
+    TabrmdTransport transport;
+    gboolean reconnect;
+} tabrmd_conf_t;
+
+/*
+ * Connections that lose the daemon are re-established up to this many times
+ * waiting TABRMD_RECONNECT_DELAY_US before the second attempt and twice as
+ * long before each attempt after that. The wait is bounded by the timeout
+ * of the receive call that noticed the loss.
+ */
+#define TABRMD_RECONNECT_ATTEMPTS 5
+#define TABRMD_RECONNECT_DELAY_US 10000
+/*
+ * State kept by contexts initialized with "reconnect=true". What's needed to
+ * re-create the connection is copied from the configuration, along with the
+ * locality last set successfully. 'replay' holds a copy of the last command
+ * transmitted when it's safe to send again to a new connection (see
+ * tcti-tabrmd-replay.c), 'replay_size' is 0 otherwise. A reconnect that ran
+ * out of time is pending: 'attempt' is the number of attempts made so far
+ * and 'next_time' the monotonic time before which the next one can't be
+ * made. 'attempt' is 0 when no reconnect is pending.
+ */
+typedef struct {
+    GBusType                       bus_type;
+    gchar                         *bus_name;
+    TabrmdTransport                transport;
+    gboolean                       locality_set;
+    guint8                         locality;
+    guint                          attempt;
+    gint64                         next_time;
+    size_t                         replay_size;
+    uint8_t                        replay [TPM2_MAX_COMMAND_SIZE];
+} tcti_tabrmd_reconnect_t;
+
+/*
+ * State of a pending Tss2_Tcti_Tabrmd_InitAsync. The connection with the
+ * daemon is established by 'thread'. When it's done it stores the result in
+ * 'rc', sets 'done' and writes a byte to 'fds [1]' so that 'fds [0]'
+ * becomes readable. 'conf_str' is the copy of the configuration string that
+ * the strings in 'conf' point into.
+ */
+typedef struct {
+    GThread                       *thread;
+    gint                           fds [2];
+    gchar                         *conf_str;
+    tabrmd_conf_t                  conf;
+    TSS2_RC                        rc;
+    gint                           done;
+} tcti_tabrmd_init_t;
+
+/*
+ * A connection with the daemon using TABRMD_TRANSPORT_MUX. It's shared by
+ * all of the TCTI contexts in the process that use the same bus type / bus
+ * name with the "mux" transport. Each context is a logical channel on the
+ * connection. Responses are read by one context at a time ('reading') and
+ * queued for the channel they belong to in the 'responses' table (channel
+ * id -> GQueue of GBytes). Contexts waiting for a response while another
+ * reads wait on 'cond'.
+ */
+typedef struct {
+    GMutex                         mutex;
+    GCond                          cond;
+    GSocketConnection             *sock_connect;
+    guint64                        id;
+    guint32                        next_channel;
+    guint                          refcount;
+    gboolean                       reading;
+    gboolean                       broken;
+    GHashTable                    *responses;
+    gchar                         *key;
+} tcti_tabrmd_mux_t;
+
 /* This is our private TCTI structure. We're required by the spec to have
  * the same structure as the non-opaque area defined by the
  * TSS2_TCTI_CONTEXT_COMMON_V1 structure. Anything after this data is opaque
@@ -90,18 +186,16 @@ typedef struct {
     tcti_tabrmd_state_t            state;
     size_t                         index;
     uint8_t                        header_buf [TPM_HEADER_SIZE];
+    TabrmdTransport                transport;
+    size_t                         outstanding;
+    tcti_tabrmd_mux_t             *mux;
+    guint32                        channel;
+    GBytes                        *mux_response;
+    tcti_tabrmd_init_t            *init;
+    tcti_tabrmd_stats_t            stats;
+    tcti_tabrmd_reconnect_t       *reconnect;
 } TSS2_TCTI_TABRMD_CONTEXT;
 
-#define TABRMD_CONF_INIT_DEFAULT { \
-    .bus_name = TABRMD_DBUS_NAME_DEFAULT, \
-    .bus_type = TABRMD_DBUS_TYPE_DEFAULT, \
-}
-
-typedef struct {
-    const char *bus_name;
-    GBusType bus_type;
-} tabrmd_conf_t;
-
 /*
  * This function is not exposed through the public header. It is meant to be
  * dynamically discovered using dlopen at run time. We include it here in the
@@ -109,6 +203,15 @@ typedef struct {
  */
 const TSS2_TCTI_INFO* Tss2_Tcti_Info (void);
 GBusType tabrmd_bus_type_from_str (const char* const bus_type);
+gint tabrmd_transport_from_str (const char* const transport);
+TctiTabrmd* tcti_tabrmd_proxy_get (GBusType bus_type,
+                                   const char *bus_name,
+                                   GError **error);
+TctiTabrmd* tcti_tabrmd_proxy_refresh (GBusType bus_type,
+                                       const char *bus_name,
+                                       TctiTabrmd *stale,
+                                       GError **error);
+void tcti_tabrmd_proxy_cache_reset (void);
 TSS2_RC tabrmd_kv_callback (const key_value_t *key_value,
                             gpointer user_data);
 TSS2_RC tss2_tcti_tabrmd_transmit (TSS2_TCTI_CONTEXT *context,
@@ -130,5 +233,29 @@ TSS2_RC tcti_tabrmd_read (TSS2_TCTI_TABRMD_CONTEXT *ctx,
                           uint8_t *buf,
                           size_t size,
                           int32_t timeout);
+TSS2_RC tcti_tabrmd_receive_datagram (TSS2_TCTI_TABRMD_CONTEXT *ctx,
+                                      size_t *size,
+                                      uint8_t *response,
+                                      int32_t timeout);
+TSS2_RC tcti_tabrmd_receive_mux (TSS2_TCTI_TABRMD_CONTEXT *ctx,
+                                 size_t *size,
+                                 uint8_t *response,
+                                 int32_t timeout);
+TSS2_RC tcti_tabrmd_connect (TSS2_TCTI_CONTEXT *context,
+                             TabrmdTransport transport);
+TSS2_RC tcti_tabrmd_init_join (TSS2_TCTI_TABRMD_CONTEXT *ctx);
+/* tcti-tabrmd-mux.c */
+TSS2_RC tcti_tabrmd_mux_connect (TSS2_TCTI_CONTEXT *context,
+                                 GBusType bus_type,
+                                 const char *bus_name);
+void tcti_tabrmd_mux_detach (TSS2_TCTI_TABRMD_CONTEXT *ctx);
+TSS2_RC tcti_tabrmd_mux_send (TSS2_TCTI_TABRMD_CONTEXT *ctx,
+                              const uint8_t *command,
+                              size_t size);
+TSS2_RC tcti_tabrmd_mux_wait (tcti_tabrmd_mux_t *mux,
+                              guint32 channel,
+                              int32_t timeout,
+                              GBytes **response);
+void tcti_tabrmd_mux_cache_reset (void);
 
 #endif /* TSS2TCTI_TABRMD_PRIV_H */
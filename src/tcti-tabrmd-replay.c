@@ -0,0 +1,129 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#include <string.h>
+
+#include <tss2/tss2_tpm2_types.h>
+
+#include "tcti-tabrmd-replay.h"
+#include "tpm2-header.h"
+
+/*
+ * Commands that may be sent again to a new connection with the daemon after
+ * the connection they were sent on was lost. The daemon may or may not have
+ * sent these to the TPM before going away so each must be safe to execute
+ * twice: they don't change the state of the TPM or only change it in a way
+ * that doing so twice is harmless. 'handles' is the number of handles in
+ * the handle area of the command.
+ */
+typedef struct {
+    TPM2_CC cc;
+    size_t  handles;
+} replay_command_entry_t;
+
+static const replay_command_entry_t replay_command_map[] = {
+    { .cc = TPM2_CC_GetCapability,       .handles = 0, },
+    { .cc = TPM2_CC_GetRandom,           .handles = 0, },
+    { .cc = TPM2_CC_GetTestResult,       .handles = 0, },
+    { .cc = TPM2_CC_Hash,                .handles = 0, },
+    { .cc = TPM2_CC_IncrementalSelfTest, .handles = 0, },
+    { .cc = TPM2_CC_NV_Read,             .handles = 2, },
+    { .cc = TPM2_CC_NV_ReadPublic,       .handles = 1, },
+    { .cc = TPM2_CC_PCR_Read,            .handles = 0, },
+    { .cc = TPM2_CC_ReadClock,           .handles = 0, },
+    { .cc = TPM2_CC_ReadPublic,          .handles = 1, },
+    { .cc = TPM2_CC_SelfTest,            .handles = 0, },
+    { .cc = TPM2_CC_TestParms,           .handles = 0, },
+};
+#define REPLAY_COMMAND_MAP_LENGTH (sizeof (replay_command_map) / sizeof (replay_command_entry_t))
+
+static uint32_t
+replay_get_u32 (const uint8_t *buf)
+{
+    uint32_t value;
+
+    memcpy (&value, buf, sizeof (value));
+    return be32toh (value);
+}
+
+static uint16_t
+replay_get_u16 (const uint8_t *buf)
+{
+    uint16_t value;
+
+    memcpy (&value, buf, sizeof (value));
+    return be16toh (value);
+}
+/*
+ * Besides being in the replay_command_map the command must not reference
+ * objects or sessions that belong to the lost connection: the daemon
+ * flushes them when a connection is closed and a handle that's reused by
+ * the new connection would refer to something else entirely. Transient
+ * object and session handles are rejected in the handle area and the only
+ * session allowed in the authorization area is the password session.
+ */
+bool
+tcti_tabrmd_replay_safe (const uint8_t *command,
+                         size_t         size)
+{
+    const replay_command_entry_t *entry = NULL;
+    TPM2_HANDLE handle;
+    TPM2_CC cc;
+    size_t i, offset, auth_end;
+    uint32_t auth_size;
+
+    if (size < TPM_HEADER_SIZE || replay_get_u32 (&command [2]) != size) {
+        return false;
+    }
+    cc = replay_get_u32 (&command [6]);
+    for (i = 0; i < REPLAY_COMMAND_MAP_LENGTH; ++i) {
+        if (replay_command_map [i].cc == cc) {
+            entry = &replay_command_map [i];
+            break;
+        }
+    }
+    if (entry == NULL) {
+        return false;
+    }
+    offset = TPM_HEADER_SIZE;
+    if (size < offset + entry->handles * sizeof (TPM2_HANDLE)) {
+        return false;
+    }
+    for (i = 0; i < entry->handles; ++i) {
+        handle = replay_get_u32 (&command [offset]);
+        switch (handle >> TPM2_HR_SHIFT) {
+        case TPM2_HT_TRANSIENT:
+        case TPM2_HT_HMAC_SESSION:
+        case TPM2_HT_POLICY_SESSION:
+            return false;
+        }
+        offset += sizeof (TPM2_HANDLE);
+    }
+    if (replay_get_u16 (command) != TPM2_ST_SESSIONS) {
+        return true;
+    }
+    if (size < offset + sizeof (uint32_t)) {
+        return false;
+    }
+    auth_size = replay_get_u32 (&command [offset]);
+    offset += sizeof (uint32_t);
+    if (auth_size > size - offset) {
+        return false;
+    }
+    auth_end = offset + auth_size;
+    while (offset < auth_end) {
+        if (auth_end - offset < sizeof (TPM2_HANDLE) + sizeof (uint16_t)) {
+            return false;
+        }
+        if (replay_get_u32 (&command [offset]) != TPM2_RS_PW) {
+            return false;
+        }
+        offset += sizeof (TPM2_HANDLE);
+        /* nonce, session attributes and the size of the hmac */
+        offset += sizeof (uint16_t) + replay_get_u16 (&command [offset]) +
+                  sizeof (uint8_t);
+        if (offset + sizeof (uint16_t) > auth_end) {
+            return false;
+        }
+        offset += sizeof (uint16_t) + replay_get_u16 (&command [offset]);
+    }
+    return offset == auth_end;
+}
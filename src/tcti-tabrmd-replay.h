@@ -0,0 +1,17 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef TCTI_TABRMD_REPLAY_H
+#define TCTI_TABRMD_REPLAY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Determine whether a command transmitted by a context that reconnects may
+ * be sent again to a new connection with the daemon. This is shared by the
+ * GLib and the lite TCTI and so mustn't depend on GLib.
+ */
+bool tcti_tabrmd_replay_safe (const uint8_t *command,
+                              size_t size);
+
+#endif /* TCTI_TABRMD_REPLAY_H */
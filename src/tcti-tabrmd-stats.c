@@ -0,0 +1,79 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#include <time.h>
+
+#include "tcti-tabrmd-stats.h"
+
+/*
+ * Current time from the monotonic clock in microseconds.
+ */
+uint64_t
+tcti_tabrmd_stats_now (void)
+{
+    struct timespec ts;
+
+    if (clock_gettime (CLOCK_MONOTONIC, &ts) != 0) {
+        return 0;
+    }
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+/*
+ * Map a latency to its histogram bucket: the position of the most
+ * significant bit set, clamped to the last bucket.
+ */
+size_t
+tcti_tabrmd_stats_bucket (uint64_t latency_us)
+{
+    size_t bucket;
+
+    if (latency_us < 2) {
+        return 0;
+    }
+    bucket = 63 - (size_t)__builtin_clzll (latency_us);
+    if (bucket >= TSS2_TCTI_TABRMD_STATS_BUCKETS) {
+        bucket = TSS2_TCTI_TABRMD_STATS_BUCKETS - 1;
+    }
+    return bucket;
+}
+/*
+ * Account for 'count' commands totalling 'bytes' that have been sent to the
+ * daemon.
+ */
+void
+tcti_tabrmd_stats_transmit (tcti_tabrmd_stats_t *stats,
+                            size_t count,
+                            size_t bytes)
+{
+    stats->stats.transmits += count;
+    stats->stats.bytes_transmitted += bytes;
+    stats->transmit_time = tcti_tabrmd_stats_now ();
+}
+/*
+ * Account for the result of a call to the receive function. Only a response
+ * that has been received in full is counted as a receive and has its
+ * latency recorded. Queries for the size of the response are not counted.
+ */
+void
+tcti_tabrmd_stats_receive (tcti_tabrmd_stats_t *stats,
+                           TSS2_RC rc,
+                           size_t bytes)
+{
+    uint64_t now, latency;
+
+    if (rc == TSS2_TCTI_RC_TRY_AGAIN) {
+        ++stats->stats.try_again;
+        return;
+    }
+    if (rc != TSS2_RC_SUCCESS) {
+        return;
+    }
+    now = tcti_tabrmd_stats_now ();
+    latency = now > stats->transmit_time ? now - stats->transmit_time : 0;
+    ++stats->stats.receives;
+    stats->stats.bytes_received += bytes;
+    stats->stats.latency_total_us += latency;
+    if (latency > stats->stats.latency_max_us) {
+        stats->stats.latency_max_us = latency;
+    }
+    ++stats->stats.latency [tcti_tabrmd_stats_bucket (latency)];
+}
+
@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef TCTI_TABRMD_STATS_H
+#define TCTI_TABRMD_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <tss2/tss2_tcti.h>
+
+#include "tss2-tcti-tabrmd.h"
+
+/*
+ * Performance counters kept by each TCTI context. These are shared by the
+ * GLib and the lite TCTI and so mustn't depend on GLib. A TCTI context is
+ * not safe for concurrent use so the counters are updated without any
+ * locking. The cost of keeping them is a read of the monotonic clock when a
+ * command is sent and when a response is completed.
+ * 'transmit_time' is the time, in microseconds, the last command (or batch
+ * of commands from Tss2_Tcti_Tabrmd_TransmitMany) was sent.
+ */
+typedef struct {
+    TSS2_TCTI_TABRMD_STATS         stats;
+    uint64_t                       transmit_time;
+} tcti_tabrmd_stats_t;
+
+uint64_t tcti_tabrmd_stats_now (void);
+size_t tcti_tabrmd_stats_bucket (uint64_t latency_us);
+void tcti_tabrmd_stats_transmit (tcti_tabrmd_stats_t *stats,
+                                 size_t count,
+                                 size_t bytes);
+void tcti_tabrmd_stats_receive (tcti_tabrmd_stats_t *stats,
+                                TSS2_RC rc,
+                                size_t bytes);
+
+#endif /* TCTI_TABRMD_STATS_H */
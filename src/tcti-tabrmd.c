@@ -8,28 +8,244 @@
 #include <gio/gio.h>
 #include <gio/gunixfdlist.h>
 #include <glib.h>
+#include <glib-unix.h>
 #include <inttypes.h>
 #include <poll.h>
+#include <pthread.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #include <tss2/tss2_tpm2_types.h>
 
+#include "logging.h"
 #include "tabrmd.h"
 #include "tss2-tcti-tabrmd.h"
 #include "tcti-tabrmd-priv.h"
 #include "tpm2-header.h"
 #include "util.h"
 
+/*
+ * Map the errno from a failed write to the daemon to a TCTI RC. A broken
+ * pipe or a reset connection means the daemon has gone away.
+ */
+static TSS2_RC
+write_errno_to_tcti_rc (int error_number)
+{
+    switch (error_number) {
+    case EPIPE:
+    case ECONNRESET:
+        return TSS2_TCTI_RC_NO_CONNECTION;
+    default:
+        return TSS2_TCTI_RC_IO_ERROR;
+    }
+}
+/*
+ * Write a command to the connection with the daemon.
+ */
+static TSS2_RC
+tcti_tabrmd_write_command (TSS2_TCTI_TABRMD_CONTEXT *tabrmd_ctx,
+                           const uint8_t *command,
+                           size_t size)
+{
+    ssize_t write_ret;
+    GOutputStream *ostream;
+    int errsv;
+
+    tabrmd_debug_bytes (command, size, 16, 4);
+    ostream = g_io_stream_get_output_stream (TSS2_TCTI_TABRMD_IOSTREAM (tabrmd_ctx));
+    tabrmd_debug ("%s: blocking write on ostream", __func__);
+    write_ret = write_all (ostream, command, size);
+    /* should switch on possible errors to translate to TSS2 error codes */
+    switch (write_ret) {
+    case -1:
+        errsv = errno;
+        tabrmd_debug ("tss2_tcti_tabrmd_transmit: error writing to pipe: %s",
+                      strerror (errsv));
+        return write_errno_to_tcti_rc (errsv);
+    case 0:
+        tabrmd_debug ("tss2_tcti_tabrmd_transmit: EOF returned writing to pipe");
+        return TSS2_TCTI_RC_NO_CONNECTION;
+    default:
+        if (write_ret != (ssize_t) size) {
+            tabrmd_debug ("tss2_tcti_tabrmd_transmit: short write");
+            return TSS2_TCTI_RC_GENERAL_FAILURE;
+        }
+        return TSS2_RC_SUCCESS;
+    }
+}
+/*
+ * Remember a command transmitted by a context that reconnects so that it
+ * can be sent again if the connection is lost before the response is
+ * received. Commands that aren't safe to replay aren't kept.
+ */
+static void
+tcti_tabrmd_replay_save (TSS2_TCTI_TABRMD_CONTEXT *ctx,
+                         const uint8_t *command,
+                         size_t size)
+{
+    if (ctx->reconnect == NULL) {
+        return;
+    }
+    if (size > sizeof (ctx->reconnect->replay) ||
+        !tcti_tabrmd_replay_safe (command, size)) {
+        tabrmd_debug ("%s: command isn't safe to replay", __func__);
+        ctx->reconnect->replay_size = 0;
+        return;
+    }
+    memcpy (ctx->reconnect->replay, command, size);
+    ctx->reconnect->replay_size = size;
+}
+/*
+ * Replace the connection with the daemon after it has been lost. The daemon
+ * may still be starting up so the connection is attempted up to
+ * TABRMD_RECONNECT_ATTEMPTS times with an increasing delay. A daemon that
+ * has been restarted has a new unique name on the bus so after a failed
+ * attempt the proxy is refreshed. The locality, if it was set, is set again
+ * on the new connection. If no connection can be made the old one is kept
+ * so that the context continues to report the lost connection.
+ * The delays are bounded by 'timeout' (in milliseconds). When the next
+ * attempt is due after the timeout expires TSS2_TCTI_RC_TRY_AGAIN is
+ * returned and the reconnect is left pending: the next call picks it up
+ * where it stopped.
+ */
+static TSS2_RC
+tcti_tabrmd_reconnect (TSS2_TCTI_TABRMD_CONTEXT *ctx,
+                       int32_t timeout)
+{
+    tcti_tabrmd_reconnect_t *reconnect = ctx->reconnect;
+    GSocketConnection *sock_connect = ctx->sock_connect;
+    TctiTabrmd *proxy;
+    GError *error = NULL;
+    gint64 now, end_time = -1;
+    TSS2_RC rc = TSS2_TCTI_RC_NO_CONNECTION;
+    gboolean status;
+
+    if (timeout != TSS2_TCTI_TIMEOUT_BLOCK) {
+        end_time = g_get_monotonic_time () + (gint64)timeout * 1000;
+    }
+    ctx->sock_connect = NULL;
+    for (;
+         reconnect->attempt < TABRMD_RECONNECT_ATTEMPTS;
+         ++reconnect->attempt) {
+        now = g_get_monotonic_time ();
+        if (reconnect->attempt > 0) {
+            if (end_time != -1 && reconnect->next_time > end_time) {
+                if (end_time > now) {
+                    g_usleep (end_time - now);
+                }
+                tabrmd_debug ("%s: timeout before attempt %u", __func__,
+                              reconnect->attempt + 1);
+                ctx->sock_connect = sock_connect;
+                return TSS2_TCTI_RC_TRY_AGAIN;
+            }
+            if (reconnect->next_time > now) {
+                g_usleep (reconnect->next_time - now);
+            }
+            now = g_get_monotonic_time ();
+        }
+        reconnect->next_time = now +
+            ((gint64)TABRMD_RECONNECT_DELAY_US << reconnect->attempt);
+        if (reconnect->attempt > 0) {
+            proxy = tcti_tabrmd_proxy_refresh (reconnect->bus_type,
+                                               reconnect->bus_name,
+                                               ctx->proxy,
+                                               &error);
+            if (proxy == NULL) {
+                tabrmd_debug ("%s: failed to refresh proxy: %s", __func__,
+                              error->message);
+                g_clear_error (&error);
+                continue;
+            }
+            g_object_unref (ctx->proxy);
+            ctx->proxy = proxy;
+        }
+        rc = tcti_tabrmd_connect ((TSS2_TCTI_CONTEXT*)ctx,
+                                  reconnect->transport);
+        if (rc == TSS2_RC_SUCCESS) {
+            break;
+        }
+    }
+    reconnect->attempt = 0;
+    if (rc != TSS2_RC_SUCCESS) {
+        g_warning ("%s: failed to reconnect to daemon after %u attempts",
+                   __func__, TABRMD_RECONNECT_ATTEMPTS);
+        ctx->sock_connect = sock_connect;
+        return rc;
+    }
+    g_clear_object (&sock_connect);
+    ctx->index = 0;
+    tabrmd_info ("%s: reconnected to daemon with id 0x%" PRIx64, __func__, ctx->id);
+    if (!reconnect->locality_set) {
+        return TSS2_RC_SUCCESS;
+    }
+    status = tcti_tabrmd_call_set_locality_sync (ctx->proxy,
+                                                 ctx->id,
+                                                 reconnect->locality,
+                                                 &rc,
+                                                 NULL,
+                                                 &error);
+    if (status == FALSE) {
+        g_warning ("%s: failed to set locality on new connection: %s",
+                   __func__, error->message);
+        g_error_free (error);
+        return TSS2_TCTI_RC_NO_CONNECTION;
+    }
+    return rc;
+}
+/*
+ * Handle the loss of the connection with the daemon while a command is in
+ * flight. The connection is only considered lost when 'rc' is
+ * TSS2_TCTI_RC_NO_CONNECTION: the daemon closed it (EOF) or it was reset
+ * (ECONNRESET, EPIPE). Other errors are returned as they are. Contexts
+ * that reconnect get a new connection, see tcti_tabrmd_reconnect for the
+ * use of 'timeout'. When the command in flight is safe to replay it's sent
+ * again over the new connection and the result of sending it is returned.
+ * Otherwise 'rc' is returned and the context is ready to transmit the next
+ * command.
+ * Connections using the mux transport are shared and aren't re-established.
+ */
+static TSS2_RC
+tcti_tabrmd_replay (TSS2_TCTI_TABRMD_CONTEXT *ctx,
+                    TSS2_RC rc,
+                    int32_t timeout)
+{
+    TSS2_RC reconnect_rc;
+
+    if (ctx->reconnect == NULL || ctx->mux != NULL ||
+        rc != TSS2_TCTI_RC_NO_CONNECTION) {
+        return rc;
+    }
+    tabrmd_info ("%s: lost connection with daemon, reconnecting", __func__);
+    reconnect_rc = tcti_tabrmd_reconnect (ctx, timeout);
+    if (reconnect_rc != TSS2_RC_SUCCESS) {
+        return reconnect_rc;
+    }
+    ctx->state = TABRMD_STATE_TRANSMIT;
+    ctx->outstanding = 0;
+    if (ctx->reconnect->replay_size == 0) {
+        return rc;
+    }
+    tabrmd_info ("%s: replaying command", __func__);
+    rc = tcti_tabrmd_write_command (ctx,
+                                    ctx->reconnect->replay,
+                                    ctx->reconnect->replay_size);
+    if (rc == TSS2_RC_SUCCESS) {
+        ctx->state = TABRMD_STATE_RECEIVE;
+        ctx->outstanding = 1;
+    }
+    return rc;
+}
+
 TSS2_RC
 tss2_tcti_tabrmd_transmit (TSS2_TCTI_CONTEXT *context,
                            size_t             size,
                            const uint8_t      *command)
 {
-    ssize_t write_ret;
+    TSS2_TCTI_TABRMD_CONTEXT *tabrmd_ctx = (TSS2_TCTI_TABRMD_CONTEXT*)context;
     TSS2_RC tss2_ret = TSS2_RC_SUCCESS;
-    GOutputStream *ostream;
 
-    g_debug ("tss2_tcti_tabrmd_transmit");
+    tabrmd_debug ("tss2_tcti_tabrmd_transmit");
     if (context == NULL || command == NULL) {
         return TSS2_TCTI_RC_BAD_REFERENCE;
     }
@@ -43,29 +259,27 @@ tss2_tcti_tabrmd_transmit (TSS2_TCTI_CONTEXT *context,
     if (TSS2_TCTI_TABRMD_STATE (context) != TABRMD_STATE_TRANSMIT) {
         return TSS2_TCTI_RC_BAD_SEQUENCE;
     }
-    g_debug_bytes (command, size, 16, 4);
-    ostream = g_io_stream_get_output_stream (TSS2_TCTI_TABRMD_IOSTREAM (context));
-    g_debug ("%s: blocking write on ostream", __func__);
-    write_ret = write_all (ostream, command, size);
-    /* should switch on possible errors to translate to TSS2 error codes */
-    switch (write_ret) {
-    case -1:
-        g_debug ("tss2_tcti_tabrmd_transmit: error writing to pipe: %s",
-                 strerror (errno));
-        tss2_ret = TSS2_TCTI_RC_IO_ERROR;
-        break;
-    case 0:
-        g_debug ("tss2_tcti_tabrmd_transmit: EOF returned writing to pipe");
-        tss2_ret = TSS2_TCTI_RC_NO_CONNECTION;
-        break;
-    default:
-        if (write_ret == (ssize_t) size) {
+    if (tabrmd_ctx->mux != NULL) {
+        tss2_ret = tcti_tabrmd_mux_send (tabrmd_ctx, command, size);
+        if (tss2_ret == TSS2_RC_SUCCESS) {
             TSS2_TCTI_TABRMD_STATE (context) = TABRMD_STATE_RECEIVE;
-        } else {
-            g_debug ("tss2_tcti_tabrmd_transmit: short write");
-            tss2_ret = TSS2_TCTI_RC_GENERAL_FAILURE;
+            tabrmd_ctx->outstanding = 1;
+            tcti_tabrmd_stats_transmit (&tabrmd_ctx->stats, 1, size);
         }
-        break;
+        return tss2_ret;
+    }
+    tcti_tabrmd_replay_save (tabrmd_ctx, command, size);
+    tss2_ret = tcti_tabrmd_write_command (tabrmd_ctx, command, size);
+    if (tss2_ret != TSS2_RC_SUCCESS) {
+        /* a successful replay leaves the context in the RECEIVE state */
+        tss2_ret = tcti_tabrmd_replay (tabrmd_ctx,
+                                       tss2_ret,
+                                       TSS2_TCTI_TIMEOUT_BLOCK);
+    }
+    if (tss2_ret == TSS2_RC_SUCCESS) {
+        TSS2_TCTI_TABRMD_STATE (context) = TABRMD_STATE_RECEIVE;
+        tabrmd_ctx->outstanding = 1;
+        tcti_tabrmd_stats_transmit (&tabrmd_ctx->stats, 1, size);
     }
     return tss2_ret;
 }
@@ -85,12 +299,15 @@ errno_to_tcti_rc (int error_number)
     case EWOULDBLOCK:
 #endif
         return TSS2_TCTI_RC_TRY_AGAIN;
+    case EPIPE:
+    case ECONNRESET:
+        return TSS2_TCTI_RC_NO_CONNECTION;
     case EIO:
         return TSS2_TCTI_RC_IO_ERROR;
     default:
-        g_debug ("mapping errno %d with message \"%s\" to "
-                 "TSS2_TCTI_RC_GENERAL_FAILURE",
-                 error_number, strerror (error_number));
+        tabrmd_debug ("mapping errno %d with message \"%s\" to "
+                      "TSS2_TCTI_RC_GENERAL_FAILURE",
+                      error_number, strerror (error_number));
         return TSS2_TCTI_RC_GENERAL_FAILURE;
     }
 }
@@ -105,20 +322,20 @@ gerror_code_to_tcti_rc (int error_number)
         return TSS2_TCTI_RC_NO_CONNECTION;
     case G_IO_ERROR_WOULD_BLOCK:
         return TSS2_TCTI_RC_TRY_AGAIN;
+    /* G_IO_ERROR_CONNECTION_CLOSED (ECONNRESET) is an alias of this */
+    case G_IO_ERROR_BROKEN_PIPE:
+        return TSS2_TCTI_RC_NO_CONNECTION;
     case G_IO_ERROR_FAILED:
     case G_IO_ERROR_HOST_UNREACHABLE:
     case G_IO_ERROR_NETWORK_UNREACHABLE:
-#if G_IO_ERROR_BROKEN_PIPE != G_IO_ERROR_CONNECTION_CLOSED
-    case G_IO_ERROR_CONNECTION_CLOSED:
-#endif
 #if GLIB_MAJOR_VERSION == 2 && GLIB_MINOR_VERSION >= 44
     case G_IO_ERROR_NOT_CONNECTED:
 #endif
         return TSS2_TCTI_RC_IO_ERROR;
     default:
-        g_debug ("mapping errno %d with message \"%s\" to "
-                 "TSS2_TCTI_RC_GENERAL_FAILURE",
-                 error_number, strerror (error_number));
+        tabrmd_debug ("mapping errno %d with message \"%s\" to "
+                      "TSS2_TCTI_RC_GENERAL_FAILURE",
+                      error_number, strerror (error_number));
         return TSS2_TCTI_RC_GENERAL_FAILURE;
     }
 }
@@ -155,31 +372,91 @@ tcti_tabrmd_poll (int        fd,
     errno_tmp = errno;
     switch (ret) {
     case -1:
-        g_debug ("poll produced error: %d, %s",
-                 errno_tmp, strerror (errno_tmp));
+        tabrmd_debug ("poll produced error: %d, %s",
+                      errno_tmp, strerror (errno_tmp));
         return errno_tmp;
     case 0:
-        g_debug ("poll timed out after %" PRId32 " milliseconds", timeout);
+        tabrmd_debug ("poll timed out after %" PRId32 " milliseconds", timeout);
         return -1;
     default:
-        g_debug ("poll has %d fds ready", ret);
+        tabrmd_debug ("poll has %d fds ready", ret);
         if (pollfds[0].revents & POLLIN) {
-            g_debug ("  POLLIN");
+            tabrmd_debug ("  POLLIN");
         }
         if (pollfds[0].revents & POLLPRI) {
-            g_debug ("  POLLPRI");
+            tabrmd_debug ("  POLLPRI");
         }
         if (pollfds[0].revents & POLLRDHUP) {
-            g_debug ("  POLLRDHUP");
+            tabrmd_debug ("  POLLRDHUP");
         }
         return 0;
     }
 }
+/*
+ * Wait for the connection to become readable. When the timeout is
+ * TSS2_TCTI_TIMEOUT_BLOCK there's nothing to wait for: tcti_tabrmd_connect
+ * clears O_NONBLOCK on the socket so the read that follows blocks in the
+ * kernel. Only finite timeouts require a call to poll.
+ */
+static TSS2_RC
+tcti_tabrmd_wait (TSS2_TCTI_TABRMD_CONTEXT *ctx,
+                  int32_t timeout)
+{
+    int ret;
+
+    if (timeout == TSS2_TCTI_TIMEOUT_BLOCK) {
+        return TSS2_RC_SUCCESS;
+    }
+    ret = tcti_tabrmd_poll (TSS2_TCTI_TABRMD_FD (ctx), timeout);
+    switch (ret) {
+    case -1:
+        return TSS2_TCTI_RC_TRY_AGAIN;
+    case 0:
+        return TSS2_RC_SUCCESS;
+    default:
+        return errno_to_tcti_rc (ret);
+    }
+}
+/*
+ * Read 'size' bytes into the provided buffer with a single blocking recv on
+ * the socket: MSG_WAITALL has the kernel wait for all of the data. The read
+ * can still come up short if it's interrupted by a signal or the daemon
+ * closes the connection, that's reported as TSS2_TCTI_RC_TRY_AGAIN just like
+ * a short read from tcti_tabrmd_read.
+ */
+static TSS2_RC
+tcti_tabrmd_read_block (TSS2_TCTI_TABRMD_CONTEXT *ctx,
+                        uint8_t *buf,
+                        size_t size)
+{
+    int fd = TSS2_TCTI_TABRMD_FD (ctx);
+    ssize_t num_read;
+
+    do {
+        num_read = recv (fd, &buf [ctx->index], size, MSG_WAITALL);
+    } while (num_read == -1 && errno == EINTR);
+    switch (num_read) {
+    case 0:
+        tabrmd_debug ("recv produced EOF");
+        return TSS2_TCTI_RC_NO_CONNECTION;
+    case -1:
+        g_warning ("%s: recv on socket produced error: %s", __func__,
+                   strerror (errno));
+        return errno_to_tcti_rc (errno);
+    default:
+        tabrmd_debug ("successfully read %zd bytes", num_read);
+        tabrmd_debug_bytes (&buf [ctx->index], num_read, 16, 4);
+        ctx->index += num_read;
+        return (size_t)num_read == size ?
+            TSS2_RC_SUCCESS : TSS2_TCTI_RC_TRY_AGAIN;
+    }
+}
 /*
  * Read as much of the requested data as possible into the provided buffer.
  * If the read would block, return TSS2_TCTI_RC_TRY_AGAIN (a short read will
  * write data into the buffer first).
  * If an error occurs map that to the appropriate TSS2_RC and return.
+ * Blocking reads go straight to the socket, see tcti_tabrmd_read_block.
  */
 TSS2_RC
 tcti_tabrmd_read (TSS2_TCTI_TABRMD_CONTEXT *ctx,
@@ -189,16 +466,15 @@ tcti_tabrmd_read (TSS2_TCTI_TABRMD_CONTEXT *ctx,
 {
     GError *error = NULL;
     ssize_t num_read;
+    TSS2_RC rc;
     int ret;
 
-    ret = tcti_tabrmd_poll (TSS2_TCTI_TABRMD_FD (ctx), timeout);
-    switch (ret) {
-    case -1:
-        return TSS2_TCTI_RC_TRY_AGAIN;
-    case 0:
-        break;
-    default:
-        return errno_to_tcti_rc (ret);
+    if (timeout == TSS2_TCTI_TIMEOUT_BLOCK) {
+        return tcti_tabrmd_read_block (ctx, buf, size);
+    }
+    rc = tcti_tabrmd_wait (ctx, timeout);
+    if (rc != TSS2_RC_SUCCESS) {
+        return rc;
     }
 
     num_read = g_input_stream_read (TSS2_TCTI_TABRMD_ISTREAM (ctx),
@@ -208,7 +484,7 @@ tcti_tabrmd_read (TSS2_TCTI_TABRMD_CONTEXT *ctx,
                                     &error);
     switch (num_read) {
     case 0:
-        g_debug ("read produced EOF");
+        tabrmd_debug ("read produced EOF");
         return TSS2_TCTI_RC_NO_CONNECTION;
     case -1:
         g_assert (error != NULL);
@@ -218,8 +494,8 @@ tcti_tabrmd_read (TSS2_TCTI_TABRMD_CONTEXT *ctx,
         g_error_free (error);
         return gerror_code_to_tcti_rc (ret);
     default:
-        g_debug ("successfully read %zd bytes", num_read);
-        g_debug_bytes (&buf [ctx->index], num_read, 16, 4);
+        tabrmd_debug ("successfully read %zd bytes", num_read);
+        tabrmd_debug_bytes (&buf [ctx->index], num_read, 16, 4);
         /* Advance index by the number of bytes read. */
         ctx->index += num_read;
         /* short read means try again */
@@ -231,65 +507,244 @@ tcti_tabrmd_read (TSS2_TCTI_TABRMD_CONTEXT *ctx,
     }
 }
 /*
- * This is the receive function that is exposed to clients through the TCTI
- * API.
+ * Receive a single datagram from a SOCK_SEQPACKET connection. The datagram
+ * is consumed unless G_SOCKET_MSG_PEEK is set in 'flags'. The number of
+ * bytes received is returned through 'num_read' and the flags describing the
+ * received message (e.g. MSG_TRUNC) through 'msg_flags'.
+ */
+static TSS2_RC
+tcti_tabrmd_recv (TSS2_TCTI_TABRMD_CONTEXT *ctx,
+                  uint8_t *buf,
+                  size_t size,
+                  gint flags,
+                  size_t *num_read,
+                  gint *msg_flags)
+{
+    GInputVector vector = { .buffer = buf, .size = size, };
+    GError *error = NULL;
+    gssize ret;
+    int code;
+
+    *msg_flags = flags;
+    ret = g_socket_receive_message (TSS2_TCTI_TABRMD_SOCKET (ctx),
+                                    NULL,
+                                    &vector,
+                                    1,
+                                    NULL,
+                                    NULL,
+                                    msg_flags,
+                                    NULL,
+                                    &error);
+    switch (ret) {
+    case 0:
+        tabrmd_debug ("receive produced EOF");
+        return TSS2_TCTI_RC_NO_CONNECTION;
+    case -1:
+        g_assert (error != NULL);
+        g_warning ("%s: receive on socket produced error: %s", __func__,
+                   error->message);
+        code = error->code;
+        g_error_free (error);
+        return gerror_code_to_tcti_rc (code);
+    default:
+        tabrmd_debug ("successfully received %zd bytes", ret);
+        *num_read = (size_t)ret;
+        return TSS2_RC_SUCCESS;
+    }
+}
+/*
+ * Parse the response header in the context header_buf. Returns
+ * TSS2_TCTI_RC_MALFORMED_RESPONSE if the size from the header is smaller than
+ * the header itself.
+ */
+static TSS2_RC
+tcti_tabrmd_parse_header (TSS2_TCTI_TABRMD_CONTEXT *ctx)
+{
+    ctx->header.tag  = get_response_tag  (ctx->header_buf);
+    ctx->header.size = get_response_size (ctx->header_buf);
+    ctx->header.code = get_response_code (ctx->header_buf);
+    if (ctx->header.size < TPM_HEADER_SIZE) {
+        return TSS2_TCTI_RC_MALFORMED_RESPONSE;
+    }
+    return TSS2_RC_SUCCESS;
+}
+/*
+ * Receive function for connections using the SOCK_SEQPACKET transport.
+ * Each response is a single datagram:
+ * - If the caller's buffer is large enough for any TPM response we
+ *   receive the whole datagram directly into it with one call.
+ * - Otherwise we peek at the header (leaving the datagram queued) to learn
+ *   the size, and the datagram is received once the caller provides a
+ *   large enough buffer.
+ * The context 'index' is set to TPM_HEADER_SIZE once the header has been
+ * peeked. A response datagram that is truncated or whose size disagrees
+ * with its header has been consumed and can't be recovered, so these
+ * errors return the state machine to TRANSMIT.
  */
 TSS2_RC
-tss2_tcti_tabrmd_receive (TSS2_TCTI_CONTEXT *context,
-                          size_t            *size,
-                          uint8_t           *response,
-                          int32_t            timeout)
+tcti_tabrmd_receive_datagram (TSS2_TCTI_TABRMD_CONTEXT *ctx,
+                              size_t *size,
+                              uint8_t *response,
+                              int32_t timeout)
 {
-    TSS2_RC rc = TSS2_RC_SUCCESS;
-    TSS2_TCTI_TABRMD_CONTEXT *tabrmd_ctx = (TSS2_TCTI_TABRMD_CONTEXT*)context;
+    TSS2_RC rc;
+    size_t num_read = 0;
+    gint msg_flags = 0;
 
-    g_debug ("tss2_tcti_tabrmd_receive");
-    if (context == NULL || size == NULL) {
-        return TSS2_TCTI_RC_BAD_REFERENCE;
+    if (ctx->index < TPM_HEADER_SIZE) {
+        rc = tcti_tabrmd_wait (ctx, timeout);
+        if (rc != TSS2_RC_SUCCESS) {
+            return rc;
+        }
+        if (response != NULL && *size >= TPM2_MAX_RESPONSE_SIZE) {
+            rc = tcti_tabrmd_recv (ctx, response, *size, 0,
+                                   &num_read, &msg_flags);
+            if (rc != TSS2_RC_SUCCESS) {
+                return rc;
+            }
+            ctx->state = TABRMD_STATE_TRANSMIT;
+            if (msg_flags & MSG_TRUNC || num_read < TPM_HEADER_SIZE) {
+                return TSS2_TCTI_RC_MALFORMED_RESPONSE;
+            }
+            memcpy (ctx->header_buf, response, TPM_HEADER_SIZE);
+            rc = tcti_tabrmd_parse_header (ctx);
+            if (rc != TSS2_RC_SUCCESS || ctx->header.size != num_read) {
+                return TSS2_TCTI_RC_MALFORMED_RESPONSE;
+            }
+            tabrmd_debug_bytes (response, num_read, 16, 4);
+            *size = num_read;
+            return TSS2_RC_SUCCESS;
+        }
+        rc = tcti_tabrmd_recv (ctx, ctx->header_buf, TPM_HEADER_SIZE,
+                               G_SOCKET_MSG_PEEK, &num_read, &msg_flags);
+        if (rc != TSS2_RC_SUCCESS) {
+            return rc;
+        }
+        if (num_read < TPM_HEADER_SIZE ||
+            tcti_tabrmd_parse_header (ctx) != TSS2_RC_SUCCESS) {
+            /* discard the malformed datagram */
+            tcti_tabrmd_recv (ctx, ctx->header_buf, TPM_HEADER_SIZE, 0,
+                              &num_read, &msg_flags);
+            ctx->state = TABRMD_STATE_TRANSMIT;
+            return TSS2_TCTI_RC_MALFORMED_RESPONSE;
+        }
+        ctx->index = TPM_HEADER_SIZE;
     }
-    if (response == NULL && *size != 0) {
-        return TSS2_TCTI_RC_BAD_VALUE;
+    /* if response is NULL, caller is querying size, we know size isn't NULL */
+    if (response == NULL) {
+        *size = ctx->header.size;
+        return TSS2_RC_SUCCESS;
     }
-    if (TSS2_TCTI_MAGIC (context) != TSS2_TCTI_TABRMD_MAGIC ||
-        TSS2_TCTI_VERSION (context) != TSS2_TCTI_TABRMD_VERSION) {
-        return TSS2_TCTI_RC_BAD_CONTEXT;
+    if (*size < ctx->header.size) {
+        return TSS2_TCTI_RC_INSUFFICIENT_BUFFER;
     }
-    if (tabrmd_ctx->state != TABRMD_STATE_RECEIVE) {
-        return TSS2_TCTI_RC_BAD_SEQUENCE;
+    rc = tcti_tabrmd_recv (ctx, response, ctx->header.size, 0,
+                           &num_read, &msg_flags);
+    if (rc != TSS2_RC_SUCCESS) {
+        return rc;
     }
-    if (timeout < TSS2_TCTI_TIMEOUT_BLOCK) {
-        return TSS2_TCTI_RC_BAD_VALUE;
+    ctx->index = 0;
+    ctx->state = TABRMD_STATE_TRANSMIT;
+    if (msg_flags & MSG_TRUNC || num_read != ctx->header.size) {
+        return TSS2_TCTI_RC_MALFORMED_RESPONSE;
     }
-    if (size == NULL || (response == NULL && *size != 0)) {
-        return TSS2_TCTI_RC_BAD_REFERENCE;
+    tabrmd_debug_bytes (response, num_read, 16, 4);
+    *size = num_read;
+    return TSS2_RC_SUCCESS;
+}
+/*
+ * Receive function for contexts using a channel of a multiplexed
+ * connection. Responses are read from the shared connection and handed to
+ * the channel they belong to by tcti_tabrmd_mux_wait. The response for
+ * this context is kept in 'mux_response' until the caller provides a large
+ * enough buffer.
+ */
+TSS2_RC
+tcti_tabrmd_receive_mux (TSS2_TCTI_TABRMD_CONTEXT *ctx,
+                         size_t *size,
+                         uint8_t *response,
+                         int32_t timeout)
+{
+    const uint8_t *buf;
+    gsize buf_size = 0;
+    TSS2_RC rc;
+
+    if (ctx->mux_response == NULL) {
+        rc = tcti_tabrmd_mux_wait (ctx->mux,
+                                   ctx->channel,
+                                   timeout,
+                                   &ctx->mux_response);
+        if (rc != TSS2_RC_SUCCESS) {
+            return rc;
+        }
+        buf = g_bytes_get_data (ctx->mux_response, &buf_size);
+        memcpy (ctx->header_buf, buf, TPM_HEADER_SIZE);
+        rc = tcti_tabrmd_parse_header (ctx);
+        if (rc != TSS2_RC_SUCCESS || ctx->header.size != buf_size) {
+            g_clear_pointer (&ctx->mux_response, g_bytes_unref);
+            ctx->state = TABRMD_STATE_TRANSMIT;
+            return TSS2_TCTI_RC_MALFORMED_RESPONSE;
+        }
     }
-    /* response buffer must be at least as large as the header */
-    if (response != NULL && *size < TPM_HEADER_SIZE) {
+    /* if response is NULL, caller is querying size, we know size isn't NULL */
+    if (response == NULL) {
+        *size = ctx->header.size;
+        return TSS2_RC_SUCCESS;
+    }
+    if (*size < ctx->header.size) {
         return TSS2_TCTI_RC_INSUFFICIENT_BUFFER;
     }
-    /* make sure we've got the response header */
+    buf = g_bytes_get_data (ctx->mux_response, &buf_size);
+    memcpy (response, buf, buf_size);
+    tabrmd_debug_bytes (response, buf_size, 16, 4);
+    *size = buf_size;
+    g_clear_pointer (&ctx->mux_response, g_bytes_unref);
+    ctx->state = TABRMD_STATE_TRANSMIT;
+    return TSS2_RC_SUCCESS;
+}
+/*
+ * Receive function for connections using the SOCK_STREAM transport.
+ * Make sure we've got the response header first.
+ * When the caller provides a buffer up front the header is read directly
+ * into it. Whatever we get is also kept in the header_buf so that a short
+ * read can be resumed with or without a response buffer.
+ */
+static TSS2_RC
+tcti_tabrmd_receive_stream (TSS2_TCTI_TABRMD_CONTEXT *tabrmd_ctx,
+                            size_t *size,
+                            uint8_t *response,
+                            int32_t timeout)
+{
+    TSS2_RC rc = TSS2_RC_SUCCESS;
+    gboolean header_in_response = FALSE;
+
     if (tabrmd_ctx->index < TPM_HEADER_SIZE) {
-        rc = tcti_tabrmd_read (tabrmd_ctx,
-                               tabrmd_ctx->header_buf,
-                               TPM_HEADER_SIZE - tabrmd_ctx->index,
-                               timeout);
+        if (tabrmd_ctx->index == 0 && response != NULL) {
+            rc = tcti_tabrmd_read (tabrmd_ctx,
+                                   response,
+                                   TPM_HEADER_SIZE,
+                                   timeout);
+            memcpy (tabrmd_ctx->header_buf, response, tabrmd_ctx->index);
+            header_in_response = TRUE;
+        } else {
+            rc = tcti_tabrmd_read (tabrmd_ctx,
+                                   tabrmd_ctx->header_buf,
+                                   TPM_HEADER_SIZE - tabrmd_ctx->index,
+                                   timeout);
+        }
         if (rc != TSS2_RC_SUCCESS)
             return rc;
-        if (tabrmd_ctx->index == TPM_HEADER_SIZE) {
-            tabrmd_ctx->header.tag  = get_response_tag  (tabrmd_ctx->header_buf);
-            tabrmd_ctx->header.size = get_response_size (tabrmd_ctx->header_buf);
-            tabrmd_ctx->header.code = get_response_code (tabrmd_ctx->header_buf);
-            if (tabrmd_ctx->header.size < TPM_HEADER_SIZE) {
-                tabrmd_ctx->state = TABRMD_STATE_TRANSMIT;
-                return TSS2_TCTI_RC_MALFORMED_RESPONSE;
-            }
+        if (tabrmd_ctx->index == TPM_HEADER_SIZE &&
+            tcti_tabrmd_parse_header (tabrmd_ctx) != TSS2_RC_SUCCESS) {
+            tabrmd_ctx->state = TABRMD_STATE_TRANSMIT;
+            return TSS2_TCTI_RC_MALFORMED_RESPONSE;
         }
     }
     /* if response is NULL, caller is querying size, we know size isn't NULL */
     if (response == NULL) {
         *size = tabrmd_ctx->header.size;
         return TSS2_RC_SUCCESS;
-    } else if (tabrmd_ctx->index == TPM_HEADER_SIZE) {
+    } else if (tabrmd_ctx->index == TPM_HEADER_SIZE && !header_in_response) {
         /* once we have the header and a buffer from the caller, copy */
         memcpy (response, tabrmd_ctx->header_buf, TPM_HEADER_SIZE);
     }
@@ -313,18 +768,282 @@ out:
     }
     return rc;
 }
+/*
+ * Call the receive function for the transport used by the connection.
+ */
+static TSS2_RC
+tcti_tabrmd_receive_transport (TSS2_TCTI_TABRMD_CONTEXT *tabrmd_ctx,
+                               size_t *size,
+                               uint8_t *response,
+                               int32_t timeout)
+{
+    if (tabrmd_ctx->mux != NULL) {
+        return tcti_tabrmd_receive_mux (tabrmd_ctx,
+                                        size,
+                                        response,
+                                        timeout);
+    } else if (tabrmd_ctx->transport == TABRMD_TRANSPORT_SEQPACKET) {
+        return tcti_tabrmd_receive_datagram (tabrmd_ctx,
+                                             size,
+                                             response,
+                                             timeout);
+    } else {
+        return tcti_tabrmd_receive_stream (tabrmd_ctx,
+                                           size,
+                                           response,
+                                           timeout);
+    }
+}
+/*
+ * This is the receive function that is exposed to clients through the TCTI
+ * API.
+ * The transport specific receive functions return the state machine to
+ * TRANSMIT once a response has been received. When more responses are
+ * outstanding (see Tss2_Tcti_Tabrmd_TransmitMany) we stay in RECEIVE. If a
+ * response can't be recovered the remaining responses are forgotten.
+ * Contexts that reconnect handle the loss of the connection here by
+ * replaying the command and receiving the response to it, see
+ * tcti_tabrmd_replay.
+ */
+TSS2_RC
+tss2_tcti_tabrmd_receive (TSS2_TCTI_CONTEXT *context,
+                          size_t            *size,
+                          uint8_t           *response,
+                          int32_t            timeout)
+{
+    TSS2_RC rc = TSS2_RC_SUCCESS;
+    TSS2_TCTI_TABRMD_CONTEXT *tabrmd_ctx = (TSS2_TCTI_TABRMD_CONTEXT*)context;
+
+    tabrmd_debug ("tss2_tcti_tabrmd_receive");
+    if (context == NULL || size == NULL) {
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+    }
+    if (response == NULL && *size != 0) {
+        return TSS2_TCTI_RC_BAD_VALUE;
+    }
+    if (TSS2_TCTI_MAGIC (context) != TSS2_TCTI_TABRMD_MAGIC ||
+        TSS2_TCTI_VERSION (context) != TSS2_TCTI_TABRMD_VERSION) {
+        return TSS2_TCTI_RC_BAD_CONTEXT;
+    }
+    if (tabrmd_ctx->state != TABRMD_STATE_RECEIVE) {
+        return TSS2_TCTI_RC_BAD_SEQUENCE;
+    }
+    if (timeout < TSS2_TCTI_TIMEOUT_BLOCK) {
+        return TSS2_TCTI_RC_BAD_VALUE;
+    }
+    if (size == NULL || (response == NULL && *size != 0)) {
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+    }
+    /* response buffer must be at least as large as the header */
+    if (response != NULL && *size < TPM_HEADER_SIZE) {
+        return TSS2_TCTI_RC_INSUFFICIENT_BUFFER;
+    }
+    rc = tcti_tabrmd_receive_transport (tabrmd_ctx, size, response, timeout);
+    if (rc == TSS2_TCTI_RC_NO_CONNECTION) {
+        rc = tcti_tabrmd_replay (tabrmd_ctx, rc, timeout);
+        if (rc == TSS2_RC_SUCCESS) {
+            rc = tcti_tabrmd_receive_transport (tabrmd_ctx,
+                                                size,
+                                                response,
+                                                timeout);
+        }
+    }
+    /* a successful query for the response size isn't a receive */
+    if (rc != TSS2_RC_SUCCESS || response != NULL) {
+        tcti_tabrmd_stats_receive (&tabrmd_ctx->stats, rc, *size);
+    }
+    if (tabrmd_ctx->state == TABRMD_STATE_TRANSMIT) {
+        if (rc == TSS2_RC_SUCCESS && tabrmd_ctx->outstanding > 1) {
+            tabrmd_ctx->state = TABRMD_STATE_RECEIVE;
+            --tabrmd_ctx->outstanding;
+        } else {
+            tabrmd_ctx->outstanding = 0;
+        }
+    }
+    return rc;
+}
+/*
+ * Send up to TSS2_TCTI_TABRMD_MANY_MAX commands to the daemon without
+ * waiting for a response to each. The daemon processes the commands from a
+ * connection in the order they're sent so the responses are received in
+ * the same order. The commands are written as they would be by the
+ * transmit function. Commands written before an error can't be taken back:
+ * if any were sent the context is left in the RECEIVE state with only those
+ * commands outstanding.
+ */
+TSS2_RC
+Tss2_Tcti_Tabrmd_TransmitMany (TSS2_TCTI_CONTEXT    *context,
+                               size_t                count,
+                               const size_t         *sizes,
+                               const uint8_t *const *commands)
+{
+    TSS2_TCTI_TABRMD_CONTEXT *tabrmd_ctx = (TSS2_TCTI_TABRMD_CONTEXT*)context;
+    GOutputStream *ostream;
+    ssize_t write_ret;
+    TSS2_RC rc = TSS2_RC_SUCCESS;
+    size_t i, bytes;
+
+    tabrmd_debug ("%s: sending %zu commands", __func__, count);
+    if (context == NULL || sizes == NULL || commands == NULL) {
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+    }
+    if (TSS2_TCTI_MAGIC (context) != TSS2_TCTI_TABRMD_MAGIC ||
+        TSS2_TCTI_VERSION (context) != TSS2_TCTI_TABRMD_VERSION) {
+        return TSS2_TCTI_RC_BAD_CONTEXT;
+    }
+    if (tabrmd_ctx->state != TABRMD_STATE_TRANSMIT) {
+        return TSS2_TCTI_RC_BAD_SEQUENCE;
+    }
+    if (count == 0 || count > TSS2_TCTI_TABRMD_MANY_MAX) {
+        return TSS2_TCTI_RC_BAD_VALUE;
+    }
+    for (i = 0; i < count; ++i) {
+        if (commands [i] == NULL) {
+            return TSS2_TCTI_RC_BAD_REFERENCE;
+        }
+        if (sizes [i] == 0) {
+            return TSS2_TCTI_RC_BAD_VALUE;
+        }
+    }
+    /* only single commands are replayed after reconnecting */
+    if (tabrmd_ctx->reconnect != NULL) {
+        tabrmd_ctx->reconnect->replay_size = 0;
+    }
+    ostream = g_io_stream_get_output_stream (TSS2_TCTI_TABRMD_IOSTREAM (context));
+    for (i = 0, bytes = 0; i < count; ++i) {
+        if (tabrmd_ctx->mux != NULL) {
+            rc = tcti_tabrmd_mux_send (tabrmd_ctx, commands [i], sizes [i]);
+            if (rc != TSS2_RC_SUCCESS) {
+                break;
+            }
+            bytes += sizes [i];
+            continue;
+        }
+        tabrmd_debug_bytes (commands [i], sizes [i], 16, 4);
+        write_ret = write_all (ostream, commands [i], sizes [i]);
+        if (write_ret == -1) {
+            rc = write_errno_to_tcti_rc (errno);
+            tabrmd_debug ("%s: error writing command %zu: %s", __func__, i,
+                          strerror (errno));
+            break;
+        } else if (write_ret == 0) {
+            tabrmd_debug ("%s: EOF writing command %zu", __func__, i);
+            rc = TSS2_TCTI_RC_NO_CONNECTION;
+            break;
+        } else if (write_ret != (ssize_t)sizes [i]) {
+            tabrmd_debug ("%s: short write for command %zu", __func__, i);
+            rc = TSS2_TCTI_RC_GENERAL_FAILURE;
+            break;
+        }
+        bytes += sizes [i];
+    }
+    if (i > 0) {
+        tabrmd_ctx->outstanding = i;
+        tabrmd_ctx->state = TABRMD_STATE_RECEIVE;
+        tcti_tabrmd_stats_transmit (&tabrmd_ctx->stats, i, bytes);
+    }
+    return rc;
+}
+/*
+ * Receive up to 'count' of the responses outstanding after a call to
+ * Tss2_Tcti_Tabrmd_TransmitMany. Responses are returned in the order the
+ * commands were sent. Each 'responses' buffer must be provided, on input
+ * 'sizes' holds the size of each buffer and on output the size of each
+ * response received. The number of responses received is returned through
+ * 'received' even when an error is returned. A TSS2_TCTI_RC_TRY_AGAIN
+ * return can be resumed by calling this function again for the responses
+ * that weren't received.
+ */
+TSS2_RC
+Tss2_Tcti_Tabrmd_ReceiveMany (TSS2_TCTI_CONTEXT *context,
+                              size_t             count,
+                              size_t            *sizes,
+                              uint8_t          **responses,
+                              int32_t            timeout,
+                              size_t            *received)
+{
+    TSS2_TCTI_TABRMD_CONTEXT *tabrmd_ctx = (TSS2_TCTI_TABRMD_CONTEXT*)context;
+    TSS2_RC rc = TSS2_RC_SUCCESS;
+    size_t i;
+
+    if (context == NULL || sizes == NULL || responses == NULL ||
+        received == NULL) {
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+    }
+    *received = 0;
+    if (TSS2_TCTI_MAGIC (context) != TSS2_TCTI_TABRMD_MAGIC ||
+        TSS2_TCTI_VERSION (context) != TSS2_TCTI_TABRMD_VERSION) {
+        return TSS2_TCTI_RC_BAD_CONTEXT;
+    }
+    if (tabrmd_ctx->state != TABRMD_STATE_RECEIVE) {
+        return TSS2_TCTI_RC_BAD_SEQUENCE;
+    }
+    if (count == 0 || count > tabrmd_ctx->outstanding) {
+        return TSS2_TCTI_RC_BAD_VALUE;
+    }
+    for (i = 0; i < count; ++i) {
+        if (responses [i] == NULL) {
+            return TSS2_TCTI_RC_BAD_REFERENCE;
+        }
+    }
+    for (i = 0; i < count; ++i) {
+        rc = tss2_tcti_tabrmd_receive (context,
+                                       &sizes [i],
+                                       responses [i],
+                                       timeout);
+        if (rc != TSS2_RC_SUCCESS) {
+            break;
+        }
+        ++*received;
+    }
+    tabrmd_debug ("%s: received %zu of %zu responses", __func__, *received, count);
+    return rc;
+}
+/*
+ * Copy the performance counters kept by the context to 'stats'. The
+ * counters can be read in any state, including after the context has been
+ * finalized.
+ */
+TSS2_RC
+Tss2_Tcti_Tabrmd_GetStats (TSS2_TCTI_CONTEXT      *context,
+                           TSS2_TCTI_TABRMD_STATS *stats)
+{
+    if (context == NULL || stats == NULL) {
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+    }
+    if (TSS2_TCTI_MAGIC (context) != TSS2_TCTI_TABRMD_MAGIC ||
+        TSS2_TCTI_VERSION (context) != TSS2_TCTI_TABRMD_VERSION) {
+        return TSS2_TCTI_RC_BAD_CONTEXT;
+    }
+    *stats = ((TSS2_TCTI_TABRMD_CONTEXT*)context)->stats.stats;
+    return TSS2_RC_SUCCESS;
+}
+
+static void
+tcti_tabrmd_reconnect_free (TSS2_TCTI_TABRMD_CONTEXT *ctx)
+{
+    if (ctx->reconnect == NULL) {
+        return;
+    }
+    g_free (ctx->reconnect->bus_name);
+    g_clear_pointer (&ctx->reconnect, g_free);
+}
 
 void
 tss2_tcti_tabrmd_finalize (TSS2_TCTI_CONTEXT *context)
 {
-    g_debug ("tss2_tcti_tabrmd_finalize");
+    tabrmd_debug ("tss2_tcti_tabrmd_finalize");
     if (context == NULL) {
         g_warning ("Invalid parameter");
         return;
     }
+    /* a pending Tss2_Tcti_Tabrmd_InitAsync must complete before cleanup */
+    tcti_tabrmd_init_join ((TSS2_TCTI_TABRMD_CONTEXT*)context);
     TSS2_TCTI_TABRMD_STATE (context) = TABRMD_STATE_FINAL;
+    tcti_tabrmd_mux_detach ((TSS2_TCTI_TABRMD_CONTEXT*)context);
     g_clear_object (&TSS2_TCTI_TABRMD_SOCK_CONNECT (context));
     g_clear_object (&TSS2_TCTI_TABRMD_PROXY (context));
+    tcti_tabrmd_reconnect_free ((TSS2_TCTI_TABRMD_CONTEXT*)context);
 }
 
 TSS2_RC
@@ -337,8 +1056,8 @@ tss2_tcti_tabrmd_cancel (TSS2_TCTI_CONTEXT *context)
     if (context == NULL) {
         return TSS2_TCTI_RC_BAD_CONTEXT;
     }
-    g_info("tss2_tcti_tabrmd_cancel: id 0x%" PRIx64,
-           TSS2_TCTI_TABRMD_ID (context));
+    tabrmd_info ("tss2_tcti_tabrmd_cancel: id 0x%" PRIx64,
+                 TSS2_TCTI_TABRMD_ID (context));
     if (TSS2_TCTI_TABRMD_STATE (context) != TABRMD_STATE_RECEIVE) {
         return TSS2_TCTI_RC_BAD_SEQUENCE;
     }
@@ -373,7 +1092,12 @@ tss2_tcti_tabrmd_get_poll_handles (TSS2_TCTI_CONTEXT     *context,
         return TSS2_TCTI_RC_INSUFFICIENT_BUFFER;
     }
     *num_handles = 1;
-    if (handles != NULL) {
+    if (handles == NULL) {
+        return TSS2_RC_SUCCESS;
+    }
+    if (TSS2_TCTI_TABRMD_STATE (context) == TABRMD_STATE_INIT) {
+        handles [0].fd = ((TSS2_TCTI_TABRMD_CONTEXT*)context)->init->fds [0];
+    } else {
         handles [0].fd = TSS2_TCTI_TABRMD_FD (context);
     }
     return TSS2_RC_SUCCESS;
@@ -390,8 +1114,8 @@ tss2_tcti_tabrmd_set_locality (TSS2_TCTI_CONTEXT *context,
     if (context == NULL) {
         return TSS2_TCTI_RC_BAD_CONTEXT;
     }
-    g_info ("tss2_tcti_tabrmd_set_locality: id 0x%" PRIx64,
-            TSS2_TCTI_TABRMD_ID (context));
+    tabrmd_info ("tss2_tcti_tabrmd_set_locality: id 0x%" PRIx64,
+                 TSS2_TCTI_TABRMD_ID (context));
     if (TSS2_TCTI_TABRMD_STATE (context) != TABRMD_STATE_TRANSMIT) {
         return TSS2_TCTI_RC_BAD_SEQUENCE;
     }
@@ -409,6 +1133,12 @@ tss2_tcti_tabrmd_set_locality (TSS2_TCTI_CONTEXT *context,
         ret = error->code;
         g_error_free (error);
     }
+    /* a new connection must be put back in the same locality */
+    if (ret == TSS2_RC_SUCCESS &&
+        ((TSS2_TCTI_TABRMD_CONTEXT*)context)->reconnect != NULL) {
+        ((TSS2_TCTI_TABRMD_CONTEXT*)context)->reconnect->locality_set = TRUE;
+        ((TSS2_TCTI_TABRMD_CONTEXT*)context)->reconnect->locality = locality;
+    }
 
     return ret;
 }
@@ -458,6 +1188,40 @@ _out:
     return _ret != NULL;
 }
 
+/*
+ * Call the CreateConnectionWithTransport D-Bus method. The transport
+ * actually used by the daemon for the connection is returned through the
+ * out_transport parameter.
+ */
+static gboolean
+tcti_tabrmd_call_create_connection_with_transport_sync_fdlist (
+    TctiTabrmd     *proxy,
+    guint           transport,
+    guint64        *out_id,
+    guint          *out_transport,
+    GUnixFDList   **out_fd_list,
+    GCancellable   *cancellable,
+    GError        **error)
+{
+    GVariant *_ret;
+    _ret = g_dbus_proxy_call_with_unix_fd_list_sync (G_DBUS_PROXY (proxy),
+        "CreateConnectionWithTransport",
+        g_variant_new ("(u)", transport),
+        G_DBUS_CALL_FLAGS_NONE,
+        -1,
+        NULL,
+        out_fd_list,
+        cancellable,
+        error);
+    if (_ret == NULL) {
+        goto _out;
+    }
+    g_variant_get (_ret, "(tu)", out_id, out_transport);
+    g_variant_unref (_ret);
+_out:
+    return _ret != NULL;
+}
+
 typedef struct {
     char *name;
     GBusType type;
@@ -478,20 +1242,57 @@ GBusType
 tabrmd_bus_type_from_str (const char* const bus_type)
 {
     size_t i;
-    g_debug ("BUS_NAME_TYPE_MAP_LENGTH: %zu", BUS_NAME_TYPE_MAP_LENGTH);
-    g_debug ("looking up type for bus_type string: %s", bus_type);
+    tabrmd_debug ("BUS_NAME_TYPE_MAP_LENGTH: %zu", BUS_NAME_TYPE_MAP_LENGTH);
+    tabrmd_debug ("looking up type for bus_type string: %s", bus_type);
     for (i = 0; i < BUS_NAME_TYPE_MAP_LENGTH; ++i) {
         if (strcmp (bus_name_type_map [i].name, bus_type) == 0) {
-            g_debug ("matched bus_type string \"%s\" to type %d",
-                     bus_name_type_map [i].name,
-                     bus_name_type_map [i].type);
+            tabrmd_debug ("matched bus_type string \"%s\" to type %d",
+                          bus_name_type_map [i].name,
+                          bus_name_type_map [i].type);
             return bus_name_type_map [i].type;
         }
     }
-    g_debug ("no match for bus_type string %s", bus_type);
+    tabrmd_debug ("no match for bus_type string %s", bus_type);
     return G_BUS_TYPE_NONE;
 }
 
+typedef struct {
+    char *name;
+    TabrmdTransport transport;
+} transport_name_entry_t;
+
+static const transport_name_entry_t transport_name_map[] = {
+    {
+        .name = "stream",
+        .transport = TABRMD_TRANSPORT_STREAM,
+    },
+    {
+        .name = "seqpacket",
+        .transport = TABRMD_TRANSPORT_SEQPACKET,
+    },
+    {
+        .name = "mux",
+        .transport = TABRMD_TRANSPORT_MUX,
+    },
+};
+#define TRANSPORT_NAME_MAP_LENGTH (sizeof (transport_name_map) / sizeof (transport_name_entry_t))
+/*
+ * Map the 'transport' string from the conf string to a TabrmdTransport.
+ * Returns -1 if the string doesn't name a known transport.
+ */
+gint
+tabrmd_transport_from_str (const char* const transport)
+{
+    size_t i;
+    for (i = 0; i < TRANSPORT_NAME_MAP_LENGTH; ++i) {
+        if (strcmp (transport_name_map [i].name, transport) == 0) {
+            return transport_name_map [i].transport;
+        }
+    }
+    tabrmd_debug ("no match for transport string %s", transport);
+    return -1;
+}
+
 TSS2_RC
 tabrmd_kv_callback (const key_value_t *key_value,
                     gpointer user_data)
@@ -502,7 +1303,7 @@ tabrmd_kv_callback (const key_value_t *key_value,
         g_warning ("%s passed NULL parameter", __func__);
         return TSS2_TCTI_RC_GENERAL_FAILURE;
     }
-    g_debug ("key: %s / value: %s\n", key_value->key, key_value->value);
+    tabrmd_debug ("key: %s / value: %s\n", key_value->key, key_value->value);
     if (strcmp (key_value->key, "bus_name") == 0) {
         tabrmd_conf->bus_name = key_value->value;
         return TSS2_RC_SUCCESS;
@@ -512,6 +1313,22 @@ tabrmd_kv_callback (const key_value_t *key_value,
             return TSS2_TCTI_RC_BAD_VALUE;
         }
         return TSS2_RC_SUCCESS;
+    } else if (strcmp (key_value->key, "transport") == 0) {
+        gint transport = tabrmd_transport_from_str (key_value->value);
+        if (transport == -1) {
+            return TSS2_TCTI_RC_BAD_VALUE;
+        }
+        tabrmd_conf->transport = (TabrmdTransport)transport;
+        return TSS2_RC_SUCCESS;
+    } else if (strcmp (key_value->key, "reconnect") == 0) {
+        if (strcmp (key_value->value, "true") == 0) {
+            tabrmd_conf->reconnect = TRUE;
+        } else if (strcmp (key_value->value, "false") == 0) {
+            tabrmd_conf->reconnect = FALSE;
+        } else {
+            return TSS2_TCTI_RC_BAD_VALUE;
+        }
+        return TSS2_RC_SUCCESS;
     } else {
         return TSS2_TCTI_RC_BAD_VALUE;
     }
@@ -527,21 +1344,48 @@ tabrmd_kv_callback (const key_value_t *key_value,
  * calling this function.
  */
 TSS2_RC
-tcti_tabrmd_connect (TSS2_TCTI_CONTEXT *context)
+tcti_tabrmd_connect (TSS2_TCTI_CONTEXT *context,
+                     TabrmdTransport    transport)
 {
     GError *error = NULL;
     GSocket *sock = NULL;
     GUnixFDList *fd_list = NULL;
-    gboolean call_ret;
+    gboolean call_ret = FALSE;
     guint64 id;
+    guint transport_used = TABRMD_TRANSPORT_STREAM;
     TSS2_RC rc = TSS2_RC_SUCCESS;
 
-    call_ret = tcti_tabrmd_call_create_connection_sync_fdlist (
-        TSS2_TCTI_TABRMD_PROXY (context),
-        &id,
-        &fd_list,
-        NULL,
-        &error);
+    if (transport != TABRMD_TRANSPORT_STREAM) {
+        call_ret = tcti_tabrmd_call_create_connection_with_transport_sync_fdlist (
+            TSS2_TCTI_TABRMD_PROXY (context),
+            transport,
+            &id,
+            &transport_used,
+            &fd_list,
+            NULL,
+            &error);
+        /* older daemons don't implement this method, fall back to stream */
+        if (call_ret == FALSE &&
+            g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD)) {
+            tabrmd_debug ("CreateConnectionWithTransport not supported by daemon, "
+                          "falling back to CreateConnection");
+            g_clear_error (&error);
+        } else if (call_ret == FALSE) {
+            g_warning ("Failed to create connection with service: %s",
+                       error->message);
+            rc = TSS2_TCTI_RC_NO_CONNECTION;
+            goto out;
+        }
+    }
+    if (call_ret == FALSE) {
+        transport_used = TABRMD_TRANSPORT_STREAM;
+        call_ret = tcti_tabrmd_call_create_connection_sync_fdlist (
+            TSS2_TCTI_TABRMD_PROXY (context),
+            &id,
+            &fd_list,
+            NULL,
+            &error);
+    }
     if (call_ret == FALSE) {
         g_warning ("Failed to create connection with service: %s",
                  error->message);
@@ -568,9 +1412,23 @@ tcti_tabrmd_connect (TSS2_TCTI_CONTEXT *context)
         goto out;
     }
     sock = g_socket_new_from_fd (fd, NULL);
+    /*
+     * GSocket makes the fd non-blocking and emulates blocking reads with a
+     * failed recv and a poll. We only ever read after poll or with
+     * TSS2_TCTI_TIMEOUT_BLOCK so the fd is put back in blocking mode to let
+     * blocking reads wait in the kernel.
+     */
+    if (!g_unix_set_fd_nonblocking (fd, FALSE, &error)) {
+        g_critical ("failed to put connection in blocking mode: %s",
+                    error->message);
+        rc = TSS2_TCTI_RC_GENERAL_FAILURE;
+        goto out;
+    }
     TSS2_TCTI_TABRMD_SOCK_CONNECT (context) = \
         g_socket_connection_factory_create_connection (sock);
     TSS2_TCTI_TABRMD_ID (context) = id;
+    ((TSS2_TCTI_TABRMD_CONTEXT*)context)->transport = transport_used;
+    tabrmd_debug ("connection uses transport %u", transport_used);
 out:
     g_clear_error (&error);
     g_clear_object (&sock);
@@ -578,20 +1436,277 @@ out:
     return rc;
 }
 
+/*
+ * Proxy objects are expensive to create: each one requires a connection to
+ * the bus and a round trip to the daemon. We create one proxy per bus type /
+ * bus name pair and share it between all TCTI contexts in the process. The
+ * cache and each context using a proxy hold a reference to it. A proxy
+ * replaced by tcti_tabrmd_proxy_refresh is dropped from the cache and freed
+ * once the last context using it lets go of it.
+ * Each proxy has a private connection to the bus instead of the one GIO
+ * shares between all users in the process (g_bus_get_sync): a child process
+ * would inherit that connection from its parent without the thread that
+ * services it. The cache belongs to the process that created it: a child
+ * forgets it (without freeing anything, the objects belong to the parent)
+ * and creates its own proxies. The mutex is held across the fork so that
+ * the child never inherits it locked. TCTI contexts themselves can't be
+ * used across a fork.
+ */
+static GMutex proxy_cache_mutex;
+static GHashTable *proxy_cache = NULL;
+static pid_t proxy_cache_pid = 0;
+static pthread_once_t proxy_cache_once = PTHREAD_ONCE_INIT;
+
+static void
+tcti_tabrmd_proxy_cache_prepare (void)
+{
+    g_mutex_lock (&proxy_cache_mutex);
+}
+static void
+tcti_tabrmd_proxy_cache_unlock (void)
+{
+    g_mutex_unlock (&proxy_cache_mutex);
+}
+static void
+tcti_tabrmd_proxy_cache_atfork (void)
+{
+    pthread_atfork (tcti_tabrmd_proxy_cache_prepare,
+                    tcti_tabrmd_proxy_cache_unlock,
+                    tcti_tabrmd_proxy_cache_unlock);
+}
+/*
+ * Get the cache for the calling process, creating it if necessary. A cache
+ * created before a fork is forgotten. The caller must hold the mutex.
+ */
+static GHashTable*
+tcti_tabrmd_proxy_cache_locked (void)
+{
+    if (proxy_cache != NULL && proxy_cache_pid != getpid ()) {
+        g_hash_table_steal_all (proxy_cache);
+        proxy_cache = NULL;
+    }
+    if (proxy_cache == NULL) {
+        proxy_cache = g_hash_table_new_full (g_str_hash,
+                                             g_str_equal,
+                                             g_free,
+                                             g_object_unref);
+        proxy_cache_pid = getpid ();
+    }
+    return proxy_cache;
+}
+/*
+ * Release the references held by the cache.
+ */
+void
+tcti_tabrmd_proxy_cache_reset (void)
+{
+    g_mutex_lock (&proxy_cache_mutex);
+    if (proxy_cache != NULL && proxy_cache_pid == getpid ()) {
+        g_hash_table_unref (proxy_cache);
+    }
+    proxy_cache = NULL;
+    g_mutex_unlock (&proxy_cache_mutex);
+}
+/*
+ * Create a proxy for the daemon on a new private connection to the bus.
+ */
+static TctiTabrmd*
+tcti_tabrmd_proxy_new (GBusType bus_type,
+                       const char *bus_name,
+                       GError **error)
+{
+    GDBusConnection *connection;
+    TctiTabrmd *proxy;
+    gchar *address;
+
+    address = g_dbus_address_get_for_bus_sync (bus_type, NULL, error);
+    if (address == NULL) {
+        return NULL;
+    }
+    connection = g_dbus_connection_new_for_address_sync (
+        address,
+        G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+        G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+        NULL,
+        NULL,
+        error);
+    g_free (address);
+    if (connection == NULL) {
+        return NULL;
+    }
+    proxy = tcti_tabrmd_proxy_new_sync (connection,
+                                        G_DBUS_PROXY_FLAGS_NONE,
+                                        bus_name,
+                                        TABRMD_DBUS_PATH,
+                                        NULL,
+                                        error);
+    g_object_unref (connection);
+    return proxy;
+}
+/*
+ * Get the proxy for the tabrmd on the given bus, creating it if this is
+ * the first request for this bus type / bus name pair. The caller owns a
+ * reference to the returned proxy.
+ */
+TctiTabrmd*
+tcti_tabrmd_proxy_get (GBusType bus_type,
+                       const char *bus_name,
+                       GError **error)
+{
+    GHashTable *cache;
+    TctiTabrmd *proxy;
+    gchar *key;
+
+    pthread_once (&proxy_cache_once, tcti_tabrmd_proxy_cache_atfork);
+    key = g_strdup_printf ("%d:%s", bus_type, bus_name);
+    g_mutex_lock (&proxy_cache_mutex);
+    cache = tcti_tabrmd_proxy_cache_locked ();
+    proxy = g_hash_table_lookup (cache, key);
+    if (proxy != NULL) {
+        tabrmd_debug ("%s: reusing proxy for %s", __func__, key);
+        g_free (key);
+        goto out;
+    }
+    proxy = tcti_tabrmd_proxy_new (bus_type, bus_name, error);
+    if (proxy == NULL) {
+        g_free (key);
+        goto out;
+    }
+    g_hash_table_insert (cache, key, proxy);
+out:
+    if (proxy != NULL) {
+        g_object_ref (proxy);
+    }
+    g_mutex_unlock (&proxy_cache_mutex);
+    return proxy;
+}
+/*
+ * Replace the cached proxy for the given bus type / bus name pair if it's
+ * 'stale'. A proxy sends method calls to the unique name of the daemon it
+ * found when it was created (or last saw on the bus) so once the daemon has
+ * been restarted a proxy may need to be replaced. If another context has
+ * already replaced 'stale' the current proxy is returned. The caller owns a
+ * reference to the returned proxy and keeps its reference to 'stale'.
+ */
+TctiTabrmd*
+tcti_tabrmd_proxy_refresh (GBusType bus_type,
+                           const char *bus_name,
+                           TctiTabrmd *stale,
+                           GError **error)
+{
+    GHashTable *cache;
+    TctiTabrmd *proxy;
+    gchar *key;
+
+    key = g_strdup_printf ("%d:%s", bus_type, bus_name);
+    g_mutex_lock (&proxy_cache_mutex);
+    cache = tcti_tabrmd_proxy_cache_locked ();
+    proxy = g_hash_table_lookup (cache, key);
+    if (proxy != NULL && proxy != stale) {
+        tabrmd_debug ("%s: proxy for %s already refreshed", __func__, key);
+        g_free (key);
+        goto out;
+    }
+    proxy = tcti_tabrmd_proxy_new (bus_type, bus_name, error);
+    if (proxy == NULL) {
+        g_free (key);
+        goto out;
+    }
+    /* drops the cache's reference to 'stale' */
+    g_hash_table_insert (cache, key, proxy);
+out:
+    if (proxy != NULL) {
+        g_object_ref (proxy);
+    }
+    g_mutex_unlock (&proxy_cache_mutex);
+    return proxy;
+}
 /*
  * The longest configuration string we'll take. Each dbus name can be 255
  * characters long (see dbus spec). The bus_types that we support are
  * 'system' or 'session' (255 + 7 = 262). 'bus_type=' and 'bus_name=' are
- * each another 9 characters for a total of 280.
+ * each another 9 characters for a total of 280. The longest transport,
+ * 'transport=seqpacket', and its separator add another 20.
+ * 'reconnect=false' and its separator add another 16.
+ */
+#define CONF_STRING_MAX 316
+/*
+ * Parse the configuration string into 'tabrmd_conf'. The strings in
+ * 'tabrmd_conf' point into a copy of 'conf' that's returned through
+ * 'conf_copy' and must be freed by the caller once they're no longer used.
+ */
+static TSS2_RC
+tcti_tabrmd_conf_parse (const char    *conf,
+                        char         **conf_copy,
+                        tabrmd_conf_t *tabrmd_conf)
+{
+    size_t conf_len;
+
+    *conf_copy = NULL;
+    if (conf == NULL) {
+        return TSS2_RC_SUCCESS;
+    }
+    conf_len = strlen (conf);
+    if (conf_len > CONF_STRING_MAX) {
+        return TSS2_TCTI_RC_BAD_VALUE;
+    }
+    *conf_copy = g_strdup (conf);
+    if (*conf_copy == NULL) {
+        g_critical ("Failed to duplicate config string: %s", strerror (errno));
+        return TSS2_TCTI_RC_GENERAL_FAILURE;
+    }
+    return parse_key_value_string (*conf_copy,
+                                   tabrmd_kv_callback,
+                                   tabrmd_conf);
+}
+/*
+ * Get the proxy for the daemon and create a connection with it. This blocks
+ * until the daemon has responded.
  */
-#define CONF_STRING_MAX 280
+static TSS2_RC
+tcti_tabrmd_init_connect (TSS2_TCTI_CONTEXT   *context,
+                          const tabrmd_conf_t *tabrmd_conf)
+{
+    tcti_tabrmd_reconnect_t *reconnect;
+    GError *error = NULL;
+    TSS2_RC rc;
+
+    TSS2_TCTI_TABRMD_PROXY (context) =
+        tcti_tabrmd_proxy_get (tabrmd_conf->bus_type,
+                               tabrmd_conf->bus_name,
+                               &error);
+    if (TSS2_TCTI_TABRMD_PROXY (context) == NULL) {
+        g_critical ("failed to allocate dbus proxy object: %s", error->message);
+        g_error_free (error);
+        return TSS2_TCTI_RC_NO_CONNECTION;
+    }
+    if (tabrmd_conf->transport == TABRMD_TRANSPORT_MUX) {
+        rc = tcti_tabrmd_mux_connect (context,
+                                      tabrmd_conf->bus_type,
+                                      tabrmd_conf->bus_name);
+    } else {
+        rc = tcti_tabrmd_connect (context, tabrmd_conf->transport);
+    }
+    if (rc != TSS2_RC_SUCCESS) {
+        g_clear_object (&TSS2_TCTI_TABRMD_PROXY (context));
+        return rc;
+    }
+    tabrmd_debug ("initialized tabrmd TCTI context with id: 0x%" PRIx64,
+                  TSS2_TCTI_TABRMD_ID (context));
+    if (tabrmd_conf->reconnect) {
+        reconnect = g_malloc0 (sizeof (tcti_tabrmd_reconnect_t));
+        reconnect->bus_type = tabrmd_conf->bus_type;
+        reconnect->bus_name = g_strdup (tabrmd_conf->bus_name);
+        reconnect->transport = tabrmd_conf->transport;
+        ((TSS2_TCTI_TABRMD_CONTEXT*)context)->reconnect = reconnect;
+    }
+    return rc;
+}
 TSS2_RC
 Tss2_Tcti_Tabrmd_Init (TSS2_TCTI_CONTEXT *context,
                        size_t            *size,
                        const char        *conf)
 {
-    GError *error = NULL;
-    size_t conf_len;
     char *conf_copy = NULL;
     TSS2_RC rc;
     tabrmd_conf_t tabrmd_conf = TABRMD_CONF_INIT_DEFAULT;
@@ -603,50 +1718,154 @@ Tss2_Tcti_Tabrmd_Init (TSS2_TCTI_CONTEXT *context,
     if (size == NULL) {
         return TSS2_TCTI_RC_BAD_VALUE;
     }
-    if (conf != NULL) {
-        conf_len = strlen (conf);
-        if (conf_len > CONF_STRING_MAX) {
-            return TSS2_TCTI_RC_BAD_VALUE;
-        }
-        conf_copy = g_strdup (conf);
-        if (conf_copy == NULL) {
-            g_critical ("Failed to duplicate config string: %s", strerror (errno));
-            return TSS2_TCTI_RC_GENERAL_FAILURE;
-        }
-        rc = parse_key_value_string (conf_copy,
-                                     tabrmd_kv_callback,
-                                     &tabrmd_conf);
-        if (rc != TSS2_RC_SUCCESS) {
-            goto out;
-        }
+    rc = tcti_tabrmd_conf_parse (conf, &conf_copy, &tabrmd_conf);
+    if (rc != TSS2_RC_SUCCESS) {
+        goto out;
     }
     /* Register dbus error mapping for tabrmd. Gets us RCs from Gerror codes */
     TABRMD_ERROR;
     init_tcti_data (context);
-    TSS2_TCTI_TABRMD_PROXY (context) =
-        tcti_tabrmd_proxy_new_for_bus_sync (tabrmd_conf.bus_type,
-                                            G_DBUS_PROXY_FLAGS_NONE,
-                                            tabrmd_conf.bus_name,
-                                            TABRMD_DBUS_PATH,
-                                            NULL,
-                                            &error);
-    if (TSS2_TCTI_TABRMD_PROXY (context) == NULL) {
-        g_critical ("failed to allocate dbus proxy object: %s", error->message);
-        rc = TSS2_TCTI_RC_NO_CONNECTION;
-        goto out;
-    }
-    rc = tcti_tabrmd_connect (context);
-    if (rc == TSS2_RC_SUCCESS) {
-        g_debug ("initialized tabrmd TCTI context with id: 0x%" PRIx64,
-                 TSS2_TCTI_TABRMD_ID (context));
-    }
+    rc = tcti_tabrmd_init_connect (context, &tabrmd_conf);
 out:
     g_clear_pointer (&conf_copy, g_free);
-    g_clear_error (&error);
 
     return rc;
 }
 
+static void
+tcti_tabrmd_init_free (tcti_tabrmd_init_t *init)
+{
+    if (init->fds [0] != -1) {
+        close (init->fds [0]);
+    }
+    if (init->fds [1] != -1) {
+        close (init->fds [1]);
+    }
+    g_free (init->conf_str);
+    g_free (init);
+}
+/*
+ * Thread function for Tss2_Tcti_Tabrmd_InitAsync: connect to the daemon
+ * then make the poll handle readable.
+ */
+static gpointer
+tcti_tabrmd_init_thread (gpointer data)
+{
+    TSS2_TCTI_CONTEXT *context = (TSS2_TCTI_CONTEXT*)data;
+    tcti_tabrmd_init_t *init = ((TSS2_TCTI_TABRMD_CONTEXT*)context)->init;
+    const uint8_t done = 1;
+
+    init->rc = tcti_tabrmd_init_connect (context, &init->conf);
+    g_atomic_int_set (&init->done, TRUE);
+    if (TABRMD_ERRNO_EINTR_RETRY (write (init->fds [1], &done, 1)) != 1) {
+        g_warning ("%s: failed to signal completion: %s", __func__,
+                   strerror (errno));
+    }
+    return NULL;
+}
+/*
+ * Wait for the thread created by Tss2_Tcti_Tabrmd_InitAsync and release
+ * the state associated with it. Returns the result of the connection
+ * attempt or TSS2_RC_SUCCESS if there's no pending initialization.
+ */
+TSS2_RC
+tcti_tabrmd_init_join (TSS2_TCTI_TABRMD_CONTEXT *ctx)
+{
+    TSS2_RC rc;
+
+    if (ctx->init == NULL) {
+        return TSS2_RC_SUCCESS;
+    }
+    g_thread_join (ctx->init->thread);
+    rc = ctx->init->rc;
+    g_clear_pointer (&ctx->init, tcti_tabrmd_init_free);
+    return rc;
+}
+TSS2_RC
+Tss2_Tcti_Tabrmd_InitAsync (TSS2_TCTI_CONTEXT *context,
+                            size_t            *size,
+                            const char        *conf)
+{
+    TSS2_TCTI_TABRMD_CONTEXT *ctx = (TSS2_TCTI_TABRMD_CONTEXT*)context;
+    tcti_tabrmd_init_t *init;
+    tabrmd_conf_t tabrmd_conf = TABRMD_CONF_INIT_DEFAULT;
+    GError *error = NULL;
+    TSS2_RC rc;
+
+    if (context == NULL && size != NULL) {
+        *size = sizeof (TSS2_TCTI_TABRMD_CONTEXT);
+        return TSS2_RC_SUCCESS;
+    }
+    if (size == NULL) {
+        return TSS2_TCTI_RC_BAD_VALUE;
+    }
+    init = g_new0 (tcti_tabrmd_init_t, 1);
+    init->fds [0] = -1;
+    init->fds [1] = -1;
+    init->conf = tabrmd_conf;
+    rc = tcti_tabrmd_conf_parse (conf, &init->conf_str, &init->conf);
+    if (rc != TSS2_RC_SUCCESS) {
+        goto err_out;
+    }
+    if (!g_unix_open_pipe (init->fds, FD_CLOEXEC, &error)) {
+        g_warning ("%s: failed to create poll handle: %s", __func__,
+                   error->message);
+        g_error_free (error);
+        rc = TSS2_TCTI_RC_GENERAL_FAILURE;
+        goto err_out;
+    }
+    /* Register dbus error mapping for tabrmd. Gets us RCs from Gerror codes */
+    TABRMD_ERROR;
+    init_tcti_data (context);
+    TSS2_TCTI_TABRMD_STATE (context) = TABRMD_STATE_INIT;
+    ctx->init = init;
+    init->thread = g_thread_try_new ("tcti-tabrmd-init",
+                                     tcti_tabrmd_init_thread,
+                                     context,
+                                     &error);
+    if (init->thread == NULL) {
+        g_warning ("%s: failed to create thread: %s", __func__,
+                   error->message);
+        g_error_free (error);
+        ctx->init = NULL;
+        TSS2_TCTI_TABRMD_STATE (context) = TABRMD_STATE_FINAL;
+        rc = TSS2_TCTI_RC_GENERAL_FAILURE;
+        goto err_out;
+    }
+    return TSS2_RC_SUCCESS;
+err_out:
+    tcti_tabrmd_init_free (init);
+    return rc;
+}
+
+TSS2_RC
+Tss2_Tcti_Tabrmd_InitFinish (TSS2_TCTI_CONTEXT *context)
+{
+    TSS2_TCTI_TABRMD_CONTEXT *ctx = (TSS2_TCTI_TABRMD_CONTEXT*)context;
+    TSS2_RC rc;
+
+    if (context == NULL) {
+        return TSS2_TCTI_RC_BAD_REFERENCE;
+    }
+    if (TSS2_TCTI_MAGIC (context) != TSS2_TCTI_TABRMD_MAGIC ||
+        TSS2_TCTI_VERSION (context) != TSS2_TCTI_TABRMD_VERSION) {
+        return TSS2_TCTI_RC_BAD_CONTEXT;
+    }
+    if (TSS2_TCTI_TABRMD_STATE (context) != TABRMD_STATE_INIT) {
+        return TSS2_TCTI_RC_BAD_SEQUENCE;
+    }
+    if (!g_atomic_int_get (&ctx->init->done)) {
+        return TSS2_TCTI_RC_TRY_AGAIN;
+    }
+    rc = tcti_tabrmd_init_join (ctx);
+    if (rc == TSS2_RC_SUCCESS) {
+        TSS2_TCTI_TABRMD_STATE (context) = TABRMD_STATE_TRANSMIT;
+    } else {
+        TSS2_TCTI_TABRMD_STATE (context) = TABRMD_STATE_FINAL;
+    }
+    return rc;
+}
+
 /* public info structure */
 static const TSS2_TCTI_INFO tss2_tcti_info = {
     .version = TSS2_TCTI_TABRMD_VERSION,
@@ -655,7 +1874,7 @@ static const TSS2_TCTI_INFO tss2_tcti_info = {
     .config_help = "This conf string is a series of key / value pairs " \
         "where keys and values are separated by the '=' character and " \
         "each pair is separated by the ',' character. Valid keys are " \
-        "\"bus_name\" and \"bus_type\".",
+        "\"bus_name\", \"bus_type\", \"transport\" and \"reconnect\".",
     .init = Tss2_Tcti_Tabrmd_Init,
 };
 
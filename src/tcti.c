@@ -7,6 +7,7 @@
 
 #include <tss2/tss2_tctildr.h>
 
+#include "logging.h"
 #include "tcti.h"
 #include "util.h"
 
@@ -29,7 +30,7 @@ tcti_set_property (GObject        *object,
 {
     Tcti *self = TCTI (object);
 
-    g_debug ("%s", __func__);
+    tabrmd_debug ("%s", __func__);
     switch (property_id) {
     case PROP_CONTEXT:
         self->tcti_context = (TSS2_TCTI_CONTEXT*)g_value_get_pointer (value);
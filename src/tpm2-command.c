@@ -10,6 +10,7 @@
 #include <tss2/tss2_tpm2_types.h>
 #include <tss2/tss2_mu.h>
 
+#include "logging.h"
 #include "tpm2-command.h"
 #include "tpm2-header.h"
 #include "util.h"
@@ -186,6 +187,7 @@ tpm2_command_dispose (GObject *obj)
     Tpm2Command *cmd = TPM2_COMMAND (obj);
 
     g_clear_object (&cmd->connection);
+    g_clear_pointer (&cmd->timeline, tabrmd_timeline_unref);
     G_OBJECT_CLASS (tpm2_command_parent_class)->dispose (obj);
 }
 /**
@@ -197,7 +199,7 @@ tpm2_command_finalize (GObject *obj)
 {
     Tpm2Command *cmd = TPM2_COMMAND (obj);
 
-    g_debug ("tpm2_command_finalize");
+    tabrmd_debug ("tpm2_command_finalize");
     g_clear_pointer (&cmd->buffer, g_free);
     G_OBJECT_CLASS (tpm2_command_parent_class)->finalize (obj);
 }
@@ -371,11 +373,42 @@ tpm2_command_get_connection (Tpm2Command *command)
     }
     return command->connection;
 }
+/*
+ * The timeline started by the CommandSource when it read the command from
+ * the client. NULL for commands created by the daemon itself. The caller
+ * must take its own reference if it needs one.
+ */
+tabrmd_timeline_t*
+tpm2_command_get_timeline (Tpm2Command *command)
+{
+    return command->timeline;
+}
+void
+tpm2_command_set_timeline (Tpm2Command       *command,
+                           tabrmd_timeline_t *timeline)
+{
+    g_clear_pointer (&command->timeline, tabrmd_timeline_unref);
+    if (timeline != NULL) {
+        command->timeline = tabrmd_timeline_ref (timeline);
+    }
+}
+/*
+ * Record the time at which the command reached 'stage' if it has a
+ * timeline.
+ */
+void
+tpm2_command_stamp (Tpm2Command *command,
+                    TabrmdStage  stage)
+{
+    if (command->timeline != NULL) {
+        tabrmd_timeline_stamp (command->timeline, stage);
+    }
+}
 /* Return the number of handles in the command. */
 guint8
 tpm2_command_get_handle_count (Tpm2Command *command)
 {
-    g_debug ("tpm2_command_get_handle_count");
+    tabrmd_debug ("tpm2_command_get_handle_count");
     uint32_t tmp;
 
     if (command == NULL) {
@@ -607,8 +640,8 @@ tpm2_command_get_auths_size (Tpm2Command *command)
         return 0;
     }
     auth_size_end = AUTH_AREA_SIZE_END_OFFSET (command);
-    g_debug ("%s: auth_size_end: %zu", __func__, auth_size_end);
-    g_debug ("%s: buffer_size: %zu", __func__, command->buffer_size);
+    tabrmd_debug ("%s: auth_size_end: %zu", __func__, auth_size_end);
+    tabrmd_debug ("%s: buffer_size: %zu", __func__, command->buffer_size);
     if (AUTH_AREA_SIZE_END_OFFSET (command) > command->buffer_size) {
         g_warning ("%s reading size of auth area would overrun command buffer."
                    " Returning 0", __func__);
@@ -10,6 +10,7 @@
 #include <tss2/tss2_tpm2_types.h>
 
 #include "connection.h"
+#include "tabrmd-timeline.h"
 
 G_BEGIN_DECLS
 
@@ -23,6 +24,7 @@ typedef struct _Tpm2Command {
     Connection     *connection;
     guint8         *buffer;
     size_t          buffer_size;
+    tabrmd_timeline_t *timeline;
 } Tpm2Command;
 
 #include "command-attrs.h"
@@ -73,6 +75,11 @@ UINT32                tpm2_command_get_auths_size  (Tpm2Command      *command);
 gboolean              tpm2_command_foreach_auth    (Tpm2Command      *command,
                                                     GFunc             func,
                                                     gpointer          user_data);
+tabrmd_timeline_t*    tpm2_command_get_timeline    (Tpm2Command      *command);
+void                  tpm2_command_set_timeline    (Tpm2Command      *command,
+                                                    tabrmd_timeline_t *timeline);
+void                  tpm2_command_stamp           (Tpm2Command      *command,
+                                                    TabrmdStage       stage);
 
 G_END_DECLS
 
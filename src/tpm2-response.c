@@ -10,6 +10,7 @@
 #include <tss2/tss2_tpm2_types.h>
 #include <tss2/tss2_mu.h>
 
+#include "logging.h"
 #include "tpm2-header.h"
 #include "tpm2-response.h"
 #include "util.h"
@@ -112,6 +113,7 @@ tpm2_response_dispose (GObject *obj)
     Tpm2Response *self = TPM2_RESPONSE (obj);
 
     g_clear_object (&self->connection);
+    g_clear_pointer (&self->timeline, tabrmd_timeline_unref);
     G_OBJECT_CLASS (tpm2_response_parent_class)->dispose (obj);
 }
 /**
@@ -123,7 +125,7 @@ tpm2_response_finalize (GObject *obj)
 {
     Tpm2Response *self = TPM2_RESPONSE (obj);
 
-    g_debug ("tpm2_response_finalize");
+    tabrmd_debug ("tpm2_response_finalize");
     g_clear_pointer (&self->buffer, g_free);
     G_OBJECT_CLASS (tpm2_response_parent_class)->finalize (obj);
 }
@@ -363,7 +365,7 @@ tpm2_response_get_connection (Tpm2Response *response)
 gboolean
 tpm2_response_has_handle (Tpm2Response  *response)
 {
-    g_debug ("%s", __func__);
+    tabrmd_debug ("%s", __func__);
     if (tpm2_response_get_size (response) > TPM_HEADER_SIZE &&
         tpm2_response_get_code (response) == TSS2_RC_SUCCESS &&
         tpm2_response_get_attributes (response) & TPMA_CC_RHANDLE)
@@ -405,6 +407,32 @@ tpm2_response_set_handle (Tpm2Response *response,
     }
     HANDLE_GET (response->buffer) = htobe32 (handle);
 }
+/*
+ * The timeline of the command this is a response to. See
+ * tpm2_command_get_timeline.
+ */
+tabrmd_timeline_t*
+tpm2_response_get_timeline (Tpm2Response *response)
+{
+    return response->timeline;
+}
+void
+tpm2_response_set_timeline (Tpm2Response      *response,
+                            tabrmd_timeline_t *timeline)
+{
+    g_clear_pointer (&response->timeline, tabrmd_timeline_unref);
+    if (timeline != NULL) {
+        response->timeline = tabrmd_timeline_ref (timeline);
+    }
+}
+void
+tpm2_response_stamp (Tpm2Response *response,
+                     TabrmdStage   stage)
+{
+    if (response->timeline != NULL) {
+        tabrmd_timeline_stamp (response->timeline, stage);
+    }
+}
 /*
  * Return the type of the handle from the Tpm2Response object.
  */
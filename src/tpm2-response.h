@@ -11,6 +11,7 @@
 
 #include "connection.h"
 #include "session-entry.h"
+#include "tabrmd-timeline.h"
 #include "tpm2-header.h"
 
 G_BEGIN_DECLS
@@ -25,6 +26,7 @@ typedef struct _Tpm2Response {
     guint8         *buffer;
     size_t          buffer_size;
     TPMA_CC         attributes;
+    tabrmd_timeline_t *timeline;
 } Tpm2Response;
 
 #define TPM_RESPONSE_HEADER_SIZE (sizeof (TPM2_ST) + sizeof (UINT32) + sizeof (TPM2_RC))
@@ -58,6 +60,11 @@ TPM2_ST              tpm2_response_get_tag       (Tpm2Response    *response);
 Connection*         tpm2_response_get_connection (Tpm2Response    *response);
 void                tpm2_response_set_handle    (Tpm2Response    *response,
                                                  TPM2_HANDLE       handle);
+tabrmd_timeline_t*  tpm2_response_get_timeline  (Tpm2Response    *response);
+void                tpm2_response_set_timeline  (Tpm2Response    *response,
+                                                 tabrmd_timeline_t *timeline);
+void                tpm2_response_stamp         (Tpm2Response    *response,
+                                                 TabrmdStage      stage);
 
 G_END_DECLS
 
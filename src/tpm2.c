@@ -10,8 +10,11 @@
 #include <string.h>
 #include <tss2/tss2_rc.h>
 
+#include "logging.h"
 #include "tabrmd.h"
 
+#include "tabrmd-probes.h"
+#include "tabrmd-stats.h"
 #include "tpm2.h"
 #include "tcti.h"
 #include "tpm2-command.h"
@@ -38,7 +41,7 @@ tpm2_set_property (GObject        *object,
 {
     Tpm2 *self = TPM2 (object);
 
-    g_debug (__func__);
+    tabrmd_debug (__func__);
     switch (property_id) {
     case PROP_SAPI_CTX:
         self->sapi_context = g_value_get_pointer (value);
@@ -63,7 +66,7 @@ tpm2_get_property (GObject     *object,
 {
     Tpm2 *self = TPM2 (object);
 
-    g_debug (__func__);
+    tabrmd_debug (__func__);
     switch (property_id) {
     case PROP_SAPI_CTX:
         g_value_set_pointer (value, self->sapi_context);
@@ -157,7 +160,7 @@ sapi_context_init (Tcti *tcti)
     assert (tcti_context != NULL);
 
     size = Tss2_Sys_GetContextSize (0);
-    g_debug ("Allocating 0x%zx bytes for SAPI context", size);
+    tabrmd_debug ("Allocating 0x%zx bytes for SAPI context", size);
     /* NOTE: g_malloc0 will terminate the program if allocation fails */
     sapi_context = (TSS2_SYS_CONTEXT*)g_malloc0 (size);
 
@@ -254,7 +257,7 @@ tpm2_get_tpm_properties_fixed (TSS2_SYS_CONTEXT     *sapi_context,
     assert (sapi_context != NULL);
     assert (capability_data != NULL);
 
-    g_debug ("tpm2_get_tpm_properties_fixed");
+    tabrmd_debug ("tpm2_get_tpm_properties_fixed");
     rc = Tss2_Sys_GetCapability (sapi_context,
                                  NULL,
                                  TPM2_CAP_TPM_PROPERTIES,
@@ -389,22 +392,34 @@ tpm2_send_command (Tpm2  *tpm2,
     Connection     *connection = NULL;
     guint8         *buffer = NULL;
     size_t          buffer_size = 0;
+    gint64          start;
 
-    g_debug (__func__);
+    tabrmd_debug (__func__);
     assert (tpm2 != NULL);
     assert (command != NULL);
     assert (rc != NULL);
 
     tpm2_lock (tpm2);
+    start = g_get_monotonic_time ();
+    TABRMD_PROBE_COMMAND (tpm_transmit, command);
+    tpm2_command_stamp (command, TABRMD_STAGE_TPM_SENT);
     *rc = tcti_transmit (tpm2->tcti,
                          tpm2_command_get_size (command),
                          tpm2_command_get_buffer (command));
     if (*rc != TSS2_RC_SUCCESS)
         goto unlock_out;
     *rc = tpm2_get_response (tpm2, &buffer, &buffer_size);
+    tpm2_command_stamp (command, TABRMD_STAGE_TPM_RECEIVED);
+    TABRMD_PROBE4 (tpm_receive,
+                   TABRMD_PROBE_CONN_ID (command->connection),
+                   tpm2_command_get_code (command),
+                   buffer_size,
+                   *rc);
     if (*rc != TSS2_RC_SUCCESS) {
         goto unlock_out;
     }
+    tabrmd_stats_observe_tpm (tpm2_command_get_code (command),
+                              g_get_monotonic_time () - start);
     tpm2_unlock (tpm2);
     connection = tpm2_command_get_connection (command);
     response = tpm2_response_new (connection,
@@ -455,7 +470,7 @@ tpm2_init_tpm (Tpm2 *tpm2)
 {
     TSS2_RC rc;
 
-    g_debug (__func__);
+    tabrmd_debug (__func__);
     assert (tpm2 != NULL);
 
     if (tpm2->initialized)
@@ -525,8 +540,11 @@ tpm2_context_load (Tpm2 *tpm2,
     sapi_context = tpm2_lock_sapi (tpm2);
     rc = Tss2_Sys_ContextLoad (sapi_context, context, handle);
     tpm2_unlock (tpm2);
+    TABRMD_PROBE3 (context_load, *handle, context->contextBlob.size, rc);
     if (rc != TSS2_RC_SUCCESS) {
         RC_WARN ("Tss2_Sys_ContextLoad", rc);
+    } else {
+        tabrmd_stats_inc (TABRMD_STATS_CONTEXT_LOAD);
     }
 
     return rc;
@@ -548,11 +566,14 @@ tpm2_context_save (Tpm2 *tpm2,
     assert (tpm2 != NULL);
     assert (context != NULL);
 
-    g_debug ("tpm2_context_save: handle 0x%08" PRIx32, handle);
+    tabrmd_debug ("tpm2_context_save: handle 0x%08" PRIx32, handle);
     sapi_context = tpm2_lock_sapi (tpm2);
     rc = Tss2_Sys_ContextSave (sapi_context, handle, context);
+    TABRMD_PROBE3 (context_save, handle, context->contextBlob.size, rc);
     if (rc != TSS2_RC_SUCCESS) {
         RC_WARN ("Tss2_Sys_ContextSave", rc);
+    } else {
+        tabrmd_stats_inc (TABRMD_STATS_CONTEXT_SAVE);
     }
     tpm2_unlock (tpm2);
 
@@ -570,11 +591,13 @@ tpm2_context_flush (Tpm2 *tpm2,
 
     assert (tpm2 != NULL);
 
-    g_debug ("tpm2_context_flush: handle 0x%08" PRIx32, handle);
+    tabrmd_debug ("tpm2_context_flush: handle 0x%08" PRIx32, handle);
     sapi_context = tpm2_lock_sapi (tpm2);
     rc = Tss2_Sys_FlushContext (sapi_context, handle);
     if (rc != TSS2_RC_SUCCESS) {
         RC_WARN ("Tss2_Sys_FlushContext", rc);
+    } else {
+        tabrmd_stats_inc (TABRMD_STATS_CONTEXT_FLUSH);
     }
     tpm2_unlock (tpm2);
 
@@ -591,17 +614,21 @@ tpm2_context_saveflush (Tpm2 *tpm2,
     assert (tpm2 != NULL);
     assert (context != NULL);
 
-    g_debug ("tpm2_context_save: handle 0x%" PRIx32, handle);
+    tabrmd_debug ("tpm2_context_save: handle 0x%" PRIx32, handle);
     sapi_context = tpm2_lock_sapi (tpm2);
     rc = Tss2_Sys_ContextSave (sapi_context, handle, context);
+    TABRMD_PROBE3 (context_save, handle, context->contextBlob.size, rc);
     if (rc != TSS2_RC_SUCCESS) {
         RC_WARN ("Tss2_Sys_ContextSave", rc);
         goto out;
     }
-    g_debug ("tpm2_context_flush: handle 0x%" PRIx32, handle);
+    tabrmd_stats_inc (TABRMD_STATS_CONTEXT_SAVE);
+    tabrmd_debug ("tpm2_context_flush: handle 0x%" PRIx32, handle);
     rc = Tss2_Sys_FlushContext (sapi_context, handle);
     if (rc != TSS2_RC_SUCCESS) {
         RC_WARN ("Tss2_Sys_FlushContext", rc);
+    } else {
+        tabrmd_stats_inc (TABRMD_STATS_CONTEXT_FLUSH);
     }
 out:
     tpm2_unlock (tpm2);
@@ -625,8 +652,8 @@ tpm2_flush_all_unlocked (Tpm2     *tpm2,
     TPM2_HANDLE handle;
     size_t i;
 
-    g_debug ("%s: first: 0x%08" PRIx32 ", last: 0x%08" PRIx32,
-             __func__, first, last);
+    tabrmd_debug ("%s: first: 0x%08" PRIx32 ", last: 0x%08" PRIx32,
+                  __func__, first, last);
     assert (tpm2 != NULL);
     assert (sapi_context != NULL);
 
@@ -642,11 +669,11 @@ tpm2_flush_all_unlocked (Tpm2     *tpm2,
         RC_WARN ("Tss2_Sys_GetCapability", rc);
         return rc;
     }
-    g_debug ("%s: got %u handles", __func__, capability_data.data.handles.count);
+    tabrmd_debug ("%s: got %u handles", __func__, capability_data.data.handles.count);
     for (i = 0; i < capability_data.data.handles.count; ++i) {
         handle = capability_data.data.handles.handle [i];
-        g_debug ("%s: flushing context with handle: 0x%08" PRIx32, __func__,
-                 handle);
+        tabrmd_debug ("%s: flushing context with handle: 0x%08" PRIx32, __func__,
+                      handle);
         rc = Tss2_Sys_FlushContext (sapi_context, handle);
         if (rc != TSS2_RC_SUCCESS) {
             RC_WARN ("Tss2_Sys_FlushContext", rc);
@@ -660,7 +687,7 @@ tpm2_flush_all_context (Tpm2 *tpm2)
 {
     TSS2_SYS_CONTEXT *sapi_context;
 
-    g_debug (__func__);
+    tabrmd_debug (__func__);
     assert (tpm2 != NULL);
 
     sapi_context = tpm2_lock_sapi (tpm2);
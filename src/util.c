@@ -8,6 +8,7 @@
 #include <gio/gunixinputstream.h>
 #include <gio/gunixoutputstream.h>
 #include <inttypes.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,7 +17,9 @@
 
 #include <tss2/tss2_tpm2_types.h>
 
+#include "logging.h"
 #include "random.h"
+#include "tabrmd.h"
 #include "util.h"
 #include "tpm2-header.h"
 
@@ -66,6 +69,7 @@ g_debug_bytes (uint8_t const *byte_array,
     }
 }
 /** Write as many of the size bytes from buf to fd as possible.
+ *  On error -1 is returned with errno left as set by the failed write.
  */
 ssize_t
 write_all (GOutputStream *ostream,
@@ -75,10 +79,11 @@ write_all (GOutputStream *ostream,
     ssize_t written = 0;
     size_t written_total = 0;
     GError *error = NULL;
+    int errsv;
 
     do {
-        g_debug ("%s: writing %zu bytes to ostream", __func__,
-                 size - written_total);
+        tabrmd_debug ("%s: writing %zu bytes to ostream", __func__,
+                      size - written_total);
         written = g_output_stream_write (ostream,
                                          (const gchar*)&buf [written_total],
                                          size - written_total,
@@ -86,21 +91,152 @@ write_all (GOutputStream *ostream,
                                          &error);
         switch (written) {
         case -1:
+            errsv = errno;
             g_assert (error != NULL);
             g_warning ("%s: failed to write to ostream: %s", __func__, error->message);
             g_error_free (error);
+            errno = errsv;
             return written;
         case  0:
             return (ssize_t)written_total;
         default:
-            g_debug ("%s: wrote %zd bytes to ostream", __func__, written);
+            tabrmd_debug ("%s: wrote %zd bytes to ostream", __func__, written);
         }
         written_total += (size_t)written;
     } while (written_total < size);
-    g_debug ("returning %zu", written_total);
+    tabrmd_debug ("returning %zu", written_total);
 
     return (ssize_t)written_total;
 }
+/*
+ * Write all 'size' bytes from 'buf' to 'socket' without blocking for longer
+ * than 'timeout' microseconds in total. The socket is written in
+ * non-blocking mode and polled for space in between writes. On timeout
+ * errno is set to ETIMEDOUT and -1 is returned, the socket may hold part
+ * of the buffer at that point. Returns -1 on any other error and 'size'
+ * on success.
+ */
+ssize_t
+write_all_timeout (GSocket       *socket,
+                   const uint8_t *buf,
+                   const size_t   size,
+                   gint64         timeout)
+{
+    const gchar *data = (const gchar*)buf;
+    GError *error = NULL;
+    gssize written;
+    size_t written_total = 0;
+    gint64 deadline = g_get_monotonic_time () + timeout;
+
+    while (written_total < size) {
+        written = g_socket_send_with_blocking (socket,
+                                               &data [written_total],
+                                               size - written_total,
+                                               FALSE,
+                                               NULL,
+                                               &error);
+        if (written >= 0) {
+            written_total += (size_t)written;
+            continue;
+        }
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK)) {
+            g_warning ("%s: failed to write to socket: %s", __func__,
+                       error->message);
+            g_error_free (error);
+            return -1;
+        }
+        g_clear_error (&error);
+        timeout = deadline - g_get_monotonic_time ();
+        if (timeout <= 0 ||
+            !g_socket_condition_timed_wait (socket, G_IO_OUT, timeout,
+                                            NULL, &error))
+        {
+            if (error != NULL &&
+                !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT))
+            {
+                g_warning ("%s: failed to wait on socket: %s", __func__,
+                           error->message);
+                g_error_free (error);
+                return -1;
+            }
+            g_clear_error (&error);
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+    tabrmd_debug ("%s: wrote %zu bytes to socket", __func__, written_total);
+
+    return (ssize_t)written_total;
+}
+/*
+ * Send 'vectors' to the SOCK_SEQPACKET 'socket' as a single datagram
+ * without copying them into one buffer first. A datagram is sent whole or
+ * not at all so the only wait is for the socket to have room for it: up
+ * to 'timeout' microseconds, or for as long as it takes if 'timeout' is
+ * negative. On timeout errno is set to ETIMEDOUT and -1 is returned.
+ * Returns -1 on any other error and the size of the datagram on success.
+ */
+ssize_t
+write_datagram_timeout (GSocket             *socket,
+                        const GOutputVector *vectors,
+                        gint                 num_vectors,
+                        gint64               timeout)
+{
+    struct iovec *iov = g_newa (struct iovec, num_vectors);
+    struct msghdr msg = {
+        .msg_iov = iov,
+        .msg_iovlen = num_vectors,
+    };
+    struct pollfd pollfd = {
+        .fd = g_socket_get_fd (socket),
+        .events = POLLOUT,
+    };
+    gint64 deadline = g_get_monotonic_time () + timeout, remaining;
+    ssize_t written;
+    gint i, ret;
+
+    for (i = 0; i < num_vectors; ++i) {
+        iov [i].iov_base = (void*)vectors [i].buffer;
+        iov [i].iov_len = vectors [i].size;
+    }
+    for (;;) {
+        written = TABRMD_ERRNO_EINTR_RETRY (sendmsg (pollfd.fd,
+                                                     &msg,
+                                                     MSG_DONTWAIT |
+                                                     MSG_NOSIGNAL));
+        if (written >= 0) {
+            break;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            g_warning ("%s: failed to send datagram: %s", __func__,
+                       strerror (errno));
+            return -1;
+        }
+        remaining = -1;
+        if (timeout >= 0) {
+            remaining = deadline - g_get_monotonic_time ();
+            if (remaining <= 0) {
+                errno = ETIMEDOUT;
+                return -1;
+            }
+        }
+        ret = TABRMD_ERRNO_EINTR_RETRY (poll (&pollfd, 1, remaining < 0 ? -1 :
+            (int)MIN ((remaining + 999) / 1000, G_MAXINT)));
+        if (ret < 0) {
+            g_warning ("%s: failed to wait on socket: %s", __func__,
+                       strerror (errno));
+            return -1;
+        }
+        if (ret == 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+    }
+    tabrmd_debug ("%s: wrote datagram of %zd bytes to socket", __func__,
+                  written);
+
+    return written;
+}
 /*
  * Read data from a GSocket.
  * Parameters:
@@ -130,20 +266,20 @@ read_data (GInputStream  *istream,
 
     g_assert (index != NULL);
     do {
-        g_debug ("%s: reading %zu bytes from istream", __func__,  bytes_left);
+        tabrmd_debug ("%s: reading %zu bytes from istream", __func__,  bytes_left);
         num_read = g_input_stream_read (istream,
                                         (gchar*)&buf [*index],
                                         bytes_left,
                                         NULL,
                                         &error);
         if (num_read > 0) {
-            g_debug ("successfully read %zd bytes", num_read);
-            g_debug_bytes ((uint8_t*)&buf [*index], num_read, 16, 4);
+            tabrmd_debug ("successfully read %zd bytes", num_read);
+            tabrmd_debug_bytes ((uint8_t*)&buf [*index], num_read, 16, 4);
             /* Advance index by the number of bytes read. */
             *index += num_read;
             bytes_left -= num_read;
         } else if (num_read == 0) {
-            g_debug ("read produced EOF");
+            tabrmd_debug ("read produced EOF");
             return -1;
         } else { /* num_read < 0 */
             g_assert (error != NULL);
@@ -243,17 +379,240 @@ read_tpm_buffer_alloc (GInputStream *istream,
             goto err_out;
         }
     } while (ret == EPROTO);
-    g_debug ("%s: read TPM buffer of size: %zd", __func__, index);
-    g_debug_bytes (buf, index, 16, 4);
+    tabrmd_debug ("%s: read TPM buffer of size: %zd", __func__, index);
+    tabrmd_debug_bytes (buf, index, 16, 4);
     *buf_size = size_tmp;
     return buf;
 err_out:
-    g_debug ("%s: err_out freeing buffer", __func__);
+    tabrmd_debug ("%s: err_out freeing buffer", __func__);
     if (buf != NULL) {
         g_free (buf);
     }
     return NULL;
 }
+#if defined(__FreeBSD__)
+#ifndef POLLRDHUP
+#define POLLRDHUP 0x0
+#endif
+#endif
+/*
+ * Return the size of the next datagram waiting on the SOCK_SEQPACKET
+ * 'socket' without consuming it so the caller can allocate a buffer of
+ * exactly that size. Returns 0 on EOF and -1 on error.
+ * The sockets are non-blocking so a wakeup with nothing to read fails with
+ * EAGAIN, this returns UTIL_READ_AGAIN. An empty datagram peeks as 0 just
+ * like EOF. It's told apart by the peer not having hung up, then discarded
+ * and UTIL_READ_AGAIN is returned as well.
+ */
+static gssize
+peek_datagram_size (GSocket *socket)
+{
+    struct pollfd pollfd = {
+        .fd = g_socket_get_fd (socket),
+        .events = POLLRDHUP,
+    };
+    gssize size;
+    gint ret;
+
+    do {
+        size = recv (pollfd.fd, NULL, 0, MSG_PEEK | MSG_TRUNC);
+    } while (size < 0 && errno == EINTR);
+    if (size < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return UTIL_READ_AGAIN;
+        }
+        g_warning ("%s: failed to peek datagram size: %s", __func__,
+                   strerror (errno));
+        return -1;
+    }
+    if (size > 0) {
+        return size;
+    }
+    ret = TABRMD_ERRNO_EINTR_RETRY (poll (&pollfd, 1, 0));
+    if (ret < 0) {
+        g_warning ("%s: failed to poll socket: %s", __func__,
+                   strerror (errno));
+        return -1;
+    }
+    if (pollfd.revents & (POLLHUP | POLLRDHUP | POLLERR)) {
+        return 0;
+    }
+    tabrmd_debug ("%s: discarding empty datagram", __func__);
+    if (TABRMD_ERRNO_EINTR_RETRY (recv (pollfd.fd, NULL, 0, MSG_DONTWAIT)) < 0) {
+        g_warning ("%s: failed to discard empty datagram: %s", __func__,
+                   strerror (errno));
+        return -1;
+    }
+    return UTIL_READ_AGAIN;
+}
+/*
+ * Receive the datagram sized by peek_datagram_size into 'vectors'. Returns
+ * FALSE if the receive fails or doesn't fill the vectors exactly.
+ */
+static gboolean
+receive_datagram (GSocket      *socket,
+                  GInputVector *vectors,
+                  gint          num_vectors,
+                  gssize        size)
+{
+    GError *error = NULL;
+    gssize num_read;
+    gint flags = 0;
+
+    num_read = g_socket_receive_message (socket,
+                                         NULL,
+                                         vectors,
+                                         num_vectors,
+                                         NULL,
+                                         NULL,
+                                         &flags,
+                                         NULL,
+                                         &error);
+    if (num_read < 0) {
+        g_assert (error != NULL);
+        g_warning ("%s: receive on socket produced error: %s", __func__,
+                   error->message);
+        g_error_free (error);
+        return FALSE;
+    }
+    if (num_read != size || flags & MSG_TRUNC) {
+        g_warning ("%s: received %zd bytes, expected %zd", __func__,
+                   num_read, size);
+        return FALSE;
+    }
+    return TRUE;
+}
+/*
+ * This function reads a TPM2 command or response from a SOCK_SEQPACKET
+ * socket. Each TPM buffer is sent as a single datagram. Its size is peeked
+ * first so the buffer is allocated at exactly that size and the whole
+ * buffer is then read with one call to recvmsg.
+ * Returns -1 on error, EOF, if the datagram is larger than UTIL_BUF_MAX,
+ * or if the size in the header doesn't match the size of the datagram.
+ * Returns UTIL_READ_AGAIN if there's no datagram to read yet. Otherwise
+ * the buffer is returned through 'buf' and its size is returned.
+ */
+gssize
+read_tpm_datagram_alloc (GSocket  *socket,
+                         uint8_t **buf)
+{
+    GInputVector vector;
+    gssize size;
+    uint8_t *tpm_buf;
+
+    if (socket == NULL || buf == NULL) {
+        g_warning ("%s: got null parameter", __func__);
+        return -1;
+    }
+    size = peek_datagram_size (socket);
+    if (size < 0) {
+        return size;
+    }
+    if (size == 0) {
+        tabrmd_debug ("%s: receive produced EOF", __func__);
+        return -1;
+    }
+    if (size > UTIL_BUF_MAX) {
+        g_warning ("%s: tpm buffer size exceeds maximum: %d",
+                   __func__, UTIL_BUF_MAX);
+        return -1;
+    }
+    if ((size_t)size < TPM_HEADER_SIZE) {
+        g_warning ("%s: datagram size %zd smaller than tpm buffer header",
+                   __func__, size);
+        return -1;
+    }
+    tpm_buf = g_malloc (size);
+    vector.buffer = tpm_buf;
+    vector.size = size;
+    if (!receive_datagram (socket, &vector, 1, size)) {
+        goto err_out;
+    }
+    if (get_command_size (tpm_buf) != (size_t)size) {
+        g_warning ("%s: datagram size %zd doesn't match tpm buffer header",
+                   __func__, size);
+        goto err_out;
+    }
+    tabrmd_debug ("%s: read TPM buffer of size: %zd", __func__, size);
+    tabrmd_debug_bytes (tpm_buf, size, 16, 4);
+    *buf = tpm_buf;
+    return size;
+err_out:
+    g_free (tpm_buf);
+    return -1;
+}
+/*
+ * This function reads a single frame from a multiplexed (TABRMD_TRANSPORT_MUX)
+ * SOCK_SEQPACKET socket. Each frame is a single datagram holding the
+ * channel id followed by a TPM buffer. The frame size is peeked first and
+ * the channel id and TPM buffer are received straight into their own
+ * buffers, the TPM buffer allocated at exactly its size. The channel id is
+ * returned through the 'channel' parameter.
+ * Returns -1 on error, EOF, if the frame is malformed, or if the size in
+ * the TPM buffer header doesn't match the size of the frame. Returns
+ * UTIL_READ_AGAIN if there's no frame to read yet and 0 for a frame
+ * holding only the channel id: the client has closed the channel.
+ * Otherwise the TPM buffer is returned through 'buf' and its size is
+ * returned.
+ */
+gssize
+read_tpm_mux_alloc (GSocket  *socket,
+                    guint32  *channel,
+                    uint8_t **buf)
+{
+    GInputVector vectors [2];
+    guint32 header;
+    gssize frame_size;
+    size_t size;
+    uint8_t *tpm_buf = NULL;
+
+    if (socket == NULL || channel == NULL || buf == NULL) {
+        g_warning ("%s: got null parameter", __func__);
+        return -1;
+    }
+    frame_size = peek_datagram_size (socket);
+    if (frame_size < 0) {
+        return frame_size;
+    }
+    if (frame_size == 0) {
+        tabrmd_debug ("%s: receive produced EOF", __func__);
+        return -1;
+    }
+    if ((size_t)frame_size < TABRMD_MUX_HEADER_SIZE ||
+        (size_t)frame_size > TABRMD_MUX_HEADER_SIZE + UTIL_BUF_MAX)
+    {
+        g_warning ("%s: malformed frame of size %zd", __func__, frame_size);
+        return -1;
+    }
+    size = (size_t)frame_size - TABRMD_MUX_HEADER_SIZE;
+    vectors [0].buffer = &header;
+    vectors [0].size = TABRMD_MUX_HEADER_SIZE;
+    if (size > 0) {
+        tpm_buf = g_malloc (size);
+        vectors [1].buffer = tpm_buf;
+        vectors [1].size = size;
+    }
+    if (!receive_datagram (socket, vectors, size > 0 ? 2 : 1, frame_size)) {
+        goto err_out;
+    }
+    *channel = GUINT32_FROM_BE (header);
+    if (size == 0) {
+        tabrmd_debug ("%s: channel %" PRIu32 " closed", __func__, *channel);
+        return 0;
+    }
+    if (size < TPM_HEADER_SIZE || get_command_size (tpm_buf) != size) {
+        g_warning ("%s: frame size %zu doesn't match tpm buffer header",
+                   __func__, size);
+        goto err_out;
+    }
+    tabrmd_debug ("%s: read TPM buffer of size %zu for channel %" PRIu32,
+                  __func__, size, *channel);
+    *buf = tpm_buf;
+    return (gssize)size;
+err_out:
+    g_free (tpm_buf);
+    return -1;
+}
 /*
  * Create a GSocket for use by the daemon for communicating with the client.
  * The client end of the socket is returned through the client_fd
@@ -261,14 +620,25 @@ err_out:
  */
 GIOStream*
 create_connection_iostream (int *client_fd)
+{
+    return create_connection_iostream_type (client_fd, SOCK_STREAM);
+}
+/*
+ * Same as create_connection_iostream but the caller selects the socket
+ * type: SOCK_STREAM or SOCK_SEQPACKET.
+ */
+GIOStream*
+create_connection_iostream_type (int *client_fd,
+                                 int  type)
 {
     GIOStream *iostream;
     GSocket *sock;
     int server_fd, ret;
 
-    ret = create_socket_pair (client_fd,
-                              &server_fd,
-                              SOCK_CLOEXEC | SOCK_NONBLOCK);
+    ret = create_socket_pair_type (client_fd,
+                                   &server_fd,
+                                   type,
+                                   SOCK_CLOEXEC | SOCK_NONBLOCK);
     if (ret == -1) {
         g_error ("CreateConnection failed to make fd pair %s", strerror (errno));
     }
@@ -285,10 +655,22 @@ int
 create_socket_pair (int *fd_a,
                     int *fd_b,
                     int  flags)
+{
+    return create_socket_pair_type (fd_a, fd_b, SOCK_STREAM, flags);
+}
+/*
+ * Create a socket pair of the given type (SOCK_STREAM or SOCK_SEQPACKET)
+ * and return the fds for both ends of the communication channel.
+ */
+int
+create_socket_pair_type (int *fd_a,
+                         int *fd_b,
+                         int  type,
+                         int  flags)
 {
     int ret, fds[2] = { 0, };
 
-    ret = socketpair (PF_LOCAL, SOCK_STREAM | flags, 0, fds);
+    ret = socketpair (PF_LOCAL, type | flags, 0, fds);
     if (ret == -1) {
         g_warning ("%s: failed to create socket pair with errno: %d",
                    __func__, errno);
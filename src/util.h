@@ -47,6 +47,12 @@
 #define UTIL_BUF_SIZE 1024
 /* stop allocating at BUF_MAX */
 #define UTIL_BUF_MAX  8*UTIL_BUF_SIZE
+/*
+ * Returned by read_tpm_datagram_alloc and read_tpm_mux_alloc when there's
+ * nothing to read yet. The caller should wait for the socket to become
+ * readable again.
+ */
+#define UTIL_READ_AGAIN (-2)
 
 #define prop_str(val) val ? "set" : "clear"
 
@@ -82,6 +88,14 @@ typedef TSS2_RC (*KeyValueFunc) (const key_value_t* key_value,
 ssize_t     write_all                       (GOutputStream    *ostream,
                                              const uint8_t    *buf,
                                              const size_t      size);
+ssize_t     write_all_timeout               (GSocket          *socket,
+                                             const uint8_t    *buf,
+                                             const size_t      size,
+                                             gint64            timeout);
+ssize_t     write_datagram_timeout          (GSocket          *socket,
+                                             const GOutputVector *vectors,
+                                             gint              num_vectors,
+                                             gint64            timeout);
 int         read_data                       (GInputStream     *istream,
                                              size_t           *index,
                                              uint8_t          *buf,
@@ -92,14 +106,25 @@ int         read_tpm_buffer                 (GInputStream     *istream,
                                              size_t            buf_size);
 uint8_t*    read_tpm_buffer_alloc           (GInputStream     *istream,
                                              size_t           *buf_size);
+gssize      read_tpm_datagram_alloc         (GSocket          *socket,
+                                             uint8_t         **buf);
+gssize      read_tpm_mux_alloc              (GSocket          *socket,
+                                             guint32          *channel,
+                                             uint8_t         **buf);
 void        g_debug_bytes                   (uint8_t const    *byte_array,
                                              size_t            array_size,
                                              size_t            width,
                                              size_t            indent);
 GIOStream*  create_connection_iostream      (int              *client_fd);
+GIOStream*  create_connection_iostream_type (int              *client_fd,
+                                             int               type);
 int         create_socket_pair              (int              *fd_a,
                                              int              *fd_b,
                                              int               flags);
+int         create_socket_pair_type         (int              *fd_a,
+                                             int              *fd_b,
+                                             int               type,
+                                             int               flags);
 void        g_debug_tpma_cc                 (TPMA_CC           tpma_cc);
 TSS2_RC     parse_key_value_string (char *kv_str,
                                     KeyValueFunc callback,
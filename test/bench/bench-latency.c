@@ -0,0 +1,71 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#include <inttypes.h>
+
+#include "bench-latency.h"
+
+static gint
+bench_compare_u64 (gconstpointer a,
+                   gconstpointer b)
+{
+    guint64 x = *(const guint64*)a, y = *(const guint64*)b;
+
+    return x < y ? -1 : x > y;
+}
+void
+bench_latency_sort (GArray *latencies)
+{
+    g_array_sort (latencies, bench_compare_u64);
+}
+/*
+ * Nearest rank percentile, 'permille' in thousandths so p999 is exact.
+ */
+guint64
+bench_latency_percentile (GArray *sorted,
+                          guint   permille)
+{
+    guint rank;
+
+    if (sorted->len == 0) {
+        return 0;
+    }
+    rank = (guint)(((guint64)sorted->len * permille + 999) / 1000);
+    if (rank == 0) {
+        rank = 1;
+    }
+    return g_array_index (sorted, guint64, rank - 1);
+}
+/*
+ * Print the summary of 'sorted' as the JSON object member 'name' of the
+ * top level report object. 'last' leaves off the trailing comma.
+ */
+void
+bench_latency_print (FILE *out,
+                     const char *name,
+                     GArray *sorted,
+                     gboolean last)
+{
+    guint64 sum = 0;
+    guint i;
+
+    for (i = 0; i < sorted->len; ++i) {
+        sum += g_array_index (sorted, guint64, i);
+    }
+    fprintf (out,
+             "  \"%s\": {\n"
+             "    \"min\": %" PRIu64 ",\n"
+             "    \"mean\": %.1f,\n"
+             "    \"p50\": %" PRIu64 ",\n"
+             "    \"p99\": %" PRIu64 ",\n"
+             "    \"p999\": %" PRIu64 ",\n"
+             "    \"max\": %" PRIu64 "\n"
+             "  }%s\n",
+             name,
+             sorted->len > 0 ? g_array_index (sorted, guint64, 0) : 0,
+             sorted->len > 0 ? (double)sum / sorted->len : 0.0,
+             bench_latency_percentile (sorted, 500),
+             bench_latency_percentile (sorted, 990),
+             bench_latency_percentile (sorted, 999),
+             sorted->len > 0 ?
+                 g_array_index (sorted, guint64, sorted->len - 1) : 0,
+             last ? "" : ",");
+}
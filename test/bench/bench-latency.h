@@ -0,0 +1,21 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#ifndef BENCH_LATENCY_H
+#define BENCH_LATENCY_H
+
+#include <stdio.h>
+
+#include <glib.h>
+
+/*
+ * Latency summaries shared by tabrmd-bench and tabrmd-replay. Latencies
+ * are collected in GArrays of guint64 microseconds.
+ */
+void     bench_latency_sort       (GArray      *latencies);
+guint64  bench_latency_percentile (GArray      *sorted,
+                                   guint        permille);
+void     bench_latency_print      (FILE        *out,
+                                   const char  *name,
+                                   GArray      *sorted,
+                                   gboolean     last);
+
+#endif /* BENCH_LATENCY_H */
@@ -0,0 +1,801 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * tabrmd-bench: a load generator for the tabrmd. It drives a number of
+ * concurrent clients, each with its own TCTI connection, through a fixed
+ * mix of TPM commands and reports throughput and latency percentiles as
+ * JSON. The daemon (and the TPM or simulator behind it) must already be
+ * running, see 'make bench' for a harness that starts both.
+ */
+#include <errno.h>
+#include <glib.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tss2/tss2_sys.h>
+
+#include "bench-latency.h"
+#include "tss2-tcti-tabrmd.h"
+
+/* work around older glib versions missing this symbol */
+#ifndef G_OPTION_FLAG_NONE
+#define G_OPTION_FLAG_NONE 0
+#endif
+
+/* environment variable set by the integration test harness */
+#define ENV_TCTI_CONF "TABRMD_TEST_TCTI_CONF"
+
+#define BENCH_CLIENTS_DEFAULT  1
+#define BENCH_CLIENTS_MAX      64
+#define BENCH_DURATION_DEFAULT 10
+#define BENCH_MIX_DEFAULT      "getrandom"
+
+#define BENCH_RETRY(expression)                                \
+    ({                                                         \
+        TSS2_RC __result = 0;                                  \
+        do {                                                   \
+            __result = (expression);                           \
+        } while ((__result & 0x0000ffff) == TPM2_RC_RETRY ||   \
+                 (__result & 0x0000ffff) == TPM2_RC_YIELDED || \
+                 (__result & 0x0000ffff) == TPM2_RC_TESTING);  \
+        __result;                                              \
+    })
+
+typedef struct {
+    gint        clients;
+    gint        duration;
+    gint        iterations;
+    gchar      *mix;
+    gchar      *tcti_conf;
+    gchar      *output;
+} bench_opts_t;
+
+/*
+ * State for a single client. Each client owns a TCTI and SAPI context and
+ * is only ever touched by a single thread at a time. Latencies are
+ * recorded per operation (one pass through the mix) in microseconds.
+ */
+typedef struct {
+    guint                 id;
+    TSS2_TCTI_CONTEXT    *tcti;
+    TSS2_SYS_CONTEXT     *sys;
+    TPM2_HANDLE           primary;
+    TPM2B_PRIVATE         key_private;
+    TPM2B_PUBLIC          key_public;
+    TPMI_SH_AUTH_SESSION  anchor;
+    GArray               *latencies;
+    guint64               commands;
+    TSS2_RC               rc;
+    gint64                end;
+    GThread              *thread;
+} bench_client_t;
+
+typedef TSS2_RC (*bench_func_t) (bench_client_t *client);
+/*
+ * A command mix. 'setup' and 'teardown' are run once per client outside of
+ * the timed section, 'run' is a single timed operation.
+ */
+typedef struct {
+    const char   *name;
+    const char   *description;
+    bench_func_t  setup;
+    bench_func_t  run;
+    bench_func_t  teardown;
+} bench_mix_t;
+
+static bench_opts_t bench_opts = {
+    .clients    = BENCH_CLIENTS_DEFAULT,
+    .duration   = BENCH_DURATION_DEFAULT,
+    .iterations = 0,
+    .mix        = NULL,
+    .tcti_conf  = NULL,
+    .output     = NULL,
+};
+static const bench_mix_t *bench_mix;
+static gint bench_stop = 0;
+
+static const TSS2L_SYS_AUTH_COMMAND bench_pw_auth = {
+    .count = 1,
+    .auths = {{
+        .sessionHandle = TPM2_RS_PW,
+    }}
+};
+
+static TSS2_RC
+bench_create_primary (bench_client_t *client)
+{
+    TPM2B_SENSITIVE_CREATE in_sensitive = { .size = 0 };
+    TPM2B_DATA outside_info = { .size = 0 };
+    TPML_PCR_SELECTION creation_pcr = { .count = 0 };
+    TPM2B_PUBLIC out_public = { .size = 0 };
+    TPM2B_CREATION_DATA creation_data = { .size = 0 };
+    TPM2B_DIGEST creation_hash = { .size = 0 };
+    TPMT_TK_CREATION creation_ticket = { .tag = 0 };
+    TPM2B_NAME name = { .size = 0 };
+    TPM2B_PUBLIC in_public = {
+        .publicArea = {
+            .type = TPM2_ALG_ECC,
+            .nameAlg = TPM2_ALG_SHA256,
+            .objectAttributes = TPMA_OBJECT_FIXEDTPM |
+                                TPMA_OBJECT_FIXEDPARENT |
+                                TPMA_OBJECT_SENSITIVEDATAORIGIN |
+                                TPMA_OBJECT_USERWITHAUTH |
+                                TPMA_OBJECT_NODA |
+                                TPMA_OBJECT_RESTRICTED |
+                                TPMA_OBJECT_DECRYPT,
+            .parameters.eccDetail = {
+                .symmetric = {
+                    .algorithm = TPM2_ALG_AES,
+                    .keyBits.aes = 128,
+                    .mode.aes = TPM2_ALG_CFB,
+                },
+                .scheme.scheme = TPM2_ALG_NULL,
+                .curveID = TPM2_ECC_NIST_P256,
+                .kdf.scheme = TPM2_ALG_NULL,
+            },
+        },
+    };
+
+    client->commands++;
+    return BENCH_RETRY (Tss2_Sys_CreatePrimary (client->sys,
+                                                TPM2_RH_OWNER,
+                                                &bench_pw_auth,
+                                                &in_sensitive,
+                                                &in_public,
+                                                &outside_info,
+                                                &creation_pcr,
+                                                &client->primary,
+                                                &out_public,
+                                                &creation_data,
+                                                &creation_hash,
+                                                &creation_ticket,
+                                                &name,
+                                                NULL));
+}
+/*
+ * Create an HMAC signing key under the client's primary key. HMAC keeps
+ * the cost of TPM2_Sign low so the numbers reflect the broker more than
+ * the TPM's asymmetric crypto.
+ */
+static TSS2_RC
+bench_create_key (bench_client_t *client)
+{
+    TPM2B_SENSITIVE_CREATE in_sensitive = { .size = 0 };
+    TPM2B_DATA outside_info = { .size = 0 };
+    TPML_PCR_SELECTION creation_pcr = { .count = 0 };
+    TPM2B_CREATION_DATA creation_data = { .size = 0 };
+    TPM2B_DIGEST creation_hash = { .size = 0 };
+    TPMT_TK_CREATION creation_ticket = { .tag = 0 };
+    TPM2B_PUBLIC in_public = {
+        .publicArea = {
+            .type = TPM2_ALG_KEYEDHASH,
+            .nameAlg = TPM2_ALG_SHA256,
+            .objectAttributes = TPMA_OBJECT_FIXEDTPM |
+                                TPMA_OBJECT_FIXEDPARENT |
+                                TPMA_OBJECT_SENSITIVEDATAORIGIN |
+                                TPMA_OBJECT_USERWITHAUTH |
+                                TPMA_OBJECT_NODA |
+                                TPMA_OBJECT_SIGN_ENCRYPT,
+            .parameters.keyedHashDetail.scheme = {
+                .scheme = TPM2_ALG_HMAC,
+                .details.hmac.hashAlg = TPM2_ALG_SHA256,
+            },
+        },
+    };
+
+    client->key_private.size = 0;
+    client->key_public.size = 0;
+    client->commands++;
+    return BENCH_RETRY (Tss2_Sys_Create (client->sys,
+                                         client->primary,
+                                         &bench_pw_auth,
+                                         &in_sensitive,
+                                         &in_public,
+                                         &outside_info,
+                                         &creation_pcr,
+                                         &client->key_private,
+                                         &client->key_public,
+                                         &creation_data,
+                                         &creation_hash,
+                                         &creation_ticket,
+                                         NULL));
+}
+static TSS2_RC
+bench_start_policy_session (bench_client_t *client,
+                            TPMI_SH_AUTH_SESSION *session)
+{
+    TPM2B_NONCE nonce_caller = { .size = TPM2_SHA256_DIGEST_SIZE };
+    TPM2B_NONCE nonce_tpm = { .size = 0 };
+    TPM2B_ENCRYPTED_SECRET salt = { .size = 0 };
+    TPMT_SYM_DEF symmetric = { .algorithm = TPM2_ALG_NULL };
+
+    client->commands++;
+    return BENCH_RETRY (Tss2_Sys_StartAuthSession (client->sys,
+                                                   TPM2_RH_NULL,
+                                                   TPM2_RH_NULL,
+                                                   NULL,
+                                                   &nonce_caller,
+                                                   &salt,
+                                                   TPM2_SE_POLICY,
+                                                   &symmetric,
+                                                   TPM2_ALG_SHA256,
+                                                   session,
+                                                   &nonce_tpm,
+                                                   NULL));
+}
+static TSS2_RC
+bench_flush (bench_client_t *client,
+             TPM2_HANDLE handle)
+{
+    client->commands++;
+    return BENCH_RETRY (Tss2_Sys_FlushContext (client->sys, handle));
+}
+/*
+ * getrandom: a single TPM2_GetRandom per operation. This is about the
+ * cheapest command there is so it mostly measures the broker.
+ */
+static TSS2_RC
+bench_getrandom_run (bench_client_t *client)
+{
+    TPM2B_DIGEST bytes = { .size = 0 };
+
+    client->commands++;
+    return BENCH_RETRY (Tss2_Sys_GetRandom (client->sys,
+                                            NULL,
+                                            16,
+                                            &bytes,
+                                            NULL));
+}
+static TSS2_RC
+bench_sign_setup (bench_client_t *client)
+{
+    TSS2_RC rc;
+
+    rc = bench_create_primary (client);
+    if (rc != TSS2_RC_SUCCESS) {
+        return rc;
+    }
+    return bench_create_key (client);
+}
+/*
+ * sign: TPM2_Load, TPM2_Sign and TPM2_FlushContext per operation. Every
+ * command references a transient object so the resource manager has to
+ * load and save contexts for each of them.
+ */
+static TSS2_RC
+bench_sign_run (bench_client_t *client)
+{
+    TPM2_HANDLE handle;
+    TPM2B_NAME name = { .size = 0 };
+    TPM2B_DIGEST digest = { .size = TPM2_SHA256_DIGEST_SIZE };
+    TPMT_SIG_SCHEME scheme = { .scheme = TPM2_ALG_NULL };
+    TPMT_TK_HASHCHECK validation = {
+        .tag = TPM2_ST_HASHCHECK,
+        .hierarchy = TPM2_RH_NULL,
+        .digest.size = 0,
+    };
+    TPMT_SIGNATURE signature;
+    TSS2_RC rc, rc_flush;
+
+    client->commands++;
+    rc = BENCH_RETRY (Tss2_Sys_Load (client->sys,
+                                     client->primary,
+                                     &bench_pw_auth,
+                                     &client->key_private,
+                                     &client->key_public,
+                                     &handle,
+                                     &name,
+                                     NULL));
+    if (rc != TSS2_RC_SUCCESS) {
+        return rc;
+    }
+    client->commands++;
+    rc = BENCH_RETRY (Tss2_Sys_Sign (client->sys,
+                                     handle,
+                                     &bench_pw_auth,
+                                     &digest,
+                                     &scheme,
+                                     &validation,
+                                     &signature,
+                                     NULL));
+    rc_flush = bench_flush (client, handle);
+
+    return rc != TSS2_RC_SUCCESS ? rc : rc_flush;
+}
+static TSS2_RC
+bench_sign_teardown (bench_client_t *client)
+{
+    return bench_flush (client, client->primary);
+}
+/*
+ * policy: a policy session built up and torn down per operation:
+ * TPM2_StartAuthSession, TPM2_PolicyCommandCode, TPM2_PolicyAuthValue,
+ * TPM2_PolicyGetDigest and TPM2_FlushContext.
+ */
+static TSS2_RC
+bench_policy_run (bench_client_t *client)
+{
+    TPMI_SH_AUTH_SESSION session;
+    TPM2B_DIGEST digest = { .size = 0 };
+    TSS2_RC rc, rc_flush;
+
+    rc = bench_start_policy_session (client, &session);
+    if (rc != TSS2_RC_SUCCESS) {
+        return rc;
+    }
+    client->commands++;
+    rc = BENCH_RETRY (Tss2_Sys_PolicyCommandCode (client->sys,
+                                                  session,
+                                                  NULL,
+                                                  TPM2_CC_Sign,
+                                                  NULL));
+    if (rc == TSS2_RC_SUCCESS) {
+        client->commands++;
+        rc = BENCH_RETRY (Tss2_Sys_PolicyAuthValue (client->sys,
+                                                    session,
+                                                    NULL,
+                                                    NULL));
+    }
+    if (rc == TSS2_RC_SUCCESS) {
+        client->commands++;
+        rc = BENCH_RETRY (Tss2_Sys_PolicyGetDigest (client->sys,
+                                                    session,
+                                                    NULL,
+                                                    &digest,
+                                                    NULL));
+    }
+    rc_flush = bench_flush (client, session);
+
+    return rc != TSS2_RC_SUCCESS ? rc : rc_flush;
+}
+static TSS2_RC
+bench_gap_setup (bench_client_t *client)
+{
+    return bench_start_policy_session (client, &client->anchor);
+}
+/*
+ * gap: each client holds on to a long lived 'anchor' session while it
+ * starts and flushes a short lived one per operation. The short lived
+ * sessions advance the TPM's context counter and the anchor is used at
+ * the end of each operation, so the resource manager has to keep it
+ * within the context gap.
+ */
+static TSS2_RC
+bench_gap_run (bench_client_t *client)
+{
+    TPMI_SH_AUTH_SESSION session;
+    TPM2B_DIGEST digest = { .size = 0 };
+    TSS2_RC rc;
+
+    rc = bench_start_policy_session (client, &session);
+    if (rc != TSS2_RC_SUCCESS) {
+        return rc;
+    }
+    rc = bench_flush (client, session);
+    if (rc != TSS2_RC_SUCCESS) {
+        return rc;
+    }
+    client->commands++;
+    return BENCH_RETRY (Tss2_Sys_PolicyGetDigest (client->sys,
+                                                  client->anchor,
+                                                  NULL,
+                                                  &digest,
+                                                  NULL));
+}
+static TSS2_RC
+bench_gap_teardown (bench_client_t *client)
+{
+    return bench_flush (client, client->anchor);
+}
+/*
+ * Create and finalize a TCTI context of its own, one CreateConnection
+ * round trip with the daemon. The client's context has already created the
+ * proxy for the daemon so this measures the cost of Tss2_Tcti_Tabrmd_Init
+ * for every context after the first in a process.
+ */
+static TSS2_RC
+bench_init_run (bench_client_t *client)
+{
+    TSS2_TCTI_CONTEXT *tcti;
+    size_t size = 0;
+    TSS2_RC rc;
+
+    client->commands++;
+    rc = Tss2_Tcti_Tabrmd_Init (NULL, &size, NULL);
+    if (rc != TSS2_RC_SUCCESS) {
+        return rc;
+    }
+    tcti = calloc (1, size);
+    if (tcti == NULL) {
+        return TSS2_TCTI_RC_MEMORY;
+    }
+    rc = Tss2_Tcti_Tabrmd_Init (tcti, &size, bench_opts.tcti_conf);
+    if (rc == TSS2_RC_SUCCESS) {
+        Tss2_Tcti_Finalize (tcti);
+    }
+    free (tcti);
+    return rc;
+}
+
+static const bench_mix_t bench_mixes [] = {
+    {
+        .name        = "getrandom",
+        .description = "TPM2_GetRandom",
+        .setup       = NULL,
+        .run         = bench_getrandom_run,
+        .teardown    = NULL,
+    },
+    {
+        .name        = "sign",
+        .description = "TPM2_Load + TPM2_Sign + TPM2_FlushContext",
+        .setup       = bench_sign_setup,
+        .run         = bench_sign_run,
+        .teardown    = bench_sign_teardown,
+    },
+    {
+        .name        = "policy",
+        .description = "policy session start / extend / digest / flush",
+        .setup       = NULL,
+        .run         = bench_policy_run,
+        .teardown    = NULL,
+    },
+    {
+        .name        = "gap",
+        .description = "session churn around a long lived session",
+        .setup       = bench_gap_setup,
+        .run         = bench_gap_run,
+        .teardown    = bench_gap_teardown,
+    },
+    {
+        .name        = "init",
+        .description = "Tss2_Tcti_Tabrmd_Init + Tss2_Tcti_Finalize",
+        .setup       = NULL,
+        .run         = bench_init_run,
+        .teardown    = NULL,
+    },
+};
+
+static const bench_mix_t*
+bench_mix_lookup (const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < G_N_ELEMENTS (bench_mixes); ++i) {
+        if (strcmp (name, bench_mixes [i].name) == 0) {
+            return &bench_mixes [i];
+        }
+    }
+    return NULL;
+}
+/*
+ * Create the TCTI and SAPI contexts for a client.
+ */
+static int
+bench_client_init (bench_client_t *client,
+                   const char *conf)
+{
+    TSS2_ABI_VERSION abi_version = TSS2_ABI_VERSION_CURRENT;
+    TSS2_RC rc;
+    size_t size = 0;
+
+    rc = Tss2_Tcti_Tabrmd_Init (NULL, &size, NULL);
+    if (rc != TSS2_RC_SUCCESS) {
+        g_warning ("client %u: failed to get TCTI context size: 0x%" PRIx32,
+                   client->id, rc);
+        return -1;
+    }
+    client->tcti = calloc (1, size);
+    if (client->tcti == NULL) {
+        g_warning ("client %u: failed to allocate TCTI context: %s",
+                   client->id, strerror (errno));
+        return -1;
+    }
+    rc = Tss2_Tcti_Tabrmd_Init (client->tcti, &size, conf);
+    if (rc != TSS2_RC_SUCCESS) {
+        g_warning ("client %u: failed to initialize TCTI: 0x%" PRIx32,
+                   client->id, rc);
+        g_clear_pointer (&client->tcti, free);
+        return -1;
+    }
+    size = Tss2_Sys_GetContextSize (0);
+    client->sys = calloc (1, size);
+    if (client->sys == NULL) {
+        g_warning ("client %u: failed to allocate SAPI context: %s",
+                   client->id, strerror (errno));
+        return -1;
+    }
+    rc = Tss2_Sys_Initialize (client->sys, size, client->tcti, &abi_version);
+    if (rc != TSS2_RC_SUCCESS) {
+        g_warning ("client %u: failed to initialize SAPI: 0x%" PRIx32,
+                   client->id, rc);
+        g_clear_pointer (&client->sys, free);
+        return -1;
+    }
+    client->latencies = g_array_new (FALSE, FALSE, sizeof (guint64));
+    return 0;
+}
+static void
+bench_client_free (bench_client_t *client)
+{
+    if (client->sys != NULL) {
+        Tss2_Sys_Finalize (client->sys);
+        g_clear_pointer (&client->sys, free);
+    }
+    if (client->tcti != NULL) {
+        Tss2_Tcti_Finalize (client->tcti);
+        g_clear_pointer (&client->tcti, free);
+    }
+    if (client->latencies != NULL) {
+        g_array_free (client->latencies, TRUE);
+    }
+}
+/*
+ * Thread function for a single client: run the mix until told to stop or
+ * the requested number of iterations is done. The first failure ends the
+ * client's run and is reported by the main thread.
+ */
+static gpointer
+bench_client_thread (gpointer data)
+{
+    bench_client_t *client = (bench_client_t*)data;
+    gint64 start, latency;
+    gint i;
+
+    for (i = 0;
+         bench_opts.iterations == 0 || i < bench_opts.iterations;
+         ++i)
+    {
+        if (g_atomic_int_get (&bench_stop)) {
+            break;
+        }
+        start = g_get_monotonic_time ();
+        client->rc = bench_mix->run (client);
+        if (client->rc != TSS2_RC_SUCCESS) {
+            g_warning ("client %u: mix \"%s\" failed: 0x%" PRIx32,
+                       client->id, bench_mix->name, client->rc);
+            break;
+        }
+        latency = g_get_monotonic_time () - start;
+        g_array_append_val (client->latencies, latency);
+    }
+    client->end = g_get_monotonic_time ();
+
+    return NULL;
+}
+static void
+bench_report (FILE *out,
+              bench_client_t *clients,
+              gint64 elapsed)
+{
+    GArray *all = g_array_new (FALSE, FALSE, sizeof (guint64));
+    guint64 commands = 0;
+    guint errors = 0;
+    double seconds = (double)elapsed / G_USEC_PER_SEC;
+    gint i;
+
+    for (i = 0; i < bench_opts.clients; ++i) {
+        g_array_append_vals (all,
+                             clients [i].latencies->data,
+                             clients [i].latencies->len);
+        commands += clients [i].commands;
+        if (clients [i].rc != TSS2_RC_SUCCESS) {
+            ++errors;
+        }
+    }
+    bench_latency_sort (all);
+    fprintf (out,
+             "{\n"
+             "  \"mix\": \"%s\",\n"
+             "  \"clients\": %d,\n"
+             "  \"elapsed_seconds\": %.6f,\n"
+             "  \"operations\": %u,\n"
+             "  \"commands\": %" PRIu64 ",\n"
+             "  \"errors\": %u,\n"
+             "  \"throughput\": {\n"
+             "    \"operations_per_second\": %.2f,\n"
+             "    \"commands_per_second\": %.2f\n"
+             "  },\n",
+             bench_mix->name,
+             bench_opts.clients,
+             seconds,
+             all->len,
+             commands,
+             errors,
+             seconds > 0 ? all->len / seconds : 0.0,
+             seconds > 0 ? commands / seconds : 0.0);
+    bench_latency_print (out, "latency_usec", all, TRUE);
+    fprintf (out, "}\n");
+    g_array_free (all, TRUE);
+}
+static gboolean
+bench_parse_opts (gint argc,
+                  gchar *argv[])
+{
+    GOptionContext *ctx;
+    GError *error = NULL;
+    GString *mixes;
+    gboolean ret;
+    size_t i;
+
+    GOptionEntry entries[] = {
+        {
+            .long_name       = "clients",
+            .short_name      = 'c',
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_INT,
+            .arg_data        = &bench_opts.clients,
+            .description     = "Number of concurrent client connections.",
+            .arg_description = "N",
+        },
+        {
+            .long_name       = "mix",
+            .short_name      = 'm',
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_STRING,
+            .arg_data        = &bench_opts.mix,
+            .description     = "Command mix run by each client.",
+            .arg_description = "[getrandom|sign|policy|gap]",
+        },
+        {
+            .long_name       = "duration",
+            .short_name      = 'd',
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_INT,
+            .arg_data        = &bench_opts.duration,
+            .description     = "Seconds to run for, ignored with --iterations.",
+            .arg_description = "SECONDS",
+        },
+        {
+            .long_name       = "iterations",
+            .short_name      = 'i',
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_INT,
+            .arg_data        = &bench_opts.iterations,
+            .description     = "Operations run by each client.",
+            .arg_description = "N",
+        },
+        {
+            .long_name       = "tcti-conf",
+            .short_name      = 't',
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_STRING,
+            .arg_data        = &bench_opts.tcti_conf,
+            .description     = "Configuration string for the tabrmd TCTI.",
+            .arg_description = "conf",
+        },
+        {
+            .long_name       = "output",
+            .short_name      = 'o',
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_FILENAME,
+            .arg_data        = &bench_opts.output,
+            .description     = "Write the JSON report to this file.",
+            .arg_description = "file",
+        },
+        { NULL, '\0', 0, 0, NULL, NULL, NULL },
+    };
+
+    mixes = g_string_new ("Command mixes:\n");
+    for (i = 0; i < G_N_ELEMENTS (bench_mixes); ++i) {
+        g_string_append_printf (mixes, "  %-10s %s\n",
+                                bench_mixes [i].name,
+                                bench_mixes [i].description);
+    }
+    ctx = g_option_context_new (" - tabrmd load generator");
+    g_option_context_add_main_entries (ctx, entries, NULL);
+    g_option_context_set_description (ctx, mixes->str);
+    ret = g_option_context_parse (ctx, &argc, &argv, &error);
+    g_option_context_free (ctx);
+    g_string_free (mixes, TRUE);
+    if (!ret) {
+        g_critical ("Failed to parse options: %s", error->message);
+        g_clear_error (&error);
+        return FALSE;
+    }
+    if (bench_opts.mix == NULL) {
+        bench_opts.mix = g_strdup (BENCH_MIX_DEFAULT);
+    }
+    if (bench_opts.tcti_conf == NULL) {
+        bench_opts.tcti_conf = g_strdup (g_getenv (ENV_TCTI_CONF));
+    }
+    bench_mix = bench_mix_lookup (bench_opts.mix);
+    if (bench_mix == NULL) {
+        g_critical ("Unknown mix: %s, try --help", bench_opts.mix);
+        return FALSE;
+    }
+    if (bench_opts.clients < 1 || bench_opts.clients > BENCH_CLIENTS_MAX) {
+        g_critical ("clients must be between 1 and %d", BENCH_CLIENTS_MAX);
+        return FALSE;
+    }
+    if (bench_opts.iterations < 0 ||
+        (bench_opts.iterations == 0 && bench_opts.duration < 1))
+    {
+        g_critical ("duration or iterations must be positive");
+        return FALSE;
+    }
+    return TRUE;
+}
+/*
+ * Set up every client before starting the clock so that connection setup
+ * and key creation aren't part of the measurement. The clients are then
+ * started together and run until the duration expires or they've all
+ * done their iterations.
+ */
+int
+main (int argc,
+      char *argv[])
+{
+    bench_client_t *clients;
+    FILE *out = stdout;
+    gint64 start, end = 0;
+    gint i, ret = 0;
+
+    if (!bench_parse_opts (argc, argv)) {
+        return 2;
+    }
+    if (bench_opts.output != NULL) {
+        out = fopen (bench_opts.output, "w");
+        if (out == NULL) {
+            g_critical ("failed to open %s: %s",
+                        bench_opts.output, strerror (errno));
+            return 1;
+        }
+    }
+    clients = g_new0 (bench_client_t, bench_opts.clients);
+    for (i = 0; i < bench_opts.clients; ++i) {
+        clients [i].id = (guint)i;
+        if (bench_client_init (&clients [i], bench_opts.tcti_conf) != 0) {
+            ret = 1;
+            goto out;
+        }
+        if (bench_mix->setup != NULL) {
+            clients [i].rc = bench_mix->setup (&clients [i]);
+            if (clients [i].rc != TSS2_RC_SUCCESS) {
+                g_critical ("client %d: setup for mix \"%s\" failed: 0x%"
+                            PRIx32, i, bench_mix->name, clients [i].rc);
+                ret = 1;
+                goto out;
+            }
+        }
+        clients [i].commands = 0;
+    }
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < bench_opts.clients; ++i) {
+        clients [i].thread = g_thread_new ("bench-client",
+                                           bench_client_thread,
+                                           &clients [i]);
+    }
+    if (bench_opts.iterations == 0) {
+        g_usleep ((gulong)bench_opts.duration * G_USEC_PER_SEC);
+        g_atomic_int_set (&bench_stop, 1);
+    }
+    for (i = 0; i < bench_opts.clients; ++i) {
+        g_thread_join (clients [i].thread);
+        end = MAX (end, clients [i].end);
+        if (clients [i].rc != TSS2_RC_SUCCESS) {
+            ret = 1;
+        }
+    }
+    bench_report (out, clients, end - start);
+    for (i = 0; i < bench_opts.clients; ++i) {
+        if (bench_mix->teardown != NULL) {
+            bench_mix->teardown (&clients [i]);
+        }
+    }
+
+out:
+    for (i = 0; i < bench_opts.clients; ++i) {
+        bench_client_free (&clients [i]);
+    }
+    g_free (clients);
+    if (out != stdout) {
+        fclose (out);
+    }
+    g_free (bench_opts.mix);
+    g_free (bench_opts.tcti_conf);
+    g_free (bench_opts.output);
+
+    return ret;
+}
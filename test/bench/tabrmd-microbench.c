@@ -0,0 +1,769 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Microbenchmarks for the data structures and parsers on the command
+ * processing path. Each benchmark is a cmocka test: the setup function
+ * builds the fixture, the test checks the code under test does what's
+ * expected once and then times a tight loop around it. Results are written
+ * as JSON to the file named on the command line (stdout by default).
+ *
+ * The number of iterations per benchmark can be set through the
+ * TABRMD_MICROBENCH_ITERATIONS environment variable. Debug logging is
+ * always disabled, as it is in production.
+ */
+#include <fcntl.h>
+#include <gio/gio.h>
+#include <glib.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "command-attrs.h"
+#include "connection.h"
+#include "handle-map.h"
+#include "logging.h"
+#include "mock-io-stream.h"
+#include "resource-manager.h"
+#include "response-sink.h"
+#include "session-entry.h"
+#include "session-list.h"
+#include "sink-interface.h"
+#include "tpm2-command.h"
+#include "tpm2-response.h"
+#include "util.h"
+
+#define ENV_ITERATIONS "TABRMD_MICROBENCH_ITERATIONS"
+#define ITERATIONS_DEFAULT 100000
+/* size of the fake context blobs held by each session */
+#define CONTEXT_CLIENT_SIZE 512
+
+typedef struct {
+    const char *name;
+    guint64     iterations;
+    gint64      usec;
+    gint64      switches;
+} bench_result_t;
+
+typedef struct {
+    HandleMap      *map;
+    HandleMapEntry *entries [MAX_ENTRIES_DEFAULT];
+    SessionList    *session_list;
+    Connection     *connection;
+    CommandAttrs   *command_attrs;
+    Tpm2Command    *command;
+    GIOStream      *iostream;
+    ResponseSink   *sink;
+    gint            client_fd;
+    guint8          context [SESSION_LIST_MAX_ENTRIES_MAX]
+                            [CONTEXT_CLIENT_SIZE];
+} bench_data_t;
+
+static GArray *bench_results;
+static guint64 bench_iterations = ITERATIONS_DEFAULT;
+
+/*
+ * TPM2_PolicySecret with two handles in the handle area and three sessions
+ * in the auth area.
+ */
+static guint8 policy_secret_cmd [] = {
+    0x80, 0x02, /* TPM2_ST_SESSIONS */
+    0x00, 0x00, 0x00, 0x3b, /* size: 59 */
+    0x00, 0x00, 0x01, 0x51, /* TPM2_CC_PolicySecret */
+    0x80, 0x00, 0x00, 0x00, /* authHandle */
+    0x03, 0x00, 0x00, 0x00, /* policySession */
+    0x00, 0x00, 0x00, 0x1b, /* auth area size: 27 */
+    0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00,
+    0x02, 0x00, 0x00, 0x01, 0x00, 0x00, 0x01, 0x00, 0x00,
+    0x02, 0x00, 0x00, 0x02, 0x00, 0x00, 0x01, 0x00, 0x00,
+    0x00, 0x00, /* nonceTPM */
+    0x00, 0x00, /* cpHashA */
+    0x00, 0x00, /* policyRef */
+    0x00, 0x00, 0x00, 0x00, /* expiration */
+};
+#define POLICY_SECRET_ATTRS \
+    ((TPMA_CC)((2 << TPMA_CC_CHANDLES_SHIFT) | TPM2_CC_PolicySecret))
+
+/*
+ * Record a result. 'switches' is the number of context switches over the
+ * timed loop or -1 if it wasn't measured.
+ */
+static void
+bench_record_switches (const char *name,
+                       gint64 usec,
+                       gint64 switches)
+{
+    bench_result_t result = {
+        .name       = name,
+        .iterations = bench_iterations,
+        .usec       = usec,
+        .switches   = switches,
+    };
+
+    g_array_append_val (bench_results, result);
+}
+static void
+bench_record (const char *name,
+              gint64 usec)
+{
+    bench_record_switches (name, usec, -1);
+}
+/* voluntary and involuntary context switches of all threads so far */
+static gint64
+bench_switches (void)
+{
+    struct rusage usage;
+
+    getrusage (RUSAGE_SELF, &usage);
+    return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+static void
+bench_report (FILE *out)
+{
+    bench_result_t *result;
+    double ns;
+    guint i;
+
+    fprintf (out, "{\n  \"benchmarks\": [\n");
+    for (i = 0; i < bench_results->len; ++i) {
+        result = &g_array_index (bench_results, bench_result_t, i);
+        ns = (double)result->usec * 1000.0 / (double)result->iterations;
+        fprintf (out,
+                 "    {\n"
+                 "      \"name\": \"%s\",\n"
+                 "      \"iterations\": %" PRIu64 ",\n"
+                 "      \"ns_per_op\": %.1f,\n"
+                 "      \"ops_per_second\": %.0f",
+                 result->name,
+                 result->iterations,
+                 ns,
+                 ns > 0 ? 1e9 / ns : 0.0);
+        if (result->switches >= 0) {
+            fprintf (out,
+                     ",\n      \"context_switches_per_op\": %.2f",
+                     (double)result->switches / (double)result->iterations);
+        }
+        fprintf (out, "\n    }%s\n", i + 1 < bench_results->len ? "," : "");
+    }
+    fprintf (out, "  ]\n}\n");
+}
+static Connection*
+bench_connection_new (void)
+{
+    GInputStream *istream;
+    GOutputStream *ostream;
+    GIOStream *iostream;
+    HandleMap *map;
+    Connection *connection;
+
+    istream = g_memory_input_stream_new ();
+    ostream = g_memory_output_stream_new_resizable ();
+    iostream = mock_io_stream_new (istream, ostream);
+    map = handle_map_new (TPM2_HT_TRANSIENT, MAX_ENTRIES_DEFAULT);
+    connection = connection_new (iostream, 1, map);
+    g_object_unref (istream);
+    g_object_unref (ostream);
+    g_object_unref (iostream);
+    g_object_unref (map);
+
+    return connection;
+}
+/*
+ * A HandleMap filled to the per-connection default with entries mapping
+ * vhandle N to phandle N.
+ */
+static int
+handle_map_setup (void **state)
+{
+    bench_data_t *data = g_new0 (bench_data_t, 1);
+    TPM2_HANDLE handle;
+    size_t i;
+
+    data->map = handle_map_new (TPM2_HT_TRANSIENT, MAX_ENTRIES_DEFAULT);
+    for (i = 0; i < MAX_ENTRIES_DEFAULT; ++i) {
+        handle = TPM2_TRANSIENT_FIRST + (TPM2_HANDLE)i;
+        data->entries [i] = handle_map_entry_new (handle, handle);
+    }
+    *state = data;
+    return 0;
+}
+static int
+handle_map_setup_full (void **state)
+{
+    bench_data_t *data;
+    size_t i;
+
+    handle_map_setup (state);
+    data = *state;
+    for (i = 0; i < MAX_ENTRIES_DEFAULT; ++i) {
+        handle_map_insert (data->map,
+                           TPM2_TRANSIENT_FIRST + (TPM2_HANDLE)i,
+                           data->entries [i]);
+    }
+    return 0;
+}
+static int
+handle_map_teardown (void **state)
+{
+    bench_data_t *data = *state;
+    size_t i;
+
+    for (i = 0; i < MAX_ENTRIES_DEFAULT; ++i) {
+        g_clear_object (&data->entries [i]);
+    }
+    g_clear_object (&data->map);
+    g_free (data);
+    return 0;
+}
+/*
+ * Insert an entry and remove it again: the map is the same size at the
+ * start of each iteration.
+ */
+static void
+handle_map_insert_bench (void **state)
+{
+    bench_data_t *data = *state;
+    TPM2_HANDLE vhandle = TPM2_TRANSIENT_FIRST;
+    gint64 start;
+    guint64 i;
+
+    assert_true (handle_map_insert (data->map, vhandle, data->entries [0]));
+    assert_true (handle_map_remove (data->map, vhandle));
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < bench_iterations; ++i) {
+        handle_map_insert (data->map, vhandle, data->entries [0]);
+        handle_map_remove (data->map, vhandle);
+    }
+    bench_record ("handle_map_insert_remove", g_get_monotonic_time () - start);
+}
+static void
+handle_map_vlookup_bench (void **state)
+{
+    bench_data_t *data = *state;
+    HandleMapEntry *entry;
+    gint64 start;
+    guint64 i;
+
+    entry = handle_map_vlookup (data->map, TPM2_TRANSIENT_FIRST);
+    assert_ptr_equal (entry, data->entries [0]);
+    g_object_unref (entry);
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < bench_iterations; ++i) {
+        entry = handle_map_vlookup (data->map, TPM2_TRANSIENT_FIRST +
+                                    (TPM2_HANDLE)(i % MAX_ENTRIES_DEFAULT));
+        g_object_unref (entry);
+    }
+    bench_record ("handle_map_vlookup", g_get_monotonic_time () - start);
+}
+/*
+ * get_cap_handles over a full HandleMap: this is what the RM does for each
+ * TPM2_GetCapability command asking for transient handles.
+ */
+static void
+get_cap_handles_bench (void **state)
+{
+    bench_data_t *data = *state;
+    TPMS_CAPABILITY_DATA cap_data;
+    gint64 start;
+    guint64 i;
+
+    assert_false (get_cap_handles (data->map,
+                                   TPM2_TRANSIENT_FIRST,
+                                   TPM2_MAX_CAP_HANDLES,
+                                   &cap_data));
+    assert_int_equal (cap_data.data.handles.count, MAX_ENTRIES_DEFAULT);
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < bench_iterations; ++i) {
+        get_cap_handles (data->map,
+                         TPM2_TRANSIENT_FIRST,
+                         TPM2_MAX_CAP_HANDLES,
+                         &cap_data);
+    }
+    bench_record ("get_cap_handles", g_get_monotonic_time () - start);
+}
+/*
+ * A SessionList holding the maximum number of sessions for one connection.
+ * Each session has a client context blob that differs from the others
+ * only in its last bytes, the worst case for the context comparison.
+ */
+static int
+session_list_setup (void **state)
+{
+    bench_data_t *data = g_new0 (bench_data_t, 1);
+    SessionEntry *entry;
+    size_buf_t *context_client;
+    size_t i;
+
+    data->connection = bench_connection_new ();
+    data->session_list = session_list_new (SESSION_LIST_MAX_ENTRIES_MAX,
+                                           SESSION_LIST_MAX_ABANDONED_DEFAULT);
+    for (i = 0; i < SESSION_LIST_MAX_ENTRIES_MAX; ++i) {
+        entry = session_entry_new (data->connection,
+                                   TPM2_HMAC_SESSION_FIRST + (TPM2_HANDLE)i);
+        memset (data->context [i], 0xa5, CONTEXT_CLIENT_SIZE);
+        memcpy (&data->context [i][CONTEXT_CLIENT_SIZE - sizeof (i)],
+                &i,
+                sizeof (i));
+        context_client = session_entry_get_context_client (entry);
+        memcpy (context_client->buf, data->context [i], CONTEXT_CLIENT_SIZE);
+        context_client->size = CONTEXT_CLIENT_SIZE;
+        session_list_insert (data->session_list, entry);
+        g_object_unref (entry);
+    }
+    *state = data;
+    return 0;
+}
+static int
+session_list_teardown (void **state)
+{
+    bench_data_t *data = *state;
+
+    g_clear_object (&data->session_list);
+    g_clear_object (&data->connection);
+    g_free (data);
+    return 0;
+}
+static void
+session_list_lookup_handle_bench (void **state)
+{
+    bench_data_t *data = *state;
+    SessionEntry *entry;
+    gint64 start;
+    guint64 i;
+
+    entry = session_list_lookup_handle (data->session_list,
+                                        TPM2_HMAC_SESSION_FIRST + 1);
+    assert_non_null (entry);
+    assert_int_equal (session_entry_get_handle (entry),
+                      TPM2_HMAC_SESSION_FIRST + 1);
+    g_object_unref (entry);
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < bench_iterations; ++i) {
+        entry = session_list_lookup_handle (data->session_list,
+            TPM2_HMAC_SESSION_FIRST +
+            (TPM2_HANDLE)(i % SESSION_LIST_MAX_ENTRIES_MAX));
+        g_object_unref (entry);
+    }
+    bench_record ("session_list_lookup_handle",
+                  g_get_monotonic_time () - start);
+}
+static void
+session_list_lookup_context_client_bench (void **state)
+{
+    bench_data_t *data = *state;
+    SessionEntry *entry;
+    gint64 start;
+    guint64 i;
+
+    entry = session_list_lookup_context_client (data->session_list,
+                                                data->context [1],
+                                                CONTEXT_CLIENT_SIZE);
+    assert_non_null (entry);
+    assert_int_equal (session_entry_get_handle (entry),
+                      TPM2_HMAC_SESSION_FIRST + 1);
+    g_object_unref (entry);
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < bench_iterations; ++i) {
+        entry = session_list_lookup_context_client (data->session_list,
+            data->context [i % SESSION_LIST_MAX_ENTRIES_MAX],
+            CONTEXT_CLIENT_SIZE);
+        g_object_unref (entry);
+    }
+    bench_record ("session_list_lookup_context_client",
+                  g_get_monotonic_time () - start);
+}
+/*
+ * CommandAttrs populated with every command code from the spec, as it
+ * would be after command_attrs_init_tpm against a TPM implementing them
+ * all.
+ */
+static int
+command_attrs_setup (void **state)
+{
+    bench_data_t *data = g_new0 (bench_data_t, 1);
+    UINT32 i;
+
+    data->command_attrs = command_attrs_new ();
+    data->command_attrs->count = TPM2_CC_LAST - TPM2_CC_FIRST + 1;
+    data->command_attrs->command_attrs =
+        g_new0 (TPMA_CC, data->command_attrs->count);
+    for (i = 0; i < data->command_attrs->count; ++i) {
+        data->command_attrs->command_attrs [i] = TPM2_CC_FIRST + i;
+    }
+    *state = data;
+    return 0;
+}
+static int
+command_attrs_teardown (void **state)
+{
+    bench_data_t *data = *state;
+
+    g_clear_object (&data->command_attrs);
+    g_free (data);
+    return 0;
+}
+static void
+command_attrs_from_cc_bench (void **state)
+{
+    bench_data_t *data = *state;
+    UINT32 count = data->command_attrs->count;
+    gint64 start;
+    guint64 i;
+
+    assert_int_equal (command_attrs_from_cc (data->command_attrs,
+                                             TPM2_CC_GetRandom),
+                      TPM2_CC_GetRandom);
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < bench_iterations; ++i) {
+        command_attrs_from_cc (data->command_attrs,
+                               TPM2_CC_FIRST + (TPM2_CC)(i % count));
+    }
+    bench_record ("command_attrs_from_cc", g_get_monotonic_time () - start);
+}
+static int
+tpm2_command_setup (void **state)
+{
+    bench_data_t *data = g_new0 (bench_data_t, 1);
+    guint8 *buffer = g_malloc (sizeof (policy_secret_cmd));
+
+    memcpy (buffer, policy_secret_cmd, sizeof (policy_secret_cmd));
+    data->command = tpm2_command_new (NULL,
+                                      buffer,
+                                      sizeof (policy_secret_cmd),
+                                      POLICY_SECRET_ATTRS);
+    *state = data;
+    return 0;
+}
+static int
+tpm2_command_teardown (void **state)
+{
+    bench_data_t *data = *state;
+
+    g_clear_object (&data->command);
+    g_free (data);
+    return 0;
+}
+static void
+tpm2_command_get_handles_bench (void **state)
+{
+    bench_data_t *data = *state;
+    TPM2_HANDLE handles [TPM2_COMMAND_MAX_HANDLES];
+    size_t count = TPM2_COMMAND_MAX_HANDLES;
+    gint64 start;
+    guint64 i;
+
+    assert_true (tpm2_command_get_handles (data->command, handles, &count));
+    assert_int_equal (count, 2);
+    assert_int_equal (handles [1], 0x03000000);
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < bench_iterations; ++i) {
+        count = TPM2_COMMAND_MAX_HANDLES;
+        tpm2_command_get_handles (data->command, handles, &count);
+    }
+    bench_record ("tpm2_command_get_handles", g_get_monotonic_time () - start);
+}
+static void
+count_auth_callback (gpointer auth_offset,
+                     gpointer user_data)
+{
+    UNUSED_PARAM (auth_offset);
+    ++*(guint*)user_data;
+}
+static void
+tpm2_command_foreach_auth_bench (void **state)
+{
+    bench_data_t *data = *state;
+    guint count = 0;
+    gint64 start;
+    guint64 i;
+
+    assert_true (tpm2_command_foreach_auth (data->command,
+                                            count_auth_callback,
+                                            &count));
+    assert_int_equal (count, 3);
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < bench_iterations; ++i) {
+        tpm2_command_foreach_auth (data->command, count_auth_callback, &count);
+    }
+    bench_record ("tpm2_command_foreach_auth",
+                  g_get_monotonic_time () - start);
+}
+/*
+ * Log a command the way the ResourceManager's dump_command did before the
+ * tabrmd_debug macros: every byte is formatted and the message handed to
+ * glib, which then drops it.
+ */
+static void
+log_dump_command_glib_bench (void **state)
+{
+    bench_data_t *data = *state;
+    gint64 start;
+    guint64 i;
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < bench_iterations; ++i) {
+        g_debug ("Tpm2Command");
+        g_debug_bytes (tpm2_command_get_buffer (data->command),
+                       tpm2_command_get_size (data->command),
+                       16,
+                       4);
+        g_debug_tpma_cc (tpm2_command_get_attributes (data->command));
+    }
+    bench_record ("log_dump_command_glib", g_get_monotonic_time () - start);
+}
+/*
+ * The same with the level gated macros. The difference between the two is
+ * the CPU saved for each command and response dumped.
+ */
+static void
+log_dump_command_gated_bench (void **state)
+{
+    bench_data_t *data = *state;
+    gint64 start;
+    guint64 i;
+
+    assert_false (tabrmd_log_enabled (G_LOG_LEVEL_DEBUG));
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < bench_iterations; ++i) {
+        tabrmd_debug ("Tpm2Command");
+        tabrmd_debug_bytes (tpm2_command_get_buffer (data->command),
+                            tpm2_command_get_size (data->command),
+                            16,
+                            4);
+        tabrmd_debug_tpma_cc (tpm2_command_get_attributes (data->command));
+    }
+    bench_record ("log_dump_command_gated", g_get_monotonic_time () - start);
+}
+/*
+ * A MockIOStream over an in-memory input stream holding a single command.
+ * The stream is rewound before each read.
+ */
+static int
+read_tpm_buffer_setup (void **state)
+{
+    bench_data_t *data = g_new0 (bench_data_t, 1);
+    GInputStream *istream;
+    GOutputStream *ostream;
+
+    istream = g_memory_input_stream_new_from_data (policy_secret_cmd,
+                                                   sizeof (policy_secret_cmd),
+                                                   NULL);
+    ostream = g_memory_output_stream_new_resizable ();
+    data->iostream = mock_io_stream_new (istream, ostream);
+    g_object_unref (istream);
+    g_object_unref (ostream);
+    *state = data;
+    return 0;
+}
+static int
+read_tpm_buffer_teardown (void **state)
+{
+    bench_data_t *data = *state;
+
+    g_clear_object (&data->iostream);
+    g_free (data);
+    return 0;
+}
+static void
+read_tpm_buffer_alloc_bench (void **state)
+{
+    bench_data_t *data = *state;
+    GInputStream *istream = g_io_stream_get_input_stream (data->iostream);
+    uint8_t *buf;
+    size_t size = 0;
+    gint64 start;
+    guint64 i;
+
+    buf = read_tpm_buffer_alloc (istream, &size);
+    assert_non_null (buf);
+    assert_int_equal (size, sizeof (policy_secret_cmd));
+    assert_memory_equal (buf, policy_secret_cmd, size);
+    g_free (buf);
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < bench_iterations; ++i) {
+        g_seekable_seek (G_SEEKABLE (istream), 0, G_SEEK_SET, NULL, NULL);
+        buf = read_tpm_buffer_alloc (istream, &size);
+        g_free (buf);
+    }
+    bench_record ("read_tpm_buffer_alloc", g_get_monotonic_time () - start);
+}
+/*
+ * A ResponseSink writing to one end of a socket pair, the benchmark reads
+ * each response from the other end like a client would. 'queued' hands
+ * responses to the ResponseSink thread, 'direct' writes them from the
+ * benchmark thread as the ResourceManager does with --direct-response.
+ */
+static int
+response_sink_setup (void **state,
+                     gboolean direct)
+{
+    bench_data_t *data = g_new0 (bench_data_t, 1);
+    HandleMap *map;
+
+    data->iostream = create_connection_iostream (&data->client_fd);
+    fcntl (data->client_fd, F_SETFL,
+           fcntl (data->client_fd, F_GETFL) & ~O_NONBLOCK);
+    map = handle_map_new (TPM2_HT_TRANSIENT, MAX_ENTRIES_DEFAULT);
+    data->connection = connection_new (data->iostream, 1, map);
+    g_object_unref (map);
+    data->sink = response_sink_new (direct);
+    if (!direct && thread_start (THREAD (data->sink)) != 0) {
+        return -1;
+    }
+    *state = data;
+    return 0;
+}
+static int
+response_sink_queued_setup (void **state)
+{
+    return response_sink_setup (state, FALSE);
+}
+static int
+response_sink_direct_setup (void **state)
+{
+    return response_sink_setup (state, TRUE);
+}
+static int
+response_sink_teardown (void **state)
+{
+    bench_data_t *data = *state;
+
+    if (!data->sink->direct) {
+        thread_cancel (THREAD (data->sink));
+        thread_join (THREAD (data->sink));
+    }
+    g_clear_object (&data->sink);
+    g_clear_object (&data->connection);
+    g_clear_object (&data->iostream);
+    close (data->client_fd);
+    g_free (data);
+    return 0;
+}
+static void
+response_sink_bench (bench_data_t *data,
+                     const char *name)
+{
+    guint8 buf_out [TPM_RESPONSE_HEADER_SIZE];
+    Tpm2Response *response;
+    guint8 *buf;
+    gint64 start, switches;
+    guint64 i;
+
+    switches = bench_switches ();
+    start = g_get_monotonic_time ();
+    for (i = 0; i < bench_iterations; ++i) {
+        buf = g_malloc0 (TPM_RESPONSE_HEADER_SIZE);
+        tpm2_header_init (buf, TPM_RESPONSE_HEADER_SIZE, TPM2_ST_NO_SESSIONS,
+                          TPM_RESPONSE_HEADER_SIZE, TPM2_RC_SUCCESS);
+        response = tpm2_response_new (data->connection,
+                                      buf,
+                                      TPM_RESPONSE_HEADER_SIZE,
+                                      (TPMA_CC){ 0 });
+        sink_enqueue (SINK (data->sink), G_OBJECT (response));
+        g_object_unref (response);
+        assert_int_equal (read (data->client_fd, buf_out, sizeof (buf_out)),
+                          sizeof (buf_out));
+    }
+    bench_record_switches (name,
+                           g_get_monotonic_time () - start,
+                           bench_switches () - switches);
+}
+static void
+response_sink_queued_bench (void **state)
+{
+    response_sink_bench (*state, "response_sink_queued");
+}
+static void
+response_sink_direct_bench (void **state)
+{
+    response_sink_bench (*state, "response_sink_direct");
+}
+gint
+main (gint argc,
+      gchar *argv[])
+{
+    const gchar *env;
+    FILE *out = stdout;
+    gint ret;
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown (handle_map_insert_bench,
+                                         handle_map_setup,
+                                         handle_map_teardown),
+        cmocka_unit_test_setup_teardown (handle_map_vlookup_bench,
+                                         handle_map_setup_full,
+                                         handle_map_teardown),
+        cmocka_unit_test_setup_teardown (get_cap_handles_bench,
+                                         handle_map_setup_full,
+                                         handle_map_teardown),
+        cmocka_unit_test_setup_teardown (session_list_lookup_handle_bench,
+                                         session_list_setup,
+                                         session_list_teardown),
+        cmocka_unit_test_setup_teardown (session_list_lookup_context_client_bench,
+                                         session_list_setup,
+                                         session_list_teardown),
+        cmocka_unit_test_setup_teardown (command_attrs_from_cc_bench,
+                                         command_attrs_setup,
+                                         command_attrs_teardown),
+        cmocka_unit_test_setup_teardown (tpm2_command_get_handles_bench,
+                                         tpm2_command_setup,
+                                         tpm2_command_teardown),
+        cmocka_unit_test_setup_teardown (tpm2_command_foreach_auth_bench,
+                                         tpm2_command_setup,
+                                         tpm2_command_teardown),
+        cmocka_unit_test_setup_teardown (read_tpm_buffer_alloc_bench,
+                                         read_tpm_buffer_setup,
+                                         read_tpm_buffer_teardown),
+        cmocka_unit_test_setup_teardown (log_dump_command_glib_bench,
+                                         tpm2_command_setup,
+                                         tpm2_command_teardown),
+        cmocka_unit_test_setup_teardown (log_dump_command_gated_bench,
+                                         tpm2_command_setup,
+                                         tpm2_command_teardown),
+        cmocka_unit_test_setup_teardown (response_sink_queued_bench,
+                                         response_sink_queued_setup,
+                                         response_sink_teardown),
+        cmocka_unit_test_setup_teardown (response_sink_direct_bench,
+                                         response_sink_direct_setup,
+                                         response_sink_teardown),
+    };
+
+    env = g_getenv (ENV_ITERATIONS);
+    if (env != NULL) {
+        bench_iterations = g_ascii_strtoull (env, NULL, 10);
+        if (bench_iterations == 0) {
+            g_critical ("%s must be a positive integer", ENV_ITERATIONS);
+            return 1;
+        }
+    }
+    if (argc > 1 && strcmp (argv [1], "-") != 0) {
+        out = fopen (argv [1], "w");
+        if (out == NULL) {
+            g_critical ("failed to open %s", argv [1]);
+            return 1;
+        }
+    }
+    g_unsetenv ("G_MESSAGES_DEBUG");
+    bench_results = g_array_new (FALSE, FALSE, sizeof (bench_result_t));
+    ret = cmocka_run_group_tests (tests, NULL, NULL);
+    bench_report (out);
+    g_array_free (bench_results, TRUE);
+    if (out != stdout) {
+        fclose (out);
+    }
+
+    return ret;
+}
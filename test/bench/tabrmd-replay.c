@@ -0,0 +1,541 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * tabrmd-replay: re-drive the connections recorded by the daemon's
+ * --capture-file against a running daemon. Each captured connection gets
+ * its own TCTI connection and sends its commands in the captured order,
+ * either at the captured times relative to the start of the replay or as
+ * fast as the daemon will take them (--fast). Throughput and latency are
+ * reported as JSON alongside the latency seen when the trace was captured
+ * so broker changes can be compared on the same workload.
+ *
+ * Commands are replayed byte for byte. Those that depend on state the
+ * replay can't reproduce (session nonces, HMACs, objects created outside
+ * the trace) get a different response code than was captured and are
+ * counted as 'rc_mismatches' rather than treated as errors.
+ */
+#include <errno.h>
+#include <glib.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tss2/tss2_tcti.h>
+
+#include "bench-latency.h"
+#include "tabrmd-capture.h"
+#include "tss2-tcti-tabrmd.h"
+
+/* work around older glib versions missing this symbol */
+#ifndef G_OPTION_FLAG_NONE
+#define G_OPTION_FLAG_NONE 0
+#endif
+
+/* environment variable set by the integration test harness */
+#define ENV_TCTI_CONF "TABRMD_TEST_TCTI_CONF"
+
+#define REPLAY_CONCURRENCY_DEFAULT 64
+#define REPLAY_CONCURRENCY_MAX     1024
+/* offset of the response code in a TPM response header */
+#define REPLAY_RC_OFFSET           6
+
+typedef struct {
+    gchar      *capture;
+    gboolean    fast;
+    gint        concurrency;
+    gchar      *tcti_conf;
+    gchar      *output;
+} replay_opts_t;
+
+/*
+ * A captured command and, if the response was captured too, its response
+ * code and the latency the daemon had at capture time.
+ */
+typedef struct {
+    guint64     time;
+    guint8     *buffer;
+    guint32     size;
+    gboolean    has_response;
+    TSS2_RC     rc;
+    guint64     latency;
+} replay_command_t;
+
+/*
+ * A captured connection. Only the thread replaying it touches the replay
+ * results, the main thread reads them once the thread pool is drained.
+ */
+typedef struct {
+    guint64     id;
+    GArray     *commands;
+    guint       responses;
+    GArray     *latencies;
+    guint64     sent;
+    guint       errors;
+    guint       rc_mismatches;
+} replay_connection_t;
+
+static replay_opts_t replay_opts = {
+    .capture     = NULL,
+    .fast        = FALSE,
+    .concurrency = REPLAY_CONCURRENCY_DEFAULT,
+    .tcti_conf   = NULL,
+    .output      = NULL,
+};
+/* g_get_monotonic_time () when the replay started */
+static gint64 replay_start;
+/* capture time of the first command, replay times are relative to this */
+static guint64 replay_base;
+
+static void
+replay_command_clear (gpointer data)
+{
+    replay_command_t *command = (replay_command_t*)data;
+
+    g_free (command->buffer);
+}
+static void
+replay_connection_free (gpointer data)
+{
+    replay_connection_t *connection = (replay_connection_t*)data;
+
+    g_array_free (connection->commands, TRUE);
+    g_array_free (connection->latencies, TRUE);
+    g_free (connection);
+}
+static TSS2_RC
+replay_response_code (const guint8 *buffer,
+                      gsize size)
+{
+    if (size < REPLAY_RC_OFFSET + sizeof (TSS2_RC)) {
+        return TSS2_TCTI_RC_MALFORMED_RESPONSE;
+    }
+    return (TSS2_RC)buffer [REPLAY_RC_OFFSET] << 24 |
+           (TSS2_RC)buffer [REPLAY_RC_OFFSET + 1] << 16 |
+           (TSS2_RC)buffer [REPLAY_RC_OFFSET + 2] << 8 |
+           (TSS2_RC)buffer [REPLAY_RC_OFFSET + 3];
+}
+/*
+ * Read the capture file into one replay_connection_t per connection id,
+ * in the order of each connection's first command. Responses are matched
+ * to the oldest command on the same connection that's still waiting for
+ * one, the daemon only ever has a single command in flight per connection.
+ */
+static GPtrArray*
+replay_load (const gchar *path,
+             guint64 *duration)
+{
+    tabrmd_capture_header_t header;
+    tabrmd_capture_record_t record;
+    replay_connection_t *connection;
+    replay_command_t command, *pending;
+    GHashTable *table;
+    GPtrArray *connections = NULL;
+    GError *error = NULL;
+    guint8 *buffer;
+    guint64 first = G_MAXUINT64, last = 0;
+    FILE *file;
+    gint ret;
+
+    file = fopen (path, "rb");
+    if (file == NULL) {
+        g_critical ("failed to open %s: %s", path, strerror (errno));
+        return NULL;
+    }
+    if (!tabrmd_capture_read_header (file, &header, &error)) {
+        g_critical ("%s: %s", path, error->message);
+        g_clear_error (&error);
+        fclose (file);
+        return NULL;
+    }
+    table = g_hash_table_new (g_int64_hash, g_int64_equal);
+    connections = g_ptr_array_new_with_free_func (replay_connection_free);
+    while ((ret = tabrmd_capture_read_record (file, &record, &buffer,
+                                              &error)) > 0)
+    {
+        connection = g_hash_table_lookup (table, &record.connection_id);
+        switch (record.type) {
+        case TABRMD_CAPTURE_COMMAND:
+            if (connection == NULL) {
+                connection = g_new0 (replay_connection_t, 1);
+                connection->id = record.connection_id;
+                connection->commands =
+                    g_array_new (FALSE, FALSE, sizeof (replay_command_t));
+                g_array_set_clear_func (connection->commands,
+                                        replay_command_clear);
+                connection->latencies =
+                    g_array_new (FALSE, FALSE, sizeof (guint64));
+                g_hash_table_insert (table, &connection->id, connection);
+                g_ptr_array_add (connections, connection);
+            }
+            first = MIN (first, record.time);
+            command = (replay_command_t) {
+                .time   = record.time,
+                .buffer = buffer,
+                .size   = record.size,
+            };
+            g_array_append_val (connection->commands, command);
+            last = record.time;
+            break;
+        case TABRMD_CAPTURE_RESPONSE:
+            if (connection != NULL &&
+                connection->responses < connection->commands->len)
+            {
+                pending = &g_array_index (connection->commands,
+                                          replay_command_t,
+                                          connection->responses++);
+                pending->has_response = TRUE;
+                pending->rc = replay_response_code (buffer, record.size);
+                pending->latency = record.time - pending->time;
+                last = record.time;
+            }
+            g_free (buffer);
+            break;
+        default:
+            g_warning ("%s: skipping record of unknown type %" PRIu32,
+                       path, record.type);
+            g_free (buffer);
+            break;
+        }
+    }
+    fclose (file);
+    g_hash_table_destroy (table);
+    if (ret < 0) {
+        g_critical ("%s: %s", path, error->message);
+        g_clear_error (&error);
+        g_ptr_array_free (connections, TRUE);
+        return NULL;
+    }
+    if (connections->len == 0) {
+        g_critical ("%s: no commands captured", path);
+        g_ptr_array_free (connections, TRUE);
+        return NULL;
+    }
+    replay_base = first;
+    *duration = last - first;
+    return connections;
+}
+/* Sleep until 'time', a capture time, is due in the replay. */
+static void
+replay_wait (guint64 time)
+{
+    gint64 due = replay_start + (gint64)(time - replay_base);
+    gint64 now = g_get_monotonic_time ();
+
+    if (!replay_opts.fast && due > now) {
+        g_usleep ((gulong)(due - now));
+    }
+}
+static TSS2_TCTI_CONTEXT*
+replay_tcti_init (guint64 id,
+                  const char *conf)
+{
+    TSS2_TCTI_CONTEXT *tcti;
+    TSS2_RC rc;
+    size_t size = 0;
+
+    rc = Tss2_Tcti_Tabrmd_Init (NULL, &size, NULL);
+    if (rc != TSS2_RC_SUCCESS) {
+        g_warning ("connection %" PRIu64 ": failed to get TCTI context "
+                   "size: 0x%" PRIx32, id, rc);
+        return NULL;
+    }
+    tcti = calloc (1, size);
+    if (tcti == NULL) {
+        g_warning ("connection %" PRIu64 ": failed to allocate TCTI "
+                   "context: %s", id, strerror (errno));
+        return NULL;
+    }
+    rc = Tss2_Tcti_Tabrmd_Init (tcti, &size, conf);
+    if (rc != TSS2_RC_SUCCESS) {
+        g_warning ("connection %" PRIu64 ": failed to initialize TCTI: 0x%"
+                   PRIx32, id, rc);
+        free (tcti);
+        return NULL;
+    }
+    return tcti;
+}
+/*
+ * Thread pool function replaying a single connection. The connection is
+ * opened when its first command is due and closed after its last
+ * response, like the client that was captured. A TCTI failure ends the
+ * connection and every command not yet sent counts as an error.
+ */
+static void
+replay_connection_thread (gpointer data,
+                          gpointer user_data)
+{
+    replay_connection_t *connection = (replay_connection_t*)data;
+    replay_command_t *command;
+    TSS2_TCTI_CONTEXT *tcti;
+    TSS2_RC rc;
+    guint8 response [TPM2_MAX_RESPONSE_SIZE];
+    size_t size;
+    gint64 sent;
+    guint64 latency;
+    guint i;
+
+    (void)user_data;
+    tcti = replay_tcti_init (connection->id, replay_opts.tcti_conf);
+    if (tcti == NULL) {
+        connection->errors = connection->commands->len;
+        return;
+    }
+    for (i = 0; i < connection->commands->len; ++i) {
+        command = &g_array_index (connection->commands, replay_command_t, i);
+        replay_wait (command->time);
+        sent = g_get_monotonic_time ();
+        rc = Tss2_Tcti_Transmit (tcti, command->size, command->buffer);
+        if (rc != TSS2_RC_SUCCESS) {
+            g_warning ("connection %" PRIu64 ": transmit failed: 0x%" PRIx32,
+                       connection->id, rc);
+            break;
+        }
+        size = sizeof (response);
+        rc = Tss2_Tcti_Receive (tcti, &size, response,
+                                TSS2_TCTI_TIMEOUT_BLOCK);
+        if (rc != TSS2_RC_SUCCESS) {
+            g_warning ("connection %" PRIu64 ": receive failed: 0x%" PRIx32,
+                       connection->id, rc);
+            break;
+        }
+        latency = (guint64)(g_get_monotonic_time () - sent);
+        g_array_append_val (connection->latencies, latency);
+        connection->sent++;
+        if (command->has_response &&
+            command->rc != replay_response_code (response, size))
+        {
+            connection->rc_mismatches++;
+        }
+    }
+    connection->errors = connection->commands->len - (guint)connection->sent;
+    Tss2_Tcti_Finalize (tcti);
+    free (tcti);
+}
+static void
+replay_report (FILE *out,
+               GPtrArray *connections,
+               gint64 elapsed,
+               guint64 duration)
+{
+    replay_connection_t *connection;
+    replay_command_t *command;
+    GArray *latencies = g_array_new (FALSE, FALSE, sizeof (guint64));
+    GArray *captured = g_array_new (FALSE, FALSE, sizeof (guint64));
+    guint64 commands = 0;
+    guint errors = 0, rc_mismatches = 0, i, j;
+    double seconds = (double)elapsed / G_USEC_PER_SEC;
+    gchar *capture;
+
+    for (i = 0; i < connections->len; ++i) {
+        connection = g_ptr_array_index (connections, i);
+        g_array_append_vals (latencies,
+                             connection->latencies->data,
+                             connection->latencies->len);
+        for (j = 0; j < connection->commands->len; ++j) {
+            command = &g_array_index (connection->commands,
+                                      replay_command_t, j);
+            if (command->has_response) {
+                g_array_append_val (captured, command->latency);
+            }
+        }
+        commands += connection->sent;
+        errors += connection->errors;
+        rc_mismatches += connection->rc_mismatches;
+    }
+    bench_latency_sort (latencies);
+    bench_latency_sort (captured);
+    capture = g_strescape (replay_opts.capture, NULL);
+    fprintf (out,
+             "{\n"
+             "  \"capture\": \"%s\",\n"
+             "  \"mode\": \"%s\",\n"
+             "  \"connections\": %u,\n"
+             "  \"elapsed_seconds\": %.6f,\n"
+             "  \"captured_seconds\": %.6f,\n"
+             "  \"commands\": %" PRIu64 ",\n"
+             "  \"errors\": %u,\n"
+             "  \"rc_mismatches\": %u,\n"
+             "  \"throughput\": {\n"
+             "    \"commands_per_second\": %.2f\n"
+             "  },\n",
+             capture,
+             replay_opts.fast ? "fast" : "timed",
+             connections->len,
+             seconds,
+             (double)duration / G_USEC_PER_SEC,
+             commands,
+             errors,
+             rc_mismatches,
+             seconds > 0 ? commands / seconds : 0.0);
+    bench_latency_print (out, "latency_usec", latencies, FALSE);
+    bench_latency_print (out, "captured_latency_usec", captured, TRUE);
+    fprintf (out, "}\n");
+    g_free (capture);
+    g_array_free (latencies, TRUE);
+    g_array_free (captured, TRUE);
+}
+static gboolean
+replay_parse_opts (gint argc,
+                   gchar *argv[])
+{
+    GOptionContext *ctx;
+    GError *error = NULL;
+    gboolean ret;
+
+    GOptionEntry entries[] = {
+        {
+            .long_name       = "capture",
+            .short_name      = 'f',
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_FILENAME,
+            .arg_data        = &replay_opts.capture,
+            .description     = "Capture file written by tabrmd --capture-file.",
+            .arg_description = "file",
+        },
+        {
+            .long_name       = "fast",
+            .short_name      = 'F',
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_NONE,
+            .arg_data        = &replay_opts.fast,
+            .description     = "Send commands as fast as possible instead of "
+                               "at their captured times.",
+            .arg_description = NULL,
+        },
+        {
+            .long_name       = "concurrency",
+            .short_name      = 'c',
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_INT,
+            .arg_data        = &replay_opts.concurrency,
+            .description     = "Maximum number of connections replayed at "
+                               "once.",
+            .arg_description = "N",
+        },
+        {
+            .long_name       = "tcti-conf",
+            .short_name      = 't',
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_STRING,
+            .arg_data        = &replay_opts.tcti_conf,
+            .description     = "Configuration string for the tabrmd TCTI.",
+            .arg_description = "conf",
+        },
+        {
+            .long_name       = "output",
+            .short_name      = 'o',
+            .flags           = G_OPTION_FLAG_NONE,
+            .arg             = G_OPTION_ARG_FILENAME,
+            .arg_data        = &replay_opts.output,
+            .description     = "Write the JSON report to this file.",
+            .arg_description = "file",
+        },
+        { NULL, '\0', 0, 0, NULL, NULL, NULL },
+    };
+
+    ctx = g_option_context_new (" - replay a tabrmd capture file");
+    g_option_context_add_main_entries (ctx, entries, NULL);
+    ret = g_option_context_parse (ctx, &argc, &argv, &error);
+    g_option_context_free (ctx);
+    if (!ret) {
+        g_critical ("Failed to parse options: %s", error->message);
+        g_clear_error (&error);
+        return FALSE;
+    }
+    if (replay_opts.capture == NULL) {
+        g_critical ("a capture file is required, try --help");
+        return FALSE;
+    }
+    if (replay_opts.tcti_conf == NULL) {
+        replay_opts.tcti_conf = g_strdup (g_getenv (ENV_TCTI_CONF));
+    }
+    if (replay_opts.concurrency < 1 ||
+        replay_opts.concurrency > REPLAY_CONCURRENCY_MAX)
+    {
+        g_critical ("concurrency must be between 1 and %d",
+                    REPLAY_CONCURRENCY_MAX);
+        return FALSE;
+    }
+    return TRUE;
+}
+/*
+ * Connections are handed to the thread pool in the order they were first
+ * seen, in timed mode each one once its first command is due. When more
+ * than --concurrency connections overlap the excess start late and the
+ * timing of the replay stretches, raise --concurrency to avoid this.
+ */
+int
+main (int argc,
+      char *argv[])
+{
+    replay_connection_t *connection;
+    replay_command_t *command;
+    GPtrArray *connections;
+    GThreadPool *pool;
+    GError *error = NULL;
+    FILE *out = stdout;
+    guint64 duration = 0;
+    gint64 elapsed;
+    guint i;
+    gint ret = 0;
+
+    if (!replay_parse_opts (argc, argv)) {
+        return 2;
+    }
+    connections = replay_load (replay_opts.capture, &duration);
+    if (connections == NULL) {
+        ret = 1;
+        goto out;
+    }
+    if (replay_opts.output != NULL) {
+        out = fopen (replay_opts.output, "w");
+        if (out == NULL) {
+            g_critical ("failed to open %s: %s",
+                        replay_opts.output, strerror (errno));
+            ret = 1;
+            goto out;
+        }
+    }
+    pool = g_thread_pool_new (replay_connection_thread,
+                              NULL,
+                              replay_opts.concurrency,
+                              FALSE,
+                              &error);
+    if (pool == NULL) {
+        g_critical ("failed to create thread pool: %s", error->message);
+        g_clear_error (&error);
+        ret = 1;
+        goto out;
+    }
+
+    replay_start = g_get_monotonic_time ();
+    for (i = 0; i < connections->len; ++i) {
+        connection = g_ptr_array_index (connections, i);
+        command = &g_array_index (connection->commands, replay_command_t, 0);
+        replay_wait (command->time);
+        g_thread_pool_push (pool, connection, NULL);
+    }
+    g_thread_pool_free (pool, FALSE, TRUE);
+    elapsed = g_get_monotonic_time () - replay_start;
+
+    replay_report (out, connections, elapsed, duration);
+    for (i = 0; i < connections->len; ++i) {
+        connection = g_ptr_array_index (connections, i);
+        if (connection->errors > 0) {
+            ret = 1;
+        }
+    }
+
+out:
+    if (connections != NULL) {
+        g_ptr_array_free (connections, TRUE);
+    }
+    if (out != stdout) {
+        fclose (out);
+    }
+    g_free (replay_opts.capture);
+    g_free (replay_opts.tcti_conf);
+    g_free (replay_opts.output);
+
+    return ret;
+}
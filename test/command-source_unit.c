@@ -122,7 +122,10 @@ command_source_allocate_test (void **state)
 
     data->command_attrs = command_attrs_new ();
     data->source = command_source_new (data->manager,
-                                       data->command_attrs);
+                                       data->command_attrs,
+                                       TABRMD_IN_FLIGHT_MAX_DEFAULT,
+                                       TABRMD_QUEUE_HIGH_WATER_DEFAULT,
+                                       TABRMD_READER_THREADS_DEFAULT);
     assert_non_null (data->source);
 }
 
@@ -168,7 +171,10 @@ command_source_start_setup (void **state)
         g_error ("failed to allocate new connection_manager");
     data->command_attrs = command_attrs_new ();
     data->source = command_source_new (data->manager,
-                                       data->command_attrs);
+                                       data->command_attrs,
+                                       TABRMD_IN_FLIGHT_MAX_DEFAULT,
+                                       TABRMD_QUEUE_HIGH_WATER_DEFAULT,
+                                       TABRMD_READER_THREADS_DEFAULT);
     if (data->source == NULL)
         g_error ("failed to allocate new command_source");
 
@@ -208,7 +214,10 @@ command_source_connection_setup (void **state)
     data->manager = connection_manager_new (TABRMD_CONNECTIONS_MAX_DEFAULT);
     data->command_attrs = command_attrs_new ();
     data->source = command_source_new (data->manager,
-                                       data->command_attrs);
+                                       data->command_attrs,
+                                       TABRMD_IN_FLIGHT_MAX_DEFAULT,
+                                       TABRMD_QUEUE_HIGH_WATER_DEFAULT,
+                                       TABRMD_READER_THREADS_DEFAULT);
 
     *state = data;
     return 0;
@@ -246,6 +255,61 @@ command_source_connection_insert_test (void **state)
 }
 /* command_source_session_insert_test end */
 
+/*
+ * Setup a CommandSource with two reader threads.
+ */
+static int
+command_source_shard_setup (void **state)
+{
+    source_test_data_t *data;
+
+    data = calloc (1, sizeof (source_test_data_t));
+    data->manager = connection_manager_new (TABRMD_CONNECTIONS_MAX_DEFAULT);
+    data->command_attrs = command_attrs_new ();
+    data->source = command_source_new (data->manager,
+                                       data->command_attrs,
+                                       TABRMD_IN_FLIGHT_MAX_DEFAULT,
+                                       TABRMD_QUEUE_HIGH_WATER_DEFAULT,
+                                       2);
+
+    *state = data;
+    return 0;
+}
+/*
+ * With two reader threads a Connection with an odd id must be monitored
+ * by the GMainContext of the second shard. The CommandSource must also be
+ * able to start, cancel and join the second reader thread.
+ */
+static void
+command_source_shard_test (void **state)
+{
+    struct source_test_data *data = (struct source_test_data*)*state;
+    source_data_t *source_data = NULL;
+    CommandSource *source = data->source;
+    GIOStream     *iostream;
+    HandleMap     *handle_map;
+    Connection *connection;
+    gint ret, client_fd;
+
+    handle_map = handle_map_new (TPM2_HT_TRANSIENT, MAX_ENTRIES_DEFAULT);
+    iostream = create_connection_iostream (&client_fd);
+    connection = connection_new (iostream, 5, handle_map);
+    g_object_unref (handle_map);
+    g_object_unref (iostream);
+    ret = thread_start (THREAD (source));
+    assert_int_equal (ret, 0);
+    will_return (__wrap_g_source_set_callback, &source_data);
+    command_source_on_new_connection (data->manager, connection, source);
+    assert_non_null (source_data);
+    assert_ptr_equal (source_data->context, source->shards [1].context);
+    assert_ptr_not_equal (source_data->context, source->main_context);
+    thread_cancel (THREAD (source));
+    ret = thread_join (THREAD (source));
+    assert_int_equal (ret, 0);
+    g_object_unref (connection);
+    close (client_fd);
+}
+
 /**
  * A test: Test the command_source_connection_responder function. We do this
  * by creating a new Connection object, associating it with a new
@@ -266,6 +330,7 @@ static void
 command_source_on_io_ready_success_test (void **state)
 {
     struct source_test_data *data = (struct source_test_data*)*state;
+    source_data_t *source_data;
     GIOStream   *iostream;
     HandleMap   *handle_map;
     Connection *connection;
@@ -282,6 +347,7 @@ command_source_on_io_ready_success_test (void **state)
     g_object_unref (handle_map);
     g_object_unref (iostream);
         /* prime wraps */
+    will_return (__wrap_g_source_set_callback, &source_data);
     will_return (__wrap_connection_manager_lookup_istream, connection);
 
     /* setup read of tpm buffer */
@@ -292,13 +358,93 @@ command_source_on_io_ready_success_test (void **state)
 
     will_return (__wrap_sink_enqueue, &command_out);
 
-    command_source_on_input_ready (NULL, data->source);
+    command_source_on_new_connection (data->manager, connection, data->source);
+    command_source_on_input_ready (NULL, source_data);
 
     assert_memory_equal (tpm2_command_get_buffer (command_out),
                          data_in,
                          sizeof (data_in));
     g_object_unref (command_out);
 }
+/*
+ * Setup a CommandSource that allows only a single command in flight per
+ * connection.
+ */
+static int
+command_source_in_flight_setup (void **state)
+{
+    source_test_data_t *data;
+
+    data = calloc (1, sizeof (source_test_data_t));
+    data->manager = connection_manager_new (TABRMD_CONNECTIONS_MAX_DEFAULT);
+    data->command_attrs = command_attrs_new ();
+    data->source = command_source_new (data->manager,
+                                       data->command_attrs,
+                                       1,
+                                       TABRMD_QUEUE_HIGH_WATER_DEFAULT,
+                                       TABRMD_READER_THREADS_DEFAULT);
+
+    *state = data;
+    return 0;
+}
+/*
+ * This tests the per-connection in-flight limit. With a limit of 1 the first
+ * command read from the connection must cause the CommandSource to stop
+ * monitoring it. Once the response has been written the CommandSource
+ * must create a new GSource for the connection.
+ */
+static void
+command_source_in_flight_pause_resume_test (void **state)
+{
+    struct source_test_data *data = (struct source_test_data*)*state;
+    source_data_t *source_data = NULL, *source_data_resume = NULL;
+    GIOStream   *iostream;
+    GInputStream *istream;
+    HandleMap   *handle_map;
+    Connection *connection;
+    Tpm2Command *command_out;
+    gint client_fd;
+    gboolean ret;
+    guint8 data_in [] = { 0x80, 0x01, 0x0,  0x0,  0x0,  0x17,
+                          0x0,  0x0,  0x01, 0x7a, 0x0,  0x0,
+                          0x0,  0x06, 0x0,  0x0,  0x01, 0x0,
+                          0x0,  0x0,  0x0,  0x7f, 0x0a };
+
+    handle_map = handle_map_new (TPM2_HT_TRANSIENT, MAX_ENTRIES_DEFAULT);
+    iostream = create_connection_iostream (&client_fd);
+    connection = connection_new (iostream, 0, handle_map);
+    istream = g_io_stream_get_input_stream (iostream);
+    g_object_unref (handle_map);
+    g_object_unref (iostream);
+
+    will_return (__wrap_g_source_set_callback, &source_data);
+    command_source_on_new_connection (data->manager, connection, data->source);
+    assert_non_null (source_data->source);
+
+    will_return (__wrap_connection_manager_lookup_istream,
+                 g_object_ref (connection));
+    will_return (__wrap_read_tpm_buffer_alloc, data_in);
+    will_return (__wrap_read_tpm_buffer_alloc, sizeof (data_in));
+    will_return (__wrap_command_attrs_from_cc, 0);
+    will_return (__wrap_sink_enqueue, &command_out);
+    ret = command_source_on_input_ready (istream, source_data);
+    assert_int_equal (ret, G_SOURCE_REMOVE);
+    assert_null (source_data->source);
+    assert_int_equal (connection_in_flight_get (connection), 1);
+
+    /* response delivered, resume is dispatched on the CommandSource context */
+    command_source_on_response_written (NULL, connection, data->source);
+    assert_int_equal (connection_in_flight_get (connection), 0);
+    will_return (__wrap_connection_manager_lookup_istream,
+                 g_object_ref (connection));
+    will_return (__wrap_g_source_set_callback, &source_data_resume);
+    g_main_context_iteration (data->source->main_context, FALSE);
+    assert_ptr_equal (source_data_resume, source_data);
+    assert_non_null (source_data->source);
+
+    g_object_unref (command_out);
+    g_object_unref (connection);
+}
 /*
  * This tests the CommandSource on_io_ready function for situations where
  * the GSocket associated with a client connection is closed. This causes
@@ -353,12 +499,18 @@ main (void)
         cmocka_unit_test_setup_teardown (command_source_connection_insert_test,
                                          command_source_connection_setup,
                                          command_source_teardown),
+        cmocka_unit_test_setup_teardown (command_source_shard_test,
+                                         command_source_shard_setup,
+                                         command_source_teardown),
         cmocka_unit_test_setup_teardown (command_source_on_io_ready_success_test,
                                          command_source_connection_setup,
                                          command_source_teardown),
         cmocka_unit_test_setup_teardown (command_source_on_io_ready_eof_test,
                                          command_source_connection_setup,
                                          command_source_teardown),
+        cmocka_unit_test_setup_teardown (command_source_in_flight_pause_resume_test,
+                                         command_source_in_flight_setup,
+                                         command_source_teardown),
     };
     return cmocka_run_group_tests (tests, NULL, NULL);
 }
@@ -113,6 +113,44 @@ connection_manager_lookup_id_test (void **state)
     assert_int_equal (connection, connection_lookup);
 }
 
+/*
+ * The flight recorder and capture file identify a connection by its
+ * number. A client that reads a dump passes a number it finds there as
+ * its own ID to SetLocality or Cancel, which look up the ID XORed with
+ * the caller's PID. Neither the number nor the number XORed with the PID
+ * of the connection's owner may find the connection.
+ */
+static void
+connection_manager_lookup_number_test (void **state)
+{
+    ConnectionManager *manager = CONNECTION_MANAGER (*state);
+    Connection *connection = NULL, *connection_lookup = NULL;
+    HandleMap   *handle_map = NULL;
+    GIOStream *iostream;
+    gint ret, client_fd;
+    guint64 pid = 4242, number;
+
+    handle_map = handle_map_new (TPM2_HT_TRANSIENT, MAX_ENTRIES_DEFAULT);
+    iostream = create_connection_iostream (&client_fd);
+    connection = connection_new (iostream,
+                                 0x0123456789abcdefULL ^ pid,
+                                 handle_map);
+    g_object_unref (handle_map);
+    g_object_unref (iostream);
+    ret = connection_manager_insert (manager, connection);
+    assert_int_equal (ret, TSS2_RC_SUCCESS);
+    number = connection_get_number (connection);
+    assert_int_not_equal (number, connection->id);
+    connection_lookup = connection_manager_lookup_id (manager, number);
+    assert_null (connection_lookup);
+    connection_lookup = connection_manager_lookup_id (manager, number ^ pid);
+    assert_null (connection_lookup);
+    connection_lookup = connection_manager_lookup_id (manager,
+                                                      connection->id);
+    assert_ptr_equal (connection, connection_lookup);
+    g_object_unref (connection_lookup);
+}
+
 static void
 connection_manager_remove_test (void **state)
 {
@@ -148,6 +186,9 @@ main(void)
         cmocka_unit_test_setup_teardown (connection_manager_lookup_id_test,
                                          connection_manager_setup,
                                          connection_manager_teardown),
+        cmocka_unit_test_setup_teardown (connection_manager_lookup_number_test,
+                                         connection_manager_setup,
+                                         connection_manager_teardown),
         cmocka_unit_test_setup_teardown (connection_manager_remove_test,
                                          connection_manager_setup,
                                          connection_manager_teardown),
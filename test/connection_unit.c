@@ -162,6 +162,97 @@ connection_server_to_client_test (void **state)
     assert_int_equal (ret, strlen ("test"));
 }
 /* connection_server_to_client_test end */
+/*
+ * Channels of a multiplexed connection are created on first use, looked up
+ * after that and account their in-flight commands against the parent.
+ */
+static void
+connection_mux_channel_test (void **state)
+{
+    connection_test_data_t *data = (connection_test_data_t*)*state;
+    Connection *parent = data->connection, *child, *child_tmp;
+
+    connection_set_mux (parent);
+    assert_true (connection_is_mux (parent));
+    child = connection_mux_channel (parent, 1, 2);
+    assert_non_null (child);
+    assert_ptr_equal (connection_get_owner (child), parent);
+    assert_ptr_equal (connection_get_owner (parent), parent);
+    assert_int_equal (child->id, parent->id);
+    assert_int_equal (child->channel, 1);
+    assert_ptr_not_equal (child->transient_handle_map,
+                          parent->transient_handle_map);
+
+    child_tmp = connection_mux_channel (parent, 1, 2);
+    assert_ptr_equal (child_tmp, child);
+    g_object_unref (child_tmp);
+
+    connection_in_flight_inc (child);
+    assert_int_equal (connection_in_flight_get (parent), 1);
+    connection_in_flight_dec (child);
+    assert_int_equal (connection_in_flight_get (parent), 0);
+
+    child_tmp = connection_mux_remove_channel (parent, 1);
+    assert_ptr_equal (child_tmp, child);
+    g_object_unref (child_tmp);
+    assert_null (connection_mux_remove_channel (parent, 1));
+    g_object_unref (child);
+}
+/*
+ * A multiplexed connection won't create more than 'max_channels' channels.
+ * All channels are handed to the caller by connection_mux_steal_channels.
+ */
+static void
+connection_mux_channel_max_test (void **state)
+{
+    connection_test_data_t *data = (connection_test_data_t*)*state;
+    Connection *parent = data->connection, *child;
+    GList *list;
+
+    connection_set_mux (parent);
+    child = connection_mux_channel (parent, 1, 2);
+    g_object_unref (child);
+    child = connection_mux_channel (parent, 2, 2);
+    g_object_unref (child);
+    assert_null (connection_mux_channel (parent, 3, 2));
+
+    list = connection_mux_steal_channels (parent);
+    assert_int_equal (g_list_length (list), 2);
+    g_list_free_full (list, g_object_unref);
+    assert_null (connection_mux_steal_channels (parent));
+}
+/*
+ * The transient objects held by the channels of a multiplexed connection
+ * are counted against the parent. A channel gives back whatever it still
+ * holds when it's disposed.
+ */
+static void
+connection_mux_trans_full_test (void **state)
+{
+    connection_test_data_t *data = (connection_test_data_t*)*state;
+    Connection *parent = data->connection, *child;
+    HandleMapEntry *entry;
+    guint max = parent->transient_handle_map->max_entries;
+
+    connection_set_mux (parent);
+    assert_false (connection_mux_trans_full (parent));
+    child = connection_mux_channel (parent, 1, 2);
+    entry = handle_map_entry_new (0x80000000, 0x80000001);
+    handle_map_insert (child->transient_handle_map, 0x80000001, entry);
+    g_object_unref (entry);
+    connection_mux_trans_add (child, 1);
+    connection_mux_trans_add (parent, 1);
+    assert_int_equal (parent->trans_count, 1);
+
+    connection_mux_trans_add (child, max - 1);
+    assert_true (connection_mux_trans_full (child));
+    connection_mux_trans_add (child, -(gint)(max - 1));
+    assert_false (connection_mux_trans_full (child));
+
+    g_object_unref (connection_mux_remove_channel (parent, 1));
+    g_object_unref (child);
+    assert_int_equal (parent->trans_count, 0);
+}
 
 int
 main(void)
@@ -180,6 +271,15 @@ main(void)
         cmocka_unit_test_setup_teardown (connection_server_to_client_test,
                                          connection_setup,
                                          connection_teardown),
+        cmocka_unit_test_setup_teardown (connection_mux_channel_test,
+                                         connection_setup,
+                                         connection_teardown),
+        cmocka_unit_test_setup_teardown (connection_mux_channel_max_test,
+                                         connection_setup,
+                                         connection_teardown),
+        cmocka_unit_test_setup_teardown (connection_mux_trans_full_test,
+                                         connection_setup,
+                                         connection_teardown),
     };
     return cmocka_run_group_tests(tests, NULL, NULL);
 }
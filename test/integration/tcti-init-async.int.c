@@ -0,0 +1,162 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (c) 2017 - 2018, Intel Corporation
+ * All rights reserved.
+ */
+
+/*
+ * This test initializes CONNECTION_COUNT TCTI instances concurrently with
+ * Tss2_Tcti_Tabrmd_InitAsync. It waits for all of them in a single poll
+ * loop, completes each with Tss2_Tcti_Tabrmd_InitFinish as its poll handle
+ * becomes readable, then sends a pre-canned TPM command through each and
+ * receives the responses.
+ *
+ * NOTE: this test can't and doesn't use the main.c driver from the
+ * integration test harness since we need to instantiate more than a single
+ * TCTI context.
+ */
+
+#include <errno.h>
+#include <glib.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tss2-tcti-tabrmd.h"
+#include "test-options.h"
+
+#define CONNECTION_COUNT 20
+#define POLL_TIMEOUT 10000
+#define RESPONSE_SIZE 4096
+
+static void
+init_async (TSS2_TCTI_CONTEXT *context,
+            const char        *conf)
+{
+    TSS2_RC rc;
+    size_t size = 0;
+
+    rc = Tss2_Tcti_Tabrmd_InitAsync (context, &size, conf);
+    if (rc != TSS2_RC_SUCCESS) {
+        g_error ("Tss2_Tcti_Tabrmd_InitAsync failed: 0x%" PRIx32, rc);
+    }
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+    TSS2_RC rc;
+    TSS2_TCTI_CONTEXT *tcti_context[CONNECTION_COUNT] = { 0 };
+    TSS2_TCTI_POLL_HANDLE handle;
+    struct pollfd fds [CONNECTION_COUNT];
+    size_t index [CONNECTION_COUNT];
+    bool done [CONNECTION_COUNT] = { false };
+    uintmax_t tries [CONNECTION_COUNT] = { 0 };
+    size_t size, num_handles, pending, num_fds, i;
+    uint8_t response [RESPONSE_SIZE];
+    test_opts_t opts = TEST_OPTS_DEFAULT_INIT;
+    /* This is a pre-canned TPM2 command buffer to invoke 'GetCapability' */
+    uint8_t cmd_buf[] = {
+        0x80, 0x01, 0x00, 0x00, 0x00, 0x16, 0x00, 0x00,
+        0x01, 0x7a, 0x00, 0x00, 0x00, 0x06, 0x00, 0x00,
+        0x01, 0x00, 0x00, 0x00, 0x00, 0x7f, 0x0a
+    };
+    int ret;
+
+    g_info ("Executing test: %s", argv[0]);
+    if (argc > 1) {
+        g_error ("Unexpected argument count %d", argc);
+    }
+    get_test_opts_from_env (&opts);
+    if (sanity_check_test_opts (&opts) != 0) {
+        g_error ("option sanity test failed");
+    }
+    rc = Tss2_Tcti_Tabrmd_InitAsync (NULL, &size, NULL);
+    if (rc != TSS2_RC_SUCCESS) {
+        g_error ("Failed to get allocation size for tabrmd TCTI context: "
+                 "0x%" PRIx32, rc);
+    }
+    for (i = 0; i < CONNECTION_COUNT; ++i) {
+        tcti_context [i] = calloc (1, size);
+        if (tcti_context [i] == NULL) {
+            g_error ("Allocation for TCTI context failed: %s",
+                     strerror (errno));
+        }
+        init_async (tcti_context [i], opts.tcti_conf);
+    }
+    /* wait for all of the connections in a single poll loop */
+    for (pending = CONNECTION_COUNT; pending > 0;) {
+        num_fds = 0;
+        for (i = 0; i < CONNECTION_COUNT; ++i) {
+            if (done [i]) {
+                continue;
+            }
+            num_handles = 1;
+            rc = Tss2_Tcti_GetPollHandles (tcti_context [i],
+                                           &handle,
+                                           &num_handles);
+            if (rc != TSS2_RC_SUCCESS) {
+                g_error ("Tss2_Tcti_GetPollHandles failed: 0x%" PRIx32, rc);
+            }
+            fds [num_fds].fd = handle.fd;
+            fds [num_fds].events = POLLIN;
+            fds [num_fds].revents = 0;
+            index [num_fds] = i;
+            ++num_fds;
+        }
+        ret = poll (fds, num_fds, POLL_TIMEOUT);
+        if (ret <= 0) {
+            g_error ("poll on %zu pending connections failed: %s", pending,
+                     ret == 0 ? "timeout" : strerror (errno));
+        }
+        for (i = 0; i < num_fds; ++i) {
+            if (fds [i].revents == 0) {
+                continue;
+            }
+            rc = Tss2_Tcti_Tabrmd_InitFinish (tcti_context [index [i]]);
+            if (rc == TSS2_TCTI_RC_TRY_AGAIN) {
+                continue;
+            }
+            if (rc == TSS2_RC_SUCCESS) {
+                done [index [i]] = true;
+                --pending;
+                continue;
+            }
+            if (++tries [index [i]] >= opts.tcti_retries) {
+                g_error ("Failed to initialize tabrmd TCTI context: 0x%"
+                         PRIx32, rc);
+            }
+            g_info ("Failed to initialize tabrmd TCTI context: 0x%" PRIx32
+                    " on try %" PRIuMAX, rc, tries [index [i]]);
+            Tss2_Tcti_Finalize (tcti_context [index [i]]);
+            sleep (1);
+            init_async (tcti_context [index [i]], opts.tcti_conf);
+        }
+    }
+    for (i = 0; i < CONNECTION_COUNT; ++i) {
+        rc = Tss2_Tcti_Transmit (tcti_context [i], sizeof (cmd_buf), cmd_buf);
+        if (rc != TSS2_RC_SUCCESS) {
+            g_error ("failed to transmit TPM command: 0x%" PRIx32, rc);
+        }
+    }
+    for (i = 0; i < CONNECTION_COUNT; ++i) {
+        size = sizeof (response);
+        rc = Tss2_Tcti_Receive (tcti_context [i],
+                                &size,
+                                response,
+                                TSS2_TCTI_TIMEOUT_BLOCK);
+        if (rc != TSS2_RC_SUCCESS) {
+            g_error ("failed to receive TPM response: 0x%" PRIx32, rc);
+        }
+    }
+    for (i = 0; i < CONNECTION_COUNT; ++i) {
+        Tss2_Tcti_Finalize (tcti_context [i]);
+        free (tcti_context [i]);
+    }
+    return 0;
+}
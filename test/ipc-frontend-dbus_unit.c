@@ -30,7 +30,8 @@ ipc_frontend_dbus_setup (void **state)
                                                IPC_FRONTEND_DBUS_NAME_DEFAULT,
                                                connection_manager,
                                                100,
-                                               random);
+                                               random,
+                                               2);
     assert_non_null (ipc_frontend_dbus);
     *state = ipc_frontend_dbus;
     g_object_unref (random);
@@ -62,6 +63,26 @@ ipc_frontend_dbus_type_test (void **state)
     assert_true (IS_IPC_FRONTEND (*state));
     assert_true (IS_IPC_FRONTEND_DBUS (*state));
 }
+/*
+ * Refilling the connection pool must create as many pre-built connections
+ * as the 'connection-pool-size' property asks for. The teardown function
+ * checks that they're released.
+ */
+static void
+ipc_frontend_dbus_pool_refill_test (void **state)
+{
+    IpcFrontendDbus *ipc_frontend_dbus = IPC_FRONTEND_DBUS (*state);
+
+    assert_int_equal (g_queue_get_length (&ipc_frontend_dbus->connection_pool),
+                      0);
+    ipc_frontend_dbus_pool_refill (ipc_frontend_dbus);
+    assert_int_equal (g_queue_get_length (&ipc_frontend_dbus->connection_pool),
+                      2);
+    /* a full pool is left alone */
+    ipc_frontend_dbus_pool_refill (ipc_frontend_dbus);
+    assert_int_equal (g_queue_get_length (&ipc_frontend_dbus->connection_pool),
+                      2);
+}
 gint
 main (void)
 {
@@ -69,6 +90,9 @@ main (void)
         cmocka_unit_test_setup_teardown (ipc_frontend_dbus_type_test,
                                          ipc_frontend_dbus_setup,
                                          ipc_frontend_dbus_teardown),
+        cmocka_unit_test_setup_teardown (ipc_frontend_dbus_pool_refill_test,
+                                         ipc_frontend_dbus_setup,
+                                         ipc_frontend_dbus_teardown),
     };
     return cmocka_run_group_tests (tests, NULL, NULL);
 }
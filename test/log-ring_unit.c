@@ -0,0 +1,184 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "log-ring.h"
+#include "util.h"
+
+#define RING_SIZE 4
+#define PRODUCER_COUNT 4
+#define PRODUCER_MESSAGES 10000
+
+static int
+log_ring_setup (void **state)
+{
+    *state = log_ring_new (RING_SIZE);
+    return 0;
+}
+static int
+log_ring_teardown (void **state)
+{
+    log_ring_free (*state);
+    return 0;
+}
+static void
+log_ring_new_size_test (void **state)
+{
+    UNUSED_PARAM (state);
+    assert_null (log_ring_new (0));
+    assert_null (log_ring_new (3));
+}
+static void
+log_ring_empty_test (void **state)
+{
+    log_ring_t *ring = *state;
+
+    assert_true (log_ring_is_empty (ring));
+    assert_null (log_ring_peek (ring));
+}
+/* Messages come out in the order they went in, across laps of the ring. */
+static void
+log_ring_fifo_test (void **state)
+{
+    log_ring_t *ring = *state;
+    log_ring_entry_t *entry;
+    gchar message [16];
+    guint i;
+
+    for (i = 0; i < RING_SIZE * 3; ++i) {
+        g_snprintf (message, sizeof (message), "%u", i);
+        assert_true (log_ring_push (ring, "domain", G_LOG_LEVEL_WARNING,
+                                    message));
+        entry = log_ring_peek (ring);
+        assert_non_null (entry);
+        assert_int_equal (entry->level, G_LOG_LEVEL_WARNING);
+        assert_string_equal (entry->domain, "domain");
+        assert_string_equal (entry->message, message);
+        log_ring_release (ring, entry);
+    }
+    assert_true (log_ring_is_empty (ring));
+}
+static void
+log_ring_full_test (void **state)
+{
+    log_ring_t *ring = *state;
+    log_ring_entry_t *entry;
+    guint i;
+
+    for (i = 0; i < RING_SIZE; ++i) {
+        assert_true (log_ring_push (ring, NULL, G_LOG_LEVEL_INFO, "foo"));
+    }
+    assert_false (log_ring_push (ring, NULL, G_LOG_LEVEL_INFO, "bar"));
+    assert_false (log_ring_push (ring, NULL, G_LOG_LEVEL_INFO, "bar"));
+    assert_int_equal (log_ring_dropped (ring), 2);
+
+    entry = log_ring_peek (ring);
+    assert_string_equal (entry->domain, "");
+    assert_string_equal (entry->message, "foo");
+    log_ring_release (ring, entry);
+    assert_true (log_ring_push (ring, NULL, G_LOG_LEVEL_INFO, "baz"));
+    assert_int_equal (log_ring_dropped (ring), 2);
+}
+/*
+ * Messages too long for a slot are copied whole, whether the slot is
+ * released or the ring is freed with them still in it.
+ */
+static void
+log_ring_oversize_test (void **state)
+{
+    log_ring_t *ring = *state;
+    log_ring_entry_t *entry;
+    gchar message [LOG_RING_MESSAGE_INLINE * 2];
+
+    memset (message, 'a', sizeof (message) - 1);
+    message [sizeof (message) - 1] = '\0';
+    assert_true (log_ring_push (ring, NULL, G_LOG_LEVEL_INFO, message));
+    assert_true (log_ring_push (ring, NULL, G_LOG_LEVEL_INFO, message));
+    message [LOG_RING_MESSAGE_INLINE - 1] = '\0';
+    assert_true (log_ring_push (ring, NULL, G_LOG_LEVEL_INFO, message));
+    entry = log_ring_peek (ring);
+    assert_int_equal (strlen (entry->message), sizeof (message) - 1);
+    assert_ptr_not_equal (entry->message, entry->message_inline);
+    log_ring_release (ring, entry);
+    entry = log_ring_peek (ring);
+    assert_int_equal (strlen (entry->message), sizeof (message) - 1);
+    log_ring_release (ring, entry);
+    entry = log_ring_peek (ring);
+    assert_string_equal (entry->message, message);
+    assert_ptr_equal (entry->message, entry->message_inline);
+    log_ring_release (ring, entry);
+    assert_int_equal (log_ring_dropped (ring), 0);
+    /* left in the ring for log_ring_free */
+    memset (message, 'b', sizeof (message) - 1);
+    assert_true (log_ring_push (ring, NULL, G_LOG_LEVEL_INFO, message));
+}
+static gpointer
+log_ring_producer (gpointer data)
+{
+    log_ring_t *ring = (log_ring_t*)data;
+    guint i;
+
+    for (i = 0; i < PRODUCER_MESSAGES; ++i) {
+        while (!log_ring_push (ring, NULL, G_LOG_LEVEL_INFO, "foo")) {
+            g_thread_yield ();
+        }
+    }
+    return NULL;
+}
+/*
+ * Producers retry dropped messages until they fit so every message must
+ * come out exactly once.
+ */
+static void
+log_ring_threads_test (void **state)
+{
+    log_ring_t *ring = *state;
+    log_ring_entry_t *entry;
+    GThread *threads [PRODUCER_COUNT];
+    guint i, count = 0;
+
+    for (i = 0; i < PRODUCER_COUNT; ++i) {
+        threads [i] = g_thread_new ("producer", log_ring_producer, ring);
+    }
+    while (count < PRODUCER_COUNT * PRODUCER_MESSAGES) {
+        entry = log_ring_peek (ring);
+        if (entry == NULL) {
+            g_thread_yield ();
+            continue;
+        }
+        assert_string_equal (entry->message, "foo");
+        log_ring_release (ring, entry);
+        ++count;
+    }
+    for (i = 0; i < PRODUCER_COUNT; ++i) {
+        g_thread_join (threads [i]);
+    }
+    assert_true (log_ring_is_empty (ring));
+}
+int
+main (void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test (log_ring_new_size_test),
+        cmocka_unit_test_setup_teardown (log_ring_empty_test,
+                                         log_ring_setup,
+                                         log_ring_teardown),
+        cmocka_unit_test_setup_teardown (log_ring_fifo_test,
+                                         log_ring_setup,
+                                         log_ring_teardown),
+        cmocka_unit_test_setup_teardown (log_ring_full_test,
+                                         log_ring_setup,
+                                         log_ring_teardown),
+        cmocka_unit_test_setup_teardown (log_ring_oversize_test,
+                                         log_ring_setup,
+                                         log_ring_teardown),
+        cmocka_unit_test_setup_teardown (log_ring_threads_test,
+                                         log_ring_setup,
+                                         log_ring_teardown),
+    };
+    return cmocka_run_group_tests (tests, NULL, NULL);
+}
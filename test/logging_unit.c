@@ -4,6 +4,7 @@
  * All rights reserved.
  */
 #include <glib.h>
+#include <stdarg.h>
 #include <stdlib.h>
 
 #include <setjmp.h>
@@ -81,14 +82,25 @@ logging_set_logger_syslog_test (void **state)
     assert_int_equal (set_logger ("syslog"), 0);
 }
 
+/* messages passed to syslog are collected here while it's not NULL */
+static GPtrArray *syslog_messages = NULL;
+static GMutex syslog_mutex;
+
 void
 __wrap_syslog (int priority,
                const char *format,
                ...)
 {
+    va_list ap;
     UNUSED_PARAM(priority);
-    UNUSED_PARAM(format);
-    return;
+
+    g_mutex_lock (&syslog_mutex);
+    if (syslog_messages != NULL) {
+        va_start (ap, format);
+        g_ptr_array_add (syslog_messages, g_strdup_vprintf (format, ap));
+        va_end (ap);
+    }
+    g_mutex_unlock (&syslog_mutex);
 }
 
 static void
@@ -170,6 +182,45 @@ logging_syslog_log_handler_default_test (void **state)
                         "foo",
                         NULL);
 }
+/*
+ * A critical message is written straight to the sink. The warnings logged
+ * before it are still in the LogRing and must be written first.
+ */
+#define ORDER_WARNINGS 100
+static void
+logging_async_critical_order_test (void **state)
+{
+    gchar *expected;
+    guint i;
+    UNUSED_PARAM(state);
+
+    will_return (__wrap_getenv, NULL);
+    tabrmd_log_levels_init ();
+    will_return (__wrap_getenv, NULL);
+    assert_int_equal (set_logger ("syslog"), 0);
+    g_mutex_lock (&syslog_mutex);
+    syslog_messages = g_ptr_array_new_with_free_func (g_free);
+    g_mutex_unlock (&syslog_mutex);
+
+    for (i = 0; i < ORDER_WARNINGS; ++i) {
+        g_warning ("warning %u", i);
+    }
+    g_critical ("critical");
+    async_logger_stop ();
+
+    g_mutex_lock (&syslog_mutex);
+    assert_int_equal (syslog_messages->len, ORDER_WARNINGS + 1);
+    for (i = 0; i < ORDER_WARNINGS; ++i) {
+        expected = g_strdup_printf ("warning %u", i);
+        assert_string_equal (g_ptr_array_index (syslog_messages, i),
+                             expected);
+        g_free (expected);
+    }
+    assert_string_equal (g_ptr_array_index (syslog_messages, ORDER_WARNINGS),
+                         "critical");
+    g_clear_pointer (&syslog_messages, g_ptr_array_unref);
+    g_mutex_unlock (&syslog_mutex);
+}
 int
 main (void)
 {
@@ -188,6 +239,8 @@ main (void)
         cmocka_unit_test (logging_syslog_log_handler_info_test),
         cmocka_unit_test (logging_syslog_log_handler_debug_test),
         cmocka_unit_test (logging_syslog_log_handler_default_test),
+        /* stops the logger thread so it must run last */
+        cmocka_unit_test (logging_async_critical_order_test),
     };
     return cmocka_run_group_tests (tests, NULL, NULL);
 }
@@ -146,6 +146,117 @@ message_queue_thread_unblock_test (void **state)
     assert_int_equal (ret, 0);
 }
 
+/*
+ * Enqueue more objects than the batch size and make sure that
+ * message_queue_dequeue_batch hands them back in FIFO order, never
+ * returning more than the requested maximum.
+ */
+#define BATCH_TEST_COUNT 5
+static void
+message_queue_dequeue_batch_test (void **state)
+{
+    msgq_test_data_t *data = (msgq_test_data_t*)*state;
+    ControlMessage *msgs [BATCH_TEST_COUNT];
+    GObject *objs [BATCH_TEST_COUNT] = { NULL, };
+    guint count, i;
+
+    for (i = 0; i < BATCH_TEST_COUNT; ++i) {
+        msgs [i] = control_message_new (CHECK_CANCEL);
+        message_queue_enqueue (data->queue, G_OBJECT (msgs [i]));
+    }
+    count = message_queue_dequeue_batch (data->queue, objs, 3);
+    assert_int_equal (count, 3);
+    for (i = 0; i < count; ++i) {
+        assert_ptr_equal (objs [i], msgs [i]);
+        g_object_unref (objs [i]);
+    }
+    count = message_queue_dequeue_batch (data->queue, objs, BATCH_TEST_COUNT);
+    assert_int_equal (count, 2);
+    for (i = 0; i < count; ++i) {
+        assert_ptr_equal (objs [i], msgs [i + 3]);
+        g_object_unref (objs [i]);
+    }
+    for (i = 0; i < BATCH_TEST_COUNT; ++i) {
+        g_object_unref (msgs [i]);
+    }
+}
+/*
+ * Producer thread for the multi-producer test. Each producer enqueues
+ * MPSC_TEST_MSGS ControlMessages carrying its own ControlMessage as the
+ * object and a sequence number as object data so that the consumer can
+ * check per-producer ordering.
+ */
+#define MPSC_TEST_PRODUCERS 4
+#define MPSC_TEST_MSGS 1000
+#define MPSC_TEST_SEQ "mpsc-test-seq"
+typedef struct {
+    MessageQueue *queue;
+    GObject *tag;
+} producer_data_t;
+
+static void*
+producer_func (void *arg)
+{
+    producer_data_t *data = (producer_data_t*)arg;
+    ControlMessage *msg;
+    guint i;
+
+    for (i = 0; i < MPSC_TEST_MSGS; ++i) {
+        msg = control_message_new_with_object (CONNECTION_REMOVED, data->tag);
+        g_object_set_data (G_OBJECT (msg), MPSC_TEST_SEQ, GUINT_TO_POINTER (i));
+        message_queue_enqueue (data->queue, G_OBJECT (msg));
+        g_object_unref (msg);
+    }
+    return NULL;
+}
+/*
+ * Several threads enqueue concurrently while the test thread drains the
+ * queue in batches. Every message must be received exactly once and the
+ * messages from each producer in the order it enqueued them.
+ */
+static void
+message_queue_multi_producer_test (void **state)
+{
+    msgq_test_data_t *data = (msgq_test_data_t*)*state;
+    producer_data_t producers [MPSC_TEST_PRODUCERS];
+    pthread_t threads [MPSC_TEST_PRODUCERS];
+    guint counts [MPSC_TEST_PRODUCERS] = { 0, };
+    GObject *objs [16];
+    GObject *tag;
+    guint total = 0, count, seq, i, j;
+    int ret;
+
+    for (i = 0; i < MPSC_TEST_PRODUCERS; ++i) {
+        producers [i].queue = data->queue;
+        producers [i].tag = G_OBJECT (control_message_new (CHECK_CANCEL));
+        ret = pthread_create (&threads [i], NULL, producer_func, &producers [i]);
+        assert_int_equal (ret, 0);
+    }
+    while (total < MPSC_TEST_PRODUCERS * MPSC_TEST_MSGS) {
+        count = message_queue_dequeue_batch (data->queue, objs, 16);
+        assert_in_range (count, 1, 16);
+        for (i = 0; i < count; ++i) {
+            tag = control_message_get_object (CONTROL_MESSAGE (objs [i]));
+            for (j = 0; j < MPSC_TEST_PRODUCERS; ++j) {
+                if (tag == producers [j].tag) {
+                    seq = GPOINTER_TO_UINT (g_object_get_data (objs [i],
+                                                               MPSC_TEST_SEQ));
+                    assert_int_equal (seq, counts [j]);
+                    ++counts [j];
+                }
+            }
+            g_object_unref (objs [i]);
+        }
+        total += count;
+    }
+    for (i = 0; i < MPSC_TEST_PRODUCERS; ++i) {
+        ret = pthread_join (threads [i], NULL);
+        assert_int_equal (ret, 0);
+        assert_int_equal (counts [i], MPSC_TEST_MSGS);
+        g_object_unref (producers [i].tag);
+    }
+}
+
 int
 main(void)
 {
@@ -160,6 +271,12 @@ main(void)
         cmocka_unit_test_setup_teardown (message_queue_thread_unblock_test,
                                          message_queue_setup,
                                          message_queue_teardown),
+        cmocka_unit_test_setup_teardown (message_queue_dequeue_batch_test,
+                                         message_queue_setup,
+                                         message_queue_teardown),
+        cmocka_unit_test_setup_teardown (message_queue_multi_producer_test,
+                                         message_queue_setup,
+                                         message_queue_teardown),
     };
     return cmocka_run_group_tests(tests, NULL, NULL);
 }
@@ -114,3 +114,34 @@ __wrap_g_input_stream_read (GInputStream *stream,
         return resp_size;
     }
 }
+/*
+ * Mock of the 'recv' system call used by tcti_tabrmd_read for blocking
+ * reads. Only TEST_FD is mocked: a positive size is followed by the buffer
+ * holding the data, -1 by the errno value.
+ */
+ssize_t
+__real_recv (int sockfd,
+             void *buf,
+             size_t len,
+             int flags);
+ssize_t
+__wrap_recv (int sockfd,
+             void *buf,
+             size_t len,
+             int flags)
+{
+    ssize_t resp_size;
+    uint8_t *resp;
+
+    if (sockfd != TEST_FD) {
+        return __real_recv (sockfd, buf, len, flags);
+    }
+    resp_size = mock_type (ssize_t);
+    if (resp_size > 0) {
+        resp = mock_type (uint8_t*);
+        memcpy (buf, resp, resp_size);
+    } else if (resp_size == -1) {
+        errno = mock_type (int);
+    }
+    return resp_size;
+}
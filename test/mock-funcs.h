@@ -33,3 +33,8 @@ __wrap_g_input_stream_read (GInputStream *stream,
                             gsize count,
                             GCancellable *cancellable,
                             GError **error);
+ssize_t
+__wrap_recv (int sockfd,
+             void *buf,
+             size_t len,
+             int flags);
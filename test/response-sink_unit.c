@@ -5,10 +5,16 @@
  */
 #include <glib.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include <setjmp.h>
 #include <cmocka.h>
 
+#include "connection.h"
+#include "handle-map.h"
+#include "sink-interface.h"
+#include "tabrmd-defaults.h"
+#include "tpm2-response.h"
 #include "util.h"
 #include "response-sink.h"
 
@@ -21,16 +27,139 @@ response_sink_allocate_test (void **state)
     ResponseSink *sink;
     UNUSED_PARAM(state);
 
-    sink = response_sink_new ();
+    sink = response_sink_new (FALSE);
 
     g_object_unref (sink);
 }
+/*
+ * Callback for the 'response-written' signal. Counts the number of times
+ * it's invoked.
+ */
+static void
+response_sink_written_cb (ResponseSink *sink,
+                          Connection   *connection,
+                          gpointer      user_data)
+{
+    guint *count = (guint*)user_data;
+    UNUSED_PARAM(sink);
+    UNUSED_PARAM(connection);
+
+    *count += 1;
+}
+/*
+ * In 'direct' mode enqueuing a Tpm2Response must write it to the client
+ * and emit the 'response-written' signal from the calling thread. The
+ * ResponseSink thread is never started.
+ */
+static void
+response_sink_direct_test (void **state)
+{
+    ResponseSink *sink;
+    Connection *connection;
+    GIOStream *iostream;
+    HandleMap *handle_map;
+    Tpm2Response *response;
+    guint8 *buf;
+    guint8 buf_out [TPM_RESPONSE_HEADER_SIZE] = { 0, };
+    guint count = 0;
+    gint client_fd;
+    UNUSED_PARAM(state);
+
+    handle_map = handle_map_new (TPM2_HT_TRANSIENT, TABRMD_TRANSIENT_MAX_DEFAULT);
+    iostream = create_connection_iostream (&client_fd);
+    connection = connection_new (iostream, 0, handle_map);
+    g_object_unref (handle_map);
+    g_object_unref (iostream);
+    buf = g_malloc0 (TPM_RESPONSE_HEADER_SIZE);
+    buf [0] = 0x80;
+    buf [1] = 0x01;
+    buf [5] = TPM_RESPONSE_HEADER_SIZE;
+    response = tpm2_response_new (connection,
+                                  buf,
+                                  TPM_RESPONSE_HEADER_SIZE,
+                                  (TPMA_CC){ 0 });
+
+    sink = response_sink_new (TRUE);
+    g_signal_connect (sink,
+                      "response-written",
+                      (GCallback) response_sink_written_cb,
+                      &count);
+    sink_enqueue (SINK (sink), G_OBJECT (response));
+    assert_int_equal (count, 1);
+    assert_int_equal (read (client_fd, buf_out, sizeof (buf_out)),
+                      sizeof (buf_out));
+    assert_memory_equal (buf_out, tpm2_response_get_buffer (response),
+                         sizeof (buf_out));
+
+    g_object_unref (response);
+    g_object_unref (connection);
+    g_object_unref (sink);
+    close (client_fd);
+}
+/*
+ * In 'direct' mode a client that has stopped reading its responses must
+ * not block the calling thread: once the socket is full the write gives up
+ * after TABRMD_DIRECT_RESPONSE_TIMEOUT_USEC and the connection is shut
+ * down so the client sees EOF once it has read what was already sent.
+ */
+static void
+response_sink_direct_stalled_test (void **state)
+{
+    ResponseSink *sink;
+    Connection *connection;
+    GIOStream *iostream;
+    HandleMap *handle_map;
+    Tpm2Response *response;
+    guint8 *buf;
+    guint8 buf_out [TPM_RESPONSE_HEADER_SIZE] = { 0, };
+    guint count = 0;
+    gint client_fd, server_fd;
+    gint64 start;
+    ssize_t ret;
+    UNUSED_PARAM(state);
+
+    handle_map = handle_map_new (TPM2_HT_TRANSIENT, TABRMD_TRANSIENT_MAX_DEFAULT);
+    iostream = create_connection_iostream (&client_fd);
+    server_fd = g_socket_get_fd (
+        g_socket_connection_get_socket (G_SOCKET_CONNECTION (iostream)));
+    while (write (server_fd, buf_out, sizeof (buf_out)) > 0);
+    connection = connection_new (iostream, 0, handle_map);
+    g_object_unref (handle_map);
+    g_object_unref (iostream);
+    buf = g_malloc0 (TPM_RESPONSE_HEADER_SIZE);
+    buf [0] = 0x80;
+    buf [1] = 0x01;
+    buf [5] = TPM_RESPONSE_HEADER_SIZE;
+    response = tpm2_response_new (connection,
+                                  buf,
+                                  TPM_RESPONSE_HEADER_SIZE,
+                                  (TPMA_CC){ 0 });
+
+    sink = response_sink_new (TRUE);
+    g_signal_connect (sink,
+                      "response-written",
+                      (GCallback) response_sink_written_cb,
+                      &count);
+    start = g_get_monotonic_time ();
+    sink_enqueue (SINK (sink), G_OBJECT (response));
+    assert_true (g_get_monotonic_time () - start < G_USEC_PER_SEC);
+    assert_int_equal (count, 1);
+    while ((ret = read (client_fd, buf_out, sizeof (buf_out))) > 0);
+    assert_int_equal (ret, 0);
+
+    g_object_unref (response);
+    g_object_unref (connection);
+    g_object_unref (sink);
+    close (client_fd);
+}
 
 int
 main (void)
 {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test (response_sink_allocate_test),
+        cmocka_unit_test (response_sink_direct_test),
+        cmocka_unit_test (response_sink_direct_stalled_test),
     };
     return cmocka_run_group_tests (tests, NULL, NULL);
 }
@@ -0,0 +1,196 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tabrmd-capture.h"
+#include "util.h"
+
+typedef struct {
+    gchar *dir;
+    gchar *path;
+} test_data_t;
+
+static int
+tabrmd_capture_setup (void **state)
+{
+    test_data_t *data = calloc (1, sizeof (test_data_t));
+
+    data->dir = g_dir_make_tmp ("tabrmd-capture-XXXXXX", NULL);
+    if (data->dir == NULL) {
+        free (data);
+        return -1;
+    }
+    data->path = g_build_filename (data->dir, "capture", NULL);
+    *state = data;
+    return 0;
+}
+static int
+tabrmd_capture_teardown (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+
+    tabrmd_capture_close ();
+    g_unlink (data->path);
+    g_rmdir (data->dir);
+    g_free (data->path);
+    g_free (data->dir);
+    free (data);
+    return 0;
+}
+static FILE*
+open_capture (test_data_t *data)
+{
+    tabrmd_capture_header_t header;
+    GError *error = NULL;
+    FILE *file;
+
+    file = fopen (data->path, "rb");
+    assert_non_null (file);
+    assert_true (tabrmd_capture_read_header (file, &header, &error));
+    assert_int_equal (header.record_size, sizeof (tabrmd_capture_record_t));
+    return file;
+}
+/*
+ * Records read back in the order they were written with their connection
+ * id, type and buffer intact. The file is private to the daemon.
+ */
+static void
+tabrmd_capture_round_trip_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    tabrmd_capture_record_t record;
+    guint8 command [] = { 0x80, 0x01, 0x00, 0x00, 0x00, 0x0c,
+                          0x00, 0x00, 0x01, 0x7b, 0x00, 0x08 };
+    guint8 response [] = { 0x80, 0x01, 0x00, 0x00, 0x00, 0x0a,
+                           0x00, 0x00, 0x00, 0x00 };
+    GError *error = NULL;
+    GStatBuf buf;
+    guint8 *buffer;
+    gint64 now = g_get_monotonic_time ();
+    FILE *file;
+
+    assert_true (tabrmd_capture_open (data->path, &error));
+    assert_true (tabrmd_capture_enabled ());
+    tabrmd_capture_write (TABRMD_CAPTURE_COMMAND, 7, now,
+                          command, sizeof (command));
+    tabrmd_capture_write (TABRMD_CAPTURE_RESPONSE, 7, now + 10,
+                          response, sizeof (response));
+    tabrmd_capture_close ();
+    assert_false (tabrmd_capture_enabled ());
+    assert_int_equal (g_stat (data->path, &buf), 0);
+    assert_int_equal (buf.st_mode & 0777, 0600);
+
+    file = open_capture (data);
+    assert_int_equal (tabrmd_capture_read_record (file, &record, &buffer,
+                                                  &error), 1);
+    assert_int_equal (record.connection_id, 7);
+    assert_int_equal (record.type, TABRMD_CAPTURE_COMMAND);
+    assert_int_equal (record.size, sizeof (command));
+    assert_memory_equal (buffer, command, sizeof (command));
+    g_free (buffer);
+    assert_int_equal (tabrmd_capture_read_record (file, &record, &buffer,
+                                                  &error), 1);
+    assert_int_equal (record.connection_id, 7);
+    assert_int_equal (record.type, TABRMD_CAPTURE_RESPONSE);
+    assert_int_equal (record.size, sizeof (response));
+    assert_memory_equal (buffer, response, sizeof (response));
+    g_free (buffer);
+    assert_int_equal (tabrmd_capture_read_record (file, &record, &buffer,
+                                                  &error), 0);
+    fclose (file);
+}
+/* Nothing is written once capture is closed. */
+static void
+tabrmd_capture_closed_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    tabrmd_capture_record_t record;
+    guint8 command [] = { 0x80, 0x01 };
+    GError *error = NULL;
+    guint8 *buffer;
+    FILE *file;
+
+    assert_true (tabrmd_capture_open (data->path, &error));
+    tabrmd_capture_close ();
+    tabrmd_capture_write (TABRMD_CAPTURE_COMMAND, 1, g_get_monotonic_time (),
+                          command, sizeof (command));
+    file = open_capture (data);
+    assert_int_equal (tabrmd_capture_read_record (file, &record, &buffer,
+                                                  &error), 0);
+    fclose (file);
+}
+static void
+tabrmd_capture_bad_magic_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    tabrmd_capture_header_t header = { .magic = 0 };
+    GError *error = NULL;
+    FILE *file;
+
+    assert_true (g_file_set_contents (data->path, (gchar*)&header,
+                                      sizeof (header), &error));
+    file = fopen (data->path, "rb");
+    assert_non_null (file);
+    assert_false (tabrmd_capture_read_header (file, &header, &error));
+    assert_non_null (error);
+    g_clear_error (&error);
+    fclose (file);
+}
+/* A record whose buffer was cut short is an error, not the end. */
+static void
+tabrmd_capture_truncated_test (void **state)
+{
+    test_data_t *data = (test_data_t*)*state;
+    tabrmd_capture_record_t record;
+    guint8 command [] = { 0x80, 0x01, 0x00, 0x00, 0x00, 0x0a,
+                          0x00, 0x00, 0x01, 0x44 };
+    GError *error = NULL;
+    guint8 *buffer = NULL;
+    gchar *contents;
+    gsize length;
+    FILE *file;
+
+    assert_true (tabrmd_capture_open (data->path, &error));
+    tabrmd_capture_write (TABRMD_CAPTURE_COMMAND, 1, g_get_monotonic_time (),
+                          command, sizeof (command));
+    tabrmd_capture_close ();
+    assert_true (g_file_get_contents (data->path, &contents, &length,
+                                      &error));
+    assert_true (g_file_set_contents (data->path, contents, length - 1,
+                                      &error));
+    g_free (contents);
+
+    file = open_capture (data);
+    assert_int_equal (tabrmd_capture_read_record (file, &record, &buffer,
+                                                  &error), -1);
+    assert_null (buffer);
+    assert_non_null (error);
+    g_clear_error (&error);
+    fclose (file);
+}
+int
+main (void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown (tabrmd_capture_round_trip_test,
+                                         tabrmd_capture_setup,
+                                         tabrmd_capture_teardown),
+        cmocka_unit_test_setup_teardown (tabrmd_capture_closed_test,
+                                         tabrmd_capture_setup,
+                                         tabrmd_capture_teardown),
+        cmocka_unit_test_setup_teardown (tabrmd_capture_bad_magic_test,
+                                         tabrmd_capture_setup,
+                                         tabrmd_capture_teardown),
+        cmocka_unit_test_setup_teardown (tabrmd_capture_truncated_test,
+                                         tabrmd_capture_setup,
+                                         tabrmd_capture_teardown),
+    };
+    return cmocka_run_group_tests (tests, NULL, NULL);
+}
@@ -156,6 +156,7 @@ init_thread_func_random_fail (void **state)
 {
     UNUSED_PARAM (state);
 
+    will_return (__wrap_g_unix_signal_add, 1);
     will_return (__wrap_g_unix_signal_add, 1);
     will_return (__wrap_g_unix_signal_add, 1);
     will_return (__wrap_random_seed_from_file, 1);
@@ -189,6 +190,7 @@ init_thread_func_tcti_factory_fail (void **state)
 {
     UNUSED_PARAM (state);
 
+    will_return (__wrap_g_unix_signal_add, 1);
     will_return (__wrap_g_unix_signal_add, 1);
     will_return (__wrap_g_unix_signal_add, 1);
     will_return (__wrap_random_seed_from_file, 0);
@@ -211,6 +213,7 @@ init_thread_func_tpm2_init_fail (void **state)
     UNUSED_PARAM (state);
     TSS2_TCTI_CONTEXT *tcti_ctx = tcti_ctx_from_state (state);
 
+    will_return (__wrap_g_unix_signal_add, 1);
     will_return (__wrap_g_unix_signal_add, 1);
     will_return (__wrap_g_unix_signal_add, 1);
     will_return (__wrap_random_seed_from_file, 0);
@@ -241,6 +244,7 @@ init_thread_func_cmdattrs_fail (void **state)
     UNUSED_PARAM (state);
     TSS2_TCTI_CONTEXT *tcti_ctx = tcti_ctx_from_state (state);
 
+    will_return (__wrap_g_unix_signal_add, 1);
     will_return (__wrap_g_unix_signal_add, 1);
     will_return (__wrap_g_unix_signal_add, 1);
     will_return (__wrap_random_seed_from_file, 0);
@@ -264,6 +268,7 @@ init_thread_func_cmdsrc_fail (void **state)
     UNUSED_PARAM (state);
     TSS2_TCTI_CONTEXT *tcti_ctx = tcti_ctx_from_state (state);
 
+    will_return (__wrap_g_unix_signal_add, 1);
     will_return (__wrap_g_unix_signal_add, 1);
     will_return (__wrap_g_unix_signal_add, 1);
     will_return (__wrap_random_seed_from_file, 0);
@@ -281,6 +286,7 @@ init_thread_func_resmgr_fail (void **state)
     UNUSED_PARAM (state);
     TSS2_TCTI_CONTEXT *tcti_ctx = tcti_ctx_from_state (state);
 
+    will_return (__wrap_g_unix_signal_add, 1);
     will_return (__wrap_g_unix_signal_add, 1);
     will_return (__wrap_g_unix_signal_add, 1);
     will_return (__wrap_random_seed_from_file, 0);
@@ -299,6 +305,7 @@ init_thread_func_respsnk_fail (void **state)
     UNUSED_PARAM (state);
     TSS2_TCTI_CONTEXT *tcti_ctx = tcti_ctx_from_state (state);
 
+    will_return (__wrap_g_unix_signal_add, 1);
     will_return (__wrap_g_unix_signal_add, 1);
     will_return (__wrap_g_unix_signal_add, 1);
     will_return (__wrap_random_seed_from_file, 0);
@@ -318,6 +325,7 @@ init_thread_func_success (void **state)
     UNUSED_PARAM (state);
     TSS2_TCTI_CONTEXT *tcti_ctx = tcti_ctx_from_state (state);
 
+    will_return (__wrap_g_unix_signal_add, 1);
     will_return (__wrap_g_unix_signal_add, 1);
     will_return (__wrap_g_unix_signal_add, 1);
     will_return (__wrap_random_seed_from_file, 0);
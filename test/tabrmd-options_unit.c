@@ -39,11 +39,21 @@ __wrap_g_option_context_add_main_entries (
         if (strcmp (long_name, entries [i].long_name) == 0) {
             if (strcmp (long_name, "max-connections") == 0 ||
                 strcmp (long_name, "max-sessions") == 0 ||
-                strcmp (long_name, "max-transients") == 0)
+                strcmp (long_name, "max-transients") == 0 ||
+                strcmp (long_name, "max-in-flight") == 0 ||
+                strcmp (long_name, "queue-high-water") == 0 ||
+                strcmp (long_name, "reader-threads") == 0 ||
+                strcmp (long_name, "connection-pool-size") == 0 ||
+                strcmp (long_name, "slow-command-ms") == 0 ||
+                strcmp (long_name, "flight-recorder-events") == 0)
             {
                 *(guint*)entries [i].arg_data = mock_type (guint);
             }
-            if (strcmp (long_name, "tcti") == 0) {
+            if (strcmp (long_name, "tcti") == 0 ||
+                strcmp (long_name, "metrics-socket") == 0 ||
+                strcmp (long_name, "flight-recorder-file") == 0 ||
+                strcmp (long_name, "capture-file") == 0)
+            {
                 *(char**)entries [i].arg_data = g_strdup (mock_type (char*));
             }
         }
@@ -160,6 +170,176 @@ tcti_conf_parse_opts_max_transient_fail (void **state)
     will_return (__wrap_set_logger, 0);
     assert_false (parse_opts (argc, argv, &options));
 }
+static void
+tcti_conf_parse_opts_max_in_flight_fail (void **state)
+{
+    UNUSED_PARAM (state);
+    tabrmd_options_t options = TABRMD_OPTIONS_INIT_DEFAULT;
+    GOptionContext *ctx = NULL;
+    int argc = 0;
+    char **argv = NULL;
+    GError error = { .message = "foo", };
+
+    will_return (__wrap_g_option_context_new, ctx);
+    will_return (__wrap_g_option_context_add_main_entries, "max-in-flight");
+    will_return (__wrap_g_option_context_add_main_entries, 0);
+    will_return (__wrap_g_option_context_parse, &error);
+    will_return (__wrap_g_option_context_parse, TRUE);
+    will_return (__wrap_set_logger, 0);
+    assert_false (parse_opts (argc, argv, &options));
+}
+static void
+tcti_conf_parse_opts_queue_high_water_fail (void **state)
+{
+    UNUSED_PARAM (state);
+    tabrmd_options_t options = TABRMD_OPTIONS_INIT_DEFAULT;
+    GOptionContext *ctx = NULL;
+    int argc = 0;
+    char **argv = NULL;
+    GError error = { .message = "foo", };
+
+    will_return (__wrap_g_option_context_new, ctx);
+    will_return (__wrap_g_option_context_add_main_entries, "queue-high-water");
+    will_return (__wrap_g_option_context_add_main_entries, 0);
+    will_return (__wrap_g_option_context_parse, &error);
+    will_return (__wrap_g_option_context_parse, TRUE);
+    will_return (__wrap_set_logger, 0);
+    assert_false (parse_opts (argc, argv, &options));
+}
+static void
+tcti_conf_parse_opts_reader_threads_fail (void **state)
+{
+    UNUSED_PARAM (state);
+    tabrmd_options_t options = TABRMD_OPTIONS_INIT_DEFAULT;
+    GOptionContext *ctx = NULL;
+    int argc = 0;
+    char **argv = NULL;
+    GError error = { .message = "foo", };
+
+    will_return (__wrap_g_option_context_new, ctx);
+    will_return (__wrap_g_option_context_add_main_entries, "reader-threads");
+    will_return (__wrap_g_option_context_add_main_entries, 0);
+    will_return (__wrap_g_option_context_parse, &error);
+    will_return (__wrap_g_option_context_parse, TRUE);
+    will_return (__wrap_set_logger, 0);
+    assert_false (parse_opts (argc, argv, &options));
+}
+static void
+tcti_conf_parse_opts_connection_pool_size_fail (void **state)
+{
+    UNUSED_PARAM (state);
+    tabrmd_options_t options = TABRMD_OPTIONS_INIT_DEFAULT;
+    GOptionContext *ctx = NULL;
+    int argc = 0;
+    char **argv = NULL;
+    GError error = { .message = "foo", };
+
+    will_return (__wrap_g_option_context_new, ctx);
+    will_return (__wrap_g_option_context_add_main_entries, "connection-pool-size");
+    will_return (__wrap_g_option_context_add_main_entries,
+                 TABRMD_CONNECTION_POOL_SIZE_MAX + 1);
+    will_return (__wrap_g_option_context_parse, &error);
+    will_return (__wrap_g_option_context_parse, TRUE);
+    will_return (__wrap_set_logger, 0);
+    assert_false (parse_opts (argc, argv, &options));
+}
+static void
+tcti_conf_parse_opts_metrics_socket_fail (void **state)
+{
+    UNUSED_PARAM (state);
+    tabrmd_options_t options = TABRMD_OPTIONS_INIT_DEFAULT;
+    GOptionContext *ctx = NULL;
+    int argc = 0;
+    char **argv = NULL;
+    GError error = { .message = "foo", };
+
+    will_return (__wrap_g_option_context_new, ctx);
+    will_return (__wrap_g_option_context_add_main_entries, "metrics-socket");
+    will_return (__wrap_g_option_context_add_main_entries, "tabrmd.sock");
+    will_return (__wrap_g_option_context_parse, &error);
+    will_return (__wrap_g_option_context_parse, TRUE);
+    will_return (__wrap_set_logger, 0);
+    assert_false (parse_opts (argc, argv, &options));
+    assert_null (options.metrics_socket);
+}
+static void
+tcti_conf_parse_opts_slow_command_ms_fail (void **state)
+{
+    UNUSED_PARAM (state);
+    tabrmd_options_t options = TABRMD_OPTIONS_INIT_DEFAULT;
+    GOptionContext *ctx = NULL;
+    int argc = 0;
+    char **argv = NULL;
+    GError error = { .message = "foo", };
+
+    will_return (__wrap_g_option_context_new, ctx);
+    will_return (__wrap_g_option_context_add_main_entries, "slow-command-ms");
+    will_return (__wrap_g_option_context_add_main_entries,
+                 TABRMD_SLOW_COMMAND_MS_MAX + 1);
+    will_return (__wrap_g_option_context_parse, &error);
+    will_return (__wrap_g_option_context_parse, TRUE);
+    will_return (__wrap_set_logger, 0);
+    assert_false (parse_opts (argc, argv, &options));
+}
+static void
+tcti_conf_parse_opts_flight_recorder_events_fail (void **state)
+{
+    UNUSED_PARAM (state);
+    tabrmd_options_t options = TABRMD_OPTIONS_INIT_DEFAULT;
+    GOptionContext *ctx = NULL;
+    int argc = 0;
+    char **argv = NULL;
+    GError error = { .message = "foo", };
+
+    will_return (__wrap_g_option_context_new, ctx);
+    will_return (__wrap_g_option_context_add_main_entries,
+                 "flight-recorder-events");
+    will_return (__wrap_g_option_context_add_main_entries,
+                 TABRMD_FLIGHT_RECORDER_EVENTS_MAX + 1);
+    will_return (__wrap_g_option_context_parse, &error);
+    will_return (__wrap_g_option_context_parse, TRUE);
+    will_return (__wrap_set_logger, 0);
+    assert_false (parse_opts (argc, argv, &options));
+}
+static void
+tcti_conf_parse_opts_flight_recorder_file_fail (void **state)
+{
+    UNUSED_PARAM (state);
+    tabrmd_options_t options = TABRMD_OPTIONS_INIT_DEFAULT;
+    GOptionContext *ctx = NULL;
+    int argc = 0;
+    char **argv = NULL;
+    GError error = { .message = "foo", };
+
+    will_return (__wrap_g_option_context_new, ctx);
+    will_return (__wrap_g_option_context_add_main_entries,
+                 "flight-recorder-file");
+    will_return (__wrap_g_option_context_add_main_entries, "tabrmd.dump");
+    will_return (__wrap_g_option_context_parse, &error);
+    will_return (__wrap_g_option_context_parse, TRUE);
+    will_return (__wrap_set_logger, 0);
+    assert_false (parse_opts (argc, argv, &options));
+    assert_null (options.flight_recorder_file);
+}
+static void
+tcti_conf_parse_opts_capture_file_fail (void **state)
+{
+    UNUSED_PARAM (state);
+    tabrmd_options_t options = TABRMD_OPTIONS_INIT_DEFAULT;
+    GOptionContext *ctx = NULL;
+    int argc = 0;
+    char **argv = NULL;
+    GError error = { .message = "foo", };
+
+    will_return (__wrap_g_option_context_new, ctx);
+    will_return (__wrap_g_option_context_add_main_entries, "capture-file");
+    will_return (__wrap_g_option_context_add_main_entries, "tabrmd.cap");
+    will_return (__wrap_g_option_context_parse, &error);
+    will_return (__wrap_g_option_context_parse, TRUE);
+    will_return (__wrap_set_logger, 0);
+    assert_false (parse_opts (argc, argv, &options));
+    assert_null (options.capture_file);
+}
 void
 __wrap_g_option_context_free (GOptionContext *context)
 {
@@ -197,6 +377,15 @@ main (void)
         cmocka_unit_test (tcti_conf_parse_opts_max_connections_fail),
         cmocka_unit_test (tcti_conf_parse_opts_max_sessions_fail),
         cmocka_unit_test (tcti_conf_parse_opts_max_transient_fail),
+        cmocka_unit_test (tcti_conf_parse_opts_max_in_flight_fail),
+        cmocka_unit_test (tcti_conf_parse_opts_queue_high_water_fail),
+        cmocka_unit_test (tcti_conf_parse_opts_reader_threads_fail),
+        cmocka_unit_test (tcti_conf_parse_opts_connection_pool_size_fail),
+        cmocka_unit_test (tcti_conf_parse_opts_metrics_socket_fail),
+        cmocka_unit_test (tcti_conf_parse_opts_slow_command_ms_fail),
+        cmocka_unit_test (tcti_conf_parse_opts_flight_recorder_events_fail),
+        cmocka_unit_test (tcti_conf_parse_opts_flight_recorder_file_fail),
+        cmocka_unit_test (tcti_conf_parse_opts_capture_file_fail),
         cmocka_unit_test (tcti_conf_parse_opts_success),
     };
     return cmocka_run_group_tests (tests, NULL, NULL);
@@ -0,0 +1,163 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tabrmd-recorder.h"
+#include "util.h"
+
+#define RECORDER_CAPACITY 4
+
+static int
+tabrmd_recorder_setup (void **state)
+{
+    UNUSED_PARAM (state);
+    return tabrmd_recorder_init (RECORDER_CAPACITY, NULL) ? 0 : -1;
+}
+static int
+tabrmd_recorder_teardown (void **state)
+{
+    UNUSED_PARAM (state);
+    tabrmd_recorder_cleanup ();
+    return 0;
+}
+static void
+record_events (guint count)
+{
+    tabrmd_recorder_event_t event = { 0 };
+    guint i;
+
+    for (i = 0; i < count; ++i) {
+        event.connection_id = i;
+        event.command_code = TPM2_CC_Sign;
+        tabrmd_recorder_record (&event);
+    }
+}
+static void
+tabrmd_recorder_disabled_test (void **state)
+{
+    UNUSED_PARAM (state);
+    assert_true (tabrmd_recorder_init (0, NULL));
+    assert_false (tabrmd_recorder_enabled ());
+    record_events (1);
+    assert_null (tabrmd_recorder_snapshot ());
+}
+static void
+tabrmd_recorder_snapshot_empty_test (void **state)
+{
+    tabrmd_recorder_header_t *header;
+    GBytes *dump;
+    gsize size;
+
+    UNUSED_PARAM (state);
+    dump = tabrmd_recorder_snapshot ();
+    header = (tabrmd_recorder_header_t*)g_bytes_get_data (dump, &size);
+    assert_int_equal (size, sizeof (*header));
+    assert_int_equal (header->magic, TABRMD_RECORDER_MAGIC);
+    assert_int_equal (header->version, TABRMD_RECORDER_VERSION);
+    assert_int_equal (header->event_size, sizeof (tabrmd_recorder_event_t));
+    assert_int_equal (header->capacity, RECORDER_CAPACITY);
+    assert_int_equal (header->event_count, 0);
+    g_bytes_unref (dump);
+}
+/*
+ * Once the ring has wrapped the dump holds the last 'capacity' events,
+ * oldest first.
+ */
+static void
+tabrmd_recorder_snapshot_wrap_test (void **state)
+{
+    tabrmd_recorder_header_t *header;
+    tabrmd_recorder_event_t *events;
+    GBytes *dump;
+    gsize size;
+    guint i;
+
+    UNUSED_PARAM (state);
+    record_events (RECORDER_CAPACITY + 2);
+    dump = tabrmd_recorder_snapshot ();
+    header = (tabrmd_recorder_header_t*)g_bytes_get_data (dump, &size);
+    assert_int_equal (header->event_count, RECORDER_CAPACITY);
+    assert_int_equal (header->next, RECORDER_CAPACITY + 3);
+    assert_int_equal (size, sizeof (*header) +
+                      RECORDER_CAPACITY * sizeof (tabrmd_recorder_event_t));
+    events = (tabrmd_recorder_event_t*)(header + 1);
+    for (i = 0; i < RECORDER_CAPACITY; ++i) {
+        assert_int_equal (events [i].sequence, i + 3);
+        assert_int_equal (events [i].connection_id, i + 2);
+        assert_int_equal (events [i].command_code, TPM2_CC_Sign);
+    }
+    g_bytes_unref (dump);
+}
+/* The dump file is the snapshot byte for byte and private to the daemon. */
+static void
+tabrmd_recorder_write_test (void **state)
+{
+    tabrmd_recorder_header_t *header;
+    GError *error = NULL;
+    GStatBuf buf;
+    gchar *dir, *path, *contents;
+    gsize length;
+
+    UNUSED_PARAM (state);
+    dir = g_dir_make_tmp ("tabrmd-recorder-XXXXXX", &error);
+    assert_non_null (dir);
+    path = g_build_filename (dir, "dump", NULL);
+    record_events (2);
+    assert_true (tabrmd_recorder_write (path, &error));
+    assert_true (g_file_get_contents (path, &contents, &length, &error));
+    header = (tabrmd_recorder_header_t*)contents;
+    assert_int_equal (length, sizeof (*header) +
+                      2 * sizeof (tabrmd_recorder_event_t));
+    assert_int_equal (header->magic, TABRMD_RECORDER_MAGIC);
+    assert_int_equal (header->event_count, 2);
+    assert_int_equal (g_stat (path, &buf), 0);
+    assert_int_equal (buf.st_mode & 0777, 0600);
+
+    g_free (contents);
+    g_unlink (path);
+    g_rmdir (dir);
+    g_free (path);
+    g_free (dir);
+}
+/*
+ * Dumps are made from inside the log handler so the outcome is returned
+ * rather than logged.
+ */
+static void
+tabrmd_recorder_dump_no_file_test (void **state)
+{
+    gchar *message;
+
+    UNUSED_PARAM (state);
+    assert_null (tabrmd_recorder_on_critical ());
+    message = tabrmd_recorder_dump ("test");
+    assert_non_null (strstr (message, "no dump file configured"));
+    g_free (message);
+}
+int
+main (void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_teardown (tabrmd_recorder_disabled_test,
+                                   tabrmd_recorder_teardown),
+        cmocka_unit_test_setup_teardown (tabrmd_recorder_snapshot_empty_test,
+                                         tabrmd_recorder_setup,
+                                         tabrmd_recorder_teardown),
+        cmocka_unit_test_setup_teardown (tabrmd_recorder_snapshot_wrap_test,
+                                         tabrmd_recorder_setup,
+                                         tabrmd_recorder_teardown),
+        cmocka_unit_test_setup_teardown (tabrmd_recorder_write_test,
+                                         tabrmd_recorder_setup,
+                                         tabrmd_recorder_teardown),
+        cmocka_unit_test_setup_teardown (tabrmd_recorder_dump_no_file_test,
+                                         tabrmd_recorder_setup,
+                                         tabrmd_recorder_teardown),
+    };
+    return cmocka_run_group_tests (tests, NULL, NULL);
+}
@@ -0,0 +1,291 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#include <glib.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tabrmd-stats.h"
+#include "util.h"
+
+static int
+tabrmd_stats_setup (void **state)
+{
+    UNUSED_PARAM (state);
+    tabrmd_stats_reset ();
+    return 0;
+}
+/*
+ * Lookup a single value in the a{st} dictionary returned by
+ * tabrmd_stats_to_variant. Returns -1 if the key isn't present.
+ */
+static gint64
+stats_lookup (const gchar *key)
+{
+    GVariant *dict;
+    guint64 value;
+    gint64 ret = -1;
+
+    dict = tabrmd_stats_to_variant ();
+    if (g_variant_lookup (dict, key, "t", &value)) {
+        ret = (gint64)value;
+    }
+    g_variant_unref (g_variant_ref_sink (dict));
+    return ret;
+}
+/*
+ * Commands in the TPM2_CC range are counted individually, everything else
+ * ends up in 'commands.other'.
+ */
+static void
+tabrmd_stats_command_test (void **state)
+{
+    tabrmd_stats_t stats;
+    UNUSED_PARAM (state);
+
+    tabrmd_stats_command (TPM2_CC_FIRST);
+    tabrmd_stats_command (TPM2_CC_FIRST);
+    tabrmd_stats_command (TPM2_CC_FIRST + TABRMD_STATS_CC_COUNT - 1);
+    tabrmd_stats_command (TPM2_CC_FIRST + TABRMD_STATS_CC_COUNT);
+    tabrmd_stats_command (0x20000001);
+    tabrmd_stats_command (0);
+
+    tabrmd_stats_snapshot (&stats);
+    assert_int_equal (stats.commands [0], 2);
+    assert_int_equal (stats.commands [TABRMD_STATS_CC_COUNT - 1], 1);
+    assert_int_equal (stats.commands_other, 3);
+}
+/*
+ * Format one TPM response codes have the parameter / handle / session
+ * number stripped. Format zero and response codes from other layers are
+ * left alone.
+ */
+static void
+tabrmd_stats_normalize_rc_test (void **state)
+{
+    UNUSED_PARAM (state);
+
+    /* TPM2_RC_VALUE for parameter 1 */
+    assert_int_equal (tabrmd_stats_normalize_rc (0x000001c4), 0x00000084);
+    /* TPM2_RC_HANDLE for handle 2 */
+    assert_int_equal (tabrmd_stats_normalize_rc (0x0000028b), 0x0000008b);
+    /* TPM2_RC_CONTEXT_GAP is format zero */
+    assert_int_equal (tabrmd_stats_normalize_rc (0x00000901), 0x00000901);
+    assert_int_equal (tabrmd_stats_normalize_rc (TSS2_RC_SUCCESS),
+                      TSS2_RC_SUCCESS);
+    /* RM layer response codes are not touched */
+    assert_int_equal (tabrmd_stats_normalize_rc (0x000b01c4), 0x000b01c4);
+}
+static void
+tabrmd_stats_response_test (void **state)
+{
+    UNUSED_PARAM (state);
+
+    tabrmd_stats_response (TSS2_RC_SUCCESS);
+    tabrmd_stats_response (TSS2_RC_SUCCESS);
+    tabrmd_stats_response (0x000001c4);
+    tabrmd_stats_response (0x000002c4);
+
+    assert_int_equal (stats_lookup ("responses.0x00000000"), 2);
+    assert_int_equal (stats_lookup ("responses.0x00000084"), 2);
+    assert_int_equal (stats_lookup ("responses.0x000001c4"), -1);
+    assert_int_equal (stats_lookup ("responses.other"), 0);
+}
+/*
+ * Once every slot in the response table is claimed new response codes are
+ * counted in 'responses.other' while existing ones are still counted
+ * individually.
+ */
+static void
+tabrmd_stats_response_full_test (void **state)
+{
+    TSS2_RC rc;
+    UNUSED_PARAM (state);
+
+    for (rc = 0x00100000; rc < 0x00100000 + TABRMD_STATS_RC_SLOTS; ++rc) {
+        tabrmd_stats_response (rc);
+    }
+    tabrmd_stats_response (0x00200000);
+    tabrmd_stats_response (0x00100000);
+
+    assert_int_equal (stats_lookup ("responses.0x00100000"), 2);
+    assert_int_equal (stats_lookup ("responses.other"), 1);
+}
+static void
+tabrmd_stats_queue_test (void **state)
+{
+    UNUSED_PARAM (state);
+
+    tabrmd_stats_queue (1);
+    tabrmd_stats_queue (1);
+    tabrmd_stats_queue (1);
+    tabrmd_stats_queue (-2);
+    tabrmd_stats_queue (1);
+
+    assert_int_equal (stats_lookup ("queue.depth"), 2);
+    assert_int_equal (stats_lookup ("queue.depth-max"), 3);
+}
+static void
+tabrmd_stats_connection_test (void **state)
+{
+    UNUSED_PARAM (state);
+
+    tabrmd_stats_connection (1);
+    tabrmd_stats_connection (1);
+    tabrmd_stats_connection (-1);
+
+    assert_int_equal (stats_lookup ("connections"), 1);
+    assert_int_equal (stats_lookup ("connections.total"), 2);
+}
+/*
+ * Sessions move between states, with -1 used for sessions being created
+ * and destroyed.
+ */
+static void
+tabrmd_stats_session_state_test (void **state)
+{
+    UNUSED_PARAM (state);
+
+    tabrmd_stats_session_state (-1, SESSION_ENTRY_LOADED);
+    tabrmd_stats_session_state (-1, SESSION_ENTRY_LOADED);
+    tabrmd_stats_session_state (SESSION_ENTRY_LOADED, SESSION_ENTRY_SAVED_RM);
+    tabrmd_stats_session_state (SESSION_ENTRY_SAVED_RM,
+                                SESSION_ENTRY_SAVED_CLIENT);
+    tabrmd_stats_session_state (SESSION_ENTRY_SAVED_CLIENT,
+                                SESSION_ENTRY_SAVED_CLIENT_CLOSED);
+    tabrmd_stats_session_state (SESSION_ENTRY_LOADED, -1);
+    tabrmd_stats_inc (TABRMD_STATS_SESSION_ABANDONED);
+
+    assert_int_equal (stats_lookup ("sessions.loaded"), 0);
+    assert_int_equal (stats_lookup ("sessions.saved-rm"), 0);
+    assert_int_equal (stats_lookup ("sessions.saved-client"), 0);
+    assert_int_equal (stats_lookup ("sessions.saved-client-closed"), 1);
+    assert_int_equal (stats_lookup ("sessions.abandoned"), 1);
+}
+/*
+ * Per-command entries only show up once the command has been seen while
+ * the fixed counters are always present.
+ */
+static void
+tabrmd_stats_to_variant_test (void **state)
+{
+    UNUSED_PARAM (state);
+
+    assert_int_equal (stats_lookup ("commands.0x0000017b"), -1);
+    tabrmd_stats_command (0x0000017b);
+    tabrmd_stats_inc (TABRMD_STATS_CONTEXT_LOAD);
+    tabrmd_stats_inc (TABRMD_STATS_CONTEXT_SAVE);
+    tabrmd_stats_inc (TABRMD_STATS_CONTEXT_SAVE);
+    tabrmd_stats_inc (TABRMD_STATS_REGAP);
+
+    assert_int_equal (stats_lookup ("commands.0x0000017b"), 1);
+    assert_int_equal (stats_lookup ("context.loads"), 1);
+    assert_int_equal (stats_lookup ("context.saves"), 2);
+    assert_int_equal (stats_lookup ("context.flushes"), 0);
+    assert_int_equal (stats_lookup ("context.regaps"), 1);
+    assert_int_equal (stats_lookup ("quota.rejections"), 0);
+}
+/*
+ * Bucket 'i' holds durations up to 2^i microseconds, everything past the
+ * last bound lands in the last bucket.
+ */
+static void
+tabrmd_stats_hist_bucket_test (void **state)
+{
+    UNUSED_PARAM (state);
+
+    assert_int_equal (tabrmd_stats_hist_bucket (0), 0);
+    assert_int_equal (tabrmd_stats_hist_bucket (1), 0);
+    assert_int_equal (tabrmd_stats_hist_bucket (2), 1);
+    assert_int_equal (tabrmd_stats_hist_bucket (3), 2);
+    assert_int_equal (tabrmd_stats_hist_bucket (4), 2);
+    assert_int_equal (tabrmd_stats_hist_bucket (1025), 11);
+    assert_int_equal (tabrmd_stats_hist_bucket (G_MAXINT64),
+                      TABRMD_STATS_HIST_BUCKETS - 1);
+}
+static void
+tabrmd_stats_observe_test (void **state)
+{
+    UNUSED_PARAM (state);
+    tabrmd_stats_t *stats = g_new0 (tabrmd_stats_t, 1);
+
+    tabrmd_stats_observe (TABRMD_STATS_HIST_COMMAND, 3);
+    tabrmd_stats_observe (TABRMD_STATS_HIST_COMMAND, 100);
+    tabrmd_stats_observe (TABRMD_STATS_HIST_COMMAND, -5);
+    tabrmd_stats_observe_tpm (TPM2_CC_GetRandom, 50);
+    tabrmd_stats_observe_tpm (0x20000000, 50);
+    tabrmd_stats_snapshot (stats);
+
+    assert_int_equal (stats->hists [TABRMD_STATS_HIST_COMMAND].count, 3);
+    assert_int_equal (stats->hists [TABRMD_STATS_HIST_COMMAND].sum, 103);
+    assert_int_equal (stats->hists [TABRMD_STATS_HIST_COMMAND].buckets [0], 1);
+    assert_int_equal (stats->hists [TABRMD_STATS_HIST_COMMAND].buckets [2], 1);
+    assert_int_equal (stats->hists [TABRMD_STATS_HIST_COMMAND].buckets [7], 1);
+    assert_int_equal (stats->hists [TABRMD_STATS_HIST_LOAD_HANDLES].count, 0);
+    assert_int_equal (
+        stats->tpm [TPM2_CC_GetRandom - TABRMD_STATS_CC_FIRST].count, 1);
+    assert_int_equal (stats->tpm_other.count, 1);
+    g_free (stats);
+}
+/*
+ * Spot check the exposition format: cumulative buckets with bounds in
+ * seconds, per command TPM histograms only once the command has been seen.
+ */
+static void
+tabrmd_stats_to_prometheus_test (void **state)
+{
+    UNUSED_PARAM (state);
+    gchar *text;
+
+    tabrmd_stats_command (TPM2_CC_GetRandom);
+    tabrmd_stats_observe (TABRMD_STATS_HIST_COMMAND, 3);
+    tabrmd_stats_observe_tpm (TPM2_CC_GetRandom, 2);
+    text = tabrmd_stats_to_prometheus ();
+
+    assert_non_null (strstr (text, "# TYPE tabrmd_commands_total counter\n"));
+    assert_non_null (strstr (text,
+        "tabrmd_commands_total{code=\"0x0000017b\"} 1\n"));
+    assert_non_null (strstr (text,
+        "tabrmd_command_duration_seconds_bucket{le=\"0.000002\"} 0\n"));
+    assert_non_null (strstr (text,
+        "tabrmd_command_duration_seconds_bucket{le=\"0.000004\"} 1\n"));
+    assert_non_null (strstr (text,
+        "tabrmd_command_duration_seconds_bucket{le=\"+Inf\"} 1\n"));
+    assert_non_null (strstr (text, "tabrmd_command_duration_seconds_count 1\n"));
+    assert_non_null (strstr (text,
+        "tabrmd_tpm_duration_seconds_bucket{code=\"0x0000017b\",le=\"0.000002\"} 1\n"));
+    assert_non_null (strstr (text,
+        "tabrmd_tpm_duration_seconds_count{code=\"0x0000017b\"} 1\n"));
+    assert_null (strstr (text, "code=\"0x00000176\""));
+    g_free (text);
+}
+gint
+main (void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup (tabrmd_stats_command_test,
+                                tabrmd_stats_setup),
+        cmocka_unit_test_setup (tabrmd_stats_normalize_rc_test,
+                                tabrmd_stats_setup),
+        cmocka_unit_test_setup (tabrmd_stats_response_test,
+                                tabrmd_stats_setup),
+        cmocka_unit_test_setup (tabrmd_stats_response_full_test,
+                                tabrmd_stats_setup),
+        cmocka_unit_test_setup (tabrmd_stats_queue_test,
+                                tabrmd_stats_setup),
+        cmocka_unit_test_setup (tabrmd_stats_connection_test,
+                                tabrmd_stats_setup),
+        cmocka_unit_test_setup (tabrmd_stats_session_state_test,
+                                tabrmd_stats_setup),
+        cmocka_unit_test_setup (tabrmd_stats_to_variant_test,
+                                tabrmd_stats_setup),
+        cmocka_unit_test (tabrmd_stats_hist_bucket_test),
+        cmocka_unit_test_setup (tabrmd_stats_observe_test,
+                                tabrmd_stats_setup),
+        cmocka_unit_test_setup (tabrmd_stats_to_prometheus_test,
+                                tabrmd_stats_setup),
+    };
+    return cmocka_run_group_tests (tests, NULL, NULL);
+}
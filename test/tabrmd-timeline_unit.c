@@ -0,0 +1,201 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+#include <glib.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tabrmd-timeline.h"
+#include "util.h"
+
+static int
+tabrmd_timeline_setup (void **state)
+{
+    tabrmd_timeline_t *timeline;
+
+    tabrmd_stats_reset ();
+    tabrmd_timeline_set_slow_threshold (0);
+    timeline = tabrmd_timeline_new (3, TPM2_CC_Sign, 1000);
+    *state = timeline;
+    return 0;
+}
+static int
+tabrmd_timeline_teardown (void **state)
+{
+    g_clear_pointer ((tabrmd_timeline_t**)state, tabrmd_timeline_unref);
+    return 0;
+}
+/*
+ * Stamp every stage of a command sent to the TPM. Saving contexts and
+ * writing the response both start when the TPM responds.
+ */
+static void
+timeline_stamp_all (tabrmd_timeline_t *timeline)
+{
+    timeline->stamps [TABRMD_STAGE_DEQUEUE]      = 1010;
+    timeline->stamps [TABRMD_STAGE_LOADED]       = 1030;
+    timeline->stamps [TABRMD_STAGE_TPM_SENT]     = 1060;
+    timeline->stamps [TABRMD_STAGE_TPM_RECEIVED] = 1100;
+    timeline->stamps [TABRMD_STAGE_SAVED]        = 1250;
+    timeline->stamps [TABRMD_STAGE_WRITTEN]      = 1150;
+}
+static void
+tabrmd_timeline_stage_usec_test (void **state)
+{
+    tabrmd_timeline_t *timeline = *state;
+
+    timeline_stamp_all (timeline);
+    assert_int_equal (tabrmd_timeline_stage_usec (timeline,
+                                                  TABRMD_STAGE_READ), -1);
+    assert_int_equal (tabrmd_timeline_stage_usec (timeline,
+                                                  TABRMD_STAGE_DEQUEUE), 10);
+    assert_int_equal (tabrmd_timeline_stage_usec (timeline,
+                                                  TABRMD_STAGE_LOADED), 20);
+    assert_int_equal (tabrmd_timeline_stage_usec (timeline,
+                                                  TABRMD_STAGE_TPM_SENT), 30);
+    assert_int_equal (tabrmd_timeline_stage_usec (timeline,
+                                                  TABRMD_STAGE_TPM_RECEIVED),
+                      40);
+    assert_int_equal (tabrmd_timeline_stage_usec (timeline,
+                                                  TABRMD_STAGE_SAVED), 150);
+    assert_int_equal (tabrmd_timeline_stage_usec (timeline,
+                                                  TABRMD_STAGE_WRITTEN), 50);
+    assert_int_equal (tabrmd_timeline_total_usec (timeline), 150);
+}
+/*
+ * A command handled by the ResourceManager never goes to the TPM. The
+ * later stages are measured from the last stage it did reach.
+ */
+static void
+tabrmd_timeline_stage_skipped_test (void **state)
+{
+    tabrmd_timeline_t *timeline = *state;
+
+    timeline->stamps [TABRMD_STAGE_DEQUEUE] = 1010;
+    timeline->stamps [TABRMD_STAGE_SAVED]   = 1040;
+    timeline->stamps [TABRMD_STAGE_WRITTEN] = 1025;
+    assert_int_equal (tabrmd_timeline_stage_usec (timeline,
+                                                  TABRMD_STAGE_LOADED), -1);
+    assert_int_equal (tabrmd_timeline_stage_usec (timeline,
+                                                  TABRMD_STAGE_TPM_RECEIVED),
+                      -1);
+    assert_int_equal (tabrmd_timeline_stage_usec (timeline,
+                                                  TABRMD_STAGE_SAVED), 30);
+    assert_int_equal (tabrmd_timeline_stage_usec (timeline,
+                                                  TABRMD_STAGE_WRITTEN), 15);
+}
+/* Without a response written there's no total. */
+static void
+tabrmd_timeline_total_unwritten_test (void **state)
+{
+    tabrmd_timeline_t *timeline = *state;
+
+    timeline->stamps [TABRMD_STAGE_DEQUEUE] = 1010;
+    assert_int_equal (tabrmd_timeline_total_usec (timeline), -1);
+}
+static void
+tabrmd_timeline_to_string_test (void **state)
+{
+    tabrmd_timeline_t *timeline = *state;
+    gchar *str;
+
+    timeline_stamp_all (timeline);
+    str = tabrmd_timeline_to_string (timeline);
+    assert_string_equal (str, "connection 3 command 0x0000015d took 150us: "
+                         "queue 10us, load 20us, dispatch 30us, tpm 40us, "
+                         "save 150us, write 50us");
+    g_free (str);
+}
+/*
+ * Dropping the last reference records each stage the command reached
+ * and the total.
+ */
+static void
+tabrmd_timeline_unref_test (void **state)
+{
+    tabrmd_timeline_t *timeline = *state;
+    tabrmd_stats_t stats;
+
+    timeline->stamps [TABRMD_STAGE_DEQUEUE] = 1010;
+    timeline->stamps [TABRMD_STAGE_WRITTEN] = 1100;
+    tabrmd_timeline_ref (timeline);
+    tabrmd_timeline_unref (timeline);
+    tabrmd_stats_snapshot (&stats);
+    assert_int_equal (stats.hists [TABRMD_STATS_HIST_COMMAND].count, 0);
+
+    g_clear_pointer ((tabrmd_timeline_t**)state, tabrmd_timeline_unref);
+    tabrmd_stats_snapshot (&stats);
+    assert_int_equal (stats.stages [TABRMD_STAGE_DEQUEUE].count, 1);
+    assert_int_equal (stats.stages [TABRMD_STAGE_DEQUEUE].sum, 10);
+    assert_int_equal (stats.stages [TABRMD_STAGE_LOADED].count, 0);
+    assert_int_equal (stats.stages [TABRMD_STAGE_WRITTEN].count, 1);
+    assert_int_equal (stats.stages [TABRMD_STAGE_WRITTEN].sum, 90);
+    assert_int_equal (stats.hists [TABRMD_STATS_HIST_COMMAND].count, 1);
+    assert_int_equal (stats.hists [TABRMD_STATS_HIST_COMMAND].sum, 100);
+}
+/*
+ * Dropping the last reference copies the command into the flight
+ * recorder.
+ */
+static void
+tabrmd_timeline_record_test (void **state)
+{
+    tabrmd_timeline_t *timeline = *state;
+    tabrmd_recorder_header_t *header;
+    tabrmd_recorder_event_t *event;
+    GBytes *dump;
+    guint i;
+
+    assert_true (tabrmd_recorder_init (2, NULL));
+    timeline_stamp_all (timeline);
+    tabrmd_timeline_set_response_code (timeline, TPM2_RC_SUCCESS);
+    for (i = 0; i < TABRMD_RECORDER_HANDLES_MAX + 1; ++i) {
+        tabrmd_timeline_add_handle (timeline, 0x80000000 + i);
+    }
+    g_clear_pointer ((tabrmd_timeline_t**)state, tabrmd_timeline_unref);
+
+    dump = tabrmd_recorder_snapshot ();
+    header = (tabrmd_recorder_header_t*)g_bytes_get_data (dump, NULL);
+    assert_int_equal (header->event_count, 1);
+    event = (tabrmd_recorder_event_t*)(header + 1);
+    assert_int_equal (event->connection_id, 3);
+    assert_int_equal (event->command_code, TPM2_CC_Sign);
+    assert_int_equal (event->response_code, TPM2_RC_SUCCESS);
+    assert_int_equal (event->total_usec, 150);
+    assert_int_equal (event->stage_usec [TABRMD_STAGE_READ], -1);
+    assert_int_equal (event->stage_usec [TABRMD_STAGE_TPM_RECEIVED], 40);
+    assert_int_equal (event->stage_usec [TABRMD_STAGE_SAVED], 150);
+    assert_int_equal (event->handle_count, TABRMD_RECORDER_HANDLES_MAX);
+    for (i = 0; i < TABRMD_RECORDER_HANDLES_MAX; ++i) {
+        assert_int_equal (event->handles [i], 0x80000000 + i);
+    }
+    g_bytes_unref (dump);
+    tabrmd_recorder_cleanup ();
+}
+int
+main (void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown (tabrmd_timeline_stage_usec_test,
+                                         tabrmd_timeline_setup,
+                                         tabrmd_timeline_teardown),
+        cmocka_unit_test_setup_teardown (tabrmd_timeline_stage_skipped_test,
+                                         tabrmd_timeline_setup,
+                                         tabrmd_timeline_teardown),
+        cmocka_unit_test_setup_teardown (tabrmd_timeline_total_unwritten_test,
+                                         tabrmd_timeline_setup,
+                                         tabrmd_timeline_teardown),
+        cmocka_unit_test_setup_teardown (tabrmd_timeline_to_string_test,
+                                         tabrmd_timeline_setup,
+                                         tabrmd_timeline_teardown),
+        cmocka_unit_test_setup_teardown (tabrmd_timeline_unref_test,
+                                         tabrmd_timeline_setup,
+                                         tabrmd_timeline_teardown),
+        cmocka_unit_test_setup_teardown (tabrmd_timeline_record_test,
+                                         tabrmd_timeline_setup,
+                                         tabrmd_timeline_teardown),
+    };
+    return cmocka_run_group_tests (tests, NULL, NULL);
+}
@@ -0,0 +1,249 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (c) 2017 - 2018, Intel Corporation
+ * All rights reserved.
+ */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/un.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tabrmd-defaults.h"
+#include "tcti-tabrmd-lite-priv.h"
+
+#define UNUSED_PARAM(p) ((void)(p))
+
+/*
+ * Marshal a method call with a 't' body and parse it back. The header
+ * fields that we parse and the body must survive the round trip.
+ */
+static void
+tcti_tabrmd_lite_method_call_parse_test (void **state)
+{
+    uint8_t buf [512], body [sizeof (uint64_t)] = {
+        0x08, 0x07, 0x06, 0x05, 0x04, 0x03, 0x02, 0x01,
+    };
+    tcti_tabrmd_lite_msg_t msg;
+    size_t size;
+    UNUSED_PARAM (state);
+
+    size = tcti_tabrmd_lite_method_call (buf,
+                                         sizeof (buf),
+                                         3,
+                                         TABRMD_DBUS_NAME_DEFAULT,
+                                         TABRMD_DBUS_PATH,
+                                         TABRMD_DBUS_INTERFACE,
+                                         TABRMD_DBUS_METHOD_CANCEL,
+                                         "t",
+                                         body,
+                                         sizeof (body));
+    assert_int_not_equal (size, 0);
+    assert_int_equal (size % 8, 0);
+    assert_int_equal (tcti_tabrmd_lite_msg_parse (buf, size, &msg), 0);
+    assert_int_equal (msg.type, TABRMD_LITE_MSG_METHOD_CALL);
+    assert_false (msg.big_endian);
+    assert_int_equal (msg.serial, 3);
+    assert_string_equal (msg.signature, "t");
+    assert_int_equal (msg.body_size, sizeof (body));
+    assert_true (tcti_tabrmd_lite_get_u64 (msg.body, msg.big_endian) ==
+                 0x0102030405060708);
+}
+/*
+ * A message that doesn't fit in the buffer isn't marshalled.
+ */
+static void
+tcti_tabrmd_lite_method_call_overflow_test (void **state)
+{
+    uint8_t buf [32];
+    UNUSED_PARAM (state);
+
+    assert_int_equal (tcti_tabrmd_lite_method_call (buf,
+                                                    sizeof (buf),
+                                                    1,
+                                                    TABRMD_DBUS_NAME_DEFAULT,
+                                                    TABRMD_DBUS_PATH,
+                                                    TABRMD_DBUS_INTERFACE,
+                                                    "Hello",
+                                                    NULL,
+                                                    NULL,
+                                                    0),
+                      0);
+}
+/*
+ * A big-endian METHOD_RETURN with a reply serial and a 'u' body, the way
+ * the bus would send it from a big-endian host.
+ */
+static uint8_t reply_be [] = {
+    'B', TABRMD_LITE_MSG_METHOD_RETURN, 0x00, 0x01,
+    0x00, 0x00, 0x00, 0x04, /* body size */
+    0x00, 0x00, 0x00, 0x05, /* serial */
+    0x00, 0x00, 0x00, 0x0f, /* header fields size */
+    0x05, 0x01, 'u', 0x00, 0x00, 0x00, 0x00, 0x02, /* reply serial */
+    0x08, 0x01, 'g', 0x00, 0x01, 'u', 0x00, /* signature */
+    0x00, /* padding */
+    0x00, 0x00, 0x00, 0x07, /* body */
+};
+static void
+tcti_tabrmd_lite_msg_parse_big_endian_test (void **state)
+{
+    tcti_tabrmd_lite_msg_t msg;
+    UNUSED_PARAM (state);
+
+    assert_int_equal (tcti_tabrmd_lite_msg_parse (reply_be,
+                                                  sizeof (reply_be),
+                                                  &msg),
+                      0);
+    assert_int_equal (msg.type, TABRMD_LITE_MSG_METHOD_RETURN);
+    assert_true (msg.big_endian);
+    assert_int_equal (msg.serial, 5);
+    assert_int_equal (msg.reply_serial, 2);
+    assert_string_equal (msg.signature, "u");
+    assert_int_equal (tcti_tabrmd_lite_get_u32 (msg.body, msg.big_endian), 7);
+}
+/*
+ * A message whose size doesn't match the sizes in its header is rejected.
+ */
+static void
+tcti_tabrmd_lite_msg_parse_truncated_test (void **state)
+{
+    tcti_tabrmd_lite_msg_t msg;
+    UNUSED_PARAM (state);
+
+    assert_int_equal (tcti_tabrmd_lite_msg_parse (reply_be,
+                                                  sizeof (reply_be) - 1,
+                                                  &msg),
+                      -1);
+}
+/*
+ * A header field that runs past the end of the header fields is rejected.
+ */
+static void
+tcti_tabrmd_lite_msg_parse_bad_field_test (void **state)
+{
+    uint8_t reply [sizeof (reply_be)];
+    tcti_tabrmd_lite_msg_t msg;
+    UNUSED_PARAM (state);
+
+    memcpy (reply, reply_be, sizeof (reply));
+    /* signature length larger than the rest of the header */
+    reply [28] = 0x20;
+    assert_int_equal (tcti_tabrmd_lite_msg_parse (reply, sizeof (reply), &msg),
+                      -1);
+}
+static void
+tcti_tabrmd_lite_bus_address_path_test (void **state)
+{
+    struct sockaddr_un addr;
+    socklen_t addr_len = 0;
+    UNUSED_PARAM (state);
+
+    assert_int_equal (tcti_tabrmd_lite_bus_address (
+                          "unix:path=/run/dbus/system_bus_socket",
+                          &addr,
+                          &addr_len),
+                      0);
+    assert_int_equal (addr.sun_family, AF_UNIX);
+    assert_string_equal (addr.sun_path, "/run/dbus/system_bus_socket");
+    assert_int_equal (addr_len, offsetof (struct sockaddr_un, sun_path) +
+                      strlen ("/run/dbus/system_bus_socket") + 1);
+}
+/*
+ * Addresses for other transports are skipped and escaped bytes in the
+ * value are decoded. Keys other than "path" and "abstract" are ignored.
+ */
+static void
+tcti_tabrmd_lite_bus_address_abstract_test (void **state)
+{
+    struct sockaddr_un addr;
+    socklen_t addr_len = 0;
+    UNUSED_PARAM (state);
+
+    assert_int_equal (tcti_tabrmd_lite_bus_address (
+                          "tcp:host=localhost,port=1234;"
+                          "unix:abstract=/tmp/dbus%2dtest,guid=0123",
+                          &addr,
+                          &addr_len),
+                      0);
+    assert_int_equal (addr.sun_path [0], '\0');
+    assert_memory_equal (&addr.sun_path [1], "/tmp/dbus-test",
+                         strlen ("/tmp/dbus-test"));
+    assert_int_equal (addr_len, offsetof (struct sockaddr_un, sun_path) +
+                      strlen ("/tmp/dbus-test") + 1);
+}
+static void
+tcti_tabrmd_lite_bus_address_none_test (void **state)
+{
+    struct sockaddr_un addr;
+    socklen_t addr_len = 0;
+    UNUSED_PARAM (state);
+
+    assert_int_equal (tcti_tabrmd_lite_bus_address ("tcp:host=localhost",
+                                                    &addr,
+                                                    &addr_len),
+                      -1);
+    assert_int_equal (tcti_tabrmd_lite_bus_address ("unix:path=/bad%zz",
+                                                    &addr,
+                                                    &addr_len),
+                      -1);
+}
+static void
+tcti_tabrmd_lite_conf_parse_test (void **state)
+{
+    char conf [] = "bus_name=com.example.Tabrmd,bus_type=session,transport=mux,"
+                   "reconnect=true";
+    tcti_tabrmd_lite_conf_t lite_conf = {
+        .bus_name = TABRMD_DBUS_NAME_DEFAULT,
+        .bus_type = TABRMD_LITE_BUS_SYSTEM,
+    };
+    UNUSED_PARAM (state);
+
+    assert_int_equal (tcti_tabrmd_lite_conf_parse (conf, &lite_conf),
+                      TSS2_RC_SUCCESS);
+    assert_string_equal (lite_conf.bus_name, "com.example.Tabrmd");
+    assert_int_equal (lite_conf.bus_type, TABRMD_LITE_BUS_SESSION);
+    assert_true (lite_conf.reconnect);
+}
+static void
+tcti_tabrmd_lite_conf_parse_bad_test (void **state)
+{
+    char bad_type [] = "bus_type=foo";
+    char bad_transport [] = "transport=foo";
+    char bad_key [] = "foo=bar";
+    char bad_reconnect [] = "reconnect=yes";
+    char no_value [] = "bus_name=";
+    tcti_tabrmd_lite_conf_t lite_conf = { 0 };
+    UNUSED_PARAM (state);
+
+    assert_int_equal (tcti_tabrmd_lite_conf_parse (bad_type, &lite_conf),
+                      TSS2_TCTI_RC_BAD_VALUE);
+    assert_int_equal (tcti_tabrmd_lite_conf_parse (bad_transport, &lite_conf),
+                      TSS2_TCTI_RC_BAD_VALUE);
+    assert_int_equal (tcti_tabrmd_lite_conf_parse (bad_key, &lite_conf),
+                      TSS2_TCTI_RC_BAD_VALUE);
+    assert_int_equal (tcti_tabrmd_lite_conf_parse (bad_reconnect, &lite_conf),
+                      TSS2_TCTI_RC_BAD_VALUE);
+    assert_int_equal (tcti_tabrmd_lite_conf_parse (no_value, &lite_conf),
+                      TSS2_TCTI_RC_BAD_VALUE);
+}
+
+int
+main (void)
+{
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test (tcti_tabrmd_lite_method_call_parse_test),
+        cmocka_unit_test (tcti_tabrmd_lite_method_call_overflow_test),
+        cmocka_unit_test (tcti_tabrmd_lite_msg_parse_big_endian_test),
+        cmocka_unit_test (tcti_tabrmd_lite_msg_parse_truncated_test),
+        cmocka_unit_test (tcti_tabrmd_lite_msg_parse_bad_field_test),
+        cmocka_unit_test (tcti_tabrmd_lite_bus_address_path_test),
+        cmocka_unit_test (tcti_tabrmd_lite_bus_address_abstract_test),
+        cmocka_unit_test (tcti_tabrmd_lite_bus_address_none_test),
+        cmocka_unit_test (tcti_tabrmd_lite_conf_parse_test),
+        cmocka_unit_test (tcti_tabrmd_lite_conf_parse_bad_test),
+    };
+    return cmocka_run_group_tests (tests, NULL, NULL);
+}
@@ -21,8 +21,12 @@
 #include <tss2/tss2_tpm2_types.h>
 
 #include "tcti-tabrmd-priv.h"
+#include "tss2-tcti-tabrmd.h"
 #include "mock-funcs.h"
 
+/* finite timeout used by tests that exercise the call to poll */
+#define TEST_TIMEOUT 100
+
 /*
  * This tests the tcti_tabrmd_poll function, ensuring that it returns the
  * expected response code for the POLIN event.
@@ -172,7 +176,7 @@ tcti_tabrmd_read_poll_timeout (void **state)
     TSS2_RC rc;
     uint8_t resp [TPM2_MAX_RESPONSE_SIZE] = { 0, };
     size_t resp_size = sizeof (resp);
-    uint32_t timeout = TSS2_TCTI_TIMEOUT_BLOCK;
+    int32_t timeout = TEST_TIMEOUT;
     TSS2_TCTI_TABRMD_CONTEXT *tcti_ctx = (TSS2_TCTI_TABRMD_CONTEXT*)*state;
 
     will_return (__wrap_g_socket_connection_get_socket, TEST_SOCKET);
@@ -196,7 +200,7 @@ tcti_tabrmd_read_poll_fail (void **state)
     TSS2_RC rc;
     uint8_t resp [TPM2_MAX_RESPONSE_SIZE] = { 0, };
     size_t resp_size = sizeof (resp);
-    uint32_t timeout = TSS2_TCTI_TIMEOUT_BLOCK;
+    int32_t timeout = TEST_TIMEOUT;
     TSS2_TCTI_TABRMD_CONTEXT *tcti_ctx = (TSS2_TCTI_TABRMD_CONTEXT*)*state;
 
     will_return (__wrap_g_socket_connection_get_socket, TEST_SOCKET);
@@ -211,7 +215,7 @@ tcti_tabrmd_read_poll_fail (void **state)
 }
 /*
  * This test ensures that a call to tcti_tabrmd_read that causes
- * g_input_stream_read to return EOF will return the appropriate RC.
+ * recv to return EOF will return the appropriate RC.
  */
 static void
 tcti_tabrmd_read_eof (void **state)
@@ -222,27 +226,18 @@ tcti_tabrmd_read_eof (void **state)
     uint32_t timeout = TSS2_TCTI_TIMEOUT_BLOCK;
     TSS2_TCTI_TABRMD_CONTEXT *tcti_ctx = (TSS2_TCTI_TABRMD_CONTEXT*)*state;
 
-    /* mock stack required to extract the fd from the GSocketConnection */
+    /* mock stack required to extract the fd */
     will_return (__wrap_g_socket_connection_get_socket, TEST_SOCKET);
     will_return (__wrap_g_socket_get_fd, TEST_FD);
-
-    /* prime mock stack for poll to indicate data is ready */
-    will_return (__wrap_poll, POLLIN);
-    will_return (__wrap_poll, 0);
-    will_return (__wrap_poll, 1);
-
-    /* mock stack required to extract GIStream */
-    will_return (__wrap_g_io_stream_get_input_stream, TEST_CONNECTION);
-    /* cause g_input_stream_read to return 0 indicating EOF */
-    will_return (__wrap_g_input_stream_read, 0);
+    /* cause recv to return 0 indicating EOF */
+    will_return (__wrap_recv, 0);
 
     ret = tcti_tabrmd_read (tcti_ctx, resp, resp_size, timeout);
     assert_int_equal (ret, TSS2_TCTI_RC_NO_CONNECTION);
 }
 /*
  * This test ensures that a call to tcti_tabrmd_read that causes
- * g_input_stream_read to indicate that it would block, returns the
- * appropriate RC.
+ * recv to indicate that it would block, returns the appropriate RC.
  */
 static void
 tcti_tabrmd_read_block_error (void **state)
@@ -252,28 +247,18 @@ tcti_tabrmd_read_block_error (void **state)
     size_t resp_size = sizeof (resp);
     uint32_t timeout = TSS2_TCTI_TIMEOUT_BLOCK;
     TSS2_TCTI_TABRMD_CONTEXT *tcti_ctx = (TSS2_TCTI_TABRMD_CONTEXT*)*state;
-    GError* error;
 
-    /* mock stack required to extract the fd from the GSocketConnection */
+    /* mock stack required to extract the fd & read data */
     will_return (__wrap_g_socket_connection_get_socket, TEST_SOCKET);
     will_return (__wrap_g_socket_get_fd, TEST_FD);
-
-    /* prime mock stack for poll to indicate data is ready */
-    will_return (__wrap_poll, POLLIN);
-    will_return (__wrap_poll, 0);
-    will_return (__wrap_poll, 1);
-
-    /* mock stack required to extract GIStream & read data */
-    will_return (__wrap_g_io_stream_get_input_stream, TEST_CONNECTION);
-    error = g_error_new (1, G_IO_ERROR_WOULD_BLOCK, __func__);
-    will_return (__wrap_g_input_stream_read, -1);
-    will_return (__wrap_g_input_stream_read, error);
+    will_return (__wrap_recv, -1);
+    will_return (__wrap_recv, EAGAIN);
 
     ret = tcti_tabrmd_read (tcti_ctx, resp, resp_size, timeout);
     assert_int_equal (ret, TSS2_TCTI_RC_TRY_AGAIN);
 }
 /*
- * This test forces the call to 'g_input_stream_read' to read fewer bytes
+ * This test forces the call to 'recv' to read fewer bytes
  * than requested by the caller (the 'tcti_tabrmd_read' in this case). This
  * is a "short read" and should return an RC telling the caller to retry.
  */
@@ -287,19 +272,11 @@ tcti_tabrmd_read_short (void **state)
     TSS2_TCTI_TABRMD_CONTEXT *tcti_ctx = (TSS2_TCTI_TABRMD_CONTEXT*)*state;
     uint8_t buf [sizeof (resp)] = { 0, };
 
-    /* mock stack required to extract the fd from the GSocketConnection */
+    /* mock stack required to extract the fd & read data */
     will_return (__wrap_g_socket_connection_get_socket, TEST_SOCKET);
     will_return (__wrap_g_socket_get_fd, TEST_FD);
-
-    /* prime mock stack for poll to indicate data is ready */
-    will_return (__wrap_poll, POLLIN);
-    will_return (__wrap_poll, 0);
-    will_return (__wrap_poll, 1);
-
-    /* mock stack required to extract GIStream & read data */
-    will_return (__wrap_g_io_stream_get_input_stream, TEST_CONNECTION);
-    will_return (__wrap_g_input_stream_read, read_size);
-    will_return (__wrap_g_input_stream_read, buf);
+    will_return (__wrap_recv, read_size);
+    will_return (__wrap_recv, buf);
 
     ret = tcti_tabrmd_read (tcti_ctx, resp, resp_size, timeout);
     assert_int_equal (ret, TSS2_TCTI_RC_TRY_AGAIN);
@@ -314,18 +291,11 @@ tcti_tabrmd_read_success (void **state)
     uint32_t timeout = TSS2_TCTI_TIMEOUT_BLOCK;
     TSS2_TCTI_TABRMD_CONTEXT *tcti_ctx = (TSS2_TCTI_TABRMD_CONTEXT*)*state;
 
-    /* prime mock stack for poll to indicate data is ready */
-    will_return (__wrap_poll, POLLIN);
-    will_return (__wrap_poll, 0);
-    will_return (__wrap_poll, 1);
-    /* mock stack required to extract the fd from the GSocketConnection */
+    /* mock stack required to extract the fd & read data */
     will_return (__wrap_g_socket_connection_get_socket, TEST_SOCKET);
     will_return (__wrap_g_socket_get_fd, TEST_FD);
-
-    /* mock stack required to extract GIStream & read data */
-    will_return (__wrap_g_io_stream_get_input_stream, TEST_CONNECTION);
-    will_return (__wrap_g_input_stream_read, resp_size);
-    will_return (__wrap_g_input_stream_read, buf);
+    will_return (__wrap_recv, resp_size);
+    will_return (__wrap_recv, buf);
 
     ret = tcti_tabrmd_read (tcti_ctx, resp, resp_size, timeout);
     assert_int_equal (ret, TSS2_RC_SUCCESS);
@@ -451,7 +421,7 @@ tcti_tabrmd_receive_header_fail (void **state)
     will_return (__wrap_poll, EINVAL);
     will_return (__wrap_poll, -1);
 
-    rc = tss2_tcti_tabrmd_receive (ctx, &size, NULL, TSS2_TCTI_TIMEOUT_BLOCK);
+    rc = tss2_tcti_tabrmd_receive (ctx, &size, NULL, TEST_TIMEOUT);
     assert_int_equal (rc, TSS2_TCTI_RC_GENERAL_FAILURE);
 }
 /*
@@ -471,17 +441,11 @@ tcti_tabrmd_receive_header_lt_expected (void **state)
     };
     size_t size = 0;
 
-    /* mock stack required to extract the fd from the GSocketConnection */
+    /* mock stack required to get 10 bytes back from the socket */
     will_return (__wrap_g_socket_connection_get_socket, TEST_SOCKET);
     will_return (__wrap_g_socket_get_fd, TEST_FD);
-    /* prime mock stack for poll to indicate data is ready */
-    will_return (__wrap_poll, POLLIN);
-    will_return (__wrap_poll, 0);
-    will_return (__wrap_poll, 1);
-    /* mock stack required to get 10 bytes back from the GInputStream */
-    will_return (__wrap_g_io_stream_get_input_stream, TEST_CONNECTION);
-    will_return (__wrap_g_input_stream_read, TPM_HEADER_SIZE);
-    will_return (__wrap_g_input_stream_read, buf);
+    will_return (__wrap_recv, TPM_HEADER_SIZE);
+    will_return (__wrap_recv, buf);
 
     rc = tss2_tcti_tabrmd_receive (ctx, &size, NULL, TSS2_TCTI_TIMEOUT_BLOCK);
     assert_int_equal (rc, TSS2_TCTI_RC_MALFORMED_RESPONSE);
@@ -504,17 +468,11 @@ tcti_tabrmd_receive_get_size (void **state)
     };
     size_t size = 0;
 
-    /* mock stack required to extract the fd from the GSocketConnection */
+    /* mock stack required to get 10 bytes back from the socket */
     will_return (__wrap_g_socket_connection_get_socket, TEST_SOCKET);
     will_return (__wrap_g_socket_get_fd, TEST_FD);
-    /* prime mock stack for poll to indicate data is ready */
-    will_return (__wrap_poll, POLLIN);
-    will_return (__wrap_poll, 0);
-    will_return (__wrap_poll, 1);
-    /* mock stack required to get 10 bytes back from the GInputStream */
-    will_return (__wrap_g_io_stream_get_input_stream, TEST_CONNECTION);
-    will_return (__wrap_g_input_stream_read, TPM_HEADER_SIZE);
-    will_return (__wrap_g_input_stream_read, buf);
+    will_return (__wrap_recv, TPM_HEADER_SIZE);
+    will_return (__wrap_recv, buf);
 
     rc = tss2_tcti_tabrmd_receive (ctx, &size, NULL, TSS2_TCTI_TIMEOUT_BLOCK);
     assert_int_equal (rc, TSS2_RC_SUCCESS);
@@ -537,17 +495,11 @@ tcti_tabrmd_receive_header_only (void **state)
         0x00, 0x00, 0x00, 0x00,
     };
 
-    /* mock stack required to extract the fd from the GSocketConnection */
+    /* mock stack required to get 10 bytes back from the socket */
     will_return (__wrap_g_socket_connection_get_socket, TEST_SOCKET);
     will_return (__wrap_g_socket_get_fd, TEST_FD);
-    /* prime mock stack for poll to indicate data is ready */
-    will_return (__wrap_poll, POLLIN);
-    will_return (__wrap_poll, 0);
-    will_return (__wrap_poll, 1);
-    /* mock stack required to get 10 bytes back from the GInputStream */
-    will_return (__wrap_g_io_stream_get_input_stream, TEST_CONNECTION);
-    will_return (__wrap_g_input_stream_read, TPM_HEADER_SIZE);
-    will_return (__wrap_g_input_stream_read, buf);
+    will_return (__wrap_recv, TPM_HEADER_SIZE);
+    will_return (__wrap_recv, buf);
 
     rc = tss2_tcti_tabrmd_receive (ctx, &resp_size, resp, TSS2_TCTI_TIMEOUT_BLOCK);
     assert_int_equal (rc, TSS2_RC_SUCCESS);
@@ -573,37 +525,93 @@ tcti_tabrmd_receive_header_only_retry (void **state)
         0x00, 0x00, 0x00, 0x00,
     };
 
-    /* mock stack required to extract the fd from the GSocketConnection */
+    /* mock stack required to get first bytes back from the socket */
     will_return (__wrap_g_socket_connection_get_socket, TEST_SOCKET);
     will_return (__wrap_g_socket_get_fd, TEST_FD);
-    /* prime mock stack for poll to indicate data is ready */
-    will_return (__wrap_poll, POLLIN);
-    will_return (__wrap_poll, 0);
-    will_return (__wrap_poll, 1);
-    /* mock stack required to get first bytes back from the GInputStream */
-    will_return (__wrap_g_io_stream_get_input_stream, TEST_CONNECTION);
-    will_return (__wrap_g_input_stream_read, FIRST_READ_SIZE);
-    will_return (__wrap_g_input_stream_read, buf);
+    will_return (__wrap_recv, FIRST_READ_SIZE);
+    will_return (__wrap_recv, buf);
 
     rc = tss2_tcti_tabrmd_receive (ctx, &resp_size, resp, TSS2_TCTI_TIMEOUT_BLOCK);
     assert_int_equal (rc, TSS2_TCTI_RC_TRY_AGAIN);
 
-    /* mock stack required to extract the fd from the GSocketConnection */
+    /* mock stack required to get first bytes back from the socket */
     will_return (__wrap_g_socket_connection_get_socket, TEST_SOCKET);
     will_return (__wrap_g_socket_get_fd, TEST_FD);
-    /* prime mock stack for poll to indicate data is ready */
-    will_return (__wrap_poll, POLLIN);
-    will_return (__wrap_poll, 0);
-    will_return (__wrap_poll, 1);
-    /* mock stack required to get first bytes back from the GInputStream */
-    will_return (__wrap_g_io_stream_get_input_stream, TEST_CONNECTION);
-    will_return (__wrap_g_input_stream_read, SECOND_READ_SIZE);
-    will_return (__wrap_g_input_stream_read, &buf[FIRST_READ_SIZE]);
+    will_return (__wrap_recv, SECOND_READ_SIZE);
+    will_return (__wrap_recv, &buf[FIRST_READ_SIZE]);
 
     rc = tss2_tcti_tabrmd_receive (ctx, &resp_size, resp, TSS2_TCTI_TIMEOUT_BLOCK);
     assert_int_equal (rc, TSS2_RC_SUCCESS);
     assert_memory_equal (buf, resp, resp_size);
 }
+/*
+ * A TRY_AGAIN is counted as such, a query for the response size isn't
+ * counted and the completed response is counted as a receive with its
+ * latency recorded in one bucket of the histogram.
+ */
+static void
+tcti_tabrmd_receive_stats (void **state)
+{
+    TSS2_RC rc;
+    TSS2_TCTI_TABRMD_CONTEXT *tabrmd_ctx = (TSS2_TCTI_TABRMD_CONTEXT*)*state;
+    TSS2_TCTI_CONTEXT *ctx = (TSS2_TCTI_CONTEXT*)*state;
+    TSS2_TCTI_TABRMD_STATS stats;
+    uint8_t resp [TPM_HEADER_SIZE] = { 0, };
+    size_t resp_size = 0, i;
+    uint64_t latencies = 0;
+    uint8_t buf [TPM_HEADER_SIZE] = {
+        0x80, 0x02,
+        0x00, 0x00, 0x00, 0x0a, /* TPM_HEADER_SIZE -> resp is just header */
+        0x00, 0x00, 0x00, 0x00,
+    };
+
+    tabrmd_ctx->stats.transmit_time = tcti_tabrmd_stats_now ();
+    will_return (__wrap_g_socket_connection_get_socket, TEST_SOCKET);
+    will_return (__wrap_g_socket_get_fd, TEST_FD);
+    will_return (__wrap_recv, FIRST_READ_SIZE);
+    will_return (__wrap_recv, buf);
+    rc = tss2_tcti_tabrmd_receive (ctx, &resp_size, NULL, TSS2_TCTI_TIMEOUT_BLOCK);
+    assert_int_equal (rc, TSS2_TCTI_RC_TRY_AGAIN);
+
+    will_return (__wrap_g_socket_connection_get_socket, TEST_SOCKET);
+    will_return (__wrap_g_socket_get_fd, TEST_FD);
+    will_return (__wrap_recv, SECOND_READ_SIZE);
+    will_return (__wrap_recv, &buf[FIRST_READ_SIZE]);
+    rc = tss2_tcti_tabrmd_receive (ctx, &resp_size, NULL, TSS2_TCTI_TIMEOUT_BLOCK);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+
+    rc = tss2_tcti_tabrmd_receive (ctx, &resp_size, resp, TSS2_TCTI_TIMEOUT_BLOCK);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+
+    rc = Tss2_Tcti_Tabrmd_GetStats (ctx, &stats);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_int_equal (stats.try_again, 1);
+    assert_int_equal (stats.receives, 1);
+    assert_int_equal (stats.bytes_received, TPM_HEADER_SIZE);
+    for (i = 0; i < TSS2_TCTI_TABRMD_STATS_BUCKETS; ++i) {
+        latencies += stats.latency [i];
+    }
+    assert_int_equal (latencies, 1);
+    assert_true (stats.latency_max_us >= stats.latency_total_us);
+}
+/*
+ * Latencies are counted in power of two buckets with everything past the
+ * last bucket counted in it.
+ */
+static void
+tcti_tabrmd_stats_bucket_test (void **state)
+{
+    UNUSED_PARAM (state);
+
+    assert_int_equal (tcti_tabrmd_stats_bucket (0), 0);
+    assert_int_equal (tcti_tabrmd_stats_bucket (1), 0);
+    assert_int_equal (tcti_tabrmd_stats_bucket (2), 1);
+    assert_int_equal (tcti_tabrmd_stats_bucket (3), 1);
+    assert_int_equal (tcti_tabrmd_stats_bucket (1000), 9);
+    assert_int_equal (tcti_tabrmd_stats_bucket (1024), 10);
+    assert_int_equal (tcti_tabrmd_stats_bucket (UINT64_MAX),
+                      TSS2_TCTI_TABRMD_STATS_BUCKETS - 1);
+}
 /*
  * This test implements a calling pattern referred to as "partial reads"
  * in the system API implementation from tpm2-tss. It is also prescribed
@@ -623,17 +631,11 @@ tcti_tabrmd_receive_partial_reads (void **state)
     uint8_t resp [sizeof (buf)] = { 0, };
     size_t resp_size = 0;
 
-    /* mock stack required to extract the fd from the GSocketConnection */
+    /* mock stack required to get 10 bytes back from the socket */
     will_return (__wrap_g_socket_connection_get_socket, TEST_SOCKET);
     will_return (__wrap_g_socket_get_fd, TEST_FD);
-    /* prime mock stack for poll to indicate data is ready */
-    will_return (__wrap_poll, POLLIN);
-    will_return (__wrap_poll, 0);
-    will_return (__wrap_poll, 1);
-    /* mock stack required to get 10 bytes back from the GInputStream */
-    will_return (__wrap_g_io_stream_get_input_stream, TEST_CONNECTION);
-    will_return (__wrap_g_input_stream_read, TPM_HEADER_SIZE);
-    will_return (__wrap_g_input_stream_read, buf);
+    will_return (__wrap_recv, TPM_HEADER_SIZE);
+    will_return (__wrap_recv, buf);
 
     rc = tss2_tcti_tabrmd_receive (ctx,
                                    &resp_size,
@@ -642,17 +644,11 @@ tcti_tabrmd_receive_partial_reads (void **state)
     assert_int_equal (rc, TSS2_RC_SUCCESS);
     assert_int_equal (resp_size, sizeof (buf));
 
-    /* mock stack required to extract the fd from the GSocketConnection */
+    /* mock stack required to get 10 bytes back from the socket */
     will_return (__wrap_g_socket_connection_get_socket, TEST_SOCKET);
     will_return (__wrap_g_socket_get_fd, TEST_FD);
-    /* prime mock stack for poll to indicate data is ready */
-    will_return (__wrap_poll, POLLIN);
-    will_return (__wrap_poll, 0);
-    will_return (__wrap_poll, 1);
-    /* mock stack required to get 10 bytes back from the GInputStream */
-    will_return (__wrap_g_io_stream_get_input_stream, TEST_CONNECTION);
-    will_return (__wrap_g_input_stream_read, 4);
-    will_return (__wrap_g_input_stream_read, &buf[TPM_HEADER_SIZE]);
+    will_return (__wrap_recv, 4);
+    will_return (__wrap_recv, &buf[TPM_HEADER_SIZE]);
 
     rc = tss2_tcti_tabrmd_receive (ctx,
                                    &resp_size,
@@ -661,6 +657,138 @@ tcti_tabrmd_receive_partial_reads (void **state)
     assert_int_equal (rc, TSS2_RC_SUCCESS);
     assert_memory_equal (buf, resp, sizeof (buf));
 }
+/*
+ * When the caller provides a buffer large enough for the response with a
+ * blocking timeout, the header and then the body are read directly into it
+ * with one blocking recv each. Poll is never called.
+ */
+static void
+tcti_tabrmd_receive_block_no_poll (void **state)
+{
+    TSS2_RC rc;
+    TSS2_TCTI_CONTEXT *ctx = (TSS2_TCTI_CONTEXT*)*state;
+    uint8_t buf [] = {
+        0x80, 0x01,
+        0x00, 0x00, 0x00, 0x0e,
+        0x00, 0x00, 0x00, 0x00,
+        0xde, 0xad, 0xbe, 0xef,
+    };
+    uint8_t resp [TPM2_MAX_RESPONSE_SIZE] = { 0, };
+    size_t resp_size = sizeof (resp);
+
+    will_return (__wrap_g_socket_connection_get_socket, TEST_SOCKET);
+    will_return (__wrap_g_socket_get_fd, TEST_FD);
+    will_return (__wrap_recv, TPM_HEADER_SIZE);
+    will_return (__wrap_recv, buf);
+    will_return (__wrap_g_socket_connection_get_socket, TEST_SOCKET);
+    will_return (__wrap_g_socket_get_fd, TEST_FD);
+    will_return (__wrap_recv, sizeof (buf) - TPM_HEADER_SIZE);
+    will_return (__wrap_recv, &buf [TPM_HEADER_SIZE]);
+
+    rc = tss2_tcti_tabrmd_receive (ctx, &resp_size, resp, TSS2_TCTI_TIMEOUT_BLOCK);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_int_equal (resp_size, sizeof (buf));
+    assert_memory_equal (buf, resp, sizeof (buf));
+}
+/*
+ * With a finite timeout each read must be preceded by a call to poll.
+ */
+static void
+tcti_tabrmd_receive_timeout_poll (void **state)
+{
+    TSS2_RC rc;
+    TSS2_TCTI_CONTEXT *ctx = (TSS2_TCTI_CONTEXT*)*state;
+    uint8_t buf [] = {
+        0x80, 0x01,
+        0x00, 0x00, 0x00, 0x0e,
+        0x00, 0x00, 0x00, 0x00,
+        0xde, 0xad, 0xbe, 0xef,
+    };
+    uint8_t resp [sizeof (buf)] = { 0, };
+    size_t resp_size = sizeof (resp);
+    size_t i;
+
+    for (i = 0; i < 2; ++i) {
+        will_return (__wrap_g_socket_connection_get_socket, TEST_SOCKET);
+        will_return (__wrap_g_socket_get_fd, TEST_FD);
+        will_return (__wrap_poll, POLLIN);
+        will_return (__wrap_poll, 0);
+        will_return (__wrap_poll, 1);
+    }
+    will_return (__wrap_g_io_stream_get_input_stream, TEST_CONNECTION);
+    will_return (__wrap_g_input_stream_read, TPM_HEADER_SIZE);
+    will_return (__wrap_g_input_stream_read, buf);
+    will_return (__wrap_g_io_stream_get_input_stream, TEST_CONNECTION);
+    will_return (__wrap_g_input_stream_read, sizeof (buf) - TPM_HEADER_SIZE);
+    will_return (__wrap_g_input_stream_read, &buf [TPM_HEADER_SIZE]);
+
+    rc = tss2_tcti_tabrmd_receive (ctx, &resp_size, resp, TEST_TIMEOUT);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_memory_equal (buf, resp, sizeof (buf));
+}
+/*
+ * With two responses outstanding the context must stay in the RECEIVE
+ * state after the first is received and return to TRANSMIT after the
+ * second. Both are received by a single call to ReceiveMany.
+ */
+static void
+tcti_tabrmd_receive_many_success (void **state)
+{
+    TSS2_RC rc;
+    TSS2_TCTI_TABRMD_CONTEXT *tabrmd_ctx = (TSS2_TCTI_TABRMD_CONTEXT*)*state;
+    uint8_t buf [2][TPM_HEADER_SIZE] = {
+        { 0x80, 0x01, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x00, 0x00, },
+        { 0x80, 0x01, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01, 0x01, },
+    };
+    uint8_t resp [2][TPM_HEADER_SIZE] = { { 0, }, };
+    uint8_t *responses [2] = { resp [0], resp [1], };
+    size_t sizes [2] = { TPM_HEADER_SIZE, TPM_HEADER_SIZE, };
+    size_t received = 0, i;
+
+    tabrmd_ctx->outstanding = 2;
+    for (i = 0; i < 2; ++i) {
+        will_return (__wrap_g_socket_connection_get_socket, TEST_SOCKET);
+        will_return (__wrap_g_socket_get_fd, TEST_FD);
+        will_return (__wrap_recv, TPM_HEADER_SIZE);
+        will_return (__wrap_recv, buf [i]);
+    }
+
+    rc = Tss2_Tcti_Tabrmd_ReceiveMany ((TSS2_TCTI_CONTEXT*)tabrmd_ctx,
+                                       2,
+                                       sizes,
+                                       responses,
+                                       TSS2_TCTI_TIMEOUT_BLOCK,
+                                       &received);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_int_equal (received, 2);
+    assert_memory_equal (resp [0], buf [0], TPM_HEADER_SIZE);
+    assert_memory_equal (resp [1], buf [1], TPM_HEADER_SIZE);
+    assert_int_equal (tabrmd_ctx->state, TABRMD_STATE_TRANSMIT);
+    assert_int_equal (tabrmd_ctx->outstanding, 0);
+}
+/*
+ * Asking for more responses than are outstanding is a BAD_VALUE.
+ */
+static void
+tcti_tabrmd_receive_many_too_many (void **state)
+{
+    TSS2_RC rc;
+    TSS2_TCTI_TABRMD_CONTEXT *tabrmd_ctx = (TSS2_TCTI_TABRMD_CONTEXT*)*state;
+    uint8_t resp [2][TPM_HEADER_SIZE] = { { 0, }, };
+    uint8_t *responses [2] = { resp [0], resp [1], };
+    size_t sizes [2] = { TPM_HEADER_SIZE, TPM_HEADER_SIZE, };
+    size_t received = 0;
+
+    tabrmd_ctx->outstanding = 1;
+    rc = Tss2_Tcti_Tabrmd_ReceiveMany ((TSS2_TCTI_CONTEXT*)tabrmd_ctx,
+                                       2,
+                                       sizes,
+                                       responses,
+                                       TSS2_TCTI_TIMEOUT_BLOCK,
+                                       &received);
+    assert_int_equal (rc, TSS2_TCTI_RC_BAD_VALUE);
+    assert_int_equal (received, 0);
+}
 
 int
 main (void)
@@ -721,9 +849,25 @@ main (void)
         cmocka_unit_test_setup_teardown (tcti_tabrmd_receive_header_only_retry,
                                          tcti_tabrmd_receive_setup,
                                          tcti_tabrmd_teardown),
+        cmocka_unit_test_setup_teardown (tcti_tabrmd_receive_stats,
+                                         tcti_tabrmd_receive_setup,
+                                         tcti_tabrmd_teardown),
+        cmocka_unit_test (tcti_tabrmd_stats_bucket_test),
         cmocka_unit_test_setup_teardown (tcti_tabrmd_receive_partial_reads,
                                          tcti_tabrmd_receive_setup,
                                          tcti_tabrmd_teardown),
+        cmocka_unit_test_setup_teardown (tcti_tabrmd_receive_block_no_poll,
+                                         tcti_tabrmd_receive_setup,
+                                         tcti_tabrmd_teardown),
+        cmocka_unit_test_setup_teardown (tcti_tabrmd_receive_many_success,
+                                         tcti_tabrmd_receive_setup,
+                                         tcti_tabrmd_teardown),
+        cmocka_unit_test_setup_teardown (tcti_tabrmd_receive_many_too_many,
+                                         tcti_tabrmd_receive_setup,
+                                         tcti_tabrmd_teardown),
+        cmocka_unit_test_setup_teardown (tcti_tabrmd_receive_timeout_poll,
+                                         tcti_tabrmd_receive_setup,
+                                         tcti_tabrmd_teardown),
     };
     return cmocka_run_group_tests (tests, NULL, NULL);
 }
@@ -7,6 +7,7 @@
 #include <gio/gunixfdlist.h>
 #include <glib.h>
 #include <inttypes.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -181,6 +182,162 @@ tcti_tabrmd_kv_callback_type_bad_test (void **state)
     assert_int_equal (rc, TSS2_TCTI_RC_BAD_VALUE);
     assert_int_equal (conf.bus_type, G_BUS_TYPE_NONE);
 }
+/*
+ * Ensure that when we pass the key "transport" and the value "seqpacket"
+ * to tabrmd_kv_callback that it returns an RC indicating success while
+ * the conf structure 'transport' field is set to TABRMD_TRANSPORT_SEQPACKET.
+ */
+static void
+tcti_tabrmd_kv_callback_transport_good_test (void **state)
+{
+    tabrmd_conf_t conf = TABRMD_CONF_INIT_DEFAULT;
+    key_value_t key_value = {
+        .key = "transport",
+        .value = "seqpacket",
+    };
+    TSS2_RC rc;
+    UNUSED_PARAM(state);
+
+    rc = tabrmd_kv_callback (&key_value, &conf);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_int_equal (conf.transport, TABRMD_TRANSPORT_SEQPACKET);
+}
+/*
+ * Ensure that the "mux" value for the "transport" key selects the
+ * multiplexed transport.
+ */
+static void
+tcti_tabrmd_kv_callback_transport_mux_test (void **state)
+{
+    tabrmd_conf_t conf = TABRMD_CONF_INIT_DEFAULT;
+    key_value_t key_value = {
+        .key = "transport",
+        .value = "mux",
+    };
+    TSS2_RC rc;
+    UNUSED_PARAM(state);
+
+    rc = tabrmd_kv_callback (&key_value, &conf);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_int_equal (conf.transport, TABRMD_TRANSPORT_MUX);
+}
+/*
+ * Ensure that when we pass the key "transport" with an invalid value string
+ * (not "stream", "seqpacket" or "mux") that it returns the BAD_VALUE RC and leaves
+ * the 'transport' field of the conf structure unchanged.
+ */
+static void
+tcti_tabrmd_kv_callback_transport_bad_test (void **state)
+{
+    tabrmd_conf_t conf = TABRMD_CONF_INIT_DEFAULT;
+    key_value_t key_value = {
+        .key = "transport",
+        .value = "foo",
+    };
+    TSS2_RC rc;
+    UNUSED_PARAM(state);
+
+    rc = tabrmd_kv_callback (&key_value, &conf);
+    assert_int_equal (rc, TSS2_TCTI_RC_BAD_VALUE);
+    assert_int_equal (conf.transport, TABRMD_TRANSPORT_STREAM);
+}
+/*
+ * Ensure that the "reconnect" key accepts "true" and sets the 'reconnect'
+ * field of the conf structure.
+ */
+static void
+tcti_tabrmd_kv_callback_reconnect_good_test (void **state)
+{
+    tabrmd_conf_t conf = TABRMD_CONF_INIT_DEFAULT;
+    key_value_t key_value = {
+        .key = "reconnect",
+        .value = "true",
+    };
+    TSS2_RC rc;
+    UNUSED_PARAM(state);
+
+    rc = tabrmd_kv_callback (&key_value, &conf);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_true (conf.reconnect);
+}
+/*
+ * Ensure that a value other than "true" or "false" for the "reconnect" key
+ * returns BAD_VALUE and leaves reconnecting disabled.
+ */
+static void
+tcti_tabrmd_kv_callback_reconnect_bad_test (void **state)
+{
+    tabrmd_conf_t conf = TABRMD_CONF_INIT_DEFAULT;
+    key_value_t key_value = {
+        .key = "reconnect",
+        .value = "yes",
+    };
+    TSS2_RC rc;
+    UNUSED_PARAM(state);
+
+    rc = tabrmd_kv_callback (&key_value, &conf);
+    assert_int_equal (rc, TSS2_TCTI_RC_BAD_VALUE);
+    assert_false (conf.reconnect);
+}
+/*
+ * Commands from the replay list that reference no transient objects or
+ * sessions are safe to replay, including those authorized with the
+ * password session.
+ */
+static void
+tcti_tabrmd_replay_safe_test (void **state)
+{
+    uint8_t get_random [] = {
+        0x80, 0x01, 0x00, 0x00, 0x00, 0x0c, 0x00, 0x00, 0x01, 0x7b,
+        0x00, 0x10,
+    };
+    uint8_t read_public [] = {
+        0x80, 0x01, 0x00, 0x00, 0x00, 0x0e, 0x00, 0x00, 0x01, 0x73,
+        0x81, 0x00, 0x00, 0x01,
+    };
+    uint8_t nv_read [] = {
+        0x80, 0x02, 0x00, 0x00, 0x00, 0x23, 0x00, 0x00, 0x01, 0x4e,
+        0x01, 0x00, 0x00, 0x01, 0x01, 0x00, 0x00, 0x01,
+        0x00, 0x00, 0x00, 0x09,
+        0x40, 0x00, 0x00, 0x09, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x20, 0x00, 0x00,
+    };
+    UNUSED_PARAM(state);
+
+    assert_true (tcti_tabrmd_replay_safe (get_random, sizeof (get_random)));
+    assert_true (tcti_tabrmd_replay_safe (read_public, sizeof (read_public)));
+    assert_true (tcti_tabrmd_replay_safe (nv_read, sizeof (nv_read)));
+}
+/*
+ * Commands that aren't on the replay list, that reference transient objects
+ * or that use sessions other than the password session aren't safe to
+ * replay. Neither are commands whose size doesn't match their header.
+ */
+static void
+tcti_tabrmd_replay_unsafe_test (void **state)
+{
+    uint8_t nv_increment [] = {
+        0x80, 0x01, 0x00, 0x00, 0x00, 0x12, 0x00, 0x00, 0x01, 0x34,
+        0x01, 0x00, 0x00, 0x01, 0x01, 0x00, 0x00, 0x01,
+    };
+    uint8_t read_public [] = {
+        0x80, 0x01, 0x00, 0x00, 0x00, 0x0e, 0x00, 0x00, 0x01, 0x73,
+        0x80, 0x00, 0x00, 0x01,
+    };
+    uint8_t nv_read [] = {
+        0x80, 0x02, 0x00, 0x00, 0x00, 0x23, 0x00, 0x00, 0x01, 0x4e,
+        0x01, 0x00, 0x00, 0x01, 0x01, 0x00, 0x00, 0x01,
+        0x00, 0x00, 0x00, 0x09,
+        0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+        0x00, 0x20, 0x00, 0x00,
+    };
+    UNUSED_PARAM(state);
+
+    assert_false (tcti_tabrmd_replay_safe (nv_increment, sizeof (nv_increment)));
+    assert_false (tcti_tabrmd_replay_safe (read_public, sizeof (read_public)));
+    assert_false (tcti_tabrmd_replay_safe (nv_read, sizeof (nv_read)));
+    assert_false (tcti_tabrmd_replay_safe (read_public, sizeof (read_public) - 1));
+}
 /*
  * Ensure that when we pass an invalid key (not 'bus_type' or 'bus_name')
  * that it returns an RC indicating BAD_VALUE.
@@ -326,15 +483,15 @@ tcti_tabrmd_conf_parse_no_key_test (void **state)
  * caller will g_clear_error this object for us.
  */
 TctiTabrmd *
-__wrap_tcti_tabrmd_proxy_new_for_bus_sync (
-    GBusType             bus_type,
+__wrap_tcti_tabrmd_proxy_new_sync (
+    GDBusConnection     *connection,
     GDBusProxyFlags      flags,
     const gchar         *name,
     const gchar         *object_path,
     GCancellable        *cancellable,
     GError             **error)
 {
-    UNUSED_PARAM (bus_type);
+    UNUSED_PARAM (connection);
     UNUSED_PARAM (flags);
     UNUSED_PARAM (name);
     UNUSED_PARAM (object_path);
@@ -346,6 +503,38 @@ __wrap_tcti_tabrmd_proxy_new_for_bus_sync (
     }
     return proxy;
 }
+/*
+ * Each proxy gets a private connection to the bus. These mocks stand in
+ * for the bus: the connection is a plain GObject that's only ever passed to
+ * the mocked proxy constructor and released.
+ */
+gchar*
+__wrap_g_dbus_address_get_for_bus_sync (GBusType bus_type,
+                                        GCancellable *cancellable,
+                                        GError **error)
+{
+    UNUSED_PARAM (bus_type);
+    UNUSED_PARAM (cancellable);
+    UNUSED_PARAM (error);
+
+    return g_strdup ("unix:path=/dev/null");
+}
+GDBusConnection*
+__wrap_g_dbus_connection_new_for_address_sync (
+    const gchar *address,
+    GDBusConnectionFlags flags,
+    GDBusAuthObserver *observer,
+    GCancellable *cancellable,
+    GError **error)
+{
+    UNUSED_PARAM (address);
+    UNUSED_PARAM (flags);
+    UNUSED_PARAM (observer);
+    UNUSED_PARAM (cancellable);
+    UNUSED_PARAM (error);
+
+    return (GDBusConnection*)g_object_new (G_TYPE_OBJECT, NULL);
+}
 
 /*
  * Force failure acquiring proxy object.
@@ -358,8 +547,9 @@ tcti_tabrmd_proxy_new_fail (void **state)
     uint8_t buf [sizeof (TSS2_TCTI_TABRMD_CONTEXT)] = { 0 };
     TSS2_RC rc = TSS2_RC_SUCCESS;
 
-    will_return (__wrap_tcti_tabrmd_proxy_new_for_bus_sync, NULL);
-    will_return (__wrap_tcti_tabrmd_proxy_new_for_bus_sync,
+    tcti_tabrmd_proxy_cache_reset ();
+    will_return (__wrap_tcti_tabrmd_proxy_new_sync, NULL);
+    will_return (__wrap_tcti_tabrmd_proxy_new_sync,
                  g_error_new_literal (1, 1, __func__));
     rc = Tss2_Tcti_Tabrmd_Init ((TSS2_TCTI_CONTEXT*)buf, &size, NULL);
     assert_int_equal (rc, TSS2_TCTI_RC_NO_CONNECTION);
@@ -455,7 +645,7 @@ typedef struct {
     gint    client_fd;
     gint    server_fd;
     TSS2_TCTI_CONTEXT  *context;
-    TctiTabrmdProxy *proxy;
+    TctiTabrmd *proxy;
 } data_t;
 /*
  * This is the setup function used to create the TCTI context structure for
@@ -484,8 +674,8 @@ tcti_tabrmd_setup (void **state)
         perror ("calloc");
         return 1;
     }
-    data->proxy = calloc (1, sizeof (TctiTabrmdProxy));
-    will_return (__wrap_tcti_tabrmd_proxy_new_for_bus_sync, data->proxy);
+    data->proxy = (TctiTabrmd*)g_object_new (G_TYPE_OBJECT, NULL);
+    will_return (__wrap_tcti_tabrmd_proxy_new_sync, data->proxy);
     g_debug ("preparing g_dbus_proxy_call_with_unix_fd_list_sync mock wrapper");
     assert_int_equal (socketpair (PF_LOCAL, SOCK_STREAM, 0, fds), 0);
     data->client_fd = fds [0];
@@ -510,15 +700,146 @@ tcti_tabrmd_teardown (void **state)
     data_t *data = *state;
 
     tss2_tcti_tabrmd_finalize (data->context);
+    tcti_tabrmd_proxy_cache_reset ();
     close (data->client_fd);
     close (data->server_fd);
     if (data->context)
         free (data->context);
-    if (data->proxy)
-        free (data->proxy);
     free (data);
     return 0;
 }
+/*
+ * A second TCTI context initialized with the same bus type / name must
+ * reuse the proxy created for the first instead of creating a new one.
+ */
+static void
+tcti_tabrmd_init_proxy_reuse_test (void **state)
+{
+    data_t *data = *state;
+    TSS2_TCTI_CONTEXT *context;
+    size_t tcti_size = sizeof (TSS2_TCTI_TABRMD_CONTEXT);
+    gint fds [2];
+    TSS2_RC rc;
+
+    context = calloc (1, tcti_size);
+    assert_non_null (context);
+    assert_int_equal (socketpair (PF_LOCAL, SOCK_STREAM, 0, fds), 0);
+    will_return (__wrap_g_dbus_proxy_call_with_unix_fd_list_sync, fds [0]);
+    will_return (__wrap_g_dbus_proxy_call_with_unix_fd_list_sync, 667);
+    rc = Tss2_Tcti_Tabrmd_Init (context, &tcti_size, "bus_type=session");
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_ptr_equal (TSS2_TCTI_TABRMD_PROXY (context),
+                      TSS2_TCTI_TABRMD_PROXY (data->context));
+
+    tss2_tcti_tabrmd_finalize (context);
+    close (fds [0]);
+    close (fds [1]);
+    free (context);
+}
+/*
+ * A refreshed proxy replaces the stale one in the cache. The stale proxy
+ * stays alive while contexts use it and the cache no longer holds a
+ * reference to it so it's freed along with the last of them.
+ */
+static void
+tcti_tabrmd_proxy_refresh_release_test (void **state)
+{
+    data_t *data = *state;
+    TSS2_TCTI_CONTEXT *context;
+    TctiTabrmd *fresh, *proxy;
+    size_t tcti_size = sizeof (TSS2_TCTI_TABRMD_CONTEXT);
+    gint fds [2];
+    TSS2_RC rc;
+
+    context = calloc (1, tcti_size);
+    assert_non_null (context);
+    assert_int_equal (socketpair (PF_LOCAL, SOCK_STREAM, 0, fds), 0);
+    will_return (__wrap_g_dbus_proxy_call_with_unix_fd_list_sync, fds [0]);
+    will_return (__wrap_g_dbus_proxy_call_with_unix_fd_list_sync, 669);
+    rc = Tss2_Tcti_Tabrmd_Init (context, &tcti_size, "bus_type=session");
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    /* the cache and both contexts */
+    assert_int_equal (G_OBJECT (data->proxy)->ref_count, 3);
+
+    fresh = (TctiTabrmd*)g_object_new (G_TYPE_OBJECT, NULL);
+    will_return (__wrap_tcti_tabrmd_proxy_new_sync, fresh);
+    proxy = tcti_tabrmd_proxy_refresh (G_BUS_TYPE_SESSION,
+                                       TABRMD_DBUS_NAME_DEFAULT,
+                                       data->proxy,
+                                       NULL);
+    assert_ptr_equal (proxy, fresh);
+    assert_int_equal (G_OBJECT (data->proxy)->ref_count, 2);
+    tss2_tcti_tabrmd_finalize (context);
+    assert_int_equal (G_OBJECT (data->proxy)->ref_count, 1);
+
+    g_object_unref (proxy);
+    close (fds [0]);
+    close (fds [1]);
+    free (context);
+}
+/*
+ * Initialize a second TCTI context with Tss2_Tcti_Tabrmd_InitAsync. The
+ * context must refuse to transmit until the poll handle becomes readable
+ * and Tss2_Tcti_Tabrmd_InitFinish completes the initialization.
+ */
+static void
+tcti_tabrmd_init_async_test (void **state)
+{
+    data_t *data = *state;
+    TSS2_TCTI_CONTEXT *context;
+    TSS2_TCTI_POLL_HANDLE handle;
+    size_t tcti_size = sizeof (TSS2_TCTI_TABRMD_CONTEXT), num_handles = 1;
+    struct pollfd pollfd;
+    uint8_t command [TPM_HEADER_SIZE] = { 0 };
+    gint fds [2];
+    TSS2_RC rc;
+
+    context = calloc (1, tcti_size);
+    assert_non_null (context);
+    assert_int_equal (socketpair (PF_LOCAL, SOCK_STREAM, 0, fds), 0);
+    will_return (__wrap_g_dbus_proxy_call_with_unix_fd_list_sync, fds [0]);
+    will_return (__wrap_g_dbus_proxy_call_with_unix_fd_list_sync, 668);
+    rc = Tss2_Tcti_Tabrmd_InitAsync (context, &tcti_size, "bus_type=session");
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    rc = tss2_tcti_tabrmd_transmit (context, sizeof (command), command);
+    assert_int_equal (rc, TSS2_TCTI_RC_BAD_SEQUENCE);
+
+    rc = tss2_tcti_tabrmd_get_poll_handles (context, &handle, &num_handles);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    pollfd.fd = handle.fd;
+    pollfd.events = POLLIN;
+    assert_int_equal (poll (&pollfd, 1, 5000), 1);
+    rc = Tss2_Tcti_Tabrmd_InitFinish (context);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_int_equal (TSS2_TCTI_TABRMD_STATE (context), TABRMD_STATE_TRANSMIT);
+    assert_int_equal (TSS2_TCTI_TABRMD_ID (context), 668);
+    assert_ptr_equal (TSS2_TCTI_TABRMD_PROXY (context),
+                      TSS2_TCTI_TABRMD_PROXY (data->context));
+    rc = Tss2_Tcti_Tabrmd_InitFinish (context);
+    assert_int_equal (rc, TSS2_TCTI_RC_BAD_SEQUENCE);
+
+    tss2_tcti_tabrmd_finalize (context);
+    close (fds [0]);
+    close (fds [1]);
+    free (context);
+}
+/*
+ * Tss2_Tcti_Tabrmd_InitAsync must validate the configuration string before
+ * returning.
+ */
+static void
+tcti_tabrmd_init_async_bad_conf_test (void **state)
+{
+    size_t tcti_size = sizeof (TSS2_TCTI_TABRMD_CONTEXT);
+    uint8_t buf [sizeof (TSS2_TCTI_TABRMD_CONTEXT)] = { 0 };
+    TSS2_RC rc;
+    UNUSED_PARAM (state);
+
+    rc = Tss2_Tcti_Tabrmd_InitAsync ((TSS2_TCTI_CONTEXT*)buf,
+                                     &tcti_size,
+                                     "transport=foo");
+    assert_int_equal (rc, TSS2_TCTI_RC_BAD_VALUE);
+}
 /*
  * Ensure that after initialization the 'magic' value in the TCTI structure
  * is the one that we expect.
@@ -630,6 +951,192 @@ tcti_tabrmd_transmit_success_test (void **state)
                       TABRMD_STATE_RECEIVE);
     assert_memory_equal (command_in, command_out, size);
 }
+/*
+ * A successful transmit is counted in the statistics for the context.
+ */
+static void
+tcti_tabrmd_transmit_stats_test (void **state)
+{
+    data_t *data = *state;
+    uint8_t command [] = { 0x80, 0x02,
+                           0x00, 0x00, 0x00, 0x0c,
+                           0x00, 0x00, 0x00, 0x00,
+                           0x01, 0x02};
+    TSS2_TCTI_TABRMD_STATS stats;
+    TSS2_RC rc;
+
+    rc = tss2_tcti_tabrmd_transmit (data->context, sizeof (command), command);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    rc = Tss2_Tcti_Tabrmd_GetStats (data->context, &stats);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_int_equal (stats.transmits, 1);
+    assert_int_equal (stats.bytes_transmitted, sizeof (command));
+    assert_int_equal (stats.receives, 0);
+}
+/*
+ * Mock for write_all: the number of calls that go through to the real
+ * function before a call fails with 'write_all_errno'. A negative value
+ * never fails.
+ */
+static gint write_all_passes = -1;
+static int write_all_errno = EPIPE;
+ssize_t __real_write_all (GOutputStream *ostream,
+                          const uint8_t *buf,
+                          const size_t size);
+ssize_t
+__wrap_write_all (GOutputStream *ostream,
+                  const uint8_t *buf,
+                  const size_t size)
+{
+    if (write_all_passes < 0) {
+        return __real_write_all (ostream, buf, size);
+    }
+    if (write_all_passes == 0) {
+        errno = write_all_errno;
+        return -1;
+    }
+    --write_all_passes;
+    return __real_write_all (ostream, buf, size);
+}
+/*
+ * When the second of two commands can't be written TransmitMany returns the
+ * error (the broken pipe means the daemon is gone), but the first command
+ * has already been sent. The context must be
+ * left in the RECEIVE state with that one command outstanding.
+ */
+static void
+tcti_tabrmd_transmit_many_second_write_fail_test (void **state)
+{
+    data_t *data = *state;
+    TSS2_TCTI_TABRMD_CONTEXT *tabrmd_ctx =
+        (TSS2_TCTI_TABRMD_CONTEXT*)data->context;
+    uint8_t command [] = { 0x80, 0x02,
+                           0x00, 0x00, 0x00, 0x0c,
+                           0x00, 0x00, 0x00, 0x00,
+                           0x01, 0x02};
+    const uint8_t *commands [] = { command, command };
+    size_t sizes [] = { sizeof (command), sizeof (command) };
+    uint8_t command_out [sizeof (command)] = { 0 };
+    TSS2_TCTI_TABRMD_STATS stats;
+    TSS2_RC rc;
+
+    write_all_passes = 1;
+    rc = Tss2_Tcti_Tabrmd_TransmitMany (data->context, 2, sizes, commands);
+    write_all_passes = -1;
+    assert_int_equal (rc, TSS2_TCTI_RC_NO_CONNECTION);
+    assert_int_equal (read (data->server_fd, command_out, sizeof (command)),
+                      sizeof (command));
+    assert_memory_equal (command, command_out, sizeof (command));
+    assert_int_equal (tabrmd_ctx->state, TABRMD_STATE_RECEIVE);
+    assert_int_equal (tabrmd_ctx->outstanding, 1);
+    rc = Tss2_Tcti_Tabrmd_GetStats (data->context, &stats);
+    assert_int_equal (rc, TSS2_RC_SUCCESS);
+    assert_int_equal (stats.transmits, 1);
+    assert_int_equal (stats.bytes_transmitted, sizeof (command));
+}
+/*
+ * When the first command can't be written nothing is outstanding and the
+ * context stays in the TRANSMIT state.
+ */
+static void
+tcti_tabrmd_transmit_many_first_write_fail_test (void **state)
+{
+    data_t *data = *state;
+    TSS2_TCTI_TABRMD_CONTEXT *tabrmd_ctx =
+        (TSS2_TCTI_TABRMD_CONTEXT*)data->context;
+    uint8_t command [] = { 0x80, 0x02,
+                           0x00, 0x00, 0x00, 0x0c,
+                           0x00, 0x00, 0x00, 0x00,
+                           0x01, 0x02};
+    const uint8_t *commands [] = { command, command };
+    size_t sizes [] = { sizeof (command), sizeof (command) };
+    TSS2_RC rc;
+
+    write_all_passes = 0;
+    rc = Tss2_Tcti_Tabrmd_TransmitMany (data->context, 2, sizes, commands);
+    write_all_passes = -1;
+    assert_int_equal (rc, TSS2_TCTI_RC_NO_CONNECTION);
+    assert_int_equal (tabrmd_ctx->state, TABRMD_STATE_TRANSMIT);
+    assert_int_equal (tabrmd_ctx->outstanding, 0);
+}
+/*
+ * An I/O error that doesn't mean the daemon is gone isn't handled by
+ * reconnecting. The reconnect state is set up so that the next attempt is
+ * due now: the mocks for refreshing the proxy have nothing queued and the
+ * test fails if an attempt is made.
+ */
+static void
+tcti_tabrmd_transmit_io_error_no_reconnect_test (void **state)
+{
+    data_t *data = *state;
+    TSS2_TCTI_TABRMD_CONTEXT *tabrmd_ctx =
+        (TSS2_TCTI_TABRMD_CONTEXT*)data->context;
+    uint8_t command [] = { 0x80, 0x02,
+                           0x00, 0x00, 0x00, 0x0c,
+                           0x00, 0x00, 0x00, 0x00,
+                           0x01, 0x02};
+    TSS2_RC rc;
+
+    tabrmd_ctx->reconnect = g_malloc0 (sizeof (tcti_tabrmd_reconnect_t));
+    tabrmd_ctx->reconnect->attempt = 1;
+    write_all_passes = 0;
+    write_all_errno = EIO;
+    rc = tss2_tcti_tabrmd_transmit (data->context, sizeof (command), command);
+    write_all_passes = -1;
+    write_all_errno = EPIPE;
+    assert_int_equal (rc, TSS2_TCTI_RC_IO_ERROR);
+    assert_int_equal (tabrmd_ctx->reconnect->attempt, 1);
+    assert_int_equal (tabrmd_ctx->state, TABRMD_STATE_TRANSMIT);
+}
+/*
+ * When the daemon closes the connection during a receive with a finite
+ * timeout, the delay before the next reconnect attempt isn't waited for
+ * past the timeout. TRY_AGAIN is returned with the reconnect left pending
+ * and the old connection kept.
+ */
+static void
+tcti_tabrmd_receive_reconnect_pending_test (void **state)
+{
+    data_t *data = *state;
+    TSS2_TCTI_TABRMD_CONTEXT *tabrmd_ctx =
+        (TSS2_TCTI_TABRMD_CONTEXT*)data->context;
+    uint8_t response [TPM_HEADER_SIZE] = { 0 };
+    size_t size = sizeof (response);
+    TSS2_RC rc;
+
+    tabrmd_ctx->reconnect = g_malloc0 (sizeof (tcti_tabrmd_reconnect_t));
+    tabrmd_ctx->reconnect->attempt = 1;
+    tabrmd_ctx->reconnect->next_time = g_get_monotonic_time () +
+        60 * G_USEC_PER_SEC;
+    tabrmd_ctx->state = TABRMD_STATE_RECEIVE;
+    close (data->server_fd);
+    data->server_fd = -1;
+
+    rc = tss2_tcti_tabrmd_receive (data->context, &size, response, 0);
+    assert_int_equal (rc, TSS2_TCTI_RC_TRY_AGAIN);
+    assert_int_equal (tabrmd_ctx->reconnect->attempt, 1);
+    assert_int_equal (tabrmd_ctx->state, TABRMD_STATE_RECEIVE);
+    assert_non_null (tabrmd_ctx->sock_connect);
+}
+/*
+ * GetStats checks its parameters and the context like the other functions.
+ */
+static void
+tcti_tabrmd_get_stats_bad_test (void **state)
+{
+    data_t *data = *state;
+    TSS2_TCTI_TABRMD_STATS stats;
+    TSS2_RC rc;
+
+    rc = Tss2_Tcti_Tabrmd_GetStats (NULL, &stats);
+    assert_int_equal (rc, TSS2_TCTI_RC_BAD_REFERENCE);
+    rc = Tss2_Tcti_Tabrmd_GetStats (data->context, NULL);
+    assert_int_equal (rc, TSS2_TCTI_RC_BAD_REFERENCE);
+    TSS2_TCTI_MAGIC (data->context) = 1;
+    rc = Tss2_Tcti_Tabrmd_GetStats (data->context, &stats);
+    TSS2_TCTI_MAGIC (data->context) = TSS2_TCTI_TABRMD_MAGIC;
+    assert_int_equal (rc, TSS2_TCTI_RC_BAD_CONTEXT);
+}
 /*
  * This test ensures that the magic value in the context structure is checked
  * before the transmit function executes and that the RC is what we expect.
@@ -872,6 +1379,16 @@ main (void)
         cmocka_unit_test_setup_teardown (tcti_tabrmd_init_success_test,
                                          tcti_tabrmd_setup,
                                          tcti_tabrmd_teardown),
+        cmocka_unit_test_setup_teardown (tcti_tabrmd_init_proxy_reuse_test,
+                                         tcti_tabrmd_setup,
+                                         tcti_tabrmd_teardown),
+        cmocka_unit_test_setup_teardown (tcti_tabrmd_proxy_refresh_release_test,
+                                         tcti_tabrmd_setup,
+                                         tcti_tabrmd_teardown),
+        cmocka_unit_test_setup_teardown (tcti_tabrmd_init_async_test,
+                                         tcti_tabrmd_setup,
+                                         tcti_tabrmd_teardown),
+        cmocka_unit_test (tcti_tabrmd_init_async_bad_conf_test),
         cmocka_unit_test (tcti_tabrmd_info_test),
         cmocka_unit_test (tcti_tabrmd_bus_type_from_str_session_test),
         cmocka_unit_test (tcti_tabrmd_bus_type_from_str_system_test),
@@ -879,6 +1396,13 @@ main (void)
         cmocka_unit_test (tcti_tabrmd_kv_callback_name_test),
         cmocka_unit_test (tcti_tabrmd_kv_callback_type_good_test),
         cmocka_unit_test (tcti_tabrmd_kv_callback_type_bad_test),
+        cmocka_unit_test (tcti_tabrmd_kv_callback_transport_good_test),
+        cmocka_unit_test (tcti_tabrmd_kv_callback_transport_mux_test),
+        cmocka_unit_test (tcti_tabrmd_kv_callback_transport_bad_test),
+        cmocka_unit_test (tcti_tabrmd_kv_callback_reconnect_good_test),
+        cmocka_unit_test (tcti_tabrmd_kv_callback_reconnect_bad_test),
+        cmocka_unit_test (tcti_tabrmd_replay_safe_test),
+        cmocka_unit_test (tcti_tabrmd_replay_unsafe_test),
         cmocka_unit_test (tcti_tabrmd_kv_callback_bad_key_test),
         cmocka_unit_test (tcti_tabrmd_conf_parse_named_session_test),
         cmocka_unit_test (tcti_tabrmd_conf_parse_named_system_test),
@@ -900,6 +1424,24 @@ main (void)
         cmocka_unit_test_setup_teardown (tcti_tabrmd_transmit_success_test,
                                          tcti_tabrmd_setup,
                                          tcti_tabrmd_teardown),
+        cmocka_unit_test_setup_teardown (tcti_tabrmd_transmit_stats_test,
+                                         tcti_tabrmd_setup,
+                                         tcti_tabrmd_teardown),
+        cmocka_unit_test_setup_teardown (tcti_tabrmd_transmit_many_second_write_fail_test,
+                                         tcti_tabrmd_setup,
+                                         tcti_tabrmd_teardown),
+        cmocka_unit_test_setup_teardown (tcti_tabrmd_transmit_many_first_write_fail_test,
+                                         tcti_tabrmd_setup,
+                                         tcti_tabrmd_teardown),
+        cmocka_unit_test_setup_teardown (tcti_tabrmd_transmit_io_error_no_reconnect_test,
+                                         tcti_tabrmd_setup,
+                                         tcti_tabrmd_teardown),
+        cmocka_unit_test_setup_teardown (tcti_tabrmd_receive_reconnect_pending_test,
+                                         tcti_tabrmd_setup,
+                                         tcti_tabrmd_teardown),
+        cmocka_unit_test_setup_teardown (tcti_tabrmd_get_stats_bad_test,
+                                         tcti_tabrmd_setup,
+                                         tcti_tabrmd_teardown),
         cmocka_unit_test_setup_teardown (tcti_tabrmd_transmit_bad_magic_test,
                                          tcti_tabrmd_setup,
                                          tcti_tabrmd_teardown),
@@ -9,11 +9,14 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #include <setjmp.h>
 #include <cmocka.h>
 
 #include "util.h"
+#include "tabrmd.h"
 #include "tpm2-header.h"
 
 #define MAX_BUF 4096
@@ -117,6 +120,25 @@ write_zero (void **state)
     written = write_all (0, NULL, WRITE_SIZE);
     assert_int_equal (written, 0);
 }
+/*
+ * mock 'recv' function: when 'recv_errno' is set the next call fails with
+ * it, otherwise calls go to the real recv.
+ */
+static int recv_errno = 0;
+ssize_t __real_recv (int sockfd, void *buf, size_t len, int flags);
+ssize_t
+__wrap_recv (int     sockfd,
+             void   *buf,
+             size_t  len,
+             int     flags)
+{
+    if (recv_errno != 0) {
+        errno = recv_errno;
+        recv_errno = 0;
+        return -1;
+    }
+    return __real_recv (sockfd, buf, len, flags);
+}
 /*
  * mock 'read' function: This function expects 3 things to be on the mock
  * queue:
@@ -669,6 +691,386 @@ read_tpm_buf_alloc_eof_test (void **state)
     assert_null (buf);
 }
 
+/*
+ * write_all_timeout writes the whole buffer when the peer has room for it.
+ */
+static void
+write_all_timeout_success_test (void **state)
+{
+    GSocket *socket;
+    uint8_t buf [WRITE_SIZE] = { 0x80, 0x01, };
+    uint8_t buf_out [WRITE_SIZE] = { 0, };
+    int client_fd, server_fd;
+    UNUSED_PARAM(state);
+
+    assert_int_equal (create_socket_pair (&client_fd, &server_fd, 0), 0);
+    socket = g_socket_new_from_fd (server_fd, NULL);
+    assert_non_null (socket);
+
+    assert_int_equal (write_all_timeout (socket, buf, sizeof (buf), 1000),
+                      sizeof (buf));
+    assert_int_equal (read (client_fd, buf_out, sizeof (buf_out)),
+                      sizeof (buf_out));
+    assert_memory_equal (buf_out, buf, sizeof (buf));
+    g_object_unref (socket);
+    close (client_fd);
+}
+/*
+ * When the peer isn't reading and the socket is full write_all_timeout
+ * gives up with ETIMEDOUT instead of blocking.
+ */
+static void
+write_all_timeout_full_test (void **state)
+{
+    GSocket *socket;
+    uint8_t buf [WRITE_SIZE] = { 0x80, 0x01, };
+    int client_fd, server_fd;
+    gint64 start;
+    UNUSED_PARAM(state);
+
+    assert_int_equal (create_socket_pair (&client_fd,
+                                          &server_fd,
+                                          SOCK_NONBLOCK),
+                      0);
+    while (write (server_fd, buf, sizeof (buf)) > 0);
+    assert_int_equal (errno, EAGAIN);
+    socket = g_socket_new_from_fd (server_fd, NULL);
+    assert_non_null (socket);
+
+    start = g_get_monotonic_time ();
+    assert_int_equal (write_all_timeout (socket, buf, sizeof (buf), 1000), -1);
+    assert_int_equal (errno, ETIMEDOUT);
+    assert_true (g_get_monotonic_time () - start < G_USEC_PER_SEC);
+    g_object_unref (socket);
+    close (client_fd);
+}
+/*
+ * write_datagram_timeout gathers its vectors into a single datagram.
+ */
+static void
+write_datagram_timeout_success_test (void **state)
+{
+    GSocket *socket;
+    guint32 header = GUINT32_TO_BE (5);
+    uint8_t buf [WRITE_SIZE] = { 0x80, 0x01, };
+    uint8_t buf_out [sizeof (header) + WRITE_SIZE + 1] = { 0, };
+    GOutputVector vectors [2] = {
+        { .buffer = &header, .size = sizeof (header), },
+        { .buffer = buf, .size = sizeof (buf), },
+    };
+    int client_fd, server_fd;
+    UNUSED_PARAM(state);
+
+    assert_int_equal (create_socket_pair_type (&client_fd,
+                                               &server_fd,
+                                               SOCK_SEQPACKET,
+                                               0),
+                      0);
+    socket = g_socket_new_from_fd (server_fd, NULL);
+    assert_non_null (socket);
+
+    assert_int_equal (write_datagram_timeout (socket, vectors, 2, 1000),
+                      sizeof (header) + sizeof (buf));
+    assert_int_equal (read (client_fd, buf_out, sizeof (buf_out)),
+                      sizeof (header) + sizeof (buf));
+    assert_memory_equal (buf_out, &header, sizeof (header));
+    assert_memory_equal (&buf_out [sizeof (header)], buf, sizeof (buf));
+    g_object_unref (socket);
+    close (client_fd);
+}
+/*
+ * When the peer isn't reading and the socket is full
+ * write_datagram_timeout gives up with ETIMEDOUT instead of blocking.
+ */
+static void
+write_datagram_timeout_full_test (void **state)
+{
+    GSocket *socket;
+    uint8_t buf [WRITE_SIZE] = { 0x80, 0x01, };
+    GOutputVector vector = { .buffer = buf, .size = sizeof (buf), };
+    int client_fd, server_fd;
+    gint64 start;
+    UNUSED_PARAM(state);
+
+    assert_int_equal (create_socket_pair_type (&client_fd,
+                                               &server_fd,
+                                               SOCK_SEQPACKET,
+                                               SOCK_NONBLOCK),
+                      0);
+    while (write (server_fd, buf, sizeof (buf)) > 0);
+    assert_int_equal (errno, EAGAIN);
+    socket = g_socket_new_from_fd (server_fd, NULL);
+    assert_non_null (socket);
+
+    start = g_get_monotonic_time ();
+    assert_int_equal (write_datagram_timeout (socket, &vector, 1, 1000), -1);
+    assert_int_equal (errno, ETIMEDOUT);
+    assert_true (g_get_monotonic_time () - start < G_USEC_PER_SEC);
+    g_object_unref (socket);
+    close (client_fd);
+}
+/*
+ * Send a TPM buffer as a single datagram over a SOCK_SEQPACKET socket pair
+ * and read it back with read_tpm_datagram_alloc.
+ */
+static void
+read_tpm_datagram_alloc_success_test (void **state)
+{
+    GSocket *socket;
+    uint8_t buf [] = {
+        0x80, 0x01, 0x00, 0x00, 0x00, 0x0e, 0x00, 0x00,
+        0x01, 0x7a, 0xde, 0xad, 0xbe, 0xef
+    };
+    uint8_t *buf_out = NULL;
+    int client_fd, server_fd;
+    UNUSED_PARAM(state);
+
+    assert_int_equal (create_socket_pair_type (&client_fd,
+                                               &server_fd,
+                                               SOCK_SEQPACKET,
+                                               0),
+                      0);
+    assert_int_equal (write (client_fd, buf, sizeof (buf)), sizeof (buf));
+    socket = g_socket_new_from_fd (server_fd, NULL);
+    assert_non_null (socket);
+
+    assert_int_equal (read_tpm_datagram_alloc (socket, &buf_out),
+                      sizeof (buf));
+    assert_non_null (buf_out);
+    assert_memory_equal (buf_out, buf, sizeof (buf));
+    g_free (buf_out);
+    g_object_unref (socket);
+    close (client_fd);
+}
+/*
+ * A datagram whose size doesn't match the size field in its header must be
+ * rejected.
+ */
+static void
+read_tpm_datagram_alloc_size_mismatch_test (void **state)
+{
+    GSocket *socket;
+    uint8_t buf [] = {
+        0x80, 0x01, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00,
+        0x01, 0x7a, 0xde, 0xad, 0xbe, 0xef
+    };
+    uint8_t *buf_out = NULL;
+    int client_fd, server_fd;
+    UNUSED_PARAM(state);
+
+    assert_int_equal (create_socket_pair_type (&client_fd,
+                                               &server_fd,
+                                               SOCK_SEQPACKET,
+                                               0),
+                      0);
+    assert_int_equal (write (client_fd, buf, sizeof (buf)), sizeof (buf));
+    socket = g_socket_new_from_fd (server_fd, NULL);
+    assert_non_null (socket);
+
+    assert_int_equal (read_tpm_datagram_alloc (socket, &buf_out), -1);
+    assert_null (buf_out);
+    g_object_unref (socket);
+    close (client_fd);
+}
+/*
+ * A datagram larger than UTIL_BUF_MAX must be rejected before a buffer is
+ * allocated for it.
+ */
+static void
+read_tpm_datagram_alloc_too_large_test (void **state)
+{
+    GSocket *socket;
+    uint8_t *buf, *buf_out = NULL;
+    int client_fd, server_fd;
+    UNUSED_PARAM(state);
+
+    assert_int_equal (create_socket_pair_type (&client_fd,
+                                               &server_fd,
+                                               SOCK_SEQPACKET,
+                                               0),
+                      0);
+    buf = g_malloc0 (UTIL_BUF_MAX + 1);
+    assert_int_equal (write (client_fd, buf, UTIL_BUF_MAX + 1),
+                      UTIL_BUF_MAX + 1);
+    g_free (buf);
+    socket = g_socket_new_from_fd (server_fd, NULL);
+    assert_non_null (socket);
+
+    assert_int_equal (read_tpm_datagram_alloc (socket, &buf_out), -1);
+    assert_null (buf_out);
+    g_object_unref (socket);
+    close (client_fd);
+}
+/*
+ * The client sockets are non-blocking: a wakeup with no datagram waiting
+ * makes the peek fail with EAGAIN. That isn't an error, the caller is
+ * told to try again.
+ */
+static void
+read_tpm_datagram_alloc_again_test (void **state)
+{
+    GSocket *socket;
+    uint8_t *buf_out = NULL;
+    int client_fd, server_fd;
+    UNUSED_PARAM(state);
+
+    assert_int_equal (create_socket_pair_type (&client_fd,
+                                               &server_fd,
+                                               SOCK_SEQPACKET,
+                                               SOCK_NONBLOCK),
+                      0);
+    socket = g_socket_new_from_fd (server_fd, NULL);
+    assert_non_null (socket);
+
+    recv_errno = EAGAIN;
+    assert_int_equal (read_tpm_datagram_alloc (socket, &buf_out),
+                      UTIL_READ_AGAIN);
+    assert_null (buf_out);
+    g_object_unref (socket);
+    close (client_fd);
+}
+/*
+ * An empty datagram peeks the same as EOF. It's discarded and the caller
+ * told to try again, the datagram after it is read as usual. Once the
+ * peer has closed its end a peek of 0 is EOF.
+ */
+static void
+read_tpm_datagram_alloc_empty_test (void **state)
+{
+    GSocket *socket;
+    uint8_t buf [] = {
+        0x80, 0x01, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01, 0x7a
+    };
+    uint8_t *buf_out = NULL;
+    int client_fd, server_fd;
+    UNUSED_PARAM(state);
+
+    assert_int_equal (create_socket_pair_type (&client_fd,
+                                               &server_fd,
+                                               SOCK_SEQPACKET,
+                                               SOCK_NONBLOCK),
+                      0);
+    assert_int_equal (send (client_fd, buf, 0, 0), 0);
+    assert_int_equal (write (client_fd, buf, sizeof (buf)), sizeof (buf));
+    socket = g_socket_new_from_fd (server_fd, NULL);
+    assert_non_null (socket);
+
+    assert_int_equal (read_tpm_datagram_alloc (socket, &buf_out),
+                      UTIL_READ_AGAIN);
+    assert_null (buf_out);
+    assert_int_equal (read_tpm_datagram_alloc (socket, &buf_out),
+                      sizeof (buf));
+    assert_memory_equal (buf_out, buf, sizeof (buf));
+    g_clear_pointer (&buf_out, g_free);
+    assert_int_equal (read_tpm_datagram_alloc (socket, &buf_out),
+                      UTIL_READ_AGAIN);
+    close (client_fd);
+    assert_int_equal (read_tpm_datagram_alloc (socket, &buf_out), -1);
+    assert_null (buf_out);
+    g_object_unref (socket);
+}
+/*
+ * Send a frame carrying a TPM buffer for channel 5 followed by a frame
+ * closing channel 7 and read both back with read_tpm_mux_alloc.
+ */
+static void
+read_tpm_mux_alloc_success_test (void **state)
+{
+    GSocket *socket;
+    uint8_t frame [] = {
+        0x00, 0x00, 0x00, 0x05,
+        0x80, 0x01, 0x00, 0x00, 0x00, 0x0e, 0x00, 0x00,
+        0x01, 0x7a, 0xde, 0xad, 0xbe, 0xef
+    };
+    uint8_t close_frame [] = { 0x00, 0x00, 0x00, 0x07 };
+    uint8_t *buf_out = NULL;
+    guint32 channel = 0;
+    int client_fd, server_fd;
+    UNUSED_PARAM(state);
+
+    assert_int_equal (create_socket_pair_type (&client_fd,
+                                               &server_fd,
+                                               SOCK_SEQPACKET,
+                                               0),
+                      0);
+    assert_int_equal (write (client_fd, frame, sizeof (frame)),
+                      sizeof (frame));
+    assert_int_equal (write (client_fd, close_frame, sizeof (close_frame)),
+                      sizeof (close_frame));
+    socket = g_socket_new_from_fd (server_fd, NULL);
+    assert_non_null (socket);
+
+    assert_int_equal (read_tpm_mux_alloc (socket, &channel, &buf_out),
+                      sizeof (frame) - TABRMD_MUX_HEADER_SIZE);
+    assert_int_equal (channel, 5);
+    assert_non_null (buf_out);
+    assert_memory_equal (buf_out,
+                         &frame [TABRMD_MUX_HEADER_SIZE],
+                         sizeof (frame) - TABRMD_MUX_HEADER_SIZE);
+    g_free (buf_out);
+
+    assert_int_equal (read_tpm_mux_alloc (socket, &channel, &buf_out), 0);
+    assert_int_equal (channel, 7);
+    g_object_unref (socket);
+    close (client_fd);
+}
+/*
+ * A frame shorter than the channel id must be rejected.
+ */
+static void
+read_tpm_mux_alloc_short_frame_test (void **state)
+{
+    GSocket *socket;
+    uint8_t frame [] = { 0x00, 0x05 };
+    uint8_t *buf_out = NULL;
+    guint32 channel = 0;
+    int client_fd, server_fd;
+    UNUSED_PARAM(state);
+
+    assert_int_equal (create_socket_pair_type (&client_fd,
+                                               &server_fd,
+                                               SOCK_SEQPACKET,
+                                               0),
+                      0);
+    assert_int_equal (write (client_fd, frame, sizeof (frame)),
+                      sizeof (frame));
+    socket = g_socket_new_from_fd (server_fd, NULL);
+    assert_non_null (socket);
+
+    assert_int_equal (read_tpm_mux_alloc (socket, &channel, &buf_out), -1);
+    assert_null (buf_out);
+    g_object_unref (socket);
+    close (client_fd);
+}
+/*
+ * A spurious wakeup on a multiplexed connection is reported the same way
+ * as for read_tpm_datagram_alloc.
+ */
+static void
+read_tpm_mux_alloc_again_test (void **state)
+{
+    GSocket *socket;
+    uint8_t *buf_out = NULL;
+    guint32 channel = 0;
+    int client_fd, server_fd;
+    UNUSED_PARAM(state);
+
+    assert_int_equal (create_socket_pair_type (&client_fd,
+                                               &server_fd,
+                                               SOCK_SEQPACKET,
+                                               SOCK_NONBLOCK),
+                      0);
+    socket = g_socket_new_from_fd (server_fd, NULL);
+    assert_non_null (socket);
+
+    recv_errno = EWOULDBLOCK;
+    assert_int_equal (read_tpm_mux_alloc (socket, &channel, &buf_out),
+                      UTIL_READ_AGAIN);
+    assert_null (buf_out);
+    g_object_unref (socket);
+    close (client_fd);
+}
+
 gint
 main (void)
 {
@@ -733,6 +1135,22 @@ main (void)
         cmocka_unit_test_setup_teardown (read_tpm_buf_alloc_eof_test,
                                          read_data_setup,
                                          read_data_teardown),
+        /* write_all_timeout */
+        cmocka_unit_test (write_all_timeout_success_test),
+        cmocka_unit_test (write_all_timeout_full_test),
+        /* write_datagram_timeout */
+        cmocka_unit_test (write_datagram_timeout_success_test),
+        cmocka_unit_test (write_datagram_timeout_full_test),
+        /* read_tpm_datagram_alloc */
+        cmocka_unit_test (read_tpm_datagram_alloc_success_test),
+        cmocka_unit_test (read_tpm_datagram_alloc_size_mismatch_test),
+        cmocka_unit_test (read_tpm_datagram_alloc_too_large_test),
+        cmocka_unit_test (read_tpm_datagram_alloc_again_test),
+        cmocka_unit_test (read_tpm_datagram_alloc_empty_test),
+        /* read_tpm_mux_alloc */
+        cmocka_unit_test (read_tpm_mux_alloc_success_test),
+        cmocka_unit_test (read_tpm_mux_alloc_short_frame_test),
+        cmocka_unit_test (read_tpm_mux_alloc_again_test),
     };
     return cmocka_run_group_tests (tests, NULL, NULL);
 }